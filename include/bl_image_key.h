@@ -0,0 +1,22 @@
+/**
+ * @file bl_image_key.h
+ * @brief AES-128 key used to decrypt encrypted application transfers.
+ * Generated by tools/encrypt_image.py keygen, do not edit by hand.
+ * 
+ * Development key from NIST SP 800-38A, it is public. Run
+ * `tools/encrypt_image.py keygen <image.key> --header include/bl_image_key.h`
+ * before building a production bootloader.
+ */
+
+#ifndef BL_IMAGE_KEY_H
+#define BL_IMAGE_KEY_H
+
+#include <stdint.h>
+
+// Kept in bootloader flash, outside the range served by flash read-back
+static const uint8_t bl_image_key[16] __attribute__((section(".bl_keys"), used)) = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+
+#endif
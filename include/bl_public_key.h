@@ -0,0 +1,23 @@
+/**
+ * @file bl_public_key.h
+ * @brief Ed25519 public key used to authenticate application images.
+ * Generated by tools/sign_image.py keygen, do not edit by hand.
+ * 
+ * Development key from RFC 8032 section 7.1 test 1, its private half is public.
+ * Run `tools/sign_image.py keygen <seed> --header include/bl_public_key.h` before
+ * building a production bootloader.
+ */
+
+#ifndef BL_PUBLIC_KEY_H
+#define BL_PUBLIC_KEY_H
+
+#include <stdint.h>
+
+static const uint8_t bl_public_key[32] = {
+    0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7,
+    0xd5, 0x4b, 0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a,
+    0x0e, 0xe1, 0x72, 0xf3, 0xda, 0xa6, 0x23, 0x25,
+    0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51, 0x1a,
+};
+
+#endif
@@ -14,21 +14,29 @@
 
 #include "stm32f429xx.h"
 #include <stdbool.h>
+#include <can_msg.h>
+#include <can_port.h>
+#include <ram_func.h>
 
 #define TX_TIMEOUT (1000U)
 
-typedef struct
-{
-  uint16_t StdId; /*!< Specifies the standard identifier. */
-  uint32_t ExtId; /*!< Specifies the extended identifier. */
-  uint32_t IDE; /*!< Specifies the type of identifier for the message that will be transmitted.  */
-  uint32_t DLC; /*!< Specifies the length of the frame that will be transmitted. */
-  uint8_t Data[8]; /*!< Contains the data to be transmitted. */
-} CanMsgTypeDef;
+// 10 kbit/s with 16 time quanta from CAN_CLOCK, the bit rate when the application does not ask for another
+#define CAN_BTR_DEFAULT (0x001c0063U)
+#define CAN_CLOCK (16000000U)       // APB1, SystemInit() leaves the core on HSI
 
-bool initCAN1();
+// First filter bank owned by CAN2, banks below this belong to CAN1
+#define CAN2_FILTER_START (14U)
+
+bool initCAN1(uint32_t btr);
 bool deinitCAN1();
+bool initCAN2();
+bool deinitCAN2();
 
 bool txCANMessage(CAN_TypeDef* can, CanMsgTypeDef* msg);
+RAM_FUNC bool txCANMessageAsync(CAN_TypeDef* can, CanMsgTypeDef* msg);
+RAM_FUNC void rxCANMessage(CAN_TypeDef* can, CanMsgTypeDef* msg);
+
+// Classic CAN transport on CAN1 for the bootloader
+extern const can_port_t can1Port;
 
 #endif
\ No newline at end of file
@@ -13,11 +13,17 @@
 #define PER_HAL_CRC_F4
 
 #include "stm32f429xx.h"
+#include <stdbool.h>
 
 void initCRC();
 void deinitCRC();
 
 uint32_t accum32CRC(uint32_t data);
 uint32_t calculateCRC(uint32_t start, uint32_t length);
+uint32_t readCRC();
+
+void streamCRC(const uint32_t* words, uint32_t count);
+bool streamCRCBusy();
+void stopStreamCRC();
 
 #endif
\ No newline at end of file
@@ -13,11 +13,16 @@
 #define PER_HAL_FLASH
 
 #include "stm32f429xx.h"
+#include <ram_func.h>
 
 // Flash magic numbers obtained from family reference manual
 #define FLASH_KEY_1 0x45670123
 #define FLASH_KEY_2 0xCDEF89AB
 
-void flashWriteU32(uint32_t address, uint32_t value);
+extern volatile uint32_t flashOpCycles;
+
+// Run from RAM and wait for the operation to finish there, so interrupts are served meanwhile
+RAM_FUNC void flashWriteU32(uint32_t address, uint32_t value);
+RAM_FUNC void flashEraseSector(uint8_t sector);
 
 #endif
\ No newline at end of file
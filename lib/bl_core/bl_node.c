@@ -0,0 +1,1375 @@
+/**
+ * @file bl_node.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Bootloader FSM implementation
+ *
+ * Every handler runs from an event of the node's scheduler. The hooks of bl_uds, bl_readback,
+ * bl_journal and ISO-TP carry no context, they reach the node through `active`, which every
+ * event handler sets before it does anything else.
+ * @version 0.1
+ * @date 2021-07-17
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <bl_node.h>
+#include <bl_transport.h>
+
+static bl_node_t* active;       // Node running an event, target of the context free hooks
+
+static BLState_e setBootFlags(bl_node_t* n, BLRxMessage_t* msg);
+static BLState_e checkBootFlags(bl_node_t* n, BLRxMessage_t* msg);
+static BLState_e processMetadata(bl_node_t* n, BLRxMessage_t* msg);
+static BLState_e storeSegment(bl_node_t* n, BLRxMessage_t* msg);
+static BLState_e storeSegmentCRC(bl_node_t* n, BLRxMessage_t* msg);
+static BLState_e setTransport(bl_node_t* n, BLRxMessage_t* msg);
+static BLState_e checkFlashedCRC(bl_node_t* n, BLRxMessage_t* msg);
+static BLState_e flashApp(bl_node_t* n, BLRxMessage_t* msg);
+static BLState_e validateFlash(bl_node_t* n, BLRxMessage_t* msg);
+static BLState_e launchApp(bl_node_t* n, BLRxMessage_t* msg);
+#ifdef BL_SIGNED_IMAGES
+static BLState_e storeSignature(bl_node_t* n, BLRxMessage_t* msg);
+#endif
+#ifdef BL_ENCRYPTED_IMAGES
+static BLState_e storeCipherIV(bl_node_t* n, BLRxMessage_t* msg);
+#endif
+static bool imageSignatureValid(bl_node_t* n);
+static void programWord(bl_node_t* n, uint32_t word);
+
+static bool decodeCANMsg(CanMsgTypeDef* canMessage, BLRxMessage_t* fsmMessage);
+static void runFSM(bl_node_t* n, CanMsgTypeDef* canMessage, BLRxMessage_t* fsmMessage);
+static bool serviceReadback(bl_node_t* n, BLRxMessage_t* msg);
+static bool serviceUDS(bl_node_t* n, CanMsgTypeDef* msg);
+#ifdef BL_UDS
+static void initUDSServices(bl_node_t* n);
+static void udsTimer(bl_node_t* n);
+static void udsTxPump(bl_node_t* n);
+static void udsRoutineFinish(bl_node_t* n, uint8_t nrc, bool passed);
+#endif
+static bool txBLMessage(CanMsgTypeDef* msg);
+static void queueStatus(bl_node_t* n, BLState_e previousState, BLRxMessage_t* msg);
+static void statusPump(bl_node_t* n);
+static void imageCheckPump(bl_node_t* n);
+static void eraseRange(bl_node_t* n, uint32_t address, uint32_t length);
+static void eraseStart(bl_node_t* n);
+static bool sectorBlank(bl_node_t* n, uint8_t sector);
+static void eraseFinish(bl_node_t* n);
+static BLState_e finishImageCheck(bl_node_t* n, bool passed);
+static uint32_t appFlashCRC(uint32_t offset, uint32_t length);
+static void journalProgram(volatile uint32_t* address, uint32_t value);
+static void journalErase(volatile uint32_t* sector);
+static void saveBootMeta(bl_node_t* n);
+static void invalidateApp(bl_node_t* n);
+static bool appVerified(bl_node_t* n);
+
+static FSMTableEntry_t transition_table[] =
+{
+    {S_WAIT_FOR_FLAG,  M_FLAG_SET,  setBootFlags},      // Waiting for flag, got external message
+    {S_WAIT_FOR_FLAG,  M_NONE,      checkBootFlags},    // Waiting for flag, but timed out
+
+    {S_RECOVERY,       M_FLAG_SET,  setBootFlags},      // In recovery mode, recieved new flags
+
+    {S_CRC_CHECK,      M_NONE,      checkFlashedCRC},   // Going to check CRC
+    {S_CRC_CHECK,      M_METADATA,  processMetadata},   // Start over, cancels a running check
+
+    {S_WAIT_FOR_META,  M_METADATA,  processMetadata},   // Waiting for meta, got metadata message
+    {S_WAIT_FOR_META,  M_SEGMENT,   storeSegment},      // Sparse image, range of one segment
+    {S_WAIT_FOR_META,  M_SEGMENT_CRC, storeSegmentCRC}, // Sparse image, CRC through one segment
+    {S_WAIT_FOR_META,  M_TRANSPORT, setTransport},      // Frame size for application data
+
+    {S_FLASH_APP,      M_APP_DATA,  flashApp},          // Rx a piece of program data and write to flash
+#ifdef BL_SIGNED_IMAGES
+    {S_FLASH_APP,      M_SIGNATURE, storeSignature},    // Rx a piece of the image signature
+    {S_CRC_CHECK,      M_SIGNATURE, storeSignature},    // Signature may also follow the last data word
+#endif
+#ifdef BL_ENCRYPTED_IMAGES
+    {S_FLASH_APP,      M_CIPHER_IV, storeCipherIV},     // Rx a piece of the initial counter block
+#endif
+
+    {S_VALIDATE_FLASH, M_NONE,      validateFlash},     // Validate Flash CRC and store to flash
+
+    {S_LAUNCH_APP,     M_NONE,      launchApp}          // Clean up peripherals and launch application
+};
+
+/**
+ * @brief Based on the current operating state, call the state function corresponding to the type of the incoming message
+ * See the @ref transition_table for the mapping of state functions. Next state is determined by the return value of state functions.
+ *
+ * @param message Bootloader message recieved
+ */
+static BLState_e bootloaderFSM(bl_node_t* n, BLState_e currentState, BLRxMessage_t *message)
+{
+    for(int i = 0; i < sizeof(transition_table)/sizeof(FSMTableEntry_t); i++)
+    {
+        FSMTableEntry_t *entry = &(transition_table[i]);
+        if (currentState == entry->state && message->message_type == entry->type)
+        {
+            return entry->fn(n, message);
+        }
+    }
+
+    // Maybe handle some sort of invalid message error?
+    return currentState;
+}
+
+/**
+ * @brief Where the CPU reads a flash address
+ */
+static const uint8_t* flashRead(bl_node_t* n, uint32_t address)
+{
+    return n->cfg.flash + (address - n->cfg.flash_address);
+}
+
+/**
+ * @brief Start address of a flash sector, `sectors` gives the end of the bank
+ *
+ * @param sector Sector number
+ * @return uint32_t Address
+ */
+static uint32_t flashSectorBase(bl_node_t* n, uint8_t sector)
+{
+    uint32_t base = n->cfg.flash_address;
+    for (uint8_t i = 0; i < sector && i < n->cfg.sectors; i++)
+        base += n->cfg.sector_bytes[i];
+    return base;
+}
+
+/**
+ * @brief Handle one frame from rx_message_q. Stays pending while frames are left, so every
+ * higher priority event gets a turn between two frames.
+ *
+ * @param ctx Node
+ * @return true More frames are queued
+ * @return false Queue is empty
+ */
+static bool rxReadyEvent(void* ctx)
+{
+    bl_node_t* n = active = ctx;
+    BLRxMessage_t fsmMessage;
+    CanMsgTypeDef canMessage;
+
+    // Frames wait for the erase job, the last sector posts this again
+    if (n->erase_next < n->erase_end)
+        return false;
+    if (!rbDequeue(n->rx_q, &canMessage))
+        return false;
+    n->hw->port->rxResume();        // RX interrupt may have backed off on a full queue
+
+    if (!serviceUDS(n, &canMessage) && decodeCANMsg(&canMessage, &fsmMessage)) // Ensure that message is valid type
+    {
+        if (!serviceReadback(n, &fsmMessage))
+            runFSM(n, &canMessage, &fsmMessage);
+    }
+
+    // A status report, read-back or UDS response may be waiting, a check may have started
+    schedPost(n->sched, EV_TX_FREE);
+    if (n->state == S_CRC_CHECK)
+        schedPost(n->sched, EV_CRC_CHUNK);
+
+    return !isRBQueueEmpty(n->rx_q);
+}
+
+/**
+ * @brief Run a message through the FSM. A CAN FD data frame runs once per word, as if every word
+ * had come in a classic frame of its own. FD frames the session did not agree on are dropped.
+ *
+ * @param canMessage Frame the message came in
+ * @param fsmMessage Decoded message
+ */
+static void runFSM(bl_node_t* n, CanMsgTypeDef* canMessage, BLRxMessage_t* fsmMessage)
+{
+    uint32_t words[TRANSPORT_WORDS_MAX];
+    bool fdData = fsmMessage->message_type == M_APP_DATA && canMessage->FDF;
+    uint8_t count = 1;
+
+    if (!transportAccepts(canMessage, n->transport_dlc))
+        return;
+    if (fdData)
+        count = transportUnpackData(canMessage, words);
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        BLState_e previousState = n->state;
+        if (fdData)
+            fsmMessage->application_data = words[i];
+        n->state = bootloaderFSM(n, n->state, fsmMessage);
+        queueStatus(n, previousState, fsmMessage);
+    }
+}
+
+/**
+ * @brief Keep TX mailboxes loaded, the TX empty interrupt posts this again for more
+ *
+ * @param ctx Node
+ * @return false Always, waits for the next post
+ */
+static bool txFreeEvent(void* ctx)
+{
+    bl_node_t* n = active = ctx;
+
+    readbackPump(&n->readback, txBLMessage);
+    statusPump(n);
+#ifdef BL_UDS
+    udsTxPump(n);
+#endif
+    return false;
+}
+
+/**
+ * @brief One shot timer expired, only UDS routines that outlast P2 use it
+ *
+ * @param ctx Node
+ * @return false Always, the timer posts again once it is started again
+ */
+static bool timerEvent(void* ctx)
+{
+    active = ctx;
+
+#ifdef BL_UDS
+    udsTimer(active);
+#endif
+    return false;
+}
+
+/**
+ * @brief Erase the next sector of the erase job. The erase waits in RAM until it is done, so
+ * this is also where it completes. Higher priority events run before the next sector.
+ *
+ * @param ctx Node
+ * @return true More sectors are left
+ * @return false The job is done, or waits to be started
+ */
+static bool flashDoneEvent(void* ctx)
+{
+    bl_node_t* n = active = ctx;
+
+    if (n->erase_next >= n->erase_end)
+        return false;
+#ifdef BL_UDS
+    if (n->uds_erase_waits)
+        return false;
+#endif
+
+    // Sectors still blank from an earlier erase, or never written, are not erased again
+    uint8_t sector = n->erase_next++;
+    if (!sectorBlank(n, sector))
+    {
+        n->hw->erase(sector);
+        if (!sectorBlank(n, sector))
+        {
+            n->erase_failed = true;
+            n->erase_next = n->erase_end;
+        }
+
+        // A tester of the CAN protocol waits for a status report after the metadata, one per sector keeps it waiting
+        if (n->state == S_FLASH_APP)
+        {
+            n->status_pending = true;
+            schedPost(n->sched, EV_TX_FREE);
+        }
+    }
+
+    if (n->erase_next < n->erase_end)
+        return true;
+
+    eraseFinish(n);
+    return false;
+}
+
+/**
+ * @brief Advance the image check by one chunk. The DMA transfer complete interrupt posts the
+ * next one, chunks fed by the CPU stay pending instead.
+ *
+ * @param ctx Node
+ * @return true A CPU fed chunk is next
+ * @return false Waiting for DMA, or the check is over
+ */
+static bool crcChunkEvent(void* ctx)
+{
+    bl_node_t* n = active = ctx;
+
+    imageCheckPump(n);
+    schedPost(n->sched, EV_TX_FREE);
+
+    return n->state == S_CRC_CHECK && n->image_crc.state == CRC_RUNNING && !n->image_crc.streaming;
+}
+
+/**
+ * @brief Initalize all bootloader data structures before FSM starts
+ *
+ * @param n Node
+ * @param cfg Identity and flash layout, copied
+ * @param hw Hardware hooks, kept
+ * @param sched Scheduler the interrupts post to, the node registers its handlers
+ * @param rx_q Frames accepted by the RX interrupt
+ */
+void initNode(bl_node_t* n, const bl_node_cfg_t* cfg, const bl_node_hw_t* hw, ev_sched_t* sched, rb_queue_t* rx_q)
+{
+    active = n;
+    n->cfg = *cfg;
+    n->hw = hw;
+    n->sched = sched;
+    n->rx_q = rx_q;
+
+    n->state = S_WAIT_FOR_FLAG;
+    n->image_crc_value = 0;
+    n->image_length = 0;
+    n->write_address = 0;
+    n->write_end = 0;
+    n->image_words = 0;
+    n->transport_dlc = TRANSPORT_CLASSIC_DLC;
+    n->transport_brs = false;
+    n->status_pending = false;
+    n->status_words = 0;
+    n->image_check_failed = false;
+    n->erase_next = 0;
+    n->erase_end = 0;
+    n->erase_failed = false;
+
+    initCRCEngine(&n->image_crc, hw->crc, BL_CRC_CHUNK_WORDS);
+    initCRCEngine(&n->readback_crc, hw->crc, BL_CRC_CHUNK_WORDS);
+    initSegments(&n->pending_segments);
+    initSegments(&n->image_segments);
+    initReadback(&n->readback, flashRead(n, cfg->app_address), cfg->app_length, cfg->tx_id, appFlashCRC);
+
+    initJournal(&n->journal, (volatile uint32_t*) flashRead(n, cfg->shared_address),
+                (volatile uint32_t*) flashRead(n, cfg->shared_address + cfg->shared_sector_bytes),
+                cfg->shared_sector_bytes, journalProgram, journalErase);
+
+    // Nothing stored yet, stay in recovery until the flags are set
+    n->meta.boot_flag  = FLAG_IDLE_IN_RECOVERY;
+    n->meta.app_crc    = 0;
+    n->meta.app_length = 0;
+    n->meta.app_start  = cfg->app_address;
+    n->meta.app_check  = CHECK_NONE;
+    n->meta.spare[0]   = 0;
+
+    if (journalMount(&n->journal))
+    {
+        n->meta.boot_flag  = n->journal.meta.boot_flag;
+        n->meta.app_crc    = n->journal.meta.app_crc;
+        n->meta.app_length = n->journal.meta.app_length;
+        n->meta.app_start  = n->journal.meta.app_start;
+        n->meta.app_check  = n->journal.meta.app_check;
+    }
+
+    // The application asked for a flashing session: skip the flag exchange and leave the stored
+    // flag alone. A session cut short fails validation on the next boot and waits for an image.
+    n->warm_session = cfg->handoff &&
+                      handoffTake(cfg->handoff, cfg->ecu_id, cfg->app_length, cfg->can_clock, &n->handoff_session);
+    if (n->warm_session)
+    {
+        n->state = S_WAIT_FOR_META;
+        n->status_pending = true;   // Tells the tester the node is ready once CAN is up
+    }
+
+#ifdef BL_UDS
+    initUDSServices(n);
+#endif
+
+    initScheduler(sched, n);
+    schedRegister(sched, EV_TX_FREE, txFreeEvent);
+    schedRegister(sched, EV_TIMER, timerEvent);
+    schedRegister(sched, EV_RX_READY, rxReadyEvent);
+    schedRegister(sched, EV_FLASH_DONE, flashDoneEvent);
+    schedRegister(sched, EV_CRC_CHUNK, crcChunkEvent);
+    if (n->status_pending)
+        schedPost(sched, EV_TX_FREE);
+}
+
+/**
+ * @brief CAN bit timing asked for by a warm re-entry
+ *
+ * @return uint32_t BTR value, 0 for the bootloader default
+ */
+uint32_t nodeBitTiming(bl_node_t* n)
+{
+    return n->warm_session ? n->handoff_session.btr : 0;
+}
+
+/**
+ * @brief Translate CANRx message into bootloader message data structure.
+ *
+ * @param canMessage
+ * @param fsmMessage
+ * @return true CAN message translated into a valid Bootloader message
+ * @return false otherwise
+ */
+static bool decodeCANMsg(CanMsgTypeDef* canMessage, BLRxMessage_t* fsmMessage)
+{
+    blUnpackRxMessage(canMessage->Data, fsmMessage);
+
+    return fsmMessage->message_type <= M_TRANSPORT;
+}
+
+/**
+ * @brief Non-blocking transmit of a bootloader response frame
+ *
+ * @param msg Frame to send
+ * @return true Frame loaded into a TX mailbox
+ * @return false All mailboxes busy
+ */
+static bool txBLMessage(CanMsgTypeDef* msg)
+{
+    return active->hw->port->tx(msg);
+}
+
+/**
+ * @brief Decide whether a frame gets a status report. Every frame except application data gets
+ * one, so the tester also sees commands that did not apply in the current state. Data frames
+ * only get one every BL_STATUS_EVERY words or when they change the state.
+ *
+ * @param previousState State before the frame
+ * @param msg Frame handled by the FSM
+ */
+static void queueStatus(bl_node_t* n, BLState_e previousState, BLRxMessage_t* msg)
+{
+    if (msg->message_type != M_APP_DATA || n->state != previousState ||
+        (n->state == S_FLASH_APP && n->image_words - n->status_words >= BL_STATUS_EVERY))
+        n->status_pending = true;
+}
+
+/**
+ * @brief Send a queued status report once a TX mailbox is free
+ */
+static void statusPump(bl_node_t* n)
+{
+    BLStatusMessage_t status;
+    CanMsgTypeDef msg;
+
+    if (!n->status_pending)
+        return;
+
+    status.status_state = n->state;
+    status.status_ecuid = n->cfg.ecu_id;
+    status.status_words = n->state == S_FLASH_APP || n->state == S_CRC_CHECK ? n->image_words : 0;
+    status.status_crc_failed = n->image_check_failed;
+    status.status_checked = n->state == S_CRC_CHECK ? segmentCheckProgress(&n->image_segments, &n->image_crc) / 4 : 0;
+    status.status_data_dlc = n->transport_dlc;
+    status.status_brs = n->transport_brs;
+
+    msg.IDE = CAN_ID_EXT;
+    msg.ExtId = n->cfg.status_id;
+    msg.StdId = 0;
+    msg.DLC = BL_STATUS_MESSAGE_DLC;
+    msg.FDF = 0;
+    blPackStatusMessage(&status, msg.Data);
+
+    if (txBLMessage(&msg))
+    {
+        n->status_pending = false;
+        n->status_words = status.status_words;
+    }
+}
+
+static void crcOff(bl_node_t* n)
+{
+    if (n->hw->crcOff)
+        n->hw->crcOff();
+}
+
+/**
+ * @brief CRC of a range of application flash, closes a read-back stream
+ *
+ * @param offset Offset from the start of application flash
+ * @param length Number of bytes
+ * @return uint32_t CRC from the CRC peripheral
+ */
+static uint32_t appFlashCRC(uint32_t offset, uint32_t length)
+{
+    uint32_t crc = crcRun(&active->readback_crc, flashRead(active, active->cfg.app_address) + offset, length);
+    crcOff(active);
+    return crc;
+}
+
+static void journalProgram(volatile uint32_t* address, uint32_t value)
+{
+    active->hw->program(active->cfg.flash_address + ((const uint8_t*) address - active->cfg.flash), value);
+}
+
+/**
+ * @brief Erase one of the shared flash sectors, given by its base address
+ *
+ * @param sector Base address of the sector
+ */
+static void journalErase(volatile uint32_t* sector)
+{
+    uint32_t address = active->cfg.flash_address + ((const uint8_t*) sector - active->cfg.flash);
+
+    for (uint8_t i = 0; i < active->cfg.sectors; i++)
+    {
+        if (flashSectorBase(active, i) == address)
+            active->hw->erase(i);
+    }
+}
+
+/**
+ * @brief Append the boot metadata to the journal. Nothing is written if it did not change.
+ */
+static void saveBootMeta(bl_node_t* n)
+{
+    journalAppend(&n->journal, &n->meta);
+}
+
+/**
+ * @brief Forget the stored application before its flash changes. Only finishImageCheck()
+ * stores one again, so a download cut short can not be booted with the old CRC.
+ */
+static void invalidateApp(bl_node_t* n)
+{
+    if (n->meta.boot_flag == FLAG_FLASH_NEW_APP && n->meta.app_length == 0 && n->meta.app_check == CHECK_NONE)
+        return;
+
+    n->meta.boot_flag  = FLAG_FLASH_NEW_APP;
+    n->meta.app_crc    = 0;
+    n->meta.app_length = 0;
+    n->meta.app_check  = CHECK_NONE;
+    saveBootMeta(n);
+}
+
+/**
+ * @brief The stored application passed a full image check. Signed builds only boot what passed
+ * the signature, unsigned builds also take records written before app_check existed.
+ */
+static bool appVerified(bl_node_t* n)
+{
+#ifdef BL_SIGNED_IMAGES
+    return n->meta.app_check == CHECK_SIGNATURE;
+#else
+    return n->meta.app_length != 0;
+#endif
+}
+
+/**
+ * @brief Set up an erase job for every sector touching a range. Frames wait in rx_message_q
+ * until the job is done, eraseStart() runs it.
+ *
+ * @param address Start of the range
+ * @param length Bytes, at least one
+ */
+static void eraseRange(bl_node_t* n, uint32_t address, uint32_t length)
+{
+    n->erase_next = n->cfg.sectors;
+    n->erase_end = 0;
+    n->erase_failed = false;
+
+    for (uint8_t sector = 0; sector < n->cfg.sectors; sector++)
+    {
+        if (flashSectorBase(n, sector + 1) <= address || flashSectorBase(n, sector) >= address + length)
+            continue;
+        if (n->erase_next > sector)
+            n->erase_next = sector;
+        n->erase_end = sector + 1;
+    }
+    if (n->erase_end == 0)
+        n->erase_next = 0;
+}
+
+/**
+ * @brief Erase the first sector of the job at the next EV_FLASH_DONE
+ */
+static void eraseStart(bl_node_t* n)
+{
+    schedPost(n->sched, EV_FLASH_DONE);
+}
+
+/**
+ * @brief Every word of a sector reads back erased
+ */
+static bool sectorBlank(bl_node_t* n, uint8_t sector)
+{
+    const volatile uint32_t* word = (const volatile uint32_t*) flashRead(n, flashSectorBase(n, sector));
+
+    for (uint32_t i = 0; i < n->cfg.sector_bytes[sector] / 4; i++)
+    {
+        if (word[i] != 0xFFFFFFFFU)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Erase job over, report it and take frames again
+ */
+static void eraseFinish(bl_node_t* n)
+{
+#ifdef BL_UDS
+    udsRoutineFinish(n, n->erase_failed ? UDS_NRC_PROGRAMMING_FAILURE : UDS_NRC_OK, true);
+#endif
+    schedPost(n->sched, EV_RX_READY);
+}
+
+/**
+ * @brief Handle read-back requests and ACKs. Read-back runs beside the FSM and never changes state,
+ * requests are only honoured while idle (recovery or waiting for metadata) so a dump can not
+ * interleave with programming, and a flag set or metadata message ends a running dump. Out of range
+ * requests are dropped and the tester times out.
+ * Encrypted builds never start a dump, it would hand out the plaintext image.
+ *
+ * @param msg Decoded bootloader message
+ * @return true Message belonged to the read-back service
+ * @return false Message should be passed to the FSM
+ */
+static bool serviceReadback(bl_node_t* n, BLRxMessage_t* msg)
+{
+    if (msg->message_type == M_READ_ACK)
+    {
+        readbackAck(&n->readback, msg->read_ack_sequence);
+        return true;
+    }
+
+    if (msg->message_type != M_READ_REQ)
+        return false;
+
+#ifndef BL_ENCRYPTED_IMAGES
+    if (n->state == S_RECOVERY || n->state == S_WAIT_FOR_META)
+        readbackStart(&n->readback, msg->read_start_offset, msg->read_length, msg->read_window);
+#endif
+
+    return true;
+}
+
+#ifdef BL_UDS
+/**
+ * @brief eraseMemory routine. Sets the flash new app flag like M_FLAG_SET, then erases every
+ * sector touching the range. The range has to lie in application flash.
+ * The sectors are erased by an erase job once the response pending is out, the routine
+ * finishes in eraseFinish().
+ *
+ * @param address Start of the range
+ * @param length Bytes
+ * @return uint8_t NRC, response pending once the job is set up
+ */
+static uint8_t udsErase(uint32_t address, uint32_t length)
+{
+    bl_node_t* n = active;
+    BLRxMessage_t msg = {0};
+
+    if (address < n->cfg.app_address || length == 0 || length > n->cfg.app_address + n->cfg.app_length - address)
+        return UDS_NRC_OUT_OF_RANGE;
+
+    if (n->state == S_WAIT_FOR_FLAG || n->state == S_RECOVERY)
+    {
+        msg.message_type = M_FLAG_SET;
+        msg.op_mode_flag = FLAG_FLASH_NEW_APP;
+        n->state = bootloaderFSM(n, n->state, &msg);
+    }
+    else if (n->state == S_FLASH_APP || n->state == S_CRC_CHECK)
+    {
+        // Download abandoned by the tester, the stored flag still says flash new app
+        crcCancel(&n->image_crc);
+        n->state = S_WAIT_FOR_META;
+    }
+
+    if (n->state != S_WAIT_FOR_META)
+        return UDS_NRC_CONDITIONS_NOT_CORRECT;
+
+    // An erase holds off the main loop, the response pending goes out first
+    invalidateApp(n);
+    eraseRange(n, address, length);
+    n->uds_erase_waits = true;
+    n->hw->timer(BL_UDS_PENDING_TIMEOUT_US);
+    return UDS_NRC_RESPONSE_PENDING;
+}
+
+/**
+ * @brief RequestDownload, same as M_METADATA without a CRC. The CRC comes with the check memory routine.
+ *
+ * @param address Has to be the application start
+ * @param length Image length
+ * @return uint8_t NRC
+ */
+static uint8_t udsDownload(uint32_t address, uint32_t length)
+{
+    bl_node_t* n = active;
+    BLRxMessage_t msg = {0};
+
+    if (n->state != S_WAIT_FOR_META)
+        return UDS_NRC_DOWNLOAD_NOT_ACCEPTED;
+    if (address != n->meta.app_start || length == 0 || length > n->cfg.app_length)
+        return UDS_NRC_OUT_OF_RANGE;
+
+    // One contiguous image, segments left over from the CAN protocol do not apply
+    initSegments(&n->pending_segments);
+    msg.message_type = M_METADATA;
+    msg.application_length = length;
+    msg.crc_value = 0;
+    n->state = bootloaderFSM(n, n->state, &msg);
+
+    n->uds_word = 0;
+    n->uds_word_bytes = 0;
+    return UDS_NRC_OK;
+}
+
+/**
+ * @brief Program one word through the FSM like M_APP_DATA and read it back
+ *
+ * @param word Application word
+ * @return uint8_t NRC, programming failure when flash was not erased
+ */
+static uint8_t udsProgramWord(bl_node_t* n, uint32_t word)
+{
+    BLRxMessage_t msg = {0};
+    uint32_t address = n->write_address;
+
+    if (n->state != S_FLASH_APP)
+        return UDS_NRC_SEQUENCE_ERROR;
+
+    msg.message_type = M_APP_DATA;
+    msg.application_data = word;
+    n->state = bootloaderFSM(n, n->state, &msg);
+
+    return *(volatile uint32_t*) flashRead(n, address) == word ? UDS_NRC_OK : UDS_NRC_PROGRAMMING_FAILURE;
+}
+
+/**
+ * @brief TransferData bytes, any chunk size. Whole words are programmed right away,
+ * the rest waits for the next chunk.
+ *
+ * @param data Image bytes
+ * @param length Bytes
+ * @return uint8_t NRC
+ */
+static uint8_t udsTransfer(const uint8_t* data, uint32_t length)
+{
+    bl_node_t* n = active;
+    uint8_t nrc = UDS_NRC_OK;
+
+    for (uint32_t i = 0; i < length && nrc == UDS_NRC_OK; i++)
+    {
+        n->uds_word |= (uint32_t) data[i] << (8 * n->uds_word_bytes);
+        if (++n->uds_word_bytes == 4)
+        {
+            nrc = udsProgramWord(n, n->uds_word);
+            n->uds_word = 0;
+            n->uds_word_bytes = 0;
+        }
+    }
+
+    return nrc;
+}
+
+/**
+ * @brief RequestTransferExit, programs the last partial word padded like erased flash
+ *
+ * @return uint8_t NRC
+ */
+static uint8_t udsExit()
+{
+    bl_node_t* n = active;
+    uint8_t nrc = UDS_NRC_OK;
+
+    if (n->uds_word_bytes)
+    {
+        nrc = udsProgramWord(n, n->uds_word | (0xFFFFFFFFU << (8 * n->uds_word_bytes)));
+        n->uds_word = 0;
+        n->uds_word_bytes = 0;
+    }
+
+    if (nrc == UDS_NRC_OK && n->state != S_CRC_CHECK)
+        return UDS_NRC_SEQUENCE_ERROR;
+    return nrc;
+}
+
+/**
+ * @brief checkMemory routine. The record is the image CRC, big endian, followed by the
+ * Ed25519 signature in signed builds. Starts the same check as M_NONE in S_CRC_CHECK, the
+ * routine finishes in finishImageCheck().
+ *
+ * @param record Routine option record
+ * @param length Record length
+ * @param passed Set when the image was marked bootable
+ * @return uint8_t NRC, response pending while the check runs
+ */
+static uint8_t udsCheck(const uint8_t* record, uint32_t length, bool* passed)
+{
+    bl_node_t* n = active;
+    BLRxMessage_t msg = {0};
+
+#ifdef BL_SIGNED_IMAGES
+    if (length != 4 + ED25519_SIGNATURE_SIZE)
+#else
+    if (length != 4)
+#endif
+        return UDS_NRC_INCORRECT_LENGTH;
+
+    if (n->state != S_CRC_CHECK)
+        return UDS_NRC_SEQUENCE_ERROR;
+
+    n->image_crc_value = ((uint32_t) record[0] << 24) | (record[1] << 16) | (record[2] << 8) | record[3];
+
+#ifdef BL_SIGNED_IMAGES
+    for (uint32_t i = 0; i < ED25519_SIGNATURE_SIZE / 4; i++)
+    {
+        const uint8_t* word = &record[4 + 4 * i];
+        msg.message_type = M_SIGNATURE;
+        msg.signature_index = i;
+        msg.signature_data = word[0] | (word[1] << 8) | (word[2] << 16) | ((uint32_t) word[3] << 24);
+        n->state = bootloaderFSM(n, n->state, &msg);
+    }
+#endif
+
+    msg.message_type = M_NONE;
+    n->state = bootloaderFSM(n, n->state, &msg);
+    if (n->state == S_CRC_CHECK)
+    {
+        n->hw->timer(BL_UDS_PENDING_REPEAT_US);
+        return UDS_NRC_RESPONSE_PENDING;
+    }
+
+    *passed = n->state == S_LAUNCH_APP;
+    return UDS_NRC_OK;
+}
+
+/**
+ * @brief Send the final response of a routine answered with response pending
+ *
+ * @param nrc UDS_NRC_OK or the negative response code of the routine
+ * @param passed checkMemory: the image was marked bootable
+ */
+static void udsRoutineFinish(bl_node_t* n, uint8_t nrc, bool passed)
+{
+    if (!n->uds.routine_running)
+        return;
+
+    n->hw->timer(0);
+    n->uds_final_length = udsRoutineDone(&n->uds, nrc, passed);
+    schedPost(n->sched, EV_TX_FREE);
+}
+
+/**
+ * @brief Keep UDS frames moving. A final routine response waits for a response pending still in
+ * the transport, an erase job waits for the first response pending to reach a mailbox.
+ */
+static void udsTxPump(bl_node_t* n)
+{
+    isoTpPump(&n->uds_tp, txBLMessage, 0);
+
+    if (n->uds_final_length && isoTpSend(&n->uds_tp, n->uds.response, n->uds_final_length))
+    {
+        n->uds_final_length = 0;
+        isoTpPump(&n->uds_tp, txBLMessage, 0);
+    }
+
+    if (n->uds_erase_waits && n->uds_tp.tx_state == ISOTP_TX_IDLE)
+    {
+        n->uds_erase_waits = false;
+        n->hw->timer(BL_UDS_PENDING_REPEAT_US);
+        eraseStart(n);
+    }
+}
+
+/**
+ * @brief Timer of a routine answered with response pending. The first response pending did not
+ * reach a mailbox within BL_UDS_PENDING_TIMEOUT_US: a bus that takes nothing (bus-off, no tester)
+ * drops it and the erase starts anyway. Otherwise the routine still runs and the tester gets
+ * another response pending before P2* runs out.
+ */
+static void udsTimer(bl_node_t* n)
+{
+    if (!n->uds.routine_running)
+        return;
+
+    if (n->uds_erase_waits)
+    {
+        // The final response must not queue up behind a pending one that never went out
+        isoTpAbort(&n->uds_tp);
+        n->uds_erase_waits = false;
+        n->hw->timer(BL_UDS_PENDING_REPEAT_US);
+        eraseStart(n);
+        return;
+    }
+
+    // Check cancelled without a result
+    if (n->uds.routine == UDS_ROUTINE_CHECK_MEMORY && n->state != S_CRC_CHECK)
+    {
+        udsRoutineFinish(n, UDS_NRC_CONDITIONS_NOT_CORRECT, false);
+        return;
+    }
+
+    isoTpSend(&n->uds_tp, n->uds_pending_rsp, sizeof(n->uds_pending_rsp));
+    n->hw->timer(BL_UDS_PENDING_REPEAT_US);
+    schedPost(n->sched, EV_TX_FREE);
+}
+
+static const bl_uds_ops_t udsOps = {
+    .erase    = udsErase,
+    .download = udsDownload,
+    .transfer = udsTransfer,
+    .exit     = udsExit,
+    .check    = udsCheck,
+};
+
+static void initUDSServices(bl_node_t* n)
+{
+    uint32_t length = n->cfg.uds_block_length;
+
+    if (length == 0 || length > sizeof(n->uds_rx_buf))
+        length = sizeof(n->uds_rx_buf);
+
+    initIsoTp(&n->uds_tp, BL_UDS_RX_ID, BL_UDS_TX_ID, n->cfg.uds_bs, n->cfg.uds_stmin, n->uds_rx_buf, length);
+    initUDS(&n->uds, &udsOps, length);
+
+    // Only routines run long enough for a response pending
+    n->uds_pending_rsp[0] = UDS_SID_NEGATIVE;
+    n->uds_pending_rsp[1] = UDS_SID_ROUTINE_CONTROL;
+    n->uds_pending_rsp[2] = UDS_NRC_RESPONSE_PENDING;
+    n->uds_erase_waits = false;
+    n->uds_final_length = 0;
+}
+
+/**
+ * @brief Handle a frame sent to the UDS request ID. TransferData is programmed while its
+ * consecutive frames arrive, other requests are handled once complete.
+ * Responses always fit a single frame, so ISO-TP never has to time STmin and runs at time 0.
+ *
+ * @param msg Received frame
+ * @return true Frame belonged to UDS
+ * @return false Frame should be decoded as a bootloader message
+ */
+static bool serviceUDS(bl_node_t* n, CanMsgTypeDef* msg)
+{
+    if (canMsgId(msg) != BL_UDS_RX_ID)
+        return false;
+
+    bool complete = isoTpRxFrame(&n->uds_tp, msg, 0);
+
+    // Release the next block before programming this frame, the tester sends while we program
+    if (n->uds_tp.fc_pending)
+        isoTpPump(&n->uds_tp, txBLMessage, 0);
+
+    if (complete || n->uds_tp.rx_active)
+        udsStream(&n->uds, n->uds_rx_buf, n->uds_tp.rx_received, n->uds_tp.rx_length);
+
+    if (complete)
+    {
+        uint32_t length = udsProcess(&n->uds, n->uds_rx_buf, n->uds_tp.rx_length);
+        if (length)
+            isoTpSend(&n->uds_tp, n->uds.response, length);
+    }
+
+    return true;
+}
+#else
+/**
+ * @brief UDS is not built in
+ *
+ * @param msg Not Used
+ * @return false Always
+ */
+static bool serviceUDS(bl_node_t* n, CanMsgTypeDef* msg)
+{
+    return false;
+}
+#endif
+
+/**
+ * @brief Set the Boot Flags object stored in Flash
+ *
+ * @param msg
+ * @return BLState_e
+ */
+static BLState_e setBootFlags(bl_node_t* n, BLRxMessage_t* msg)
+{
+    // Leaving recovery, a dump must not run into the new session
+    readbackStop(&n->readback);
+
+    // A new session starts on classic frames until the tester asks for more
+    n->transport_dlc = TRANSPORT_CLASSIC_DLC;
+    n->transport_brs = false;
+
+    // Half finished download, the stored flag stays and the node waits for an image
+    if (msg->op_mode_flag == FLAG_BOOT_TO_APP && !appVerified(n))
+        return checkBootFlags(n, msg);
+
+    n->meta.boot_flag = msg->op_mode_flag;
+    saveBootMeta(n);
+    return checkBootFlags(n, msg);
+}
+
+/**
+ * @brief Decide to flash a new application or launch current one based on
+ * saved boot flag.
+ *
+ * @param msg
+ * @return BLState_e
+ */
+static BLState_e checkBootFlags(bl_node_t* n, BLRxMessage_t* msg)
+{
+    if (n->meta.boot_flag == FLAG_BOOT_TO_APP)
+        return S_VALIDATE_FLASH;
+
+    if (n->meta.boot_flag == FLAG_FLASH_NEW_APP)
+        return S_WAIT_FOR_META;
+
+    return S_RECOVERY;
+}
+
+/**
+ * @brief Store user supplied CRC and application lengths
+ *
+ * @param msg
+ * @return BLState_e
+ */
+static BLState_e processMetadata(bl_node_t* n, BLRxMessage_t* msg)
+{
+    crcCancel(&n->image_crc);
+    readbackStop(&n->readback);
+
+    // A warm session only takes the image the application announced, or a smaller one
+    if (n->warm_session && n->handoff_session.image_length && msg->application_length > n->handoff_session.image_length)
+        return S_WAIT_FOR_META;
+
+    // Without a segment table the image is one segment at the start of application flash
+    if (n->pending_segments.count == 0)
+        segmentsSingle(&n->pending_segments, msg->application_length, msg->crc_value);
+    n->image_segments = n->pending_segments;
+    initSegments(&n->pending_segments);
+
+    if (!segmentsValidate(&n->image_segments, n->cfg.app_length, msg->application_length, msg->crc_value))
+        return S_WAIT_FOR_META;
+
+    n->image_length         = msg->application_length;
+    n->image_crc_value      = msg->crc_value;
+    n->write_address        = n->meta.app_start + n->image_segments.segments[0].offset;
+    n->write_end            = n->meta.app_start + segmentsSpan(&n->image_segments);
+    n->image_words          = 0;
+    n->image_check_failed   = false;
+    n->status_words         = 0;
+
+#ifdef BL_SIGNED_IMAGES
+    sha256Init(&n->image_hash);
+    n->signature_words = 0;
+#endif
+
+#ifdef BL_ENCRYPTED_IMAGES
+    n->cipher_iv_words = 0;
+    n->cipher_block_fill = 0;
+#endif
+
+    invalidateApp(n);
+
+    // Erase the whole span before the first word, the gaps of a sparse image then read back
+    // erased and are covered by the span CRC. Frames wait in rx_message_q until it is done.
+    eraseRange(n, n->meta.app_start, segmentsSpan(&n->image_segments));
+    eraseStart(n);
+
+    // Metadata for application recieved, begin waiting for application data.
+    return S_FLASH_APP;
+}
+
+/**
+ * @brief Store the range of one segment of a sparse image, used by the next metadata message
+ *
+ * @param msg
+ * @return BLState_e Unchanged state
+ */
+static BLState_e storeSegment(bl_node_t* n, BLRxMessage_t* msg)
+{
+    segmentSet(&n->pending_segments, msg->segment_index, msg->segment_offset, msg->segment_length);
+    return S_WAIT_FOR_META;
+}
+
+/**
+ * @brief Store the CRC through the end of one segment of a sparse image
+ *
+ * @param msg
+ * @return BLState_e Unchanged state
+ */
+static BLState_e storeSegmentCRC(bl_node_t* n, BLRxMessage_t* msg)
+{
+    segmentSetCRC(&n->pending_segments, msg->segment_crc_index, msg->segment_crc);
+    return S_WAIT_FOR_META;
+}
+
+/**
+ * @brief Settle the frame size of application data with the tester. The status report tells it the
+ * largest data length code the CAN controller takes, classic CAN stays at 8 bytes and one word.
+ *
+ * @param msg
+ * @return BLState_e Unchanged state
+ */
+static BLState_e setTransport(bl_node_t* n, BLRxMessage_t* msg)
+{
+    n->transport_dlc = transportNegotiate(msg->transport_dlc, n->hw->port->max_dlen);
+    n->transport_brs = n->transport_dlc > TRANSPORT_CLASSIC_DLC && msg->transport_brs && n->hw->port->brs;
+    return S_WAIT_FOR_META;
+}
+
+/**
+ * @brief Check the temparary CRC and lenght after flashing a new application.
+ * The CRC runs in the background, imageCheckPump() leaves S_CRC_CHECK once it is done.
+ * Another M_NONE while it runs only gets a status report.
+ *
+ * @param msg
+ * @return BLState_e
+ */
+static BLState_e checkFlashedCRC(bl_node_t* n, BLRxMessage_t* msg)
+{
+    if (n->image_segments.check != SEGMENT_CHECK_RUNNING && n->image_segments.check != SEGMENT_CHECK_SPAN)
+    {
+        // UDS only sends the CRC with the check routine, after the metadata
+        n->image_segments.segments[n->image_segments.count - 1].crc = n->image_crc_value;
+        segmentCheckStart(&n->image_segments, &n->image_crc, flashRead(n, n->meta.app_start));
+    }
+    return S_CRC_CHECK;
+}
+
+/**
+ * @brief Advance a running image check, one DMA chunk at a time. Every chunk gets a status
+ * report so the tester sees progress.
+ *
+ */
+static void imageCheckPump(bl_node_t* n)
+{
+    if (n->state != S_CRC_CHECK ||
+        !segmentCheckPoll(&n->image_segments, &n->image_crc, flashRead(n, n->meta.app_start)))
+        return;
+
+    n->status_pending = true;
+    if (n->image_segments.check == SEGMENT_CHECK_PASSED || n->image_segments.check == SEGMENT_CHECK_FAILED)
+        n->state = finishImageCheck(n, n->image_segments.check == SEGMENT_CHECK_PASSED);
+}
+
+/**
+ * @brief Store the new image or go back to waiting for one, depending on the check result.
+ * Boot validation covers the span up to the end of the last segment, gaps included.
+ *
+ * @param passed Every segment CRC matched
+ * @return BLState_e Next state
+ */
+static BLState_e finishImageCheck(bl_node_t* n, bool passed)
+{
+    BLState_e nextState = S_RECOVERY;
+
+    if (passed && imageSignatureValid(n))
+    {
+        // Recieved length and CRC passed the check, store new values and reboot
+        // All of them land in one journal record, a power cut keeps either the old or the new set
+        n->meta.app_crc    = n->image_segments.span_crc;
+        n->meta.app_length = segmentsSpan(&n->image_segments);
+        n->meta.boot_flag  = FLAG_BOOT_TO_APP;
+#ifdef BL_SIGNED_IMAGES
+        n->meta.app_check  = CHECK_SIGNATURE;
+#else
+        n->meta.app_check  = CHECK_CRC;
+#endif
+        saveBootMeta(n);
+
+        nextState = S_LAUNCH_APP;
+    } else {
+        // Reported in the next status message
+        n->image_check_failed = true;
+        n->meta.boot_flag = FLAG_FLASH_NEW_APP;
+        saveBootMeta(n);
+
+        nextState = S_WAIT_FOR_META;
+    }
+
+    crcOff(n);
+#ifdef BL_UDS
+    udsRoutineFinish(n, UDS_NRC_OK, nextState == S_LAUNCH_APP);
+#endif
+    return nextState;
+}
+
+/**
+ * @brief Program one plaintext word at the running counter.
+ * With signed images the programmed word is also fed into the image hash, so hashing overlaps
+ * with bus time instead of adding a pass over flash at the end.
+ *
+ * @param word Plaintext application word
+ */
+static void programWord(bl_node_t* n, uint32_t word)
+{
+    n->hw->program(n->write_address, word);
+
+#ifdef BL_SIGNED_IMAGES
+    // Hash what actually landed in flash, pad bytes past the image length are not signed
+    uint32_t remaining = n->write_end - n->write_address;
+    sha256Update(&n->image_hash, flashRead(n, n->write_address), remaining < 4 ? remaining : 4);
+#endif
+
+    n->write_address += 4;
+    n->image_words++;
+
+    // Skip the gap to the next segment of a sparse image
+    n->write_address = n->meta.app_start + segmentAdvance(&n->image_segments, n->write_address - n->meta.app_start);
+}
+
+#ifdef BL_ENCRYPTED_IMAGES
+/**
+ * @brief Recieve a word of ciphertext. Words are collected until a whole AES block (or the end of
+ * the image) is buffered, then the block is decrypted in place and programmed. Only one block of
+ * ciphertext is ever held in RAM. Data sent before the full IV is dropped and fails the CRC check.
+ *
+ * @param msg
+ * @return BLState_e
+ */
+static BLState_e flashApp(bl_node_t* n, BLRxMessage_t* msg)
+{
+    if (n->cipher_iv_words != 0xF)
+        return S_FLASH_APP;
+
+    for (int i = 0; i < 4; i++)
+        n->cipher_block[n->cipher_block_fill++] = (msg->application_data >> (8 * i)) & 0xFF;
+
+    if (n->cipher_block_fill == AES_BLOCK_SIZE || 4 * n->image_words + n->cipher_block_fill >= n->image_length)
+    {
+        uint8_t* block = n->cipher_block;
+        aesCtrCrypt(&n->image_cipher, block, n->cipher_block_fill);
+
+        for (uint32_t i = 0; i < n->cipher_block_fill; i += 4)
+            programWord(n, block[i] | (block[i + 1] << 8) | (block[i + 2] << 16) | ((uint32_t) block[i + 3] << 24));
+        n->cipher_block_fill = 0;
+    }
+
+    if (n->write_address >= n->write_end)
+    {
+        return S_CRC_CHECK;
+    }
+
+    return S_FLASH_APP;
+}
+
+/**
+ * @brief Store one word of the initial counter block, the cipher is keyed once all four
+ * words are in. The IV can not change after the first data word.
+ *
+ * @param msg
+ * @return BLState_e Unchanged state
+ */
+static BLState_e storeCipherIV(bl_node_t* n, BLRxMessage_t* msg)
+{
+    uint32_t index = msg->cipher_iv_index;
+
+    if (index < AES_BLOCK_SIZE / 4 && n->image_words == 0 && n->cipher_block_fill == 0)
+    {
+        for (int i = 0; i < 4; i++)
+            n->cipher_iv[4 * index + i] = (msg->cipher_iv_data >> (8 * i)) & 0xFF;
+        n->cipher_iv_words |= (1U << index);
+
+        if (n->cipher_iv_words == 0xF)
+            aesCtrInit(&n->image_cipher, n->cfg.image_key, n->cipher_iv);
+    }
+
+    return S_FLASH_APP;
+}
+#else
+/**
+ * @brief Recieve a word from outside world and program it according to a running counter.
+ * Once all words have been recieved, proceed to check that all recieved data matches temp CRC.
+ *
+ * @param msg
+ * @return BLState_e
+ */
+static BLState_e flashApp(bl_node_t* n, BLRxMessage_t* msg)
+{
+    programWord(n, msg->application_data);
+
+    if (n->write_address >= n->write_end)
+    {
+        return S_CRC_CHECK;
+    }
+
+    return S_FLASH_APP;
+}
+#endif
+
+#ifdef BL_SIGNED_IMAGES
+/**
+ * @brief Store one word of the image signature. Words may arrive in any order
+ * during or right after the data transfer.
+ *
+ * @param msg
+ * @return BLState_e Unchanged state
+ */
+static BLState_e storeSignature(bl_node_t* n, BLRxMessage_t* msg)
+{
+    uint32_t index = msg->signature_index;
+
+    if (index < ED25519_SIGNATURE_SIZE / 4)
+    {
+        for (int i = 0; i < 4; i++)
+            n->image_signature[4 * index + i] = (msg->signature_data >> (8 * i)) & 0xFF;
+        n->signature_words |= (1U << index);
+    }
+
+    return n->write_address >= n->write_end ? S_CRC_CHECK : S_FLASH_APP;
+}
+
+/**
+ * @brief Check the Ed25519 signature over the SHA-256 of the received image against the
+ * public key built into the bootloader. Cycle count is kept in signature_cycles.
+ *
+ * @return true Signature complete and valid
+ * @return false Image must not be marked bootable
+ */
+static bool imageSignatureValid(bl_node_t* n)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    bool valid;
+
+    if (n->signature_words != 0xFFFF)
+        return false;
+
+    sha256Final(&n->image_hash, digest);
+
+    uint32_t start = n->hw->cycles();
+    valid = ed25519Verify(n->image_signature, digest, sizeof(digest), n->cfg.public_key);
+    n->signature_cycles = n->hw->cycles() - start;
+
+    return valid;
+}
+#else
+/**
+ * @brief Unsigned build, only the CRC protects the image
+ *
+ * @return true Always
+ */
+static bool imageSignatureValid(bl_node_t* n)
+{
+    return true;
+}
+#endif
+
+/**
+ * @brief Validate currently stored Flash application with saved CRC and lenght values.
+ * If validation is sucessful, we will enter the Launch App state.
+ * Otherwise, bootloader will wait for a new application to be flashed.
+ *
+ * @param msg Not Used
+ * @return BLState_e Next State
+ */
+static BLState_e validateFlash(bl_node_t* n, BLRxMessage_t* msg)
+{
+    BLState_e nextState = S_RECOVERY;
+
+    // Nothing to serve before the application runs, wait for the result
+    if (appVerified(n) && crcRun(&n->image_crc, flashRead(n, n->meta.app_start), n->meta.app_length) == n->meta.app_crc)
+    {
+        // We have verified the integrety of the current flash. Go ahead and launch the application
+        nextState = S_LAUNCH_APP;
+    } else {
+        // TODO: Send CRC Error
+        n->meta.boot_flag = FLAG_FLASH_NEW_APP;
+        saveBootMeta(n);
+
+        nextState = S_WAIT_FOR_META;
+    }
+
+    crcOff(n);
+    return nextState;
+}
+
+/**
+ * @brief Prepare bootloader to launch user application
+ *
+ * @param msg Not Used
+ * @return BLState_e
+ */
+static BLState_e launchApp(bl_node_t* n, BLRxMessage_t* msg)
+{
+    return S_RECOVERY;
+}
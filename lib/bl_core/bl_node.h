@@ -0,0 +1,255 @@
+/**
+ * @file bl_node.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Bootloader node: the FSM, status reports, read-back and UDS services behind the event
+ * scheduler. The target (src/bootloader.c) and the host simulation (lib/per_sim/bl_node_sim) run
+ * the same code and only differ in the hooks of bl_node_hw_t and the flash layout in bl_node_cfg_t.
+ * @version 0.1
+ * @date 2021-07-17
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef BL_NODE_H
+#define BL_NODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <rb_queue.h>
+#include <ev_sched.h>
+#include <bl_msgs.h>
+#include <can_port.h>
+#include <bl_crc.h>
+#include <bl_journal.h>
+#include <bl_readback.h>
+#include <bl_segments.h>
+#include <bl_handoff.h>
+
+#ifdef BL_SIGNED_IMAGES
+#include <sha256.h>
+#include <ed25519.h>
+#endif
+
+#ifdef BL_ENCRYPTED_IMAGES
+#include <aes128.h>
+#endif
+
+#ifdef BL_UDS
+#ifdef BL_ENCRYPTED_IMAGES
+#error "BL_UDS downloads plaintext images and can not be combined with BL_ENCRYPTED_IMAGES"
+#endif
+#include <isotp.h>
+#include <bl_uds.h>
+#endif
+
+#define BL_STATUS_EVERY (5U)        // Programmed words between status reports, below the rx_message_q depth
+#define BL_CRC_CHUNK_WORDS (4096U)  // Words per DMA transfer of an image check, one status report each
+#define BL_NODE_MAX_SECTORS (24U)   // Both banks of a 2 MB F4
+
+#ifdef BL_UDS
+// UDS physical addressing (11 bit identifiers), ISO-TP flow control sent to the tester
+#define BL_UDS_RX_ID (0x7E0U)       // Tester -> ECU
+#define BL_UDS_TX_ID (0x7E8U)       // ECU -> Tester
+#ifndef BL_UDS_BLOCK_LENGTH
+#define BL_UDS_BLOCK_LENGTH (1026U) // maxNumberOfBlockLength, 1 kB of image per TransferData
+#endif
+#ifndef BL_UDS_BS
+#define BL_UDS_BS (8U)              // CFs per flow control, keep at or below the rx_message_q depth
+#endif
+#ifndef BL_UDS_STMIN
+#define BL_UDS_STMIN (0U)           // Back to back CFs within a block
+#endif
+#define BL_UDS_PENDING_TIMEOUT_US (5000U)       // Longest wait for a mailbox for a response pending, well below P2
+#define BL_UDS_PENDING_REPEAT_US  (2000000U)    // Response pending again while a routine runs, a sector erase later still below P2*
+#endif
+
+/*
+*   Value Table Struct Definitions
+*/
+
+typedef enum {
+    FLAG_IDLE_IN_RECOVERY = 0x0U,
+    FLAG_FLASH_NEW_APP    = 0x1U,
+	FLAG_BOOT_TO_APP      = 0x2U
+} BLBootFlag_e;
+
+typedef enum {
+    CHECK_NONE      = 0x0U,     // Nothing verified, flash may hold part of a download
+    CHECK_CRC       = 0x1U,     // Image check passed
+    CHECK_SIGNATURE = 0x2U      // Image check passed and the Ed25519 signature verified
+} BLAppCheck_e;
+
+typedef enum {
+    M_NONE      = 0x0U,
+    M_FLAG_SET  = 0x1U,       // Set boot mode to prog or launch
+    M_METADATA  = 0x2U,       // Send metadata for app data
+    M_APP_DATA  = 0x3U,       // Application data
+    M_READ_REQ  = 0x4U,       // Stream a range of application flash back to the tester
+    M_READ_ACK  = 0x5U,       // Tester acknowledges read-back frames
+    M_SIGNATURE = 0x6U,       // One word of the Ed25519 image signature
+    M_CIPHER_IV = 0x7U,       // One word of the AES-CTR initial counter block
+    M_SEGMENT   = 0x8U,       // Range of one segment of a sparse image, before the metadata
+    M_SEGMENT_CRC = 0x9U,     // CRC through the end of one segment
+    M_TRANSPORT = 0xAU        // Frame size of application data, CAN FD on controllers that have it
+} BLMessageType_e;
+
+
+typedef enum {
+    S_WAIT_FOR_FLAG  = 0x0,  // Initial state on startup, wait fo prog or boot flag message
+    S_RECOVERY       = 0x1,  // Neither flag was set, wait for flag to be sent over CAN
+    S_CRC_CHECK      = 0x2,  // Pre-app launch CRC check
+    S_LAUNCH_APP     = 0x3,  // Launching application code
+    S_WAIT_FOR_META  = 0x4,  // Waiting to recieve application metadata
+    S_FLASH_APP      = 0x5,  // Recieve app program data and wirting to flash
+    S_VALIDATE_FLASH = 0x6,  // Validating flash and generating CRC
+    S_REBOOT         = 0x7   // Prepare bootloader to perform a soft reboot.
+} BLState_e;
+
+/*
+*   Events of the node, in priority order
+*/
+typedef enum {
+    EV_TX_FREE    = 0x0U,   // TX mailbox free, or a frame is waiting to go out
+    EV_TIMER      = 0x1U,   // One shot timer of bl_node_hw_t expired
+    EV_RX_READY   = 0x2U,   // Frame in rx_message_q
+    EV_FLASH_DONE = 0x3U,   // Sector erase done, the next one of the erase job is due
+    EV_CRC_CHUNK  = 0x4U    // Image check chunk done
+} BLEvent_e;
+
+typedef struct bl_node bl_node_t;
+
+typedef struct {
+    BLState_e state;
+    BLMessageType_e type;
+    BLState_e (*fn)(bl_node_t*, BLRxMessage_t*);
+} FSMTableEntry_t;
+
+/**
+ * @brief Hardware behind a node. Flash operations block until they are done, an erase job
+ * runs one sector per EV_FLASH_DONE so other events get a turn in between.
+ */
+typedef struct {
+    const can_port_t* port;                             ///< CAN controller the node talks through
+    void (*program)(uint32_t address, uint32_t value);  ///< Program one word at a flash address
+    void (*erase)(uint8_t sector);                      ///< Erase one sector of the bank
+    const bl_crc_hw_t* crc;                             ///< CRC unit, image checks and read-back trailers
+    void (*crcOff)(void);                               ///< Turn the CRC unit off after a check, optional
+    uint32_t (*cycles)(void);                           ///< Free running cycle counter
+    void (*timer)(uint32_t us);                         ///< Post EV_TIMER once after `us`, 0 stops the timer
+} bl_node_hw_t;
+
+/**
+ * @brief Identity and flash layout of a node. Addresses are the ones the CPU programs and the tester
+ * sends, `flash` is where the bank at `flash_address` is read.
+ */
+typedef struct {
+    uint8_t ecu_id;                 ///< BL_RxECUID of this node
+    uint32_t tx_id;                 ///< BL_TxMessage, read-back frames
+    uint32_t status_id;             ///< BL_StatusMessage of this node
+
+    const uint8_t* flash;           ///< Flash bank as read by the CPU
+    uint32_t flash_address;         ///< Address of the bank
+    const uint32_t* sector_bytes;   ///< Size of each sector from the start of the bank
+    uint8_t sectors;
+    uint32_t shared_address;        ///< Boot metadata journal, two sectors
+    uint32_t shared_sector_bytes;
+    uint32_t app_address;           ///< Application flash
+    uint32_t app_length;
+
+    volatile bl_handoff_t* handoff; ///< Warm re-entry request from the application, 0 for none
+    uint32_t can_clock;             ///< CAN kernel clock, bit timing of a warm re-entry
+#ifdef BL_UDS
+    uint32_t uds_block_length;      ///< maxNumberOfBlockLength, up to BL_UDS_BLOCK_LENGTH
+    uint8_t uds_bs;                 ///< ISO-TP block size asked of the tester
+    uint8_t uds_stmin;              ///< ISO-TP STmin asked of the tester
+#endif
+#ifdef BL_SIGNED_IMAGES
+    const uint8_t* public_key;      ///< Ed25519 key images are signed with
+#endif
+#ifdef BL_ENCRYPTED_IMAGES
+    const uint8_t* image_key;       ///< AES-128 key images are encrypted with
+#endif
+} bl_node_cfg_t;
+
+struct bl_node {
+    bl_node_cfg_t cfg;
+    const bl_node_hw_t* hw;
+    ev_sched_t* sched;              ///< Posted by the interrupts, handlers registered by initNode()
+    rb_queue_t* rx_q;               ///< Frames accepted by the RX interrupt
+
+    BLState_e state;
+    bl_journal_t journal;
+    bl_boot_meta_t meta;            ///< Working copy, stored with saveBootMeta()
+
+    // Read-back only runs while idle, so its trailer CRC never meets an image check on the CRC unit.
+    // It still keeps its own engine, a trailer must not cancel or finish image_crc.
+    bl_readback_t readback;
+    bl_crc_t readback_crc;
+
+    // Image checks stream flash into the CRC unit with DMA, the main loop keeps serving CAN
+    bl_crc_t image_crc;
+
+    // Image being flashed
+    uint32_t image_crc_value;       ///< Compare to calculated CRC
+    uint32_t image_length;          ///< New application length
+    uint32_t write_address;         ///< Next word to program
+    uint32_t write_end;             ///< When to stop flashing
+    uint32_t image_words;           ///< Words programmed since the metadata
+
+    // Sparse images, segments are received while waiting for metadata and taken over by it
+    bl_segment_table_t pending_segments;
+    bl_segment_table_t image_segments;
+
+    // Frames the tester may send data with this session
+    uint32_t transport_dlc;
+    bool transport_brs;
+
+    // Session requested by the application before its reset, see bl_handoff.h
+    bool warm_session;
+    bl_handoff_session_t handoff_session;
+
+    // Sector erase job, sectors [erase_next, erase_end) are left
+    uint8_t erase_next;
+    uint8_t erase_end;
+    bool erase_failed;              ///< A sector did not read back erased
+
+    // Status reports for the tester
+    bool status_pending;
+    uint32_t status_words;          ///< Words programmed at the last report
+    bool image_check_failed;
+
+#ifdef BL_UDS
+    // UDS download services, requests are reassembled in uds_rx_buf and mapped onto FSM messages
+    isotp_t uds_tp;
+    bl_uds_t uds;
+    uint8_t uds_rx_buf[BL_UDS_BLOCK_LENGTH];    ///< Also holds the check memory record with a signature
+    uint8_t uds_pending_rsp[3];
+    bool uds_erase_waits;           ///< Erase job holds off until the response pending is in a mailbox
+    uint32_t uds_final_length;      ///< Routine response waiting for the transport
+    uint32_t uds_word;              ///< Image bytes carried over to the next TransferData
+    uint32_t uds_word_bytes;
+#endif
+
+#ifdef BL_SIGNED_IMAGES
+    // Image authentication, SHA-256 runs as words are programmed and Ed25519 once at the end
+    sha256_ctx_t image_hash;
+    uint8_t image_signature[ED25519_SIGNATURE_SIZE];
+    uint16_t signature_words;       ///< Bit n set once signature word n was received
+    uint32_t signature_cycles;      ///< Cycles of the last verification, read with a debugger
+#endif
+
+#ifdef BL_ENCRYPTED_IMAGES
+    // Image decryption, ciphertext words are collected into one block and decrypted right before programming
+    aes128_ctr_t image_cipher;
+    uint8_t cipher_iv[AES_BLOCK_SIZE];
+    uint8_t cipher_iv_words;        ///< Bit n set once IV word n was received
+    uint8_t cipher_block[AES_BLOCK_SIZE];
+    uint32_t cipher_block_fill;     ///< Ciphertext bytes waiting in cipher_block
+#endif
+};
+
+void initNode(bl_node_t* n, const bl_node_cfg_t* cfg, const bl_node_hw_t* hw, ev_sched_t* sched, rb_queue_t* rx_q);
+uint32_t nodeBitTiming(bl_node_t* n);
+
+#endif
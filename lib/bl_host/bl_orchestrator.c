@@ -0,0 +1,542 @@
+/**
+ * @file bl_orchestrator.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Tester side: flashes several ECUs at once over one CAN interface
+ * 
+ * Every ECU in the manifest gets a job that walks through the bootloader protocol on its own:
+ * flag set, frame size on CAN FD, segment table for sparse images, metadata, data words, signature, image check. Commands are sent one at a time and
+ * wait for the BL_StatusMessage they trigger. Data frames are sent while fewer than `window` frames
+ * worth of words are unreported, the bootloader reports every BL_STATUS_EVERY programmed words and
+ * after every FD frame that carries that many. With the window at or below the rx_message_q depth
+ * an ECU never has to drop a frame.
+ * 
+ * The bus is shared round robin: each pump offers one frame to every job that has something to
+ * send, starting after the job served last. Jobs waiting on an ECU (erasing a journal sector,
+ * checking a CRC, or a full window) simply have nothing to offer, so their share goes to the
+ * others and the bus stays busy as long as any ECU can take data.
+ * @version 0.1
+ * @date 2021-06-05
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bl_orchestrator.h>
+#include <bl_transport.h>
+
+// BL_MessageType values and BL_StatusMessage states, see docs/BootloaderGeneric.dbc
+#define ORCH_M_NONE       (0x0U)
+#define ORCH_M_FLAG_SET   (0x1U)
+#define ORCH_M_METADATA   (0x2U)
+#define ORCH_M_APP_DATA   (0x3U)
+#define ORCH_M_SIGNATURE  (0x6U)
+#define ORCH_M_SEGMENT     (0x8U)
+#define ORCH_M_SEGMENT_CRC (0x9U)
+#define ORCH_M_TRANSPORT   (0xAU)
+#define ORCH_FLASH_NEW_APP (0x1U)
+
+#define ORCH_S_CRC_CHECK     (0x2U)
+#define ORCH_S_LAUNCH_APP    (0x3U)
+#define ORCH_S_WAIT_FOR_META (0x4U)
+#define ORCH_S_FLASH_APP     (0x5U)
+
+/**
+ * @brief Total length of a sparse image, 0 if the segments do not form a valid table
+ */
+static uint32_t segmentsLength(const bl_manifest_entry_t* entry)
+{
+    bl_segment_table_t table;
+    uint32_t length = 0;
+
+    initSegments(&table);
+    for (uint8_t i = 0; i < entry->segment_count; i++)
+    {
+        if (!segmentSet(&table, i, entry->segments[i].offset, entry->segments[i].length) ||
+            !segmentSetCRC(&table, i, entry->segments[i].crc))
+            return 0;
+        length += entry->segments[i].length;
+    }
+
+    // BL_SegmentOffset and BL_SegmentLength are 24 bits
+    return segmentsValidate(&table, 0xFFFFFF, length, entry->crc) ? length : 0;
+}
+
+/**
+ * @brief Set up one job per manifest entry
+ * 
+ * @param orch Orchestrator handle
+ * @param manifest ECU ID to image list, must stay valid until done
+ * @param count Number of entries
+ * @param rx_id ID the bootloaders listen on
+ * @param status_id ID ECU 0 reports status on, BL_STATUS_MSG_BASE
+ * @param timeout_us Longest wait for a status report
+ * @param progress Optional progress hook
+ * @return true Manifest accepted
+ * @return false Too many entries, an invalid or repeated ECU ID, an image that does not fit the metadata
+ * or a segment table the bootloader would refuse
+ */
+bool initOrchestrator(bl_orchestrator_t* orch, const bl_manifest_entry_t* manifest, uint8_t count,
+                      uint32_t rx_id, uint32_t status_id, uint32_t timeout_us, bl_progress_fn progress)
+{
+    uint16_t ids = 0;
+
+    if (count > ORCH_MAX_ECUS)
+        return false;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const bl_manifest_entry_t* entry = &manifest[i];
+        uint32_t length = entry->segment_count ? segmentsLength(entry) : entry->length;
+        if (entry->ecu_id > 0xF || (ids & (1U << entry->ecu_id)) || length == 0 || length > 0xFFFFFF)
+            return false;
+        ids |= 1U << entry->ecu_id;
+
+        bl_flash_job_t* job = &orch->jobs[i];
+        job->entry = entry;
+        job->state = JOB_FLAG;
+        job->error = JOB_ERR_NONE;
+        job->command_due = true;
+        job->length = length;
+        job->words = (length + 3) / 4;
+        job->sent = 0;
+        job->acked = 0;
+        job->checked = 0;
+        job->segment_frame = 0;
+        job->signature_index = 0;
+        job->window = entry->window ? entry->window : ORCH_DEFAULT_WINDOW;
+        job->data_dlc = TRANSPORT_CLASSIC_DLC;
+        job->brs = false;
+        job->deadline_us = UINT64_MAX;
+        job->start_us = 0;
+        job->end_us = 0;
+    }
+
+    orch->count = count;
+    orch->next = 0;
+    orch->rx_id = rx_id;
+    orch->status_id = status_id;
+    orch->timeout_us = timeout_us;
+    orch->progress = progress;
+    orch->transport_dlc = TRANSPORT_CLASSIC_DLC;
+    orch->transport_brs = false;
+    orch->frames = 0;
+    orch->status_frames = 0;
+    return true;
+}
+
+/**
+ * @brief Send application data in CAN FD frames where the ECU takes them. Only for bootloaders
+ * that know M_TRANSPORT, older ones drop it and the job times out. Call before the first pump.
+ * 
+ * @param orch Orchestrator handle
+ * @param dlc Largest data length code the tester interface sends, 9-15 for 12-64 bytes
+ * @param brs Switch to the data bit rate
+ */
+void orchestratorTransport(bl_orchestrator_t* orch, uint8_t dlc, bool brs)
+{
+    orch->transport_dlc = dlc;
+    orch->transport_brs = brs;
+}
+
+static bool jobFinished(bl_flash_job_t* job)
+{
+    return job->state == JOB_DONE || job->state == JOB_FAILED;
+}
+
+static void report(bl_orchestrator_t* orch, bl_flash_job_t* job)
+{
+    if (orch->progress)
+        orch->progress(job);
+}
+
+static void finish(bl_orchestrator_t* orch, bl_flash_job_t* job, BLJobError_e error, uint64_t now_us)
+{
+    job->state = error == JOB_ERR_NONE ? JOB_DONE : JOB_FAILED;
+    job->error = error;
+    job->end_us = now_us;
+    job->deadline_us = UINT64_MAX;
+    report(orch, job);
+}
+
+static void nextState(bl_orchestrator_t* orch, bl_flash_job_t* job, BLJobState_e state)
+{
+    job->state = state;
+    job->command_due = state != JOB_STREAMING;
+    report(orch, job);
+}
+
+/**
+ * @brief Image word `index`, little endian, bytes past the end read as erased flash.
+ * The segments of a sparse image are sent back to back.
+ */
+static uint32_t imageWord(const bl_manifest_entry_t* entry, uint32_t index)
+{
+    const uint8_t* data = entry->image;
+    uint32_t length = entry->length;
+    uint32_t start = 4 * index;
+    uint32_t word = 0;
+
+    for (uint8_t i = 0; i < entry->segment_count; i++)
+    {
+        data = entry->segments[i].data;
+        length = entry->segments[i].length;
+        if (start < length)
+            break;
+        start -= length;
+    }
+
+    for (uint32_t b = 0; b < 4; b++)
+    {
+        uint32_t offset = start + b;
+        word |= (uint32_t) (offset < length ? data[offset] : 0xFF) << (8 * b);
+    }
+    return word;
+}
+
+/**
+ * @brief Data words that fit the next frame of a streaming job
+ */
+static uint8_t streamWords(bl_flash_job_t* job)
+{
+    uint32_t frame_words = transportFrameWords(job->data_dlc);
+    uint32_t window = job->window * frame_words;
+    uint32_t words = job->words - job->sent;
+
+    if (job->sent - job->acked >= window)
+        return 0;
+    if (words > window - (job->sent - job->acked))
+        words = window - (job->sent - job->acked);
+    return words > frame_words ? frame_words : words;
+}
+
+/**
+ * @brief Build an FD data frame with the next words of a job
+ */
+static void fdDataFrame(bl_orchestrator_t* orch, bl_flash_job_t* job, CanMsgTypeDef* msg, uint8_t count)
+{
+    uint32_t words[TRANSPORT_WORDS_MAX];
+
+    for (uint8_t i = 0; i < count; i++)
+        words[i] = imageWord(job->entry, job->sent + i);
+
+    msg->IDE = CAN_ID_EXT;
+    msg->ExtId = orch->rx_id;
+    msg->StdId = 0;
+    transportPackData(msg, ORCH_M_APP_DATA | (job->entry->ecu_id << 4), words, count, job->brs);
+}
+
+/**
+ * @brief Build the next frame of a job
+ * 
+ * @param words Data words in the frame, 0 for commands
+ * @return true Frame built, nothing is committed until it was handed to the transmitter
+ * @return false Job is waiting on the ECU
+ */
+static bool jobFrame(bl_orchestrator_t* orch, bl_flash_job_t* job, CanMsgTypeDef* msg, uint8_t* words)
+{
+    const bl_manifest_entry_t* entry = job->entry;
+
+    *words = 0;
+    if (jobFinished(job))
+        return false;
+    if (job->state == JOB_STREAMING && (*words = streamWords(job)) == 0)
+        return false;
+    if (job->state != JOB_STREAMING && !job->command_due)
+        return false;
+
+    if (job->state == JOB_STREAMING && job->data_dlc > TRANSPORT_CLASSIC_DLC)
+    {
+        fdDataFrame(orch, job, msg, *words);
+        return true;
+    }
+
+    BLRxMessage_t frame = {0};
+    frame.rx_ecuid = entry->ecu_id;
+
+    switch (job->state)
+    {
+        case JOB_FLAG:
+            frame.message_type = ORCH_M_FLAG_SET;
+            frame.op_mode_flag = ORCH_FLASH_NEW_APP;
+            break;
+        case JOB_TRANSPORT:
+            frame.message_type = ORCH_M_TRANSPORT;
+            frame.transport_dlc = orch->transport_dlc;
+            frame.transport_brs = orch->transport_brs;
+            break;
+        case JOB_SEGMENTS:
+        {
+            const bl_image_segment_t* segment = &entry->segments[job->segment_frame / 2];
+            if (job->segment_frame % 2 == 0)
+            {
+                frame.message_type = ORCH_M_SEGMENT;
+                frame.segment_index = job->segment_frame / 2;
+                frame.segment_offset = segment->offset;
+                frame.segment_length = segment->length;
+            } else {
+                frame.message_type = ORCH_M_SEGMENT_CRC;
+                frame.segment_crc_index = job->segment_frame / 2;
+                frame.segment_crc = segment->crc;
+            }
+            break;
+        }
+        case JOB_METADATA:
+            frame.message_type = ORCH_M_METADATA;
+            frame.application_length = job->length;
+            frame.crc_value = entry->crc;
+            break;
+        case JOB_STREAMING:
+            frame.message_type = ORCH_M_APP_DATA;
+            frame.application_data = imageWord(entry, job->sent);
+            break;
+        case JOB_SIGNATURE:
+        {
+            const uint8_t* word = &entry->signature[4 * job->signature_index];
+            frame.message_type = ORCH_M_SIGNATURE;
+            frame.signature_index = job->signature_index;
+            frame.signature_data = word[0] | (word[1] << 8) | (word[2] << 16) | ((uint32_t) word[3] << 24);
+            break;
+        }
+        default:
+            frame.message_type = ORCH_M_NONE;
+            break;
+    }
+
+    msg->IDE = CAN_ID_EXT;
+    msg->ExtId = orch->rx_id;
+    msg->StdId = 0;
+    msg->DLC = BL_RX_MESSAGE_DLC;
+    msg->FDF = 0;
+    blPackRxMessage(&frame, msg->Data);
+    return true;
+}
+
+/**
+ * @brief Hand frames to the transmitter, one job after the other, until it is full or no job
+ * has anything to send. Also fails jobs whose ECU did not answer in time.
+ * 
+ * @param orch Orchestrator handle
+ * @param tx Non-blocking transmit hook
+ * @param now_us Current time
+ * @return uint32_t Frames handed to tx
+ */
+uint32_t orchestratorPump(bl_orchestrator_t* orch, bl_orch_tx_fn tx, uint64_t now_us)
+{
+    CanMsgTypeDef msg;
+    uint32_t count = 0;
+    uint8_t words = 0;
+
+    for (uint8_t i = 0; i < orch->count; i++)
+    {
+        bl_flash_job_t* job = &orch->jobs[i];
+        if (!jobFinished(job) && now_us >= job->deadline_us)
+            finish(orch, job, JOB_ERR_TIMEOUT, now_us);
+    }
+
+    while (1)
+    {
+        uint8_t i;
+        bl_flash_job_t* job = 0;
+
+        for (i = 0; i < orch->count; i++)
+        {
+            bl_flash_job_t* candidate = &orch->jobs[(orch->next + i) % orch->count];
+            if (jobFrame(orch, candidate, &msg, &words))
+            {
+                job = candidate;
+                break;
+            }
+        }
+
+        if (!job || !tx(&msg))
+            return count;
+
+        if (job->state == JOB_FLAG)
+            job->start_us = now_us;
+        if (job->state == JOB_STREAMING)
+            job->sent += words;
+        else
+            job->command_due = false;
+
+        job->deadline_us = now_us + orch->timeout_us;
+        orch->next = (orch->next + i + 1) % orch->count;
+        orch->frames++;
+        count++;
+    }
+}
+
+/**
+ * @brief Handle a frame from the bus, only status reports of jobs in the manifest are used
+ * 
+ * @param orch Orchestrator handle
+ * @param msg Received frame
+ * @param now_us Current time
+ */
+void orchestratorRx(bl_orchestrator_t* orch, CanMsgTypeDef* msg, uint64_t now_us)
+{
+    bl_flash_job_t* job = 0;
+    BLStatusMessage_t status;
+
+    if ((canMsgId(msg) & ~0xFU) != orch->status_id || msg->DLC < BL_STATUS_MESSAGE_DLC)
+        return;
+
+    blUnpackStatusMessage(msg->Data, &status);
+    uint8_t state = status.status_state;
+    uint8_t ecu_id = canMsgId(msg) & 0xF;
+    uint32_t words = status.status_words;
+    bool crc_failed = status.status_crc_failed;
+
+    for (uint8_t i = 0; i < orch->count; i++)
+    {
+        if (orch->jobs[i].entry->ecu_id == ecu_id)
+            job = &orch->jobs[i];
+    }
+
+    // Reports before the first command of a job belong to somebody else's session
+    if (!job || jobFinished(job) || (job->state != JOB_STREAMING && job->command_due))
+        return;
+
+    orch->status_frames++;
+    job->deadline_us = now_us + orch->timeout_us;
+
+    switch (job->state)
+    {
+        case JOB_FLAG:
+            if (state != ORCH_S_WAIT_FOR_META)
+                finish(orch, job, JOB_ERR_STATE, now_us);
+            else if (orch->transport_dlc > TRANSPORT_CLASSIC_DLC)
+                nextState(orch, job, JOB_TRANSPORT);
+            else
+                nextState(orch, job, job->entry->segment_count ? JOB_SEGMENTS : JOB_METADATA);
+            break;
+
+        case JOB_TRANSPORT:
+            if (state != ORCH_S_WAIT_FOR_META)
+            {
+                finish(orch, job, JOB_ERR_STATE, now_us);
+                break;
+            }
+            // Never more than asked for, bootloaders without CAN FD report 0
+            job->data_dlc = status.status_data_dlc > TRANSPORT_CLASSIC_DLC && status.status_data_dlc <= orch->transport_dlc ?
+                            status.status_data_dlc : TRANSPORT_CLASSIC_DLC;
+            job->brs = job->data_dlc > TRANSPORT_CLASSIC_DLC && status.status_brs && orch->transport_brs;
+            nextState(orch, job, job->entry->segment_count ? JOB_SEGMENTS : JOB_METADATA);
+            break;
+
+        case JOB_SEGMENTS:
+            if (state != ORCH_S_WAIT_FOR_META)
+                finish(orch, job, JOB_ERR_STATE, now_us);
+            else if (++job->segment_frame == 2 * job->entry->segment_count)
+                nextState(orch, job, JOB_METADATA);
+            else
+                job->command_due = true;
+            break;
+
+        case JOB_METADATA:
+            if (state != ORCH_S_FLASH_APP)
+                finish(orch, job, JOB_ERR_STATE, now_us);
+            else
+                nextState(orch, job, JOB_STREAMING);
+            break;
+
+        case JOB_STREAMING:
+            if (state != ORCH_S_FLASH_APP && state != ORCH_S_CRC_CHECK)
+            {
+                finish(orch, job, JOB_ERR_STATE, now_us);
+                break;
+            }
+            if (words > job->sent)
+            {
+                finish(orch, job, JOB_ERR_PROGRESS, now_us);
+                break;
+            }
+            if (words != job->acked)
+            {
+                job->acked = words;
+                report(orch, job);
+            }
+            if (state == ORCH_S_CRC_CHECK && job->acked == job->words)
+                nextState(orch, job, job->entry->signature ? JOB_SIGNATURE : JOB_CHECKING);
+            break;
+
+        case JOB_SIGNATURE:
+            if (state != ORCH_S_CRC_CHECK)
+                finish(orch, job, JOB_ERR_STATE, now_us);
+            else if (++job->signature_index == ORCH_SIGNATURE_WORDS)
+                nextState(orch, job, JOB_CHECKING);
+            else
+                job->command_due = true;
+            break;
+
+        case JOB_CHECKING:
+            if (state == ORCH_S_CRC_CHECK)
+            {
+                job->checked = status.status_checked;
+                report(orch, job);
+            }
+            else if (state == ORCH_S_LAUNCH_APP)
+                finish(orch, job, JOB_ERR_NONE, now_us);
+            else
+                finish(orch, job, crc_failed ? JOB_ERR_CRC : JOB_ERR_STATE, now_us);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Every job is done or failed
+ */
+bool orchestratorDone(bl_orchestrator_t* orch)
+{
+    for (uint8_t i = 0; i < orch->count; i++)
+    {
+        if (!jobFinished(&orch->jobs[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Fill in the CRC of every segment of a sparse image. Each one runs on from the one before,
+ * like the CRC unit of the bootloader does during the image check.
+ * 
+ * @param segments Segments in ascending address order
+ * @param count Number of segments
+ * @return uint32_t CRC of the last segment, the manifest CRC of the image
+ */
+uint32_t orchestratorSegmentCRCs(bl_image_segment_t* segments, uint8_t count)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        for (uint32_t offset = 0; offset < segments[i].length; offset += 4)
+        {
+            uint32_t word = 0;
+            for (uint32_t b = 0; b < 4 && offset + b < segments[i].length; b++)
+                word |= (uint32_t) segments[i].data[offset + b] << (8 * b);
+            crc = crcSoftware(crc, word);
+        }
+        segments[i].crc = crc;
+    }
+    return crc;
+}
+
+/**
+ * @brief Earliest time a job times out, pump at that time if nothing else happens before
+ * 
+ * @return uint64_t Time in us, UINT64_MAX when no job is waiting on an ECU
+ */
+uint64_t orchestratorDeadline(bl_orchestrator_t* orch)
+{
+    uint64_t deadline = UINT64_MAX;
+
+    for (uint8_t i = 0; i < orch->count; i++)
+    {
+        if (!jobFinished(&orch->jobs[i]) && orch->jobs[i].deadline_us < deadline)
+            deadline = orch->jobs[i].deadline_us;
+    }
+    return deadline;
+}
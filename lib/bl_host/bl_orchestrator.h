@@ -0,0 +1,120 @@
+/**
+ * @file bl_orchestrator.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Tester side: flashes several ECUs at once over one CAN interface
+ * @version 0.1
+ * @date 2021-06-05
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BL_ORCHESTRATOR_H
+#define BL_ORCHESTRATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <can_msg.h>
+#include <bl_msgs.h>
+#include <bl_segments.h>
+
+#define ORCH_MAX_ECUS       (16U)       // BL_RxECUID is 4 bits
+#define ORCH_DEFAULT_WINDOW (10U)       // rx_message_q depth of the bootloader
+#define ORCH_SIGNATURE_WORDS (16U)      // 64 byte Ed25519 signature
+
+typedef enum {
+    JOB_FLAG      = 0x0U,   // Set the flash new app flag, expect S_WAIT_FOR_META
+    JOB_TRANSPORT = 0x1U,   // CAN FD testers only, ask for larger data frames, expect S_WAIT_FOR_META
+    JOB_SEGMENTS  = 0x2U,   // Sparse images only, range and CRC of every segment, expect S_WAIT_FOR_META
+    JOB_METADATA  = 0x3U,   // Send length and CRC, expect S_FLASH_APP
+    JOB_STREAMING = 0x4U,   // Data words inside the window until all are reported programmed
+    JOB_SIGNATURE = 0x5U,   // Signature words, one at a time
+    JOB_CHECKING  = 0x6U,   // M_NONE runs the image check, progress in S_CRC_CHECK, expect S_LAUNCH_APP
+    JOB_DONE      = 0x7U,
+    JOB_FAILED    = 0x8U
+} BLJobState_e;
+
+typedef enum {
+    JOB_ERR_NONE     = 0x0U,
+    JOB_ERR_TIMEOUT  = 0x1U,    // No status report in time
+    JOB_ERR_STATE    = 0x2U,    // ECU reported a state the command should not lead to
+    JOB_ERR_CRC      = 0x3U,    // Image check failed
+    JOB_ERR_PROGRESS = 0x4U     // ECU reported more words than were sent
+} BLJobError_e;
+
+/**
+ * @brief One range of a sparse image
+ */
+typedef struct {
+    uint32_t offset;            ///< From the start of application flash, word aligned
+    const uint8_t* data;
+    uint32_t length;            ///< Bytes, word aligned except for the last segment
+    uint32_t crc;               ///< Filled in by orchestratorSegmentCRCs()
+} bl_image_segment_t;
+
+/**
+ * @brief One manifest line, image data must stay valid until the orchestrator is done
+ */
+typedef struct {
+    uint8_t ecu_id;             ///< BL_RxECUID, 0-15
+    const uint8_t* image;
+    uint32_t length;            ///< Bytes, below 16 MB
+    uint32_t crc;               ///< CRC-32/MPEG-2 of the image as calculateCRC() computes it, of all segments for a sparse image
+    const uint8_t* signature;   ///< Ed25519 signature for signed bootloaders, 0 otherwise
+    uint8_t window;             ///< Data frames in flight, 0 for ORCH_DEFAULT_WINDOW
+    const bl_image_segment_t* segments;     ///< Sparse image in ascending address order, image and length are not used. 0 otherwise.
+    uint8_t segment_count;      ///< Up to SEGMENT_MAX
+} bl_manifest_entry_t;
+
+typedef struct {
+    const bl_manifest_entry_t* entry;
+    BLJobState_e state;
+    BLJobError_e error;
+    bool command_due;           ///< Command of the current state not sent yet
+    uint32_t length;            ///< Image bytes, all segments together for a sparse image
+    uint32_t words;             ///< Image words, the last one padded with 0xFF
+    uint32_t sent;              ///< Data words handed to the transmitter
+    uint32_t acked;             ///< Data words the ECU reported programmed
+    uint32_t checked;           ///< Words the ECU reported through its image check
+    uint8_t segment_frame;      ///< Segment frames sent, a range and a CRC for each segment
+    uint8_t signature_index;
+    uint8_t window;
+    uint8_t data_dlc;           ///< Data length code of M_APP_DATA frames the ECU agreed to
+    bool brs;                   ///< FD data frames switch bit rate
+    uint64_t deadline_us;       ///< Fail once passed while waiting for the ECU
+    uint64_t start_us;
+    uint64_t end_us;
+} bl_flash_job_t;
+
+/**
+ * @brief Called on every job state change and every new progress report
+ */
+typedef void (*bl_progress_fn)(const bl_flash_job_t* job);
+
+typedef bool (*bl_orch_tx_fn)(CanMsgTypeDef* msg);
+
+typedef struct {
+    bl_flash_job_t jobs[ORCH_MAX_ECUS];
+    uint8_t count;
+    uint8_t next;               ///< Job offered the bus first by the next pump
+    uint32_t rx_id;             ///< BL_RxMessage ID
+    uint32_t status_id;         ///< BL_StatusMessage ID of ECU 0, the ECU ID is added to it
+    uint32_t timeout_us;        ///< Longest wait for a status report, cover a sector erase
+    bl_progress_fn progress;
+    uint8_t transport_dlc;      ///< Data length code asked for, classic frames unless orchestratorTransport() was called
+    bool transport_brs;
+
+    uint32_t frames;            ///< Frames handed to the transmitter
+    uint32_t status_frames;     ///< Status reports received
+} bl_orchestrator_t;
+
+bool initOrchestrator(bl_orchestrator_t* orch, const bl_manifest_entry_t* manifest, uint8_t count,
+                      uint32_t rx_id, uint32_t status_id, uint32_t timeout_us, bl_progress_fn progress);
+void orchestratorTransport(bl_orchestrator_t* orch, uint8_t dlc, bool brs);
+void orchestratorRx(bl_orchestrator_t* orch, CanMsgTypeDef* msg, uint64_t now_us);
+uint32_t orchestratorPump(bl_orchestrator_t* orch, bl_orch_tx_fn tx, uint64_t now_us);
+bool orchestratorDone(bl_orchestrator_t* orch);
+uint32_t orchestratorSegmentCRCs(bl_image_segment_t* segments, uint8_t count);
+uint64_t orchestratorDeadline(bl_orchestrator_t* orch);
+
+#endif
@@ -0,0 +1,206 @@
+/**
+ * @file bl_msgs.h
+ * @brief Bootloader CAN messages, generated from BootloaderGeneric.dbc by tools/dbc_codegen.py
+ *
+ * Do not edit, change the DBC instead. Fields hold raw signal values.
+ * Functions are always inlined so RAM resident callers stay in RAM at -O0.
+ */
+
+#ifndef BL_MSGS_H
+#define BL_MSGS_H
+
+#include <stdint.h>
+
+// BL_TxMessage, 29 bit ID
+#define BL_TX_MESSAGE_ID (0x0C01FEFEU)
+#define BL_TX_MESSAGE_DLC (8U)
+
+// BL_StatusMessage, 29 bit ID
+#define BL_STATUS_MESSAGE_ID (0x0C00FE00U)
+#define BL_STATUS_MESSAGE_DLC (8U)
+
+// BL_RxMessage, 29 bit ID
+#define BL_RX_MESSAGE_ID (0x0C00FF10U)
+#define BL_RX_MESSAGE_DLC (8U)
+
+
+/*
+*   BL_TxMessage
+*/
+typedef struct {
+    uint8_t tx_sequence; ///< 0|8, Read-back frame sequence number
+    uint64_t tx_data;    ///< 8|56, Read-back data, 7 bytes per frame. The trailer frame carries the CRC of the range in the first 4 bytes
+} BLTxMessage_t;
+
+static inline __attribute__((always_inline)) void blUnpackTxMessage(const uint8_t* data, BLTxMessage_t* msg)
+{
+    msg->tx_sequence = data[0];
+    msg->tx_data = data[1] | ((uint64_t) data[2] << 8) | ((uint64_t) data[3] << 16) | ((uint64_t) data[4] << 24) | ((uint64_t) data[5] << 32) | ((uint64_t) data[6] << 40) | ((uint64_t) data[7] << 48);
+}
+
+static inline __attribute__((always_inline)) void blPackTxMessage(const BLTxMessage_t* msg, uint8_t* data)
+{
+    data[0] = (msg->tx_sequence & 0xFFU);
+    data[1] = (msg->tx_data & 0xFFU);
+    data[2] = ((msg->tx_data >> 8) & 0xFFU);
+    data[3] = ((msg->tx_data >> 16) & 0xFFU);
+    data[4] = ((msg->tx_data >> 24) & 0xFFU);
+    data[5] = ((msg->tx_data >> 32) & 0xFFU);
+    data[6] = ((msg->tx_data >> 40) & 0xFFU);
+    data[7] = ((msg->tx_data >> 48) & 0xFFU);
+}
+
+
+/*
+*   BL_StatusMessage
+*/
+typedef struct {
+    uint8_t status_state;      ///< 0|4, Bootloader state after the last command
+    uint8_t status_ecuid;      ///< 4|4
+    uint32_t status_words;     ///< 8|24, Application words programmed since the metadata, reported every 5 words while flashing
+    uint8_t status_crc_failed; ///< 32|1, Last image check failed
+    uint8_t status_data_dlc;   ///< 33|4, Largest M_APP_DATA data length code the tester may use this session, 0 from bootloaders without CAN FD support means 8
+    uint8_t status_brs;        ///< 37|1, FD data frames may switch bit rate this session
+    uint32_t status_checked;   ///< 40|24, Application words through the CRC unit while the image check runs
+} BLStatusMessage_t;
+
+static inline __attribute__((always_inline)) void blUnpackStatusMessage(const uint8_t* data, BLStatusMessage_t* msg)
+{
+    msg->status_state = data[0] & 0xFU;
+    msg->status_ecuid = (data[0] >> 4);
+    msg->status_words = data[1] | ((uint32_t) data[2] << 8) | ((uint32_t) data[3] << 16);
+    msg->status_crc_failed = data[4] & 0x1U;
+    msg->status_data_dlc = (data[4] >> 1) & 0xFU;
+    msg->status_brs = (data[4] >> 5) & 0x1U;
+    msg->status_checked = data[5] | ((uint32_t) data[6] << 8) | ((uint32_t) data[7] << 16);
+}
+
+static inline __attribute__((always_inline)) void blPackStatusMessage(const BLStatusMessage_t* msg, uint8_t* data)
+{
+    data[0] = (msg->status_state & 0x0FU) |
+              ((msg->status_ecuid << 4) & 0xF0U);
+    data[1] = (msg->status_words & 0xFFU);
+    data[2] = ((msg->status_words >> 8) & 0xFFU);
+    data[3] = ((msg->status_words >> 16) & 0xFFU);
+    data[4] = (msg->status_crc_failed & 0x01U) |
+              ((msg->status_data_dlc << 1) & 0x1EU) |
+              ((msg->status_brs << 5) & 0x20U);
+    data[5] = (msg->status_checked & 0xFFU);
+    data[6] = ((msg->status_checked >> 8) & 0xFFU);
+    data[7] = ((msg->status_checked >> 16) & 0xFFU);
+}
+
+
+/*
+*   BL_RxMessage
+*/
+typedef struct {
+    uint8_t message_type;        ///< Multiplexer, 0|4, Multiplexer signal for BL commands
+    uint8_t rx_ecuid;            ///< 4|4
+    uint32_t crc_value;          ///< message_type 2, 32|32, Pre-Computed CRC value for application data
+    uint8_t op_mode_flag;        ///< message_type 1, 8|2, Operational mode request for bootloader.
+    uint32_t application_length; ///< message_type 2, 8|24, Length of Application to dlownload in bytes
+    uint32_t application_data;   ///< message_type 3, 8|32, Application binary data to place in ECU flash. CAN FD frames carry more words after it, the word count is in the last byte
+    uint32_t read_start_offset;  ///< message_type 4, 8|24, First byte to read back, offset from the start of application flash
+    uint32_t read_length;        ///< message_type 4, 32|24, Number of bytes to read back
+    uint8_t read_window;         ///< message_type 4, 56|8, Read-back frames allowed in flight before an ACK is required
+    uint8_t read_ack_sequence;   ///< message_type 5, 8|8, Sequence number of the last read-back frame received in order
+    uint8_t signature_index;     ///< message_type 6, 8|8, Word of the 64 byte Ed25519 image signature carried in BL_SignatureData
+    uint32_t signature_data;     ///< message_type 6, 16|32, Ed25519 signature bytes 4*index to 4*index+3, little endian
+    uint8_t cipher_iv_index;     ///< message_type 7, 8|8, Word of the 16 byte AES-CTR initial counter block carried in BL_CipherIVData
+    uint32_t cipher_iv_data;     ///< message_type 7, 16|32, Initial counter block bytes 4*index to 4*index+3, little endian
+    uint8_t segment_index;       ///< message_type 8, 8|8, Segment of a sparse image, segments are numbered in ascending address order
+    uint32_t segment_offset;     ///< message_type 8, 16|24, Segment start, word aligned offset from the start of application flash
+    uint32_t segment_length;     ///< message_type 8, 40|24, Segment bytes, word aligned except for the last segment
+    uint8_t segment_crc_index;   ///< message_type 9, 8|8, Segment the CRC in BL_SegmentCRC belongs to
+    uint32_t segment_crc;        ///< message_type 9, 16|32, CRC from the start of segment 0 through the end of this segment
+    uint8_t transport_dlc;       ///< message_type 10, 8|4, Data length code the tester wants to send M_APP_DATA frames with, 9-15 are CAN FD frames of 12-64 bytes
+    uint8_t transport_brs;       ///< message_type 10, 12|1, Tester wants FD frames with bit rate switching
+} BLRxMessage_t;
+
+static inline __attribute__((always_inline)) void blUnpackRxMessage(const uint8_t* data, BLRxMessage_t* msg)
+{
+    msg->message_type = data[0] & 0xFU;
+    msg->rx_ecuid = (data[0] >> 4);
+    msg->crc_value = data[4] | ((uint32_t) data[5] << 8) | ((uint32_t) data[6] << 16) | ((uint32_t) data[7] << 24);
+    msg->op_mode_flag = data[1] & 0x3U;
+    msg->application_length = data[1] | ((uint32_t) data[2] << 8) | ((uint32_t) data[3] << 16);
+    msg->application_data = data[1] | ((uint32_t) data[2] << 8) | ((uint32_t) data[3] << 16) | ((uint32_t) data[4] << 24);
+    msg->read_start_offset = data[1] | ((uint32_t) data[2] << 8) | ((uint32_t) data[3] << 16);
+    msg->read_length = data[4] | ((uint32_t) data[5] << 8) | ((uint32_t) data[6] << 16);
+    msg->read_window = data[7];
+    msg->read_ack_sequence = data[1];
+    msg->signature_index = data[1];
+    msg->signature_data = data[2] | ((uint32_t) data[3] << 8) | ((uint32_t) data[4] << 16) | ((uint32_t) data[5] << 24);
+    msg->cipher_iv_index = data[1];
+    msg->cipher_iv_data = data[2] | ((uint32_t) data[3] << 8) | ((uint32_t) data[4] << 16) | ((uint32_t) data[5] << 24);
+    msg->segment_index = data[1];
+    msg->segment_offset = data[2] | ((uint32_t) data[3] << 8) | ((uint32_t) data[4] << 16);
+    msg->segment_length = data[5] | ((uint32_t) data[6] << 8) | ((uint32_t) data[7] << 16);
+    msg->segment_crc_index = data[1];
+    msg->segment_crc = data[2] | ((uint32_t) data[3] << 8) | ((uint32_t) data[4] << 16) | ((uint32_t) data[5] << 24);
+    msg->transport_dlc = data[1] & 0xFU;
+    msg->transport_brs = (data[1] >> 4) & 0x1U;
+}
+
+static inline __attribute__((always_inline)) void blPackRxMessage(const BLRxMessage_t* msg, uint8_t* data)
+{
+    uint32_t mux_1 = -(uint32_t) (msg->message_type == 1);
+    uint32_t mux_2 = -(uint32_t) (msg->message_type == 2);
+    uint32_t mux_3 = -(uint32_t) (msg->message_type == 3);
+    uint32_t mux_4 = -(uint32_t) (msg->message_type == 4);
+    uint32_t mux_5 = -(uint32_t) (msg->message_type == 5);
+    uint32_t mux_6 = -(uint32_t) (msg->message_type == 6);
+    uint32_t mux_7 = -(uint32_t) (msg->message_type == 7);
+    uint32_t mux_8 = -(uint32_t) (msg->message_type == 8);
+    uint32_t mux_9 = -(uint32_t) (msg->message_type == 9);
+    uint32_t mux_10 = -(uint32_t) (msg->message_type == 10);
+    data[0] = (msg->message_type & 0x0FU) |
+              ((msg->rx_ecuid << 4) & 0xF0U);
+    data[1] = ((msg->op_mode_flag & mux_1) & 0x03U) |
+              ((msg->application_length & mux_2) & 0xFFU) |
+              ((msg->application_data & mux_3) & 0xFFU) |
+              ((msg->read_start_offset & mux_4) & 0xFFU) |
+              ((msg->read_ack_sequence & mux_5) & 0xFFU) |
+              ((msg->signature_index & mux_6) & 0xFFU) |
+              ((msg->cipher_iv_index & mux_7) & 0xFFU) |
+              ((msg->segment_index & mux_8) & 0xFFU) |
+              ((msg->segment_crc_index & mux_9) & 0xFFU) |
+              ((msg->transport_dlc & mux_10) & 0x0FU) |
+              (((msg->transport_brs << 4) & mux_10) & 0x10U);
+    data[2] = (((msg->application_length >> 8) & mux_2) & 0xFFU) |
+              (((msg->application_data >> 8) & mux_3) & 0xFFU) |
+              (((msg->read_start_offset >> 8) & mux_4) & 0xFFU) |
+              ((msg->signature_data & mux_6) & 0xFFU) |
+              ((msg->cipher_iv_data & mux_7) & 0xFFU) |
+              ((msg->segment_offset & mux_8) & 0xFFU) |
+              ((msg->segment_crc & mux_9) & 0xFFU);
+    data[3] = (((msg->application_length >> 16) & mux_2) & 0xFFU) |
+              (((msg->application_data >> 16) & mux_3) & 0xFFU) |
+              (((msg->read_start_offset >> 16) & mux_4) & 0xFFU) |
+              (((msg->signature_data >> 8) & mux_6) & 0xFFU) |
+              (((msg->cipher_iv_data >> 8) & mux_7) & 0xFFU) |
+              (((msg->segment_offset >> 8) & mux_8) & 0xFFU) |
+              (((msg->segment_crc >> 8) & mux_9) & 0xFFU);
+    data[4] = ((msg->crc_value & mux_2) & 0xFFU) |
+              (((msg->application_data >> 24) & mux_3) & 0xFFU) |
+              ((msg->read_length & mux_4) & 0xFFU) |
+              (((msg->signature_data >> 16) & mux_6) & 0xFFU) |
+              (((msg->cipher_iv_data >> 16) & mux_7) & 0xFFU) |
+              (((msg->segment_offset >> 16) & mux_8) & 0xFFU) |
+              (((msg->segment_crc >> 16) & mux_9) & 0xFFU);
+    data[5] = (((msg->crc_value >> 8) & mux_2) & 0xFFU) |
+              (((msg->read_length >> 8) & mux_4) & 0xFFU) |
+              (((msg->signature_data >> 24) & mux_6) & 0xFFU) |
+              (((msg->cipher_iv_data >> 24) & mux_7) & 0xFFU) |
+              ((msg->segment_length & mux_8) & 0xFFU) |
+              (((msg->segment_crc >> 24) & mux_9) & 0xFFU);
+    data[6] = (((msg->crc_value >> 16) & mux_2) & 0xFFU) |
+              (((msg->read_length >> 16) & mux_4) & 0xFFU) |
+              (((msg->segment_length >> 8) & mux_8) & 0xFFU);
+    data[7] = (((msg->crc_value >> 24) & mux_2) & 0xFFU) |
+              ((msg->read_window & mux_4) & 0xFFU) |
+              (((msg->segment_length >> 16) & mux_8) & 0xFFU);
+}
+
+#endif
@@ -0,0 +1,192 @@
+/**
+ * @file bl_crc.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Chunked CRC engine. Streams a memory region through the CRC unit without blocking the main loop.
+ * 
+ * The CRC is the STM32 CRC unit's CRC-32/MPEG-2 over little endian 32 bit words, starting at
+ * 0xFFFFFFFF. A length that is not a multiple of 4 ends with a word holding the remaining bytes
+ * and zeros above them. Word aligned data is handed to the stream hook chunk by chunk, so a DMA
+ * transfer feeds the unit while the CPU keeps serving CAN. Unaligned data is fed by the CPU, one
+ * chunk per poll, so it stays cancellable and reports progress the same way.
+ * @version 0.1
+ * @date 2021-06-12
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bl_crc.h>
+
+/**
+ * @brief Set up an engine
+ * 
+ * @param crc Engine handle
+ * @param hw CRC unit hooks
+ * @param chunk_words Words per transfer, limited to CRC_MAX_CHUNK_WORDS
+ */
+void initCRCEngine(bl_crc_t* crc, const bl_crc_hw_t* hw, uint32_t chunk_words)
+{
+    crc->hw = hw;
+    crc->chunk_words = chunk_words == 0 || chunk_words > CRC_MAX_CHUNK_WORDS ? CRC_MAX_CHUNK_WORDS : chunk_words;
+    crc->start = 0;
+    crc->next = 0;
+    crc->end = 0;
+    crc->streaming = 0;
+    crc->state = CRC_IDLE;
+    crc->result = 0;
+}
+
+/**
+ * @brief Start a CRC over a region, aborts a running one. Nothing is fed until the first poll.
+ * 
+ * @param crc Engine handle
+ * @param data First byte
+ * @param length Bytes
+ */
+void crcStart(bl_crc_t* crc, const uint8_t* data, uint32_t length)
+{
+    crcCancel(crc);
+    crc->hw->reset();
+    crcContinue(crc, data, length);
+}
+
+/**
+ * @brief Run on over another region without resetting the CRC unit, the result covers both.
+ * Only the last region may end off a word boundary.
+ * 
+ * @param crc Engine handle
+ * @param data First byte
+ * @param length Bytes
+ */
+void crcContinue(bl_crc_t* crc, const uint8_t* data, uint32_t length)
+{
+    crcCancel(crc);
+
+    crc->start = data;
+    crc->next = data;
+    crc->end = data + length;
+    crc->streaming = 0;
+    crc->state = CRC_RUNNING;
+}
+
+/**
+ * @brief Little endian word from any address, bytes at or past end read as 0
+ */
+static uint32_t loadWord(const uint8_t* data, const uint8_t* end)
+{
+    uint32_t word = 0;
+    for (uint32_t b = 0; b < 4 && data + b < end; b++)
+        word |= (uint32_t) data[b] << (8 * b);
+    return word;
+}
+
+/**
+ * @brief Advance the CRC, call from the main loop until it returns done
+ * 
+ * @param crc Engine handle
+ * @return true Progress was made: a chunk finished, or the CRC is done
+ * @return false Not running, or the current transfer is still busy
+ */
+bool crcPoll(bl_crc_t* crc)
+{
+    bool progress = false;
+
+    if (crc->state != CRC_RUNNING)
+        return false;
+
+    if (crc->streaming)
+    {
+        if (crc->hw->busy())
+            return false;
+        crc->next += 4 * crc->streaming;
+        crc->streaming = 0;
+        progress = true;
+    }
+
+    uint32_t words = (crc->end - crc->next) / 4;
+    if (words > crc->chunk_words)
+        words = crc->chunk_words;
+
+    if (words)
+    {
+        if (crc->hw->stream && ((uintptr_t) crc->next & 0x3) == 0)
+        {
+            crc->streaming = words;
+            crc->hw->stream((const uint32_t*) crc->next, words);
+            return progress;
+        }
+
+        for (uint32_t i = 0; i < words; i++)
+            crc->hw->feed(loadWord(crc->next + 4 * i, crc->end));
+        crc->next += 4 * words;
+        return true;
+    }
+
+    if (crc->next < crc->end)
+    {
+        crc->hw->feed(loadWord(crc->next, crc->end));
+        crc->next = crc->end;
+    }
+
+    crc->result = crc->hw->value();
+    crc->state = CRC_DONE;
+    return true;
+}
+
+/**
+ * @brief Stop a running CRC, a running transfer is aborted
+ * 
+ * @param crc Engine handle
+ */
+void crcCancel(bl_crc_t* crc)
+{
+    if (crc->state != CRC_RUNNING)
+        return;
+
+    if (crc->streaming)
+        crc->hw->stop();
+    crc->streaming = 0;
+    crc->state = CRC_CANCELLED;
+}
+
+/**
+ * @brief Bytes already through the CRC unit
+ * 
+ * @param crc Engine handle
+ * @return uint32_t Bytes from the start of the region
+ */
+uint32_t crcProgress(bl_crc_t* crc)
+{
+    return crc->next - crc->start;
+}
+
+/**
+ * @brief Blocking CRC of a region
+ * 
+ * @param crc Engine handle
+ * @param data First byte
+ * @param length Bytes
+ * @return uint32_t CRC
+ */
+uint32_t crcRun(bl_crc_t* crc, const uint8_t* data, uint32_t length)
+{
+    crcStart(crc, data, length);
+    while (crc->state == CRC_RUNNING)
+        crcPoll(crc);
+    return crc->result;
+}
+
+/**
+ * @brief Software model of the CRC unit, one data register write
+ * 
+ * @param crc CRC so far, 0xFFFFFFFF to start
+ * @param word Word written
+ * @return uint32_t New CRC
+ */
+uint32_t crcSoftware(uint32_t crc, uint32_t word)
+{
+    crc ^= word;
+    for (int bit = 0; bit < 32; bit++)
+        crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+    return crc;
+}
@@ -0,0 +1,61 @@
+/**
+ * @file bl_crc.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Chunked CRC engine. Streams a memory region through the CRC unit without blocking the main loop.
+ * @version 0.1
+ * @date 2021-06-12
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BL_CRC_H
+#define BL_CRC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CRC_MAX_CHUNK_WORDS (65535U)    // DMA NDTR is 16 bits
+
+typedef enum {
+    CRC_IDLE      = 0x0U,
+    CRC_RUNNING   = 0x1U,
+    CRC_DONE      = 0x2U,
+    CRC_CANCELLED = 0x3U
+} BLCrcState_e;
+
+/**
+ * @brief CRC unit and the DMA stream feeding it. stream may be 0, then every word goes
+ * through feed.
+ */
+typedef struct {
+    void (*reset)(void);                                        ///< Enable the unit, CRC back to 0xFFFFFFFF
+    uint32_t (*feed)(uint32_t word);                            ///< CPU write to the data register
+    void (*stream)(const uint32_t* words, uint32_t count);      ///< Start a transfer of word aligned data, returns at once
+    bool (*busy)(void);                                         ///< Transfer still running
+    void (*stop)(void);                                         ///< Abort a running transfer
+    uint32_t (*value)(void);                                    ///< Current CRC
+} bl_crc_hw_t;
+
+typedef struct {
+    const bl_crc_hw_t* hw;
+    uint32_t chunk_words;       ///< Words per transfer, one transfer per poll with CPU feeding
+
+    const uint8_t* start;
+    const uint8_t* next;        ///< First byte not handed to the CRC unit yet
+    const uint8_t* end;
+    uint32_t streaming;         ///< Words of the running transfer, 0 when none
+    BLCrcState_e state;
+    uint32_t result;
+} bl_crc_t;
+
+void initCRCEngine(bl_crc_t* crc, const bl_crc_hw_t* hw, uint32_t chunk_words);
+void crcStart(bl_crc_t* crc, const uint8_t* data, uint32_t length);
+void crcContinue(bl_crc_t* crc, const uint8_t* data, uint32_t length);
+bool crcPoll(bl_crc_t* crc);
+void crcCancel(bl_crc_t* crc);
+uint32_t crcProgress(bl_crc_t* crc);
+uint32_t crcRun(bl_crc_t* crc, const uint8_t* data, uint32_t length);
+uint32_t crcSoftware(uint32_t crc, uint32_t word);
+
+#endif
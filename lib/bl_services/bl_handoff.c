@@ -0,0 +1,77 @@
+/**
+ * @file bl_handoff.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Bootloader side of the warm re-entry request
+ * @version 0.1
+ * @date 2021-06-19
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bl_handoff.h>
+
+#define HANDOFF_TQ        (16U)     // 1 sync + 13 BS1 + 2 BS2, sample point at 87.5%
+#define HANDOFF_BTR_TS    (0x001C0000U)
+#define HANDOFF_MAX_BRP   (1024U)
+
+/**
+ * @brief Take the request left by the application. The token is cleared whether the request
+ * is valid or not, so the next reset boots normally.
+ * 
+ * @param handoff Request in no-init RAM
+ * @param ecu_id BL_ECU_ID of this node
+ * @param max_length Size of application flash
+ * @param can_clock CAN kernel clock in Hz
+ * @param session Parameters of a valid request
+ * @return true Valid request for this node, start a session
+ * @return false No request, or not one this node can serve
+ */
+bool handoffTake(volatile bl_handoff_t* handoff, uint32_t ecu_id, uint32_t max_length,
+                 uint32_t can_clock, bl_handoff_session_t* session)
+{
+    uint32_t token        = handoff->token;
+    uint32_t request_ecu  = handoff->ecu_id;
+    uint32_t bitrate      = handoff->bitrate;
+    uint32_t image_length = handoff->image_length;
+    uint32_t check        = handoff->check;
+
+    handoff->token = 0;
+
+    if (token != BL_HANDOFF_TOKEN || check != handoffCheck(request_ecu, bitrate, image_length))
+        return false;
+    if (request_ecu != ecu_id || image_length > max_length)
+        return false;
+
+    session->btr = 0;
+    if (bitrate)
+    {
+        // A node on a bit rate it can not hit exactly would be lost to the tester
+        session->btr = handoffBitTiming(can_clock, bitrate);
+        if (!session->btr)
+            return false;
+    }
+
+    session->ecu_id = request_ecu;
+    session->image_length = image_length;
+    return true;
+}
+
+/**
+ * @brief bxCAN BTR for a bit rate with 16 time quanta per bit, like the default timing
+ * 
+ * @param can_clock CAN kernel clock in Hz
+ * @param bitrate Bit rate in bit/s
+ * @return uint32_t BTR value, 0 when the clock does not divide down to the bit rate exactly
+ */
+uint32_t handoffBitTiming(uint32_t can_clock, uint32_t bitrate)
+{
+    if (bitrate == 0 || bitrate > can_clock / HANDOFF_TQ || can_clock % (HANDOFF_TQ * bitrate))
+        return 0;
+
+    uint32_t brp = can_clock / (HANDOFF_TQ * bitrate);
+    if (brp > HANDOFF_MAX_BRP)
+        return 0;
+
+    return HANDOFF_BTR_TS | (brp - 1);
+}
@@ -0,0 +1,84 @@
+/**
+ * @file bl_handoff.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Warm re-entry into the bootloader. Shared with the application: it only needs this
+ * header to hand a flashing session to the bootloader through no-init RAM.
+ * 
+ * Application side:
+ * 
+ *     handoffWrite(BL_HANDOFF, BL_ECU_ID, 500000, image_length);
+ *     NVIC_SystemReset();
+ * 
+ * The bootloader finds the request in bootloaderInit() before CAN is set up and waits for
+ * metadata right away, without a flag message and without writing the boot flag to flash.
+ * @version 0.1
+ * @date 2021-06-19
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BL_HANDOFF_H
+#define BL_HANDOFF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Top 32 bytes of the bootloader RAM, kept out of every section by stm32f429i.ld and never
+// initialised by the startup code. SRAM keeps its contents through a system reset.
+#define BL_HANDOFF_ADDR  (0x20001FE0U)
+#define BL_HANDOFF       ((volatile bl_handoff_t*) BL_HANDOFF_ADDR)
+
+#define BL_HANDOFF_TOKEN (0xB007C0DEU)
+
+/**
+ * @brief Request as the application leaves it, 8 words
+ */
+typedef struct {
+    uint32_t token;             ///< BL_HANDOFF_TOKEN, cleared by the bootloader once read
+    uint32_t ecu_id;            ///< Has to match BL_ECU_ID of the bootloader
+    uint32_t bitrate;           ///< CAN bit rate of the session in bit/s, 0 for the bootloader default
+    uint32_t image_length;      ///< Largest image the session may flash in bytes, 0 for any
+    uint32_t check;             ///< Complement of the other four words XORed together
+    uint32_t spare[3];
+} bl_handoff_t;
+
+/**
+ * @brief Session parameters the bootloader takes from a valid request
+ */
+typedef struct {
+    uint32_t ecu_id;
+    uint32_t btr;               ///< CAN BTR value for the bit rate, 0 for the bootloader default
+    uint32_t image_length;      ///< 0 for any
+} bl_handoff_session_t;
+
+/**
+ * @brief Check word of a request, random RAM after a power cycle almost never matches
+ */
+static inline uint32_t handoffCheck(uint32_t ecu_id, uint32_t bitrate, uint32_t image_length)
+{
+    return ~(BL_HANDOFF_TOKEN ^ ecu_id ^ bitrate ^ image_length);
+}
+
+/**
+ * @brief Leave a request for the bootloader, reset right after. The token goes last.
+ * 
+ * @param handoff BL_HANDOFF
+ * @param ecu_id ECU ID of the node
+ * @param bitrate CAN bit rate in bit/s, 0 keeps the bootloader default
+ * @param image_length Expected image size in bytes, 0 for any
+ */
+static inline void handoffWrite(volatile bl_handoff_t* handoff, uint32_t ecu_id, uint32_t bitrate, uint32_t image_length)
+{
+    handoff->ecu_id       = ecu_id;
+    handoff->bitrate      = bitrate;
+    handoff->image_length = image_length;
+    handoff->check        = handoffCheck(ecu_id, bitrate, image_length);
+    handoff->token        = BL_HANDOFF_TOKEN;
+}
+
+bool handoffTake(volatile bl_handoff_t* handoff, uint32_t ecu_id, uint32_t max_length,
+                 uint32_t can_clock, bl_handoff_session_t* session);
+uint32_t handoffBitTiming(uint32_t can_clock, uint32_t bitrate);
+
+#endif
@@ -0,0 +1,275 @@
+/**
+ * @file bl_journal.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Append-only journal of boot metadata records in two flash sectors
+ * 
+ * Flash words can only have bits cleared between erases, so values are never rewritten in place.
+ * Each update appends a full snapshot to the next blank slot of the active sector:
+ * 
+ *     slot 0      header: sector state, generation
+ *     slot 1..n   record: sequence, 6 payload words, CRC of the first 7 words
+ * 
+ * The CRC is programmed last, a record torn by a power cut fails the check and the previous
+ * record stays current. Slots fill in order and the sequence word is programmed first, so the
+ * first blank slot is found with a binary search and the newest record is right before it.
+ * 
+ * When the active sector is full the new record goes into the other sector, which is marked
+ * RECEIVING, then ACTIVE, before the old sector is erased. Mounting finishes or rolls back an
+ * interrupted compaction, so there is always one sector with a valid newest record.
+ * @version 0.1
+ * @date 2021-05-15
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bl_journal.h>
+#include <bl_crc.h>
+
+#define PAYLOAD_WORDS (JOURNAL_RECORD_WORDS - 2)
+
+/**
+ * @brief Word-wise CRC-32/MPEG-2 of a record, same algorithm as the STM32 CRC unit
+ */
+static uint32_t recordCRC(volatile uint32_t* record)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < JOURNAL_RECORD_WORDS - 1; i++)
+        crc = crcSoftware(crc, record[i]);
+    return crc;
+}
+
+static volatile uint32_t* slotAddress(bl_journal_t* j, uint8_t sector, uint32_t slot)
+{
+    return j->sector[sector] + slot * JOURNAL_RECORD_WORDS;
+}
+
+static uint32_t slotCount(bl_journal_t* j)
+{
+    return j->sector_words / JOURNAL_RECORD_WORDS;
+}
+
+static bool recordValid(volatile uint32_t* record)
+{
+    return record[0] != JOURNAL_BLANK && record[JOURNAL_RECORD_WORDS - 1] == recordCRC(record);
+}
+
+static bool rangeBlank(volatile uint32_t* words, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        if (words[i] != JOURNAL_BLANK)
+            return false;
+    return true;
+}
+
+static void eraseSector(bl_journal_t* j, uint8_t sector)
+{
+    j->erase(j->sector[sector]);
+    j->erases++;
+}
+
+/**
+ * @brief Binary search for the first slot whose sequence word was never programmed
+ * 
+ * @return uint32_t Slot index, slotCount() if the sector is full
+ */
+static uint32_t firstBlankSlot(bl_journal_t* j, uint8_t sector)
+{
+    uint32_t lo = 1, hi = slotCount(j);
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (slotAddress(j, sector, mid)[0] == JOURNAL_BLANK)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/**
+ * @brief Walk back from the first blank slot to the newest record with a valid CRC
+ * 
+ * @param j Journal
+ * @param sector Sector to search
+ * @param end First blank slot
+ * @return volatile uint32_t* Newest valid record, 0 if there is none
+ */
+static volatile uint32_t* newestRecord(bl_journal_t* j, uint8_t sector, uint32_t end)
+{
+    for (uint32_t slot = end; slot > 1; slot--)
+    {
+        volatile uint32_t* record = slotAddress(j, sector, slot - 1);
+        if (recordValid(record))
+            return record;
+    }
+    return 0;
+}
+
+/**
+ * @brief Program a record, CRC last, and read it back
+ * 
+ * @return true Record is valid in flash
+ * @return false Slot is damaged, try the next one
+ */
+static bool writeRecord(bl_journal_t* j, uint8_t sector, uint32_t slot, uint32_t sequence, const bl_boot_meta_t* meta)
+{
+    volatile uint32_t* record = slotAddress(j, sector, slot);
+    const uint32_t* payload = (const uint32_t*) meta;
+    uint32_t image[JOURNAL_RECORD_WORDS];
+
+    image[0] = sequence;
+    for (uint32_t i = 0; i < PAYLOAD_WORDS; i++)
+        image[1 + i] = payload[i];
+    image[JOURNAL_RECORD_WORDS - 1] = recordCRC(image);
+
+    for (uint32_t i = 0; i < JOURNAL_RECORD_WORDS; i++)
+        j->program(&record[i], image[i]);
+
+    for (uint32_t i = 0; i < JOURNAL_RECORD_WORDS; i++)
+        if (record[i] != image[i])
+            return false;
+    return true;
+}
+
+static void loadRecord(bl_journal_t* j, volatile uint32_t* record)
+{
+    uint32_t* payload = (uint32_t*) &j->meta;
+
+    j->has_record = record != 0;
+    j->sequence = record ? record[0] : 0;
+    for (uint32_t i = 0; i < PAYLOAD_WORDS; i++)
+        payload[i] = record ? record[1 + i] : 0;
+}
+
+/**
+ * @brief Set up a journal over two equally sized flash sectors. Call @ref journalMount before use.
+ * 
+ * @param j Journal
+ * @param sector0 Base of the first sector
+ * @param sector1 Base of the second sector
+ * @param sector_bytes Size of each sector
+ * @param program Programs one word, may only clear bits
+ * @param erase Erases the sector starting at the given address
+ */
+void initJournal(bl_journal_t* j, volatile uint32_t* sector0, volatile uint32_t* sector1, uint32_t sector_bytes,
+                 bl_flash_program_fn program, bl_flash_erase_fn erase)
+{
+    j->sector[0] = sector0;
+    j->sector[1] = sector1;
+    j->sector_words = sector_bytes / 4;
+    j->program = program;
+    j->erase = erase;
+    j->erases = 0;
+    j->has_record = false;
+}
+
+/**
+ * @brief Recover from any interrupted operation and find the newest record. Formats the
+ * journal if neither sector is active. Erases only when a compaction was interrupted.
+ * 
+ * @param j Journal
+ * @return true A valid record was found and copied to j->meta
+ * @return false Journal is empty, j->meta is zeroed
+ */
+bool journalMount(bl_journal_t* j)
+{
+    bool active0 = j->sector[0][0] == JOURNAL_SECTOR_ACTIVE;
+    bool active1 = j->sector[1][0] == JOURNAL_SECTOR_ACTIVE;
+    uint8_t active = active1 ? 1 : 0;
+
+    if (active0 && active1)
+    {
+        // Lost power between activating the new sector and erasing the old one, newest record wins
+        volatile uint32_t* r0 = newestRecord(j, 0, firstBlankSlot(j, 0));
+        volatile uint32_t* r1 = newestRecord(j, 1, firstBlankSlot(j, 1));
+        active = (r1 && (!r0 || (int32_t) (r1[0] - r0[0]) > 0)) ? 1 : 0;
+    }
+    else if (!active0 && !active1)
+    {
+        // Never formatted, or lost power before the first compaction finished
+        for (uint8_t s = 0; s < 2; s++)
+            if (!rangeBlank(j->sector[s], j->sector_words))
+                eraseSector(j, s);
+        j->program(&j->sector[0][1], 0);
+        j->program(&j->sector[0][0], JOURNAL_SECTOR_ACTIVE);
+        active = 0;
+    }
+
+    // Anything in the other sector is a stale or half written copy
+    if (!rangeBlank(j->sector[!active], j->sector_words))
+        eraseSector(j, !active);
+
+    j->active = active;
+    j->generation = j->sector[active][1] == JOURNAL_BLANK ? 0 : j->sector[active][1];
+    j->next_slot = firstBlankSlot(j, active);
+    loadRecord(j, newestRecord(j, active, j->next_slot));
+
+    return j->has_record;
+}
+
+/**
+ * @brief Move to the other sector with `meta` as its first record, then erase the full one
+ */
+static bool compact(bl_journal_t* j, const bl_boot_meta_t* meta)
+{
+    uint8_t from = j->active;
+    uint8_t to = !from;
+    volatile uint32_t* header = j->sector[to];
+
+    if (!rangeBlank(header, j->sector_words))
+        eraseSector(j, to);
+
+    j->program(&header[0], JOURNAL_SECTOR_RECEIVING);
+    j->program(&header[1], j->generation + 1);
+    if (!writeRecord(j, to, 1, j->sequence + 1, meta))
+        return false;
+    j->program(&header[0], JOURNAL_SECTOR_ACTIVE);
+
+    eraseSector(j, from);
+
+    j->active = to;
+    j->generation++;
+    j->next_slot = 2;
+    loadRecord(j, slotAddress(j, to, 1));
+    return true;
+}
+
+/**
+ * @brief Append a new record. Unchanged metadata is not written again. Once this returns
+ * true the record survives a power cut, until then the previous record stays current.
+ * 
+ * @param j Journal
+ * @param meta New metadata
+ * @return true Record stored
+ * @return false Flash could not be programmed
+ */
+bool journalAppend(bl_journal_t* j, const bl_boot_meta_t* meta)
+{
+    const uint32_t* current = (const uint32_t*) &j->meta;
+    const uint32_t* update = (const uint32_t*) meta;
+    bool changed = !j->has_record;
+
+    for (uint32_t i = 0; i < PAYLOAD_WORDS; i++)
+        changed |= current[i] != update[i];
+    if (!changed)
+        return true;
+
+    while (j->next_slot < slotCount(j))
+    {
+        uint32_t slot = j->next_slot++;
+
+        // Damaged slots are skipped, their sequence word already marks them as used
+        if (!rangeBlank(slotAddress(j, j->active, slot), JOURNAL_RECORD_WORDS))
+            continue;
+
+        if (writeRecord(j, j->active, slot, j->sequence + 1, meta))
+        {
+            loadRecord(j, slotAddress(j, j->active, slot));
+            return true;
+        }
+    }
+
+    return compact(j, meta);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file bl_journal.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Append-only journal of boot metadata records in two flash sectors
+ * @version 0.1
+ * @date 2021-05-15
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BL_JOURNAL_H
+#define BL_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JOURNAL_RECORD_WORDS (8U)            // Sequence, payload and CRC
+#define JOURNAL_BLANK        (0xFFFFFFFFU)   // Erased flash word
+
+// Sector states, each step only clears bits so it can be programmed without an erase
+#define JOURNAL_SECTOR_ERASED    (0xFFFFFFFFU)
+#define JOURNAL_SECTOR_RECEIVING (0xAAAAAAAAU)   // Compaction target, not trusted yet
+#define JOURNAL_SECTOR_ACTIVE    (0x00000000U)
+
+/**
+ * @brief Boot metadata, every record is a full snapshot so only the newest one matters
+ */
+typedef struct {
+    uint32_t boot_flag;         ///< BLBootFlag_e
+    uint32_t app_crc;           ///< CRC of the validated application
+    uint32_t app_length;        ///< Length of the validated application
+    uint32_t app_start;         ///< Address the application is flashed to
+    uint32_t app_check;         ///< How the application was verified, zero in records older than the field
+    uint32_t spare[1];          ///< Zero, room for new fields without changing the record size
+} bl_boot_meta_t;
+
+typedef void (*bl_flash_program_fn)(volatile uint32_t* address, uint32_t value);
+typedef void (*bl_flash_erase_fn)(volatile uint32_t* sector);
+
+typedef struct {
+    volatile uint32_t* sector[2];   ///< Base of each sector
+    uint32_t sector_words;
+    bl_flash_program_fn program;
+    bl_flash_erase_fn erase;
+
+    uint8_t active;                 ///< Sector holding the newest record
+    uint32_t next_slot;             ///< First blank record slot in the active sector
+    uint32_t sequence;              ///< Sequence number of the newest record
+    uint32_t generation;            ///< Compactions since the journal was formatted
+    bool has_record;
+    bl_boot_meta_t meta;            ///< Copy of the newest record
+
+    uint32_t erases;                ///< Sector erases issued since init
+} bl_journal_t;
+
+void initJournal(bl_journal_t* j, volatile uint32_t* sector0, volatile uint32_t* sector1, uint32_t sector_bytes,
+                 bl_flash_program_fn program, bl_flash_erase_fn erase);
+bool journalMount(bl_journal_t* j);
+bool journalAppend(bl_journal_t* j, const bl_boot_meta_t* meta);
+
+#endif
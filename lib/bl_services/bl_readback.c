@@ -0,0 +1,163 @@
+/**
+ * @file bl_readback.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Flash read-back service. Streams a memory range to the tester with windowed flow control.
+ * 
+ * Every frame carries an 8 bit sequence number in byte 0 followed by 7 bytes of memory. Up to
+ * `window` frames may be un-acknowledged at once, the tester ACKs with the sequence number of the
+ * last frame it received in order. The stream is closed by a trailer frame holding the CRC of the
+ * whole range, the session ends once the trailer is ACKed. A tester that sees a gap re-requests the
+ * range from the first missing byte.
+ * @version 0.1
+ * @date 2021-04-17
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bl_readback.h>
+
+/**
+ * @brief Initalize an idle read-back service over a memory region
+ * 
+ * @param rb Service handle
+ * @param base First byte the tester may read
+ * @param limit Number of readable bytes from base
+ * @param tx_id CAN ID for outgoing frames
+ * @param crc Function used to build the trailer CRC
+ */
+void initReadback(bl_readback_t* rb, const uint8_t* base, uint32_t limit, uint32_t tx_id, bl_crc_fn crc)
+{
+    rb->base = base;
+    rb->limit = limit;
+    rb->tx_id = tx_id;
+    rb->crc = crc;
+    rb->active = false;
+}
+
+/**
+ * @brief Begin streaming a range, replacing any session in progress
+ * 
+ * @param rb Service handle
+ * @param offset Offset of the first byte from the region base
+ * @param length Number of bytes to send
+ * @param window Frames allowed in flight, clamped to @ref READBACK_MAX_WINDOW
+ * @return true Range is inside the region, streaming started
+ * @return false Range rejected
+ */
+bool readbackStart(bl_readback_t* rb, uint32_t offset, uint32_t length, uint32_t window)
+{
+    rb->active = false;
+
+    if (length == 0 || window == 0 || offset >= rb->limit || length > rb->limit - offset)
+        return false;
+
+    rb->offset = offset;
+    rb->length = length;
+    rb->crc_ready = false;
+    rb->total = (length + READBACK_BYTES_PER_FRAME - 1) / READBACK_BYTES_PER_FRAME + 1;
+    rb->sent = 0;
+    rb->acked = 0;
+    rb->window = window > READBACK_MAX_WINDOW ? READBACK_MAX_WINDOW : window;
+    rb->active = true;
+
+    return true;
+}
+
+/**
+ * @brief End a session without waiting for the tester. Frames already handed to the transmitter
+ * still go out, no new ones follow and the trailer CRC is not computed.
+ * 
+ * @param rb Service handle
+ */
+void readbackStop(bl_readback_t* rb)
+{
+    rb->active = false;
+}
+
+/**
+ * @brief Process an ACK from the tester and open the window again
+ * 
+ * @param rb Service handle
+ * @param sequence Sequence number of the last frame received in order
+ */
+void readbackAck(bl_readback_t* rb, uint8_t sequence)
+{
+    if (!rb->active || rb->sent == 0)
+        return;
+
+    // Sequence numbers wrap, count back from the newest frame sent
+    uint32_t behind = (uint8_t) ((rb->sent - 1) - sequence);
+    if (behind >= rb->window || rb->sent - behind <= rb->acked)
+        return;     // Stale or out of window
+
+    rb->acked = rb->sent - behind;
+
+    if (rb->acked == rb->total)
+        rb->active = false;
+}
+
+/**
+ * @brief Build frame number `index` of the current session
+ * 
+ * @param rb Service handle
+ * @param index Frame number, the last one is the CRC trailer
+ * @param msg Frame to fill
+ */
+static void buildFrame(bl_readback_t* rb, uint32_t index, CanMsgTypeDef* msg)
+{
+    msg->IDE = CAN_ID_EXT;
+    msg->ExtId = rb->tx_id;
+    msg->StdId = 0;
+    msg->FDF = 0;
+    msg->Data[0] = (uint8_t) index;
+
+    if (index == rb->total - 1)
+    {
+        if (!rb->crc_ready)
+        {
+            rb->crc_value = rb->crc(rb->offset, rb->length);
+            rb->crc_ready = true;
+        }
+        for (int i = 0; i < 4; i++)
+            msg->Data[1 + i] = (rb->crc_value >> (8 * i)) & 0xFF;
+        msg->Data[5] = msg->Data[6] = msg->Data[7] = 0;
+        msg->DLC = 8;
+        return;
+    }
+
+    uint32_t offset = index * READBACK_BYTES_PER_FRAME;
+    uint32_t count = rb->length - offset;
+    if (count > READBACK_BYTES_PER_FRAME)
+        count = READBACK_BYTES_PER_FRAME;
+
+    const uint8_t* src = rb->base + rb->offset + offset;
+    for (uint32_t i = 0; i < count; i++)
+        msg->Data[1 + i] = src[i];
+    msg->DLC = 1 + count;
+}
+
+/**
+ * @brief Send frames until the window is full, the transmitter is busy or the range is done.
+ * Call after every ACK and whenever a TX mailbox frees up.
+ * 
+ * @param rb Service handle
+ * @param tx Non-blocking transmit function
+ * @return uint32_t Number of frames handed to the transmitter
+ */
+uint32_t readbackPump(bl_readback_t* rb, bl_tx_fn tx)
+{
+    CanMsgTypeDef msg;
+    uint32_t count = 0;
+
+    while (rb->active && rb->sent < rb->total && rb->sent - rb->acked < rb->window)
+    {
+        buildFrame(rb, rb->sent, &msg);
+        if (!tx(&msg))
+            break;
+        rb->sent++;
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file bl_readback.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Flash read-back service. Streams a memory range to the tester with windowed flow control.
+ * @version 0.1
+ * @date 2021-04-17
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BL_READBACK_H
+#define BL_READBACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <can_msg.h>
+
+#define READBACK_BYTES_PER_FRAME (7U)     // Byte 0 carries the sequence number
+#define READBACK_MAX_WINDOW      (128U)   // Half the 8 bit sequence space so ACKs are never ambiguous
+
+typedef bool (*bl_tx_fn)(CanMsgTypeDef* msg);
+typedef uint32_t (*bl_crc_fn)(uint32_t offset, uint32_t length);   // Offset is relative to the region base
+
+typedef struct {
+    const uint8_t* base;    ///< First readable byte
+    uint32_t limit;         ///< Number of readable bytes from base
+    uint32_t tx_id;         ///< ID used for outgoing frames
+    bl_crc_fn crc;          ///< CRC over [offset, offset + length) of the region
+
+    uint32_t offset;        ///< First byte of the requested range
+    uint32_t length;        ///< Requested number of bytes
+    uint32_t crc_value;     ///< Trailer CRC, computed once when the trailer is first built
+    bool crc_ready;
+    uint32_t total;         ///< Data frames plus the CRC trailer
+    uint32_t sent;          ///< Frames handed to the transmitter
+    uint32_t acked;         ///< Frames acknowledged by the tester
+    uint32_t window;        ///< Frames allowed in flight
+    bool active;
+} bl_readback_t;
+
+void initReadback(bl_readback_t* rb, const uint8_t* base, uint32_t limit, uint32_t tx_id, bl_crc_fn crc);
+bool readbackStart(bl_readback_t* rb, uint32_t offset, uint32_t length, uint32_t window);
+void readbackStop(bl_readback_t* rb);
+void readbackAck(bl_readback_t* rb, uint8_t sequence);
+uint32_t readbackPump(bl_readback_t* rb, bl_tx_fn tx);
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ * @file bl_segments.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Segment table of a sparse image: only the listed ranges of application flash are sent and programmed
+ * 
+ * The tester sends the table before the metadata. Data words then arrive back to back as if the
+ * segments were one image, and segmentAdvance() moves the programming address over the gaps.
+ * Segment CRCs run on across the segments, so the CRC of the last one is the CRC of all image
+ * data and the metadata CRC stays what it was for a contiguous image. One pass over the segments
+ * checks every CRC. Boot validation only knows one range, so once the segments pass, the span from
+ * the start of application flash to the end of the last segment is run through the CRC unit as
+ * well and that CRC is what gets stored.
+ * @version 0.1
+ * @date 2021-06-26
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bl_segments.h>
+
+/**
+ * @brief Empty table, a contiguous image does not need one
+ * 
+ * @param table Segment table
+ */
+void initSegments(bl_segment_table_t* table)
+{
+    table->count = 0;
+    table->entries = 0;
+    table->crcs = 0;
+    table->current = 0;
+    table->check = SEGMENT_CHECK_IDLE;
+    table->checked = 0;
+    table->span_crc = 0;
+}
+
+/**
+ * @brief Store the range of one segment
+ * 
+ * @param table Segment table
+ * @param index Segment number, segments have to be in ascending address order
+ * @param offset Start, from the start of application flash
+ * @param length Bytes
+ * @return true Stored
+ * @return false Index out of range
+ */
+bool segmentSet(bl_segment_table_t* table, uint8_t index, uint32_t offset, uint32_t length)
+{
+    if (index >= SEGMENT_MAX)
+        return false;
+
+    table->segments[index].offset = offset;
+    table->segments[index].length = length;
+    table->entries |= 1U << index;
+    if (index >= table->count)
+        table->count = index + 1;
+    return true;
+}
+
+/**
+ * @brief Store the CRC of one segment
+ * 
+ * @param table Segment table
+ * @param index Segment number
+ * @param crc CRC from the start of segment 0 through the end of this segment
+ * @return true Stored
+ * @return false Index out of range
+ */
+bool segmentSetCRC(bl_segment_table_t* table, uint8_t index, uint32_t crc)
+{
+    if (index >= SEGMENT_MAX)
+        return false;
+
+    table->segments[index].crc = crc;
+    table->crcs |= 1U << index;
+    if (index >= table->count)
+        table->count = index + 1;
+    return true;
+}
+
+/**
+ * @brief Table of a contiguous image at the start of application flash
+ * 
+ * @param table Segment table
+ * @param length Image bytes
+ * @param crc Image CRC
+ */
+void segmentsSingle(bl_segment_table_t* table, uint32_t length, uint32_t crc)
+{
+    initSegments(table);
+    segmentSet(table, 0, 0, length);
+    segmentSetCRC(table, 0, crc);
+}
+
+/**
+ * @brief Check a received table against the metadata. Every segment needs its range and CRC,
+ * a word aligned start inside application flash, and must start at or after the end of the one
+ * before. Only the last segment may end off a word boundary.
+ * 
+ * @param table Segment table
+ * @param flash_length Size of application flash
+ * @param total_length BL_ApplicationLength, the sum of the segment lengths
+ * @param image_crc BL_CRCValue, the CRC of the last segment
+ * @return true Table can be programmed
+ * @return false Table is incomplete or does not fit
+ */
+bool segmentsValidate(bl_segment_table_t* table, uint32_t flash_length, uint32_t total_length, uint32_t image_crc)
+{
+    uint32_t complete = (1U << table->count) - 1;
+    uint32_t end = 0;
+    uint32_t total = 0;
+
+    if (table->count == 0 || table->entries != complete || table->crcs != complete)
+        return false;
+
+    for (uint8_t i = 0; i < table->count; i++)
+    {
+        bl_segment_t* segment = &table->segments[i];
+        bool last = i == table->count - 1;
+
+        if (segment->offset & 0x3 || segment->length == 0 || (!last && segment->length & 0x3))
+            return false;
+        if (segment->offset < end || segment->offset > flash_length || segment->length > flash_length - segment->offset)
+            return false;
+
+        end = segment->offset + segment->length;
+        total += segment->length;
+    }
+
+    if (total != total_length || table->segments[table->count - 1].crc != image_crc)
+        return false;
+
+    table->current = 0;
+    table->check = SEGMENT_CHECK_IDLE;
+    return true;
+}
+
+/**
+ * @brief Bytes from the start of application flash to the end of the last segment
+ * 
+ * @param table Segment table
+ * @return uint32_t Span in bytes
+ */
+uint32_t segmentsSpan(bl_segment_table_t* table)
+{
+    if (table->count == 0)
+        return 0;
+    return table->segments[table->count - 1].offset + table->segments[table->count - 1].length;
+}
+
+/**
+ * @brief Where the next data word goes. Call after every programmed word, moves on to the
+ * next segment once the current one is full.
+ * 
+ * @param table Segment table
+ * @param offset Offset right after the word just programmed
+ * @return uint32_t Offset of the next word
+ */
+uint32_t segmentAdvance(bl_segment_table_t* table, uint32_t offset)
+{
+    while (table->current + 1 < table->count &&
+           offset >= table->segments[table->current].offset + table->segments[table->current].length)
+    {
+        table->current++;
+        offset = table->segments[table->current].offset;
+    }
+    return offset;
+}
+
+/**
+ * @brief Start the image check with the first segment, poll it with segmentCheckPoll()
+ * 
+ * @param table Validated segment table
+ * @param crc CRC engine
+ * @param base Start of application flash
+ */
+void segmentCheckStart(bl_segment_table_t* table, bl_crc_t* crc, const uint8_t* base)
+{
+    table->current = 0;
+    table->checked = 0;
+    table->check = SEGMENT_CHECK_RUNNING;
+    crcStart(crc, base + table->segments[0].offset, table->segments[0].length);
+}
+
+/**
+ * @brief Advance the image check. The CRC unit is not reset between segments, each segment's
+ * CRC is compared once its last word went through.
+ * 
+ * @param table Segment table
+ * @param crc CRC engine
+ * @param base Start of application flash
+ * @return true Progress was made: a chunk, a segment or the whole check finished
+ * @return false Not running, or the current transfer is still busy
+ */
+bool segmentCheckPoll(bl_segment_table_t* table, bl_crc_t* crc, const uint8_t* base)
+{
+    if (table->check != SEGMENT_CHECK_RUNNING && table->check != SEGMENT_CHECK_SPAN)
+        return false;
+    if (!crcPoll(crc))
+        return false;
+    if (crc->state != CRC_DONE)
+        return true;
+
+    if (table->check == SEGMENT_CHECK_SPAN)
+    {
+        table->checked += segmentsSpan(table);
+        table->span_crc = crc->result;
+        table->check = SEGMENT_CHECK_PASSED;
+        return true;
+    }
+
+    bl_segment_t* segment = &table->segments[table->current];
+    table->checked += segment->length;
+
+    if (crc->result != segment->crc)
+    {
+        table->check = SEGMENT_CHECK_FAILED;
+        return true;
+    }
+
+    if (++table->current < table->count)
+    {
+        segment = &table->segments[table->current];
+        crcContinue(crc, base + segment->offset, segment->length);
+        return true;
+    }
+
+    // A contiguous image from offset 0 is its own span
+    if (table->count == 1 && table->segments[0].offset == 0)
+    {
+        table->span_crc = crc->result;
+        table->check = SEGMENT_CHECK_PASSED;
+        return true;
+    }
+
+    table->check = SEGMENT_CHECK_SPAN;
+    crcStart(crc, base, segmentsSpan(table));
+    return true;
+}
+
+/**
+ * @brief Bytes through the CRC unit since the check started
+ * 
+ * @param table Segment table
+ * @param crc CRC engine
+ * @return uint32_t Bytes
+ */
+uint32_t segmentCheckProgress(bl_segment_table_t* table, bl_crc_t* crc)
+{
+    if (table->check == SEGMENT_CHECK_RUNNING || table->check == SEGMENT_CHECK_SPAN)
+        return table->checked + crcProgress(crc);
+    return table->checked;
+}
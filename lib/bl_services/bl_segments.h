@@ -0,0 +1,62 @@
+/**
+ * @file bl_segments.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Segment table of a sparse image: only the listed ranges of application flash are sent and programmed
+ * @version 0.1
+ * @date 2021-06-26
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BL_SEGMENTS_H
+#define BL_SEGMENTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <bl_crc.h>
+
+#define SEGMENT_MAX (8U)            // BL_SegmentIndex values accepted
+
+typedef enum {
+    SEGMENT_CHECK_IDLE    = 0x0U,
+    SEGMENT_CHECK_RUNNING = 0x1U,   // CRC over the segments, one after the other
+    SEGMENT_CHECK_SPAN    = 0x2U,   // Segments passed, CRC over the whole span for boot validation
+    SEGMENT_CHECK_PASSED  = 0x3U,
+    SEGMENT_CHECK_FAILED  = 0x4U
+} BLSegmentCheck_e;
+
+/**
+ * @brief One range of the image, relative to the start of application flash
+ */
+typedef struct {
+    uint32_t offset;            ///< Word aligned
+    uint32_t length;            ///< Bytes, word aligned except for the last segment
+    uint32_t crc;               ///< CRC from the start of the first segment through the end of this one
+} bl_segment_t;
+
+typedef struct {
+    bl_segment_t segments[SEGMENT_MAX];
+    uint8_t count;
+    uint8_t entries;            ///< Bit n set once segment n was received
+    uint8_t crcs;               ///< Bit n set once the CRC of segment n was received
+
+    uint8_t current;            ///< Segment being programmed or checked
+    BLSegmentCheck_e check;
+    uint32_t checked;           ///< Bytes of the finished segments or stages
+    uint32_t span_crc;          ///< CRC from offset 0 to the end of the last segment, gaps included
+} bl_segment_table_t;
+
+void initSegments(bl_segment_table_t* table);
+bool segmentSet(bl_segment_table_t* table, uint8_t index, uint32_t offset, uint32_t length);
+bool segmentSetCRC(bl_segment_table_t* table, uint8_t index, uint32_t crc);
+void segmentsSingle(bl_segment_table_t* table, uint32_t length, uint32_t crc);
+bool segmentsValidate(bl_segment_table_t* table, uint32_t flash_length, uint32_t total_length, uint32_t image_crc);
+uint32_t segmentsSpan(bl_segment_table_t* table);
+uint32_t segmentAdvance(bl_segment_table_t* table, uint32_t offset);
+
+void segmentCheckStart(bl_segment_table_t* table, bl_crc_t* crc, const uint8_t* base);
+bool segmentCheckPoll(bl_segment_table_t* table, bl_crc_t* crc, const uint8_t* base);
+uint32_t segmentCheckProgress(bl_segment_table_t* table, bl_crc_t* crc);
+
+#endif
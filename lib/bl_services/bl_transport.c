@@ -0,0 +1,125 @@
+/**
+ * @file bl_transport.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Frame size of a flashing session: classic 8 byte frames with one data word, or CAN FD
+ * frames with up to TRANSPORT_WORDS_MAX words
+ * 
+ * The tester asks for a data length code with M_TRANSPORT while the bootloader waits for metadata,
+ * and the status report answers with the largest one the controller takes. Bootloaders on bxCAN,
+ * and older ones that report 0, keep the session on classic frames, a tester must never put an FD
+ * frame on the bus before that answer. An FD M_APP_DATA frame keeps the classic layout for its
+ * first word, the next words follow back to back and the last byte of the frame holds the word
+ * count, so a short last frame only pads up to the next FD length.
+ * @version 0.1
+ * @date 2021-07-10
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bl_transport.h>
+
+/**
+ * @brief Data length code a session runs with
+ * 
+ * @param requested_dlc BL_TransportDLC from the tester
+ * @param max_dlen Largest payload of the CAN controller
+ * @return uint32_t Largest code both sides take, TRANSPORT_CLASSIC_DLC for classic frames
+ */
+uint32_t transportNegotiate(uint32_t requested_dlc, uint8_t max_dlen)
+{
+    uint32_t dlc = canLengthDlc(max_dlen);
+
+    if (requested_dlc < dlc)
+        dlc = requested_dlc;
+    return dlc < TRANSPORT_CLASSIC_DLC ? TRANSPORT_CLASSIC_DLC : dlc;
+}
+
+/**
+ * @brief Data words in a full M_APP_DATA frame
+ * 
+ * @param dlc Data length code of the session
+ * @return uint8_t 1 for classic frames, up to TRANSPORT_WORDS_MAX
+ */
+uint8_t transportFrameWords(uint32_t dlc)
+{
+    if (dlc <= TRANSPORT_CLASSIC_DLC)
+        return 1;
+    return (canDlcLength(dlc, true) - 2) / 4;
+}
+
+/**
+ * @brief Check a received frame against the session. Classic frames always pass, FD frames only
+ * once the session settled on FD and only up to the agreed length.
+ * 
+ * @param msg Received frame
+ * @param dlc Data length code of the session
+ * @return true Frame may be handled
+ * @return false Frame must be dropped
+ */
+bool transportAccepts(const CanMsgTypeDef* msg, uint32_t dlc)
+{
+    if (!msg->FDF)
+        return true;
+    return dlc > TRANSPORT_CLASSIC_DLC && msg->DLC <= dlc;
+}
+
+/**
+ * @brief Build an FD M_APP_DATA frame, the identifier is left to the caller. Frame buffers only
+ * hold more than one word in BL_CAN_FD builds.
+ * 
+ * @param msg Frame, DLC is the smallest that holds the words
+ * @param header Byte 0, message type and ECU ID
+ * @param words Data words, sent little endian
+ * @param count Number of words, 1 to TRANSPORT_WORDS_MAX
+ * @param brs Send the data phase at the data bit rate
+ */
+void transportPackData(CanMsgTypeDef* msg, uint8_t header, const uint32_t* words, uint8_t count, bool brs)
+{
+    msg->DLC = canLengthDlc(2 + 4 * count);
+    msg->FDF = 1;
+    msg->BRS = brs;
+
+    uint8_t length = canDlcLength(msg->DLC, true);
+    msg->Data[0] = header;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        for (uint8_t b = 0; b < 4; b++)
+            msg->Data[1 + 4 * i + b] = (words[i] >> (8 * b)) & 0xFF;
+    }
+    for (uint8_t i = 1 + 4 * count; i < length - 1; i++)
+        msg->Data[i] = 0;
+    msg->Data[length - 1] = count;
+}
+
+/**
+ * @brief Data words of an M_APP_DATA frame
+ * 
+ * @param msg Received frame
+ * @param words At least TRANSPORT_WORDS_MAX words
+ * @return uint8_t Number of words, 1 for a classic frame, 0 if the count does not fit the frame
+ */
+uint8_t transportUnpackData(const CanMsgTypeDef* msg, uint32_t* words)
+{
+    uint8_t length = canDlcLength(msg->DLC, msg->FDF);
+    uint8_t count = 1;
+
+    if (msg->FDF)
+    {
+        // Frames past CAN_MAX_DLEN never reach a classic build, the check keeps Data in bounds
+        if (length < 6 || length > CAN_MAX_DLEN)
+            return 0;
+        count = msg->Data[length - 1];
+        if (count == 0 || 2 + 4 * count > length)
+            return 0;
+    }
+    else if (length < 5)
+        return 0;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const uint8_t* word = &msg->Data[1 + 4 * i];
+        words[i] = word[0] | (word[1] << 8) | (word[2] << 16) | ((uint32_t) word[3] << 24);
+    }
+    return count;
+}
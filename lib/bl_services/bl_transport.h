@@ -0,0 +1,29 @@
+/**
+ * @file bl_transport.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Frame size of a flashing session: classic 8 byte frames with one data word, or CAN FD
+ * frames with up to TRANSPORT_WORDS_MAX words
+ * @version 0.1
+ * @date 2021-07-10
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BL_TRANSPORT_H
+#define BL_TRANSPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <can_msg.h>
+
+#define TRANSPORT_CLASSIC_DLC (8U)  // BL_TransportDLC of a classic session
+#define TRANSPORT_WORDS_MAX (15U)   // 64 byte frame: header byte, 15 words, word count
+
+uint32_t transportNegotiate(uint32_t requested_dlc, uint8_t max_dlen);
+uint8_t transportFrameWords(uint32_t dlc);
+bool transportAccepts(const CanMsgTypeDef* msg, uint32_t dlc);
+void transportPackData(CanMsgTypeDef* msg, uint8_t header, const uint32_t* words, uint8_t count, bool brs);
+uint8_t transportUnpackData(const CanMsgTypeDef* msg, uint32_t* words);
+
+#endif
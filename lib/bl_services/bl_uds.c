@@ -0,0 +1,424 @@
+/**
+ * @file bl_uds.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief UDS (ISO 14229) download services on top of ISO-TP
+ * 
+ * A standard programming sequence is
+ * 
+ *     10 02                    DiagnosticSessionControl, programming session
+ *     31 01 FF00 44 addr size  RoutineControl eraseMemory
+ *     34 00 44 addr size       RequestDownload, answered with maxNumberOfBlockLength
+ *     36 nn data...            TransferData, counter starts at 1 and wraps to 0
+ *     37                       RequestTransferExit
+ *     31 01 0202 crc           RoutineControl checkMemory, status 00 when the image is valid
+ * 
+ * The server only checks the sequence and formats responses, the bootloader hooks in
+ * bl_uds_ops_t do the work. TransferData is handed to the hooks while its consecutive frames are
+ * still arriving (@ref udsStream), so programming overlaps with bus time instead of following it.
+ * A repeated blockSequenceCounter is answered without programming the data again.
+ * Erase and check may outlast P2. The bootloader either runs them within the hook, after the
+ * optional pending hook sent 0x78, or answers UDS_NRC_RESPONSE_PENDING from the hook and reports the
+ * result later with udsRoutineDone().
+ * @version 0.1
+ * @date 2021-05-29
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bl_uds.h>
+
+/**
+ * @brief Initalize the server in the default session
+ * 
+ * @param uds Server handle
+ * @param ops Bootloader hooks
+ * @param max_block_length Largest TransferData request accepted, at most the ISO-TP receive buffer
+ */
+void initUDS(bl_uds_t* uds, const bl_uds_ops_t* ops, uint16_t max_block_length)
+{
+    uds->ops = ops;
+    uds->max_block_length = max_block_length;
+    uds->session = UDS_SESSION_DEFAULT;
+    uds->downloading = false;
+    uds->streamed = 0;
+    uds->stream_length = 0;
+    uds->stream_ok = false;
+    uds->routine_running = false;
+    uds->requests = 0;
+    uds->negative = 0;
+}
+
+static uint32_t negative(bl_uds_t* uds, uint8_t sid, uint8_t nrc)
+{
+    uds->response[0] = UDS_SID_NEGATIVE;
+    uds->response[1] = sid;
+    uds->response[2] = nrc;
+    uds->negative++;
+    return 3;
+}
+
+/**
+ * @brief Parse addressAndLengthFormatIdentifier followed by memoryAddress and memorySize
+ * 
+ * @param record Starts at the format identifier
+ * @param length Bytes left in the request
+ * @return uint8_t UDS_NRC_OK or the NRC for a malformed record
+ */
+static uint8_t parseAddressLength(const uint8_t* record, uint32_t length, uint32_t* address, uint32_t* size)
+{
+    if (length < 1)
+        return UDS_NRC_INCORRECT_LENGTH;
+
+    uint8_t address_bytes = record[0] & 0xF;
+    uint8_t size_bytes = record[0] >> 4;
+    if (address_bytes < 1 || address_bytes > 4 || size_bytes < 1 || size_bytes > 4)
+        return UDS_NRC_OUT_OF_RANGE;
+    if (length != 1U + address_bytes + size_bytes)
+        return UDS_NRC_INCORRECT_LENGTH;
+
+    *address = 0;
+    *size = 0;
+    for (uint8_t i = 0; i < address_bytes; i++)
+        *address = (*address << 8) | record[1 + i];
+    for (uint8_t i = 0; i < size_bytes; i++)
+        *size = (*size << 8) | record[1 + address_bytes + i];
+    return UDS_NRC_OK;
+}
+
+/**
+ * @brief Check a TransferData header against the download in progress
+ * 
+ * @param counter blockSequenceCounter of the request
+ * @param data_length Bytes after the counter
+ * @return uint8_t UDS_NRC_OK when the block is the next one and fits
+ */
+static uint8_t checkTransfer(bl_uds_t* uds, uint8_t counter, uint32_t data_length)
+{
+    if (uds->session != UDS_SESSION_PROGRAMMING)
+        return UDS_NRC_NOT_IN_SESSION;
+    if (!uds->downloading)
+        return UDS_NRC_SEQUENCE_ERROR;
+    if (counter != (uint8_t) (uds->block_counter + 1))
+        return UDS_NRC_WRONG_BLOCK_COUNTER;
+    if (data_length == 0 || data_length + 2 > uds->max_block_length)
+        return UDS_NRC_INCORRECT_LENGTH;
+    if (data_length > uds->remaining)
+        return UDS_NRC_OUT_OF_RANGE;
+    return UDS_NRC_OK;
+}
+
+static bool repeatedBlock(bl_uds_t* uds, uint8_t counter)
+{
+    return uds->downloading && uds->block_accepted && counter == uds->block_counter;
+}
+
+/**
+ * @brief Hand the data of a TransferData request to the bootloader while it is still being
+ * received. Call after every frame of a request, including the one completing it, with what the
+ * transport has so far. A request that starts before the previous one completed ends the download
+ * if the previous one was a TransferData already partly programmed.
+ * 
+ * @param uds Server handle
+ * @param request Receive buffer of the transport
+ * @param received Bytes of the request received so far
+ * @param length Total length of the request
+ */
+void udsStream(bl_uds_t* uds, const uint8_t* request, uint32_t received, uint32_t length)
+{
+    if (received <= uds->streamed || length != uds->stream_length)
+    {
+        // New request, a block cut off half way can not be programmed again
+        if (uds->stream_ok)
+            uds->downloading = false;
+        uds->streamed = 0;
+        uds->stream_ok = false;
+    }
+
+    if (uds->streamed == 0)
+    {
+        uds->streamed = received;
+        uds->stream_length = length;
+        uds->stream_nrc = UDS_NRC_OK;
+
+        if (received < 2 || request[0] != UDS_SID_TRANSFER_DATA || repeatedBlock(uds, request[1]) ||
+            checkTransfer(uds, request[1], length - 2) != UDS_NRC_OK)
+            return;
+
+        uds->stream_ok = true;
+        uds->streamed = 2;
+    }
+
+    if (uds->stream_ok && uds->stream_nrc == UDS_NRC_OK && received > uds->streamed)
+    {
+        uds->stream_nrc = uds->ops->transfer(&request[uds->streamed], received - uds->streamed);
+        uds->streamed = received;
+    }
+}
+
+static uint32_t sessionControl(bl_uds_t* uds, const uint8_t* request, uint32_t length)
+{
+    if (length != 2)
+        return negative(uds, request[0], UDS_NRC_INCORRECT_LENGTH);
+
+    uint8_t session = request[1] & ~UDS_SUPPRESS_POSITIVE;
+    if (session < UDS_SESSION_DEFAULT || session > UDS_SESSION_EXTENDED)
+        return negative(uds, request[0], UDS_NRC_SUBFUNCTION_NOT_SUPPORTED);
+
+    if (session != UDS_SESSION_PROGRAMMING)
+        uds->downloading = false;
+    uds->session = session;
+
+    if (request[1] & UDS_SUPPRESS_POSITIVE)
+        return 0;
+
+    // P2 50 ms, P2* 5 s in 10 ms steps
+    uds->response[1] = session;
+    uds->response[2] = 0x00;
+    uds->response[3] = 0x32;
+    uds->response[4] = 0x01;
+    uds->response[5] = 0xF4;
+    return 6;
+}
+
+static uint32_t testerPresent(bl_uds_t* uds, const uint8_t* request, uint32_t length)
+{
+    if (length != 2)
+        return negative(uds, request[0], UDS_NRC_INCORRECT_LENGTH);
+    if ((request[1] & ~UDS_SUPPRESS_POSITIVE) != 0)
+        return negative(uds, request[0], UDS_NRC_SUBFUNCTION_NOT_SUPPORTED);
+    if (request[1] & UDS_SUPPRESS_POSITIVE)
+        return 0;
+
+    uds->response[1] = 0x00;
+    return 2;
+}
+
+static uint32_t routineResponse(bl_uds_t* uds, uint16_t routine, bool passed)
+{
+    uds->response[0] = UDS_SID_ROUTINE_CONTROL + UDS_POSITIVE_OFFSET;
+    uds->response[1] = UDS_ROUTINE_START;
+    uds->response[2] = routine >> 8;
+    uds->response[3] = routine & 0xFF;
+    if (routine == UDS_ROUTINE_ERASE_MEMORY)
+        return 4;
+
+    uds->response[4] = passed ? 0x00 : 0x01;
+    return 5;
+}
+
+static uint32_t routineControl(bl_uds_t* uds, const uint8_t* request, uint32_t length)
+{
+    uint8_t nrc;
+    bool passed = true;
+
+    if (length < 4)
+        return negative(uds, request[0], UDS_NRC_INCORRECT_LENGTH);
+    if ((request[1] & ~UDS_SUPPRESS_POSITIVE) != UDS_ROUTINE_START)
+        return negative(uds, request[0], UDS_NRC_SUBFUNCTION_NOT_SUPPORTED);
+
+    uint16_t routine = (request[2] << 8) | request[3];
+    if (routine != UDS_ROUTINE_ERASE_MEMORY && routine != UDS_ROUTINE_CHECK_MEMORY)
+        return negative(uds, request[0], UDS_NRC_OUT_OF_RANGE);
+    if (uds->session != UDS_SESSION_PROGRAMMING)
+        return negative(uds, request[0], UDS_NRC_CONDITIONS_NOT_CORRECT);
+
+    if (routine == UDS_ROUTINE_ERASE_MEMORY)
+    {
+        uint32_t address, size;
+        nrc = parseAddressLength(&request[4], length - 4, &address, &size);
+        if (nrc != UDS_NRC_OK)
+            return negative(uds, request[0], nrc);
+
+        uds->downloading = false;
+        if (uds->ops->pending)
+            uds->ops->pending(request[0]);
+        nrc = uds->ops->erase(address, size);
+    }
+    else
+    {
+        if (length < 8)
+            return negative(uds, request[0], UDS_NRC_INCORRECT_LENGTH);
+        if (uds->downloading)
+            return negative(uds, request[0], UDS_NRC_SEQUENCE_ERROR);
+
+        if (uds->ops->pending)
+            uds->ops->pending(request[0]);
+        nrc = uds->ops->check(&request[4], length - 4, &passed);
+    }
+
+    if (nrc == UDS_NRC_RESPONSE_PENDING)
+    {
+        uds->routine_running = true;
+        uds->routine = routine;
+        uds->response[0] = UDS_SID_NEGATIVE;
+        uds->response[1] = request[0];
+        uds->response[2] = UDS_NRC_RESPONSE_PENDING;
+        return 3;
+    }
+    if (nrc != UDS_NRC_OK)
+        return negative(uds, request[0], nrc);
+    if (request[1] & UDS_SUPPRESS_POSITIVE)
+        return 0;
+
+    return routineResponse(uds, routine, passed);
+}
+
+static uint32_t requestDownload(bl_uds_t* uds, const uint8_t* request, uint32_t length)
+{
+    uint32_t address, size;
+    uint8_t nrc;
+
+    if (length < 3)
+        return negative(uds, request[0], UDS_NRC_INCORRECT_LENGTH);
+    if (uds->session != UDS_SESSION_PROGRAMMING)
+        return negative(uds, request[0], UDS_NRC_NOT_IN_SESSION);
+    if (request[1] != 0x00)
+        return negative(uds, request[0], UDS_NRC_OUT_OF_RANGE);   // No compression or encryption
+
+    nrc = parseAddressLength(&request[2], length - 2, &address, &size);
+    if (nrc != UDS_NRC_OK)
+        return negative(uds, request[0], nrc);
+    if (uds->downloading)
+        return negative(uds, request[0], UDS_NRC_CONDITIONS_NOT_CORRECT);
+
+    nrc = uds->ops->download(address, size);
+    if (nrc != UDS_NRC_OK)
+        return negative(uds, request[0], nrc);
+
+    uds->downloading = true;
+    uds->remaining = size;
+    uds->block_counter = 0;
+    uds->block_accepted = false;
+
+    // lengthFormatIdentifier, maxNumberOfBlockLength in 2 bytes
+    uds->response[1] = 0x20;
+    uds->response[2] = uds->max_block_length >> 8;
+    uds->response[3] = uds->max_block_length & 0xFF;
+    return 4;
+}
+
+static uint32_t transferData(bl_uds_t* uds, const uint8_t* request, uint32_t length, uint32_t streamed, bool stream_ok)
+{
+    uint8_t nrc;
+
+    if (length < 2)
+        return negative(uds, request[0], UDS_NRC_INCORRECT_LENGTH);
+
+    if (repeatedBlock(uds, request[1]))
+    {
+        // Tester missed our response and sent the block again, it is already in flash
+        uds->response[1] = request[1];
+        return 2;
+    }
+
+    nrc = checkTransfer(uds, request[1], length - 2);
+    if (nrc != UDS_NRC_OK)
+        return negative(uds, request[0], nrc);
+
+    if (stream_ok && uds->stream_nrc != UDS_NRC_OK)
+        nrc = uds->stream_nrc;
+    else if (length > (stream_ok ? streamed : 2))
+        nrc = uds->ops->transfer(&request[stream_ok ? streamed : 2], length - (stream_ok ? streamed : 2));
+
+    if (nrc != UDS_NRC_OK)
+    {
+        uds->downloading = false;
+        return negative(uds, request[0], nrc);
+    }
+
+    uds->block_counter = request[1];
+    uds->block_accepted = true;
+    uds->remaining -= length - 2;
+
+    uds->response[1] = request[1];
+    return 2;
+}
+
+static uint32_t transferExit(bl_uds_t* uds, const uint8_t* request)
+{
+    if (uds->session != UDS_SESSION_PROGRAMMING)
+        return negative(uds, request[0], UDS_NRC_NOT_IN_SESSION);
+    if (!uds->downloading || uds->remaining != 0)
+        return negative(uds, request[0], UDS_NRC_SEQUENCE_ERROR);
+
+    uds->downloading = false;
+    uint8_t nrc = uds->ops->exit();
+    if (nrc != UDS_NRC_OK)
+        return negative(uds, request[0], nrc);
+    return 1;
+}
+
+/**
+ * @brief Handle a complete request
+ * 
+ * @param uds Server handle
+ * @param request Request, starting with the service identifier
+ * @param length Request length
+ * @return uint32_t Length of the response in uds->response, 0 when no response is sent
+ */
+uint32_t udsProcess(bl_uds_t* uds, const uint8_t* request, uint32_t length)
+{
+    uint32_t streamed = uds->streamed;
+    bool stream_ok = uds->stream_ok;
+    uint32_t response_length;
+
+    uds->streamed = 0;
+    uds->stream_ok = false;
+    uds->requests++;
+
+    if (length == 0)
+        return 0;
+
+    if (uds->routine_running)
+        return negative(uds, request[0], UDS_NRC_BUSY_REPEAT_REQUEST);
+
+    // Services fill in the rest, a negative response replaces the whole thing
+    uds->response[0] = request[0] + UDS_POSITIVE_OFFSET;
+
+    switch (request[0])
+    {
+        case UDS_SID_SESSION_CONTROL:
+            response_length = sessionControl(uds, request, length);
+            break;
+        case UDS_SID_TESTER_PRESENT:
+            response_length = testerPresent(uds, request, length);
+            break;
+        case UDS_SID_ROUTINE_CONTROL:
+            response_length = routineControl(uds, request, length);
+            break;
+        case UDS_SID_REQUEST_DOWNLOAD:
+            response_length = requestDownload(uds, request, length);
+            break;
+        case UDS_SID_TRANSFER_DATA:
+            response_length = transferData(uds, request, length, streamed, stream_ok);
+            break;
+        case UDS_SID_TRANSFER_EXIT:
+            response_length = transferExit(uds, request);
+            break;
+        default:
+            return negative(uds, request[0], UDS_NRC_SERVICE_NOT_SUPPORTED);
+    }
+
+    return response_length;
+}
+
+/**
+ * @brief Finish the routine that was answered with 0x78. The final response is sent even when
+ * the request suppressed it, the tester is waiting for it after a response pending.
+ * 
+ * @param uds Server handle
+ * @param nrc UDS_NRC_OK or the negative response code of the routine
+ * @param passed checkMemory: the image was marked bootable
+ * @return uint32_t Length of the response in uds->response, 0 when no routine was running
+ */
+uint32_t udsRoutineDone(bl_uds_t* uds, uint8_t nrc, bool passed)
+{
+    if (!uds->routine_running)
+        return 0;
+
+    uds->routine_running = false;
+    if (nrc != UDS_NRC_OK)
+        return negative(uds, UDS_SID_ROUTINE_CONTROL, nrc);
+    return routineResponse(uds, uds->routine, passed);
+}
@@ -0,0 +1,98 @@
+/**
+ * @file bl_uds.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief UDS (ISO 14229) download services on top of ISO-TP
+ * @version 0.1
+ * @date 2021-05-29
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BL_UDS_H
+#define BL_UDS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Service identifiers
+#define UDS_SID_SESSION_CONTROL  (0x10U)
+#define UDS_SID_ROUTINE_CONTROL  (0x31U)
+#define UDS_SID_REQUEST_DOWNLOAD (0x34U)
+#define UDS_SID_TRANSFER_DATA    (0x36U)
+#define UDS_SID_TRANSFER_EXIT    (0x37U)
+#define UDS_SID_TESTER_PRESENT   (0x3EU)
+#define UDS_SID_NEGATIVE         (0x7FU)
+#define UDS_POSITIVE_OFFSET      (0x40U)
+#define UDS_SUPPRESS_POSITIVE    (0x80U)    // Sub-function bit, no positive response wanted
+
+#define UDS_SESSION_DEFAULT      (0x01U)
+#define UDS_SESSION_PROGRAMMING  (0x02U)
+#define UDS_SESSION_EXTENDED     (0x03U)
+
+#define UDS_ROUTINE_START        (0x01U)
+#define UDS_ROUTINE_ERASE_MEMORY (0xFF00U)  // Record: addressAndLengthFormatIdentifier, address, size
+#define UDS_ROUTINE_CHECK_MEMORY (0x0202U)  // Record: CRC-32/MPEG-2 of the image, big endian
+
+// Negative response codes
+#define UDS_NRC_OK                   (0x00U)
+#define UDS_NRC_SERVICE_NOT_SUPPORTED (0x11U)
+#define UDS_NRC_SUBFUNCTION_NOT_SUPPORTED (0x12U)
+#define UDS_NRC_INCORRECT_LENGTH     (0x13U)
+#define UDS_NRC_BUSY_REPEAT_REQUEST (0x21U)
+#define UDS_NRC_CONDITIONS_NOT_CORRECT (0x22U)
+#define UDS_NRC_SEQUENCE_ERROR       (0x24U)
+#define UDS_NRC_OUT_OF_RANGE         (0x31U)
+#define UDS_NRC_DOWNLOAD_NOT_ACCEPTED (0x70U)
+#define UDS_NRC_PROGRAMMING_FAILURE  (0x72U)
+#define UDS_NRC_WRONG_BLOCK_COUNTER  (0x73U)
+#define UDS_NRC_RESPONSE_PENDING     (0x78U)
+#define UDS_NRC_NOT_IN_SESSION       (0x7FU)
+
+#define UDS_MAX_RESPONSE (8U)
+
+/**
+ * @brief Bootloader side of each service. Every hook returns UDS_NRC_OK or the negative response code to send.
+ * erase and check may also return UDS_NRC_RESPONSE_PENDING: the routine goes on after the call, the server
+ * answers 0x78 and the bootloader finishes the routine with udsRoutineDone().
+ */
+typedef struct {
+    uint8_t (*erase)(uint32_t address, uint32_t length);
+    uint8_t (*download)(uint32_t address, uint32_t length);
+    uint8_t (*transfer)(const uint8_t* data, uint32_t length);  ///< Image bytes in order, any chunk size
+    uint8_t (*exit)(void);
+    uint8_t (*check)(const uint8_t* record, uint32_t length, bool* passed);
+    void (*pending)(uint8_t sid);   ///< Optional, send 0x78 before a routine that outlasts P2 and runs within the call
+} bl_uds_ops_t;
+
+typedef struct {
+    const bl_uds_ops_t* ops;
+    uint16_t max_block_length;  ///< maxNumberOfBlockLength, whole TransferData request including SID and counter
+    uint8_t session;
+
+    bool downloading;           ///< RequestDownload accepted, RequestTransferExit not yet
+    uint32_t remaining;         ///< Bytes of memorySize not transferred yet
+    uint8_t block_counter;      ///< blockSequenceCounter of the last accepted TransferData
+    bool block_accepted;        ///< At least one TransferData accepted since RequestDownload
+
+    // TransferData is programmed while its consecutive frames arrive
+    uint32_t streamed;          ///< Bytes of the request in progress already seen
+    uint32_t stream_length;     ///< Length of the request in progress
+    bool stream_ok;             ///< Request in progress is a valid TransferData being programmed
+    uint8_t stream_nrc;         ///< Programming failure while streaming
+
+    // Routine answered with 0x78 and still running, other requests get busyRepeatRequest
+    bool routine_running;
+    uint16_t routine;
+
+    uint8_t response[UDS_MAX_RESPONSE];
+    uint32_t requests;
+    uint32_t negative;          ///< Negative responses sent
+} bl_uds_t;
+
+void initUDS(bl_uds_t* uds, const bl_uds_ops_t* ops, uint16_t max_block_length);
+void udsStream(bl_uds_t* uds, const uint8_t* request, uint32_t received, uint32_t length);
+uint32_t udsProcess(bl_uds_t* uds, const uint8_t* request, uint32_t length);
+uint32_t udsRoutineDone(bl_uds_t* uds, uint8_t nrc, bool passed);
+
+#endif
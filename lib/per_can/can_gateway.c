@@ -0,0 +1,112 @@
+/**
+ * @file can_gateway.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Store-and-forward bridge of bootloader traffic between a primary and secondary CAN bus.
+ * Each direction has its own queue so a busy bus on one side never holds up the other. Frames are
+ * routed from the RX interrupt and drained by the TX mailbox empty interrupt, keeping all three
+ * hardware mailboxes loaded so the bridge runs at the rate of the slower bus.
+ * @version 0.1
+ * @date 2021-04-10
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <can_gateway.h>
+
+/**
+ * @brief Initalize gateway routing and both direction queues
+ * 
+ * @param gw Gateway handle
+ * @param bl_rx_id Bootloader command ID (tester -> ECU)
+ * @param bl_tx_id Bootloader response ID (ECU -> tester)
+ * @param bl_status_base Status report ID of ECU 0, the next GW_STATUS_IDS IDs are relayed up as well
+ * @param secondary_ecus Bitmask of ECU IDs (bit n => ECU n) reachable on the secondary bus
+ * @param down_array Storage for frames heading to the secondary bus
+ * @param down_capacity Number of frames in down_array
+ * @param up_array Storage for frames heading to the primary bus
+ * @param up_capacity Number of frames in up_array
+ */
+void initGateway(can_gateway_t* gw, uint32_t bl_rx_id, uint32_t bl_tx_id, uint32_t bl_status_base, uint16_t secondary_ecus,
+                 CanMsgTypeDef* down_array, uint32_t down_capacity,
+                 CanMsgTypeDef* up_array, uint32_t up_capacity)
+{
+    gw->bl_rx_id = bl_rx_id;
+    gw->bl_tx_id = bl_tx_id;
+    gw->bl_status_base = bl_status_base;
+    gw->secondary_ecus = secondary_ecus;
+
+    initRBQueue(&gw->down_q, (uint8_t*) down_array, down_capacity, sizeof(CanMsgTypeDef));
+    initRBQueue(&gw->up_q, (uint8_t*) up_array, up_capacity, sizeof(CanMsgTypeDef));
+
+    for (int i = 0; i < 2; i++)
+    {
+        gw->forwarded[i] = 0;
+        gw->dropped[i] = 0;
+        gw->high_water[i] = 0;
+    }
+}
+
+/**
+ * @brief Decide if a received frame belongs on the other bus and queue it if so.
+ * Commands are forwarded down when their ECU ID is mapped to the secondary bus,
+ * every bootloader response and status report seen on the secondary bus is forwarded up.
+ * 
+ * @param gw Gateway handle
+ * @param from Bus the frame was received on
+ * @param msg Received frame
+ * @return true Frame belongs to the other bus and was consumed by the gateway
+ * @return false Frame is not for the gateway and should be processed locally
+ */
+RAM_FUNC bool gatewayRoute(can_gateway_t* gw, GWBus_e from, CanMsgTypeDef* msg)
+{
+    uint32_t id = canMsgId(msg);
+    GWBus_e to;
+    rb_queue_t* q;
+
+    if (from == GW_BUS_PRIMARY)
+    {
+        uint8_t ecu_id = (msg->Data[0] >> 4) & 0xF;    // BL_RxECUID : 4|4
+        if (id != gw->bl_rx_id || !(gw->secondary_ecus & (1U << ecu_id)))
+            return false;
+        to = GW_BUS_SECONDARY;
+        q = &gw->down_q;
+    } else {
+        if (id != gw->bl_tx_id && id - gw->bl_status_base >= GW_STATUS_IDS)
+            return false;
+        to = GW_BUS_PRIMARY;
+        q = &gw->up_q;
+    }
+
+    if (!rbEnqueue(q, msg))
+        gw->dropped[to]++;
+    else if (q->_size > gw->high_water[to])
+        gw->high_water[to] = q->_size;
+
+    return true;
+}
+
+/**
+ * @brief Move queued frames onto a bus until the queue is empty or the transmitter is full.
+ * Call after routing a frame and whenever a TX mailbox frees up.
+ * 
+ * @param gw Gateway handle
+ * @param to Bus to transmit on
+ * @param tx Non-blocking transmit function for that bus
+ * @return uint32_t Number of frames handed to the transmitter
+ */
+RAM_FUNC uint32_t gatewayPump(can_gateway_t* gw, GWBus_e to, gw_tx_fn tx)
+{
+    rb_queue_t* q = (to == GW_BUS_SECONDARY) ? &gw->down_q : &gw->up_q;
+    CanMsgTypeDef msg;
+    uint32_t sent = 0;
+
+    while (rbPeek(q, &msg) && tx(&msg))
+    {
+        rbDequeue(q, &msg);
+        sent++;
+    }
+
+    gw->forwarded[to] += sent;
+    return sent;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file can_gateway.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Store-and-forward bridge of bootloader traffic between a primary and secondary CAN bus
+ * @version 0.1
+ * @date 2021-04-10
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef CAN_GATEWAY_H
+#define CAN_GATEWAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <rb_queue.h>
+#include <can_msg.h>
+#include <ram_func.h>
+
+#define GW_STATUS_IDS (16U)     // One status report ID per ECU, from bl_status_base up
+
+typedef enum {
+    GW_BUS_PRIMARY   = 0x0U,    // Bus the tester is connected to
+    GW_BUS_SECONDARY = 0x1U     // Downstream bus behind this node
+} GWBus_e;
+
+/**
+ * @brief Transmit hook for one side of the gateway. Must not block,
+ * return false when no hardware mailbox is free.
+ */
+typedef bool (*gw_tx_fn)(CanMsgTypeDef* msg);
+
+typedef struct {
+    uint32_t bl_rx_id;          ///< Bootloader command ID (tester -> ECU)
+    uint32_t bl_tx_id;          ///< Bootloader response ID (ECU -> tester)
+    uint32_t bl_status_base;    ///< Status report ID of ECU 0, ECU n reports on bl_status_base + n
+    uint16_t secondary_ecus;    ///< Bitmask of ECU IDs that live on the secondary bus
+
+    rb_queue_t down_q;          ///< Frames waiting to go out on the secondary bus
+    rb_queue_t up_q;            ///< Frames waiting to go out on the primary bus
+
+    uint32_t forwarded[2];      ///< Frames sent out on each bus
+    uint32_t dropped[2];        ///< Frames lost because the queue towards a bus was full
+    uint32_t high_water[2];     ///< Deepest queue depth seen towards each bus
+} can_gateway_t;
+
+void initGateway(can_gateway_t* gw, uint32_t bl_rx_id, uint32_t bl_tx_id, uint32_t bl_status_base, uint16_t secondary_ecus,
+                 CanMsgTypeDef* down_array, uint32_t down_capacity,
+                 CanMsgTypeDef* up_array, uint32_t up_capacity);
+// Called from the CAN interrupts, kept in RAM so frames are forwarded while flash is busy
+RAM_FUNC bool gatewayRoute(can_gateway_t* gw, GWBus_e from, CanMsgTypeDef* msg);
+RAM_FUNC uint32_t gatewayPump(can_gateway_t* gw, GWBus_e to, gw_tx_fn tx);
+
+#endif
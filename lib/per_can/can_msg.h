@@ -0,0 +1,86 @@
+/**
+ * @file can_msg.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Hardware independent CAN frame definition shared by the HAL, gateway and native simulation
+ * @version 0.1
+ * @date 2021-04-10
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef CAN_MSG_H
+#define CAN_MSG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CAN_ID_STD (0x0U)   ///< IDE value for an 11 bit identifier
+#define CAN_ID_EXT (0x1U)   ///< IDE value for a 29 bit identifier
+
+#define CAN_CLASSIC_DLEN (8U)   ///< Payload bytes of a classic frame
+#define CAN_FD_DLEN (64U)       ///< Payload bytes of the largest CAN FD frame
+
+// Frame buffers only grow to CAN FD size in builds with an FD capable controller
+#ifdef BL_CAN_FD
+#define CAN_MAX_DLEN CAN_FD_DLEN
+#else
+#define CAN_MAX_DLEN CAN_CLASSIC_DLEN
+#endif
+
+typedef struct
+{
+  uint16_t StdId; /*!< Specifies the standard identifier. */
+  uint32_t ExtId; /*!< Specifies the extended identifier. */
+  uint32_t IDE; /*!< Specifies the type of identifier for the message that will be transmitted.  */
+  uint32_t DLC; /*!< Specifies the length of the frame that will be transmitted. Codes 9-15 are 12-64 bytes on FD frames. */
+  uint8_t Data[CAN_MAX_DLEN]; /*!< Contains the data to be transmitted. */
+  uint8_t FDF; /*!< CAN FD frame, 0 for classic CAN. Set it wherever a frame is built field by field. */
+  uint8_t BRS; /*!< FD frame with the data phase at the data bit rate */
+} CanMsgTypeDef;
+
+/**
+ * @brief Identifier of a frame regardless of its format. Always inlined, the RAM resident
+ * RX interrupt uses it and an out of line copy at -O0 would live in flash.
+ * 
+ * @param msg CAN frame
+ * @return uint32_t ExtId for extended frames, StdId otherwise
+ */
+static inline __attribute__((always_inline)) uint32_t canMsgId(const CanMsgTypeDef* msg)
+{
+    return msg->IDE == CAN_ID_EXT ? msg->ExtId : msg->StdId;
+}
+
+/**
+ * @brief Payload bytes of a data length code. No lookup table, so a RAM resident interrupt
+ * never reads it from flash.
+ * 
+ * @param dlc Data length code, 0-15
+ * @param fdf Frame is a CAN FD frame
+ * @return uint8_t Bytes, codes above 8 are 8 bytes on classic frames
+ */
+static inline __attribute__((always_inline)) uint8_t canDlcLength(uint32_t dlc, bool fdf)
+{
+    if (dlc <= 8)
+        return dlc;
+    if (!fdf)
+        return 8;
+    return dlc <= 12 ? 12 + 4 * (dlc - 9) : 32 + 16 * (dlc - 13);
+}
+
+/**
+ * @brief Smallest data length code that holds a payload, FD lengths above 8 bytes
+ * 
+ * @param length Payload bytes, up to CAN_FD_DLEN
+ * @return uint32_t Data length code, the frame is padded up to canDlcLength() of it
+ */
+static inline uint32_t canLengthDlc(uint8_t length)
+{
+    uint32_t dlc = length <= 8 ? length : 9;
+
+    while (dlc < 15 && canDlcLength(dlc, true) < length)
+        dlc++;
+    return dlc;
+}
+
+#endif
@@ -0,0 +1,27 @@
+/**
+ * @file can_port.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Transport hooks of one CAN controller. The bootloader only talks to the bus through
+ * these, so the same protocol code runs on classic CAN and CAN FD controllers.
+ * @version 0.1
+ * @date 2021-07-10
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef CAN_PORT_H
+#define CAN_PORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <can_msg.h>
+
+typedef struct {
+    bool (*tx)(CanMsgTypeDef* msg); ///< Load a TX buffer without waiting, false when all are busy
+    void (*rxResume)(void);         ///< Enable the RX interrupt again after it backed off on a full queue
+    uint8_t max_dlen;               ///< Largest payload, CAN_CLASSIC_DLEN or CAN_FD_DLEN
+    bool brs;                       ///< FD frames can switch to the data bit rate
+} can_port_t;
+
+#endif
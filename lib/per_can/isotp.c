@@ -0,0 +1,336 @@
+/**
+ * @file isotp.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief ISO 15765-2 transport (ISO-TP) over classic CAN, normal addressing
+ * 
+ * Messages of up to 7 bytes go out as a single frame. Longer ones start with a first frame holding
+ * the length and 6 bytes, then consecutive frames of 7 bytes with a 4 bit sequence number. The
+ * receiver paces the sender with flow control frames: block size (CFs before the next flow control,
+ * 0 for none) and STmin (minimum gap between CFs).
+ * 
+ * Reception and transmission are independent so a response can be sent while the next request
+ * arrives. Frames are handed to a non-blocking transmit hook, anything that did not fit in a
+ * mailbox is retried by the next @ref isoTpPump. N_As/N_Bs/N_Cr timeouts are left to the caller,
+ * a new first or single frame always replaces a reception in progress.
+ * @version 0.1
+ * @date 2021-05-29
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <isotp.h>
+
+static void initFrame(isotp_t* tp, CanMsgTypeDef* msg)
+{
+    msg->IDE = tp->tx_id > 0x7FF ? CAN_ID_EXT : CAN_ID_STD;
+    msg->ExtId = msg->IDE == CAN_ID_EXT ? tp->tx_id : 0;
+    msg->StdId = msg->IDE == CAN_ID_STD ? tp->tx_id : 0;
+    msg->DLC = 8;
+    msg->FDF = 0;
+    for (int i = 0; i < 8; i++)
+        msg->Data[i] = ISOTP_PAD_BYTE;
+}
+
+/**
+ * @brief Decode a raw STmin value
+ * 
+ * @param st_min 0x00-0x7F milliseconds, 0xF1-0xF9 100-900 microseconds
+ * @return uint32_t Gap in microseconds, reserved values read as the 127 ms maximum
+ */
+uint32_t isoTpStMinUs(uint8_t st_min)
+{
+    if (st_min <= 0x7F)
+        return st_min * 1000U;
+    if (st_min >= 0xF1 && st_min <= 0xF9)
+        return (st_min - 0xF0) * 100U;
+    return 127000U;
+}
+
+/**
+ * @brief Initalize an idle transport
+ * 
+ * @param tp Transport handle
+ * @param rx_id ID of incoming frames
+ * @param tx_id ID of outgoing frames, sent as 29 bit above 0x7FF
+ * @param block_size BS advertised in flow control, 0 for no further flow control
+ * @param st_min STmin advertised in flow control, 0 lets the sender go back to back
+ * @param rx_buf Reassembly buffer
+ * @param rx_size Size of rx_buf, longer messages are refused with an overflow
+ */
+void initIsoTp(isotp_t* tp, uint32_t rx_id, uint32_t tx_id, uint8_t block_size, uint8_t st_min,
+               uint8_t* rx_buf, uint32_t rx_size)
+{
+    tp->rx_id = rx_id;
+    tp->tx_id = tx_id;
+    tp->block_size = block_size;
+    tp->st_min = st_min;
+
+    tp->rx_buf = rx_buf;
+    tp->rx_size = rx_size;
+    tp->rx_length = 0;
+    tp->rx_received = 0;
+    tp->rx_active = false;
+    tp->fc_pending = false;
+
+    tp->tx_state = ISOTP_TX_IDLE;
+    tp->tx_next_us = 0;
+
+    tp->rx_messages = 0;
+    tp->tx_messages = 0;
+    tp->rx_errors = 0;
+    tp->overflows = 0;
+}
+
+static void queueFlowControl(isotp_t* tp, uint8_t status)
+{
+    tp->fc_pending = true;
+    tp->fc_status = status;
+    tp->rx_block_left = tp->block_size;
+}
+
+static void copyIn(isotp_t* tp, const uint8_t* data, uint32_t count)
+{
+    uint32_t left = tp->rx_length - tp->rx_received;
+    if (count > left)
+        count = left;
+    for (uint32_t i = 0; i < count; i++)
+        tp->rx_buf[tp->rx_received + i] = data[i];
+    tp->rx_received += count;
+}
+
+static void rxFlowControl(isotp_t* tp, CanMsgTypeDef* msg, uint64_t now_us)
+{
+    if (tp->tx_state != ISOTP_TX_WAIT_FC || msg->DLC < 3)
+        return;
+
+    switch (msg->Data[0] & 0xF)
+    {
+        case ISOTP_FS_CTS:
+            tp->tx_bs = msg->Data[1];
+            tp->tx_block_left = msg->Data[1];
+            tp->tx_st_min_us = isoTpStMinUs(msg->Data[2]);
+            tp->tx_next_us = now_us;
+            tp->tx_state = ISOTP_TX_SEND;
+            break;
+        case ISOTP_FS_WAIT:
+            break;
+        default:
+            // Overflow or an invalid flow status aborts the message
+            tp->overflows++;
+            tp->tx_state = ISOTP_TX_IDLE;
+            break;
+    }
+}
+
+/**
+ * @brief Handle a frame received on rx_id
+ * 
+ * @param tp Transport handle
+ * @param msg Received frame
+ * @param now_us Current time, used to pace consecutive frames after a flow control
+ * @return true A message is complete, it is in rx_buf with length rx_length
+ * @return false Nothing to hand up yet
+ */
+bool isoTpRxFrame(isotp_t* tp, CanMsgTypeDef* msg, uint64_t now_us)
+{
+    uint8_t pci = msg->Data[0] >> 4;
+
+    if (msg->DLC == 0)
+        return false;
+
+    switch (pci)
+    {
+        case ISOTP_PCI_SF:
+        {
+            uint32_t length = msg->Data[0] & 0xF;
+            if (length == 0 || length > 7 || length + 1 > msg->DLC)
+                return false;
+
+            if (tp->rx_active)
+                tp->rx_errors++;
+            tp->rx_active = false;
+            if (length > tp->rx_size)
+            {
+                tp->overflows++;
+                return false;
+            }
+            tp->rx_length = length;
+            tp->rx_received = 0;
+            copyIn(tp, &msg->Data[1], length);
+            tp->rx_messages++;
+            return true;
+        }
+
+        case ISOTP_PCI_FF:
+        {
+            uint32_t length = ((msg->Data[0] & 0xF) << 8) | msg->Data[1];
+            if (msg->DLC < 8 || length < 8)
+                return false;
+
+            if (tp->rx_active)
+                tp->rx_errors++;
+            tp->rx_active = false;
+            if (length > tp->rx_size)
+            {
+                tp->overflows++;
+                queueFlowControl(tp, ISOTP_FS_OVFLW);
+                return false;
+            }
+            tp->rx_length = length;
+            tp->rx_received = 0;
+            copyIn(tp, &msg->Data[2], 6);
+            tp->rx_sn = 1;
+            tp->rx_active = true;
+            queueFlowControl(tp, ISOTP_FS_CTS);
+            return false;
+        }
+
+        case ISOTP_PCI_CF:
+            if (!tp->rx_active)
+                return false;
+
+            if ((msg->Data[0] & 0xF) != tp->rx_sn)
+            {
+                // Lost or repeated frame, the message can not be completed
+                tp->rx_errors++;
+                tp->rx_active = false;
+                return false;
+            }
+            tp->rx_sn = (tp->rx_sn + 1) & 0xF;
+            copyIn(tp, &msg->Data[1], msg->DLC - 1);
+
+            if (tp->rx_received == tp->rx_length)
+            {
+                tp->rx_active = false;
+                tp->rx_messages++;
+                return true;
+            }
+
+            if (tp->block_size && --tp->rx_block_left == 0)
+                queueFlowControl(tp, ISOTP_FS_CTS);
+            return false;
+
+        case ISOTP_PCI_FC:
+            rxFlowControl(tp, msg, now_us);
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Start sending a message, frames go out from @ref isoTpPump
+ * 
+ * @param tp Transport handle
+ * @param data Message, must stay valid until the send is done
+ * @param length 1 to @ref ISOTP_MAX_LENGTH bytes
+ * @return true Send started
+ * @return false Previous send still in progress or invalid length
+ */
+bool isoTpSend(isotp_t* tp, const uint8_t* data, uint32_t length)
+{
+    if (tp->tx_state != ISOTP_TX_IDLE || length == 0 || length > ISOTP_MAX_LENGTH)
+        return false;
+
+    tp->tx_data = data;
+    tp->tx_length = length;
+    tp->tx_sent = 0;
+    tp->tx_sn = 1;
+    tp->tx_next_us = 0;
+    tp->tx_state = ISOTP_TX_SEND;
+    return true;
+}
+
+/**
+ * @brief Give up the message being sent, frames not handed to tx yet are dropped. The receiver
+ * times out on its own.
+ * 
+ * @param tp Transport handle
+ */
+void isoTpAbort(isotp_t* tp)
+{
+    tp->tx_state = ISOTP_TX_IDLE;
+}
+
+/**
+ * @brief Send a pending flow control and as many frames of the current message as the receiver
+ * and the free mailboxes allow. With a non-zero STmin one CF goes out per call.
+ * 
+ * @param tp Transport handle
+ * @param tx Non-blocking transmit hook
+ * @param now_us Current time
+ * @return uint32_t Frames handed to tx
+ */
+uint32_t isoTpPump(isotp_t* tp, isotp_tx_fn tx, uint64_t now_us)
+{
+    CanMsgTypeDef msg;
+    uint32_t count = 0;
+
+    if (tp->fc_pending)
+    {
+        initFrame(tp, &msg);
+        msg.Data[0] = (ISOTP_PCI_FC << 4) | tp->fc_status;
+        msg.Data[1] = tp->block_size;
+        msg.Data[2] = tp->st_min;
+        if (!tx(&msg))
+            return count;
+        tp->fc_pending = false;
+        count++;
+    }
+
+    while (tp->tx_state == ISOTP_TX_SEND && now_us >= tp->tx_next_us)
+    {
+        uint32_t left = tp->tx_length - tp->tx_sent;
+        uint32_t chunk;
+        initFrame(tp, &msg);
+
+        if (tp->tx_sent == 0 && tp->tx_length <= 7)
+        {
+            msg.Data[0] = (ISOTP_PCI_SF << 4) | tp->tx_length;
+            chunk = tp->tx_length;
+            for (uint32_t i = 0; i < chunk; i++)
+                msg.Data[1 + i] = tp->tx_data[i];
+        }
+        else if (tp->tx_sent == 0)
+        {
+            msg.Data[0] = (ISOTP_PCI_FF << 4) | (tp->tx_length >> 8);
+            msg.Data[1] = tp->tx_length & 0xFF;
+            chunk = 6;
+            for (uint32_t i = 0; i < chunk; i++)
+                msg.Data[2 + i] = tp->tx_data[i];
+        }
+        else
+        {
+            msg.Data[0] = (ISOTP_PCI_CF << 4) | tp->tx_sn;
+            chunk = left < 7 ? left : 7;
+            for (uint32_t i = 0; i < chunk; i++)
+                msg.Data[1 + i] = tp->tx_data[tp->tx_sent + i];
+        }
+
+        if (!tx(&msg))
+            break;
+        count++;
+
+        if (tp->tx_sent > 0)
+        {
+            tp->tx_sn = (tp->tx_sn + 1) & 0xF;
+            tp->tx_next_us = now_us + tp->tx_st_min_us;
+        }
+        bool first = tp->tx_sent == 0;
+        tp->tx_sent += chunk;
+
+        if (tp->tx_sent == tp->tx_length)
+        {
+            tp->tx_state = ISOTP_TX_IDLE;
+            tp->tx_messages++;
+        }
+        else if (first || (tp->tx_bs && --tp->tx_block_left == 0))
+        {
+            tp->tx_state = ISOTP_TX_WAIT_FC;
+        }
+    }
+
+    return count;
+}
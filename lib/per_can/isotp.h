@@ -0,0 +1,86 @@
+/**
+ * @file isotp.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief ISO 15765-2 transport (ISO-TP) over classic CAN, normal addressing
+ * @version 0.1
+ * @date 2021-05-29
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef ISOTP_H
+#define ISOTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <can_msg.h>
+
+#define ISOTP_MAX_LENGTH (4095U)        // 12 bit FF_DL, the 32 bit escape is not supported
+#define ISOTP_PAD_BYTE   (0xCCU)        // Unused bytes of a frame, frames are always sent with DLC 8
+
+// Protocol control information, high nibble of byte 0
+#define ISOTP_PCI_SF (0x0U)             // Single frame
+#define ISOTP_PCI_FF (0x1U)             // First frame
+#define ISOTP_PCI_CF (0x2U)             // Consecutive frame
+#define ISOTP_PCI_FC (0x3U)             // Flow control
+
+// Flow status of a flow control frame
+#define ISOTP_FS_CTS   (0x0U)           // Continue to send
+#define ISOTP_FS_WAIT  (0x1U)
+#define ISOTP_FS_OVFLW (0x2U)           // Message does not fit the receive buffer
+
+/**
+ * @brief Transmit hook, must not block. Return false when no mailbox is free.
+ */
+typedef bool (*isotp_tx_fn)(CanMsgTypeDef* msg);
+
+typedef enum {
+    ISOTP_TX_IDLE    = 0x0U,
+    ISOTP_TX_SEND    = 0x1U,            // Frames may go out
+    ISOTP_TX_WAIT_FC = 0x2U             // First frame or a block sent, waiting for the receiver
+} ISOTPTxState_e;
+
+typedef struct {
+    uint32_t rx_id;             ///< Frames received on this ID
+    uint32_t tx_id;             ///< Frames sent on this ID, 29 bit if above 0x7FF
+    uint8_t block_size;         ///< BS advertised to the sender, 0 lets it send the whole message
+    uint8_t st_min;             ///< STmin advertised to the sender, raw ISO 15765-2 encoding
+
+    // Reception
+    uint8_t* rx_buf;
+    uint32_t rx_size;
+    uint32_t rx_length;         ///< FF_DL of the message being received, or of the last complete one
+    uint32_t rx_received;       ///< Bytes of rx_length already in rx_buf
+    uint8_t rx_sn;              ///< Sequence number expected in the next CF
+    uint8_t rx_block_left;      ///< CFs until the next flow control is due
+    bool rx_active;             ///< Multi frame message in progress
+    bool fc_pending;            ///< Flow control waiting for a free mailbox
+    uint8_t fc_status;
+
+    // Transmission
+    const uint8_t* tx_data;     ///< Caller keeps the message valid until the send is done
+    uint32_t tx_length;
+    uint32_t tx_sent;
+    uint8_t tx_sn;
+    ISOTPTxState_e tx_state;
+    uint8_t tx_bs;              ///< BS from the receiver's last flow control
+    uint8_t tx_block_left;
+    uint32_t tx_st_min_us;      ///< STmin from the receiver's last flow control
+    uint64_t tx_next_us;        ///< Earliest time for the next CF
+
+    uint32_t rx_messages;
+    uint32_t tx_messages;
+    uint32_t rx_errors;         ///< Receptions aborted by a wrong sequence number or an unexpected frame
+    uint32_t overflows;         ///< Receptions refused because the message did not fit, or sends refused by the receiver
+} isotp_t;
+
+void initIsoTp(isotp_t* tp, uint32_t rx_id, uint32_t tx_id, uint8_t block_size, uint8_t st_min,
+               uint8_t* rx_buf, uint32_t rx_size);
+bool isoTpRxFrame(isotp_t* tp, CanMsgTypeDef* msg, uint64_t now_us);
+bool isoTpSend(isotp_t* tp, const uint8_t* data, uint32_t length);
+void isoTpAbort(isotp_t* tp);
+uint32_t isoTpPump(isotp_t* tp, isotp_tx_fn tx, uint64_t now_us);
+uint32_t isoTpStMinUs(uint8_t st_min);
+
+#endif
@@ -0,0 +1,170 @@
+/**
+ * @file aes128.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Compact AES-128 encryption (FIPS-197) and CTR mode (SP 800-38A).
+ * 
+ * CTR only ever runs the forward cipher, so there is no inverse S-box or decryption path.
+ * State is processed in place, column-major, with one 256 byte S-box table. Data is
+ * decrypted in place a whole block at a time, no buffer beyond the current block is needed.
+ * @version 0.1
+ * @date 2021-05-01
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <aes128.h>
+
+static const uint8_t sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static inline uint8_t xtime(uint8_t b)
+{
+    return (uint8_t) ((b << 1) ^ ((b >> 7) * 0x1B));
+}
+
+/**
+ * @brief Expand a 128 bit key into the 11 round keys
+ * 
+ * @param ctx Cipher context
+ * @param key 16 byte key
+ */
+void aes128Init(aes128_ctx_t* ctx, const uint8_t key[AES_KEY_SIZE])
+{
+    uint8_t* w = ctx->round_keys;
+    uint8_t rcon = 1;
+
+    for (int i = 0; i < 16; i++)
+        w[i] = key[i];
+
+    for (int i = 16; i < 176; i += 4)
+    {
+        uint8_t t0 = w[i - 4], t1 = w[i - 3], t2 = w[i - 2], t3 = w[i - 1];
+
+        if (i % 16 == 0)
+        {
+            uint8_t tmp = t0;
+            t0 = sbox[t1] ^ rcon;
+            t1 = sbox[t2];
+            t2 = sbox[t3];
+            t3 = sbox[tmp];
+            rcon = xtime(rcon);
+        }
+
+        w[i]     = w[i - 16] ^ t0;
+        w[i + 1] = w[i - 15] ^ t1;
+        w[i + 2] = w[i - 14] ^ t2;
+        w[i + 3] = w[i - 13] ^ t3;
+    }
+}
+
+/**
+ * @brief Encrypt a single block
+ * 
+ * @param ctx Cipher context
+ * @param in Plaintext block
+ * @param out Ciphertext block, may alias in
+ */
+void aes128EncryptBlock(const aes128_ctx_t* ctx, const uint8_t in[AES_BLOCK_SIZE], uint8_t out[AES_BLOCK_SIZE])
+{
+    const uint8_t* rk = ctx->round_keys;
+    uint8_t s[16];
+    uint8_t t;
+
+    for (int i = 0; i < 16; i++)
+        s[i] = in[i] ^ rk[i];
+
+    for (int round = 1; round <= 10; round++)
+    {
+        // SubBytes
+        for (int i = 0; i < 16; i++)
+            s[i] = sbox[s[i]];
+
+        // ShiftRows, row r rotates left by r columns
+        t = s[1];  s[1]  = s[5];  s[5]  = s[9];  s[9]  = s[13]; s[13] = t;
+        t = s[2];  s[2]  = s[10]; s[10] = t;
+        t = s[6];  s[6]  = s[14]; s[14] = t;
+        t = s[15]; s[15] = s[11]; s[11] = s[7];  s[7]  = s[3];  s[3]  = t;
+
+        // MixColumns, skipped in the final round
+        if (round != 10)
+        {
+            for (int c = 0; c < 16; c += 4)
+            {
+                uint8_t a0 = s[c], a1 = s[c + 1], a2 = s[c + 2], a3 = s[c + 3];
+                uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+                s[c]     = a0 ^ all ^ xtime(a0 ^ a1);
+                s[c + 1] = a1 ^ all ^ xtime(a1 ^ a2);
+                s[c + 2] = a2 ^ all ^ xtime(a2 ^ a3);
+                s[c + 3] = a3 ^ all ^ xtime(a3 ^ a0);
+            }
+        }
+
+        // AddRoundKey
+        rk += 16;
+        for (int i = 0; i < 16; i++)
+            s[i] ^= rk[i];
+    }
+
+    for (int i = 0; i < 16; i++)
+        out[i] = s[i];
+}
+
+/**
+ * @brief Start a CTR stream
+ * 
+ * @param ctr CTR context
+ * @param key 16 byte key
+ * @param iv Initial counter block
+ */
+void aesCtrInit(aes128_ctr_t* ctr, const uint8_t key[AES_KEY_SIZE], const uint8_t iv[AES_BLOCK_SIZE])
+{
+    aes128Init(&ctr->aes, key);
+    for (uint32_t i = 0; i < AES_BLOCK_SIZE; i++)
+        ctr->counter[i] = iv[i];
+}
+
+/**
+ * @brief Encrypt or decrypt data in place. Every call starts on a fresh counter block, so pass
+ * whole blocks except for the final, shorter piece of a stream.
+ * 
+ * @param ctr CTR context
+ * @param data Data to transform in place
+ * @param length Number of bytes
+ */
+void aesCtrCrypt(aes128_ctr_t* ctr, uint8_t* data, uint32_t length)
+{
+    uint8_t stream[AES_BLOCK_SIZE];
+
+    while (length)
+    {
+        uint32_t n = length < AES_BLOCK_SIZE ? length : AES_BLOCK_SIZE;
+
+        aes128EncryptBlock(&ctr->aes, ctr->counter, stream);
+        for (uint32_t i = 0; i < n; i++)
+            data[i] ^= stream[i];
+
+        // 128 bit big endian increment
+        for (int i = AES_BLOCK_SIZE - 1; i >= 0 && ++ctr->counter[i] == 0; i--)
+            ;
+
+        data += n;
+        length -= n;
+    }
+}
@@ -0,0 +1,35 @@
+/**
+ * @file aes128.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Compact AES-128 encryption and CTR mode for decrypting firmware as it is received
+ * @version 0.1
+ * @date 2021-05-01
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef AES128_H
+#define AES128_H
+
+#include <stdint.h>
+
+#define AES_BLOCK_SIZE (16U)
+#define AES_KEY_SIZE   (16U)
+
+typedef struct {
+    uint8_t round_keys[176];            ///< Expanded key, 11 round keys
+} aes128_ctx_t;
+
+typedef struct {
+    aes128_ctx_t aes;
+    uint8_t counter[AES_BLOCK_SIZE];    ///< Next counter block, big endian
+} aes128_ctr_t;
+
+void aes128Init(aes128_ctx_t* ctx, const uint8_t key[AES_KEY_SIZE]);
+void aes128EncryptBlock(const aes128_ctx_t* ctx, const uint8_t in[AES_BLOCK_SIZE], uint8_t out[AES_BLOCK_SIZE]);
+
+void aesCtrInit(aes128_ctr_t* ctr, const uint8_t key[AES_KEY_SIZE], const uint8_t iv[AES_BLOCK_SIZE]);
+void aesCtrCrypt(aes128_ctr_t* ctr, uint8_t* data, uint32_t length);
+
+#endif
@@ -0,0 +1,24 @@
+/**
+ * @file ed25519.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Ed25519 signature verification (RFC 8032). Verify only, signing happens on the host.
+ * @version 0.1
+ * @date 2021-04-24
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef ED25519_H
+#define ED25519_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ED25519_PUBLIC_KEY_SIZE (32U)
+#define ED25519_SIGNATURE_SIZE  (64U)
+
+bool ed25519Verify(const uint8_t signature[ED25519_SIGNATURE_SIZE], const uint8_t* msg, uint32_t length,
+                   const uint8_t public_key[ED25519_PUBLIC_KEY_SIZE]);
+
+#endif
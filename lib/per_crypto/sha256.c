@@ -0,0 +1,146 @@
+/**
+ * @file sha256.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Incremental SHA-256 (FIPS 180-4). Data can be fed in any chunk size, a block is
+ * compressed as soon as it is complete so the cost is spread over the transfer.
+ * @version 0.1
+ * @date 2021-04-24
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <sha256.h>
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * @brief Compress one 64 byte block into the hash state
+ * 
+ * @param state Hash state
+ * @param block Message block
+ */
+static void sha256Block(uint32_t state[8], const uint8_t* block)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+
+    for (int i = 0; i < 16; i++)
+        w[i] = ((uint32_t) block[4 * i] << 24) | ((uint32_t) block[4 * i + 1] << 16) |
+               ((uint32_t) block[4 * i + 2] << 8) | block[4 * i + 3];
+
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/**
+ * @brief Start a new hash
+ * 
+ * @param ctx Hash context
+ */
+void sha256Init(sha256_ctx_t* ctx)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    for (int i = 0; i < 8; i++)
+        ctx->state[i] = iv[i];
+    ctx->length = 0;
+    ctx->fill = 0;
+}
+
+/**
+ * @brief Add data to the hash
+ * 
+ * @param ctx Hash context
+ * @param data Bytes to hash
+ * @param length Number of bytes
+ */
+void sha256Update(sha256_ctx_t* ctx, const uint8_t* data, uint32_t length)
+{
+    ctx->length += length;
+
+    while (length)
+    {
+        // Whole blocks straight from the input when nothing is buffered
+        if (ctx->fill == 0 && length >= SHA256_BLOCK_SIZE)
+        {
+            sha256Block(ctx->state, data);
+            data += SHA256_BLOCK_SIZE;
+            length -= SHA256_BLOCK_SIZE;
+            continue;
+        }
+
+        ctx->block[ctx->fill++] = *data++;
+        length--;
+
+        if (ctx->fill == SHA256_BLOCK_SIZE)
+        {
+            sha256Block(ctx->state, ctx->block);
+            ctx->fill = 0;
+        }
+    }
+}
+
+/**
+ * @brief Pad the message and produce the digest
+ * 
+ * @param ctx Hash context, must be re-initalized before reuse
+ * @param digest 32 byte digest output
+ */
+void sha256Final(sha256_ctx_t* ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bits = ctx->length * 8;
+
+    ctx->block[ctx->fill++] = 0x80;
+    if (ctx->fill > SHA256_BLOCK_SIZE - 8)
+    {
+        while (ctx->fill < SHA256_BLOCK_SIZE)
+            ctx->block[ctx->fill++] = 0;
+        sha256Block(ctx->state, ctx->block);
+        ctx->fill = 0;
+    }
+    while (ctx->fill < SHA256_BLOCK_SIZE - 8)
+        ctx->block[ctx->fill++] = 0;
+    for (int i = 0; i < 8; i++)
+        ctx->block[SHA256_BLOCK_SIZE - 1 - i] = (bits >> (8 * i)) & 0xFF;
+    sha256Block(ctx->state, ctx->block);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i]     = ctx->state[i] >> 24;
+        digest[4 * i + 1] = ctx->state[i] >> 16;
+        digest[4 * i + 2] = ctx->state[i] >> 8;
+        digest[4 * i + 3] = ctx->state[i];
+    }
+}
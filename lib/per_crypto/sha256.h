@@ -0,0 +1,31 @@
+/**
+ * @file sha256.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Incremental SHA-256 (FIPS 180-4)
+ * @version 0.1
+ * @date 2021-04-24
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+
+#define SHA256_BLOCK_SIZE  (64U)
+#define SHA256_DIGEST_SIZE (32U)
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;                    ///< Bytes hashed so far
+    uint8_t block[SHA256_BLOCK_SIZE];   ///< Partial block waiting for more data
+    uint32_t fill;                      ///< Bytes in block
+} sha256_ctx_t;
+
+void sha256Init(sha256_ctx_t* ctx);
+void sha256Update(sha256_ctx_t* ctx, const uint8_t* data, uint32_t length);
+void sha256Final(sha256_ctx_t* ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif
@@ -0,0 +1,31 @@
+/**
+ * @file sha512.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Incremental SHA-512 (FIPS 180-4), needed by Ed25519 verification
+ * @version 0.1
+ * @date 2021-04-24
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef SHA512_H
+#define SHA512_H
+
+#include <stdint.h>
+
+#define SHA512_BLOCK_SIZE  (128U)
+#define SHA512_DIGEST_SIZE (64U)
+
+typedef struct {
+    uint64_t state[8];
+    uint64_t length;                    ///< Bytes hashed so far
+    uint8_t block[SHA512_BLOCK_SIZE];   ///< Partial block waiting for more data
+    uint32_t fill;                      ///< Bytes in block
+} sha512_ctx_t;
+
+void sha512Init(sha512_ctx_t* ctx);
+void sha512Update(sha512_ctx_t* ctx, const uint8_t* data, uint32_t length);
+void sha512Final(sha512_ctx_t* ctx, uint8_t digest[SHA512_DIGEST_SIZE]);
+
+#endif
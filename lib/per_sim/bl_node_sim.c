@@ -0,0 +1,276 @@
+/**
+ * @file bl_node_sim.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief The bootloader node of lib/bl_core on a simulated bus
+ *
+ * The hooks of bl_node_hw_t carry no context, they work on `current`, the simulated node running
+ * an event. Programming only clears bits like NOR flash, so a word written without an erase reads
+ * back wrong. Erase times are the typical ones of the F429 datasheet at x32 parallelism.
+ * @version 0.1
+ * @date 2021-07-17
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <bl_node_sim.h>
+#include <sim_tester.h>
+#include <string.h>
+
+#define SIM_CYCLES_PER_US (16U)     // HSI, as in env:disco_f429zi
+
+static const uint32_t f4Sectors[] = {
+    0x4000U, 0x4000U, 0x4000U, 0x4000U, 0x10000U,
+    0x20000U, 0x20000U, 0x20000U, 0x20000U, 0x20000U, 0x20000U, 0x20000U
+};
+
+static bl_node_sim_t* current;
+
+static uint8_t* flashAt(uint32_t address)
+{
+    return current->flash + (address - BL_NODE_SIM_FLASH_ADDRESS);
+}
+
+static void simProgram(uint32_t address, uint32_t value)
+{
+    uint32_t word;
+
+    memcpy(&word, flashAt(address), 4);
+    word &= value;
+    memcpy(flashAt(address), &word, 4);
+
+    current->programs++;
+    current->cost_ns += current->cfg.program_ns;
+}
+
+/**
+ * @brief Erase time grows slower than the sector size
+ */
+static uint32_t eraseNs(uint32_t bytes)
+{
+    if (bytes <= 0x4000U)
+        return 250000000U;
+    if (bytes <= 0x10000U)
+        return 550000000U;
+    return 1000000000U;
+}
+
+static void simErase(uint8_t sector)
+{
+    uint32_t base = BL_NODE_SIM_FLASH_ADDRESS;
+
+    if (sector >= current->sectors)
+        return;
+    for (uint8_t i = 0; i < sector; i++)
+        base += current->sector_bytes[i];
+
+    memset(flashAt(base), 0xFF, current->sector_bytes[sector]);
+    current->erases++;
+    current->cost_ns += eraseNs(current->sector_bytes[sector]);
+}
+
+/**
+ * @brief DWT cycle counter. Only polling loops read it, every read stands for a microsecond of polling.
+ */
+static uint32_t simCycles(void)
+{
+    current->cycles += SIM_CYCLES_PER_US;
+    current->cost_ns += 1000;
+    return current->cycles;
+}
+
+static bool portTx(CanMsgTypeDef* msg)
+{
+    return canSimTransmit(&current->rx.node, msg, current->rx.cpu_free_ns + current->cost_ns);
+}
+
+static void portResume(void)
+{
+    blRxSimResume(&current->rx);
+    current->cost_ns += current->cfg.frame_ns;
+}
+
+/**
+ * @brief SysTick one shot, counted from the end of the running event's work so far
+ */
+static void simTimer(uint32_t us)
+{
+    if (us)
+        blRxSimTimer(&current->rx, current->rx.cpu_free_ns + current->cost_ns + (uint64_t) us * 1000);
+    else
+        blRxSimTimerStop(&current->rx);
+}
+
+/**
+ * @brief Run one event of the node on its own CRC unit, every word fed to the unit costs `crc_word_ns`
+ */
+static uint32_t runEvent(bl_rx_sim_t* rx, uint32_t* blocking_ns)
+{
+    current = (bl_node_sim_t*) rx->ctx;
+    current->cost_ns = 0;
+
+    uint32_t words = current->crc.words;
+    simCRCUnitSelect(&current->crc);
+    schedRunOne(&current->sched);
+    current->cost_ns += (current->crc.words - words) * current->cfg.crc_word_ns;
+    return current->cost_ns;
+}
+
+static void journalProgram(volatile uint32_t* address, uint32_t value)
+{
+    simProgram(BL_NODE_SIM_FLASH_ADDRESS + ((uint8_t*) address - current->flash), value);
+}
+
+static void journalErase(volatile uint32_t* sector)
+{
+    uint32_t address = BL_NODE_SIM_FLASH_ADDRESS + ((uint8_t*) sector - current->flash);
+    uint32_t base = BL_NODE_SIM_FLASH_ADDRESS;
+
+    for (uint8_t i = 0; i < current->sectors; i++)
+    {
+        if (base == address)
+            simErase(i);
+        base += current->sector_bytes[i];
+    }
+}
+
+/**
+ * @brief Append records until the next one has to compact the journal
+ *
+ * @return uint32_t Records appended
+ */
+static uint32_t appendUntilCompaction(uint32_t limit)
+{
+    bl_journal_t j;
+    bl_boot_meta_t meta = {.app_start = BL_NODE_SIM_APP_ADDRESS};
+    uint32_t records = 0;
+
+    initJournal(&j, (volatile uint32_t*) flashAt(BL_NODE_SIM_SHARED_ADDRESS),
+                (volatile uint32_t*) flashAt(BL_NODE_SIM_SHARED_ADDRESS + f4Sectors[1]),
+                f4Sectors[1], journalProgram, journalErase);
+    journalMount(&j);
+
+    while (records < limit && j.erases == 0)
+    {
+        meta.spare[0] = records + 1;
+        journalAppend(&j, &meta);
+        records++;
+    }
+    return records;
+}
+
+/**
+ * @brief Leave the journal one record short of a compaction, the worst case for the next append
+ */
+static void fillJournal(bl_node_sim_t* sim)
+{
+    uint32_t records = appendUntilCompaction(UINT32_MAX);
+
+    memset(flashAt(BL_NODE_SIM_SHARED_ADDRESS), 0xFF, 2 * f4Sectors[1]);
+    appendUntilCompaction(records - 1);
+}
+
+/**
+ * @brief Attach a bootloader node to the bus
+ *
+ * @param sim Simulated node
+ * @param bus Bus the node listens on
+ * @param cfg Receive path, identity and costs, copied
+ * @param flash Bank of `flash_bytes`, erased here. Whole F4 sectors are used, the
+ * application gets everything above the bootloader and the journal.
+ * @param flash_bytes Size of the bank
+ */
+void initBLNodeSim(bl_node_sim_t* sim, can_sim_bus_t* bus, const bl_node_sim_cfg_t* cfg, uint8_t* flash, uint32_t flash_bytes)
+{
+    bl_rx_sim_cfg_t rx_cfg = cfg->rx;
+    bl_node_cfg_t node_cfg = {0};
+    uint32_t end = 0;
+
+    current = sim;
+    sim->cfg = *cfg;
+    sim->flash = flash;
+    sim->sectors = 0;
+    for (uint8_t i = 0; i < sizeof(f4Sectors) / sizeof(f4Sectors[0]) && end + f4Sectors[i] <= flash_bytes; i++)
+    {
+        sim->sector_bytes[sim->sectors++] = f4Sectors[i];
+        end += f4Sectors[i];
+    }
+    sim->flash_bytes = end;
+    memset(flash, 0xFF, flash_bytes);
+
+    sim->crc.dr = 0xFFFFFFFF;
+    sim->cycles = 0;
+    sim->cost_ns = 0;
+
+    if (cfg->journal_full)
+        fillJournal(sim);
+    sim->programs = 0;
+    sim->erases = 0;
+    sim->crc.words = 0;
+    sim->crc.resets = 0;
+
+    rx_cfg.rx_event = EV_RX_READY;
+    rx_cfg.tx_event = EV_TX_FREE;
+    rx_cfg.timer_event = EV_TIMER;
+    initBLRxSimEvents(&sim->rx, bus, &rx_cfg, &sim->sched, runEvent, sim);
+
+    sim->port.tx = portTx;
+    sim->port.rxResume = portResume;
+    sim->port.max_dlen = cfg->max_dlen ? cfg->max_dlen : CAN_CLASSIC_DLEN;
+    sim->port.brs = cfg->brs;
+
+    sim->hw.port = &sim->port;
+    sim->hw.program = simProgram;
+    sim->hw.erase = simErase;
+    sim->hw.crc = &simCRCUnitHw;       // Fed by the CPU, a DMA transfer would need a completion event
+    sim->hw.crcOff = 0;
+    sim->hw.cycles = simCycles;
+    sim->hw.timer = simTimer;
+
+    node_cfg.ecu_id = cfg->ecu_id;
+    node_cfg.tx_id = BL_TX_MESSAGE_ID;
+    node_cfg.status_id = BL_STATUS_MESSAGE_ID | cfg->ecu_id;
+    node_cfg.flash = flash;
+    node_cfg.flash_address = BL_NODE_SIM_FLASH_ADDRESS;
+    node_cfg.sector_bytes = sim->sector_bytes;
+    node_cfg.sectors = sim->sectors;
+    node_cfg.shared_address = BL_NODE_SIM_SHARED_ADDRESS;
+    node_cfg.shared_sector_bytes = f4Sectors[1];
+    node_cfg.app_address = BL_NODE_SIM_APP_ADDRESS;
+    node_cfg.app_length = end - (BL_NODE_SIM_APP_ADDRESS - BL_NODE_SIM_FLASH_ADDRESS);
+    node_cfg.handoff = 0;
+#ifdef BL_UDS
+    node_cfg.uds_block_length = cfg->uds_block_length;
+    node_cfg.uds_bs = cfg->uds_bs;
+    node_cfg.uds_stmin = cfg->uds_stmin;
+#endif
+#ifdef BL_SIGNED_IMAGES
+    node_cfg.public_key = cfg->public_key;
+#endif
+
+    initNode(&sim->node, &node_cfg, &sim->hw, &sim->sched, &sim->rx.q);
+}
+
+/**
+ * @brief Reset the node like a power cycle. Flash and the boot metadata journal are kept,
+ * frames still queued are not.
+ */
+void blNodeSimReboot(bl_node_sim_t* sim)
+{
+    bl_node_cfg_t node_cfg = sim->node.cfg;
+    CanMsgTypeDef msg;
+
+    current = sim;
+    while (rbDequeue(&sim->rx.q, &msg))
+        ;
+    blRxSimTimerStop(&sim->rx);
+    initNode(&sim->node, &node_cfg, &sim->hw, &sim->sched, &sim->rx.q);
+}
+
+/**
+ * @brief Application flash of the node
+ */
+uint8_t* blNodeSimApp(bl_node_sim_t* sim)
+{
+    return sim->flash + (BL_NODE_SIM_APP_ADDRESS - BL_NODE_SIM_FLASH_ADDRESS);
+}
@@ -0,0 +1,74 @@
+/**
+ * @file bl_node_sim.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief The bootloader node of lib/bl_core on a simulated bus. The node runs behind the
+ * receive model in event mode, on an in-memory flash bank with the F4 sector layout.
+ * Flash operations and CRC words are charged to the event running them.
+ * @version 0.1
+ * @date 2021-07-17
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef BL_NODE_SIM_H
+#define BL_NODE_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <bl_node.h>
+#include <bl_rx_sim.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+
+#define BL_NODE_SIM_FLASH_ADDRESS  (0x08000000U)
+#define BL_NODE_SIM_SHARED_ADDRESS (0x08004000U)    // Sectors 1 and 2, as in stm32f429i.ld
+#define BL_NODE_SIM_APP_ADDRESS    (0x0800C000U)
+
+typedef struct {
+    bl_rx_sim_cfg_t rx;         ///< Receive path, the events are set by initBLNodeSim()
+    uint8_t ecu_id;
+    uint8_t max_dlen;           ///< Largest payload of the CAN controller
+    bool brs;                   ///< Controller can switch bit rate
+    uint32_t frame_ns;          ///< Dequeue, decode and FSM lookup of one frame
+    uint32_t program_ns;        ///< One word program
+    uint32_t crc_word_ns;       ///< One word fed to the CRC unit
+    bool journal_full;          ///< Next journal append compacts and erases a sector
+#ifdef BL_UDS
+    uint32_t uds_block_length;
+    uint8_t uds_bs;
+    uint8_t uds_stmin;
+#endif
+#ifdef BL_SIGNED_IMAGES
+    const uint8_t* public_key;
+#endif
+} bl_node_sim_cfg_t;
+
+typedef struct bl_node_sim bl_node_sim_t;
+
+struct bl_node_sim {
+    bl_rx_sim_t rx;
+    ev_sched_t sched;
+    bl_node_t node;
+    bl_node_sim_cfg_t cfg;
+    can_port_t port;
+    bl_node_hw_t hw;
+
+    uint8_t* flash;             ///< Bank starting at BL_NODE_SIM_FLASH_ADDRESS
+    uint32_t flash_bytes;
+    uint32_t sector_bytes[BL_NODE_MAX_SECTORS];
+    uint8_t sectors;
+
+    sim_crc_unit_t crc;         ///< CRC unit of the node
+    uint32_t cost_ns;           ///< Main loop time of the running event
+    uint32_t cycles;            ///< Cycle counter, advanced by every read
+
+    uint32_t programs;
+    uint32_t erases;
+};
+
+void initBLNodeSim(bl_node_sim_t* sim, can_sim_bus_t* bus, const bl_node_sim_cfg_t* cfg, uint8_t* flash, uint32_t flash_bytes);
+void blNodeSimReboot(bl_node_sim_t* sim);
+uint8_t* blNodeSimApp(bl_node_sim_t* sim);
+
+#endif
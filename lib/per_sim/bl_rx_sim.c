@@ -0,0 +1,377 @@
+/**
+ * @file bl_rx_sim.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Timing model of the bootloader receive path: the three deep bxCAN FIFO0,
+ * CAN1_RX0_IRQHandler, rx_message_q and the bootloaderMain loop that drains it.
+ * 
+ * Every frame on the bus lands in FIFO0 (filter bank 0 accepts everything). The ISR moves it to
+ * the queue, optionally dropping foreign IDs first. When the queue is full the ISR masks itself and
+ * frames pile up in FIFO0 until the main loop frees an entry, a fourth frame overruns the FIFO and
+ * is lost. The main loop handles one frame at a time, a handler reports how long that took and how
+ * much of it also held off interrupts (flash programming stalls fetches from flash).
+ * 
+ * By default the main loop works like the event scheduler and keeps handling frames until the
+ * queue is empty. With wfi_each_frame it works like the old super loop, which handled one frame and
+ * then slept in wfi. Only an interrupt taken while it sleeps wakes it: an RX interrupt, which every
+ * frame on the bus causes unless the ISR is masked or held off, or a TX mailbox of the target
+ * freeing up. Interrupts taken while the loop runs do not end the next wfi.
+ * 
+ * In event mode the main loop is bootloaderMain(): the ISR posts an event for every queued frame,
+ * a freed TX mailbox posts another, and the loop runs the handlers of the scheduler until none is
+ * pending. The handlers take frames from the queue themselves. With wfi_each_frame a wakeup ends
+ * once a frame was taken and only events behind the frame event are left. A one shot timer
+ * posts its event once the loop gets to its expiry, or right away when the loop is idle.
+ * @version 0.1
+ * @date 2021-05-08
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bl_rx_sim.h>
+
+static void popFifo(bl_rx_sim_t* sim)
+{
+    for (uint32_t i = 1; i < sim->fifo_count; i++)
+    {
+        sim->fifo[i - 1] = sim->fifo[i];
+        sim->fifo_ns[i - 1] = sim->fifo_ns[i];
+    }
+    sim->fifo_count--;
+}
+
+/**
+ * @brief Frame addressed to this target, with ecu_filter the BL_RxECUID has to match too
+ */
+static bool addressed(bl_rx_sim_t* sim, CanMsgTypeDef* msg)
+{
+    if (canMsgId(msg) != sim->cfg.accept_id)
+        return false;
+    return !sim->cfg.ecu_filter || (msg->Data[0] >> 4) == sim->cfg.ecu_id;
+}
+
+/**
+ * @brief Run the RX interrupt until FIFO0 is empty or the queue is full
+ * 
+ * @param sim Receive model
+ * @param t Time the interrupt is entered
+ */
+static void runISR(bl_rx_sim_t* sim, uint64_t t)
+{
+    while (sim->fifo_count && !sim->isr_masked)
+    {
+        // Interrupt time is stolen from the main loop
+        if (sim->cpu_free_ns < t)
+            sim->cpu_free_ns = t;
+        sim->cpu_free_ns += sim->cfg.isr_ns;
+        t += sim->cfg.isr_ns;
+
+        if (t - sim->fifo_ns[0] > sim->max_latency_ns)
+            sim->max_latency_ns = t - sim->fifo_ns[0];
+
+        if (sim->cfg.id_filter && !addressed(sim, &sim->fifo[0]))
+        {
+            sim->filtered++;
+            popFifo(sim);
+            continue;
+        }
+
+        if (!rbEnqueue(&sim->q, &sim->fifo[0]))
+        {
+            sim->isr_masked = true;
+            sim->stalls++;
+            sim->stall_start_ns = t;
+            break;
+        }
+
+        popFifo(sim);
+        if (sim->q._size > sim->high_water)
+            sim->high_water = sim->q._size;
+        if (sim->sched)
+            schedPost(sim->sched, sim->cfg.rx_event);
+    }
+}
+
+/**
+ * @brief Interrupt at time t, ends wfi if the loop was asleep
+ */
+static void wakeUp(bl_rx_sim_t* sim, uint64_t t)
+{
+    if (!sim->wake && t >= sim->cpu_free_ns)
+    {
+        sim->wake = true;
+        sim->wake_ns = t;
+    }
+}
+
+/**
+ * @brief Event mode: an event that runs before the frame event is pending
+ */
+static bool aheadOfFrames(bl_rx_sim_t* sim)
+{
+    for (uint8_t i = 0; i < sim->cfg.rx_event; i++)
+    {
+        if (sim->sched->pending[i])
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Event mode of blRxSimRun(), runs every event it can start before `until_ns`
+ */
+static void runEvents(bl_rx_sim_t* sim, uint64_t until_ns)
+{
+    uint32_t blocking_ns;
+
+    while (1)
+    {
+        if (sim->fifo_count && !sim->isr_masked && sim->block_end_ns <= until_ns)
+            runISR(sim, sim->block_end_ns);
+
+        // Expired while an event ran, or the loop sleeps until it expires
+        if (sim->timer_armed && sim->timer_ns <= until_ns &&
+            (sim->timer_ns <= sim->cpu_free_ns || !schedPending(sim->sched)))
+        {
+            sim->timer_armed = false;
+            if (!schedPending(sim->sched) && sim->cpu_free_ns < sim->timer_ns)
+                sim->cpu_free_ns = sim->timer_ns;
+            wakeUp(sim, sim->timer_ns);
+            schedPost(sim->sched, sim->cfg.timer_event);
+        }
+
+        if (sim->cfg.wfi_each_frame)
+        {
+            // The pass ends with one frame handled, or with nothing left to run
+            if (sim->awake && (!schedPending(sim->sched) || (sim->processed != sim->wake_processed && !aheadOfFrames(sim))))
+            {
+                if (!isRBQueueEmpty(&sim->q))
+                    sim->queued_sleeps++;
+                sim->awake = false;
+            }
+
+            if (!sim->awake)
+            {
+                if (!sim->wake || sim->wake_ns > until_ns || sim->cpu_free_ns > until_ns)
+                    break;
+                sim->wake = false;
+                if (sim->cpu_free_ns < sim->wake_ns)
+                    sim->cpu_free_ns = sim->wake_ns;
+                sim->awake = true;
+                sim->wake_processed = sim->processed;
+                continue;
+            }
+
+            if (sim->cpu_free_ns > until_ns)
+                break;
+        }
+        else if (!schedPending(sim->sched) || sim->cpu_free_ns > until_ns)
+            break;
+
+        // Taking a frame may run the ISR and move cpu_free_ns, the event time goes on top
+        blocking_ns = 0;
+        uint32_t cost = sim->step(sim, &blocking_ns);
+        sim->cpu_free_ns += cost;
+        sim->block_start_ns = sim->cpu_free_ns - blocking_ns;
+        sim->block_end_ns = sim->cpu_free_ns;
+    }
+}
+
+/**
+ * @brief Advance the main loop, handling every queued frame it can start before `until_ns`.
+ * Call with UINT64_MAX once the bus is idle to drain the queue.
+ * 
+ * @param sim Receive model
+ * @param until_ns Current bus time
+ */
+void blRxSimRun(bl_rx_sim_t* sim, uint64_t until_ns)
+{
+    CanMsgTypeDef msg;
+    uint32_t blocking_ns;
+
+    if (sim->sched)
+    {
+        runEvents(sim, until_ns);
+        return;
+    }
+
+    while (1)
+    {
+        // Frames that arrived while interrupts were held off are picked up when the block ends
+        if (sim->fifo_count && !sim->isr_masked && sim->block_end_ns <= until_ns)
+            runISR(sim, sim->block_end_ns);
+
+        if (sim->cfg.wfi_each_frame)
+        {
+            // One pass of the loop per wakeup, frames left in the queue wait for the next interrupt
+            if (!sim->wake || sim->wake_ns > until_ns || sim->cpu_free_ns > until_ns)
+                break;
+            sim->wake = false;
+            if (sim->cpu_free_ns < sim->wake_ns)
+                sim->cpu_free_ns = sim->wake_ns;
+            if (isRBQueueEmpty(&sim->q))
+                continue;
+        }
+        else if (isRBQueueEmpty(&sim->q) || sim->cpu_free_ns > until_ns)
+            break;
+
+        uint64_t start = sim->cpu_free_ns;
+        rbDequeue(&sim->q, &msg);
+        sim->processed++;
+
+        if (sim->isr_masked)
+        {
+            // Dequeue made room, the interrupt is enabled again and drains FIFO0
+            sim->isr_masked = false;
+            sim->stall_ns += start - sim->stall_start_ns;
+            runISR(sim, start);
+            start = sim->cpu_free_ns;
+        }
+
+        blocking_ns = 0;
+        sim->cpu_free_ns = start + sim->handler(sim, &msg, &blocking_ns);
+        sim->block_start_ns = sim->cpu_free_ns - blocking_ns;
+        sim->block_end_ns = sim->cpu_free_ns;
+
+        if (sim->cfg.wfi_each_frame && !isRBQueueEmpty(&sim->q))
+            sim->queued_sleeps++;
+    }
+}
+
+static void rxFrame(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t now_ns)
+{
+    bl_rx_sim_t* sim = (bl_rx_sim_t*) node->ctx;
+
+    blRxSimRun(sim, now_ns);
+    sim->received++;
+
+    if (sim->fifo_count == BL_RX_SIM_HW_FIFO)
+    {
+        sim->overruns++;
+        if (addressed(sim, msg))
+            sim->accept_overruns++;
+        return;
+    }
+
+    sim->fifo_ns[sim->fifo_count] = now_ns;
+    sim->fifo[sim->fifo_count++] = *msg;
+
+    bool blocked = now_ns >= sim->block_start_ns && now_ns < sim->block_end_ns;
+    if (!sim->isr_masked && !blocked)
+    {
+        wakeUp(sim, now_ns);
+        runISR(sim, now_ns);
+    }
+}
+
+static void txDone(can_sim_node_t* node, uint64_t now_ns)
+{
+    bl_rx_sim_t* sim = (bl_rx_sim_t*) node->ctx;
+
+    blRxSimRun(sim, now_ns);
+    wakeUp(sim, now_ns);
+    if (sim->sched)
+        schedPost(sim->sched, sim->cfg.tx_event);
+}
+
+/**
+ * @brief Event mode: the main loop took a frame from the queue. An ISR that backed off on
+ * the full queue is enabled again and drains FIFO0 right away.
+ * 
+ * @param sim Receive model
+ */
+void blRxSimResume(bl_rx_sim_t* sim)
+{
+    sim->processed++;
+
+    if (sim->isr_masked)
+    {
+        sim->isr_masked = false;
+        sim->stall_ns += sim->cpu_free_ns - sim->stall_start_ns;
+        runISR(sim, sim->cpu_free_ns);
+    }
+}
+
+/**
+ * @brief Event mode: start the one shot timer, a running one starts over
+ * 
+ * @param sim Receive model
+ * @param at_ns Expiry, cfg.timer_event is posted then
+ */
+void blRxSimTimer(bl_rx_sim_t* sim, uint64_t at_ns)
+{
+    sim->timer_armed = true;
+    sim->timer_ns = at_ns;
+}
+
+/**
+ * @brief Event mode: stop the timer without posting
+ */
+void blRxSimTimerStop(bl_rx_sim_t* sim)
+{
+    sim->timer_armed = false;
+}
+
+/**
+ * @brief Attach a receive model to the bus
+ * 
+ * @param sim Receive model
+ * @param bus Bus the target listens on
+ * @param cfg Queue depth, ISR cost and filtering, copied
+ * @param handler Main loop work per dequeued frame
+ * @param ctx User data for the handler
+ */
+void initBLRxSim(bl_rx_sim_t* sim, can_sim_bus_t* bus, const bl_rx_sim_cfg_t* cfg, bl_rx_sim_handler_fn handler, void* ctx)
+{
+    uint32_t depth = cfg->queue_depth > BL_RX_SIM_MAX_QUEUE ? BL_RX_SIM_MAX_QUEUE : cfg->queue_depth;
+
+    sim->cfg = *cfg;
+    sim->handler = handler;
+    sim->sched = 0;
+    sim->step = 0;
+    sim->ctx = ctx;
+    initRBQueue(&sim->q, (uint8_t*) sim->q_array, depth, sizeof(CanMsgTypeDef));
+
+    sim->fifo_count = 0;
+    sim->isr_masked = false;
+    sim->cpu_free_ns = 0;
+    sim->block_start_ns = 0;
+    sim->block_end_ns = 0;
+    sim->wake = false;
+    sim->wake_ns = 0;
+    sim->awake = false;
+    sim->wake_processed = 0;
+    sim->timer_armed = false;
+    sim->timer_ns = 0;
+
+    sim->received = 0;
+    sim->filtered = 0;
+    sim->overruns = 0;
+    sim->accept_overruns = 0;
+    sim->processed = 0;
+    sim->high_water = 0;
+    sim->stalls = 0;
+    sim->stall_ns = 0;
+    sim->max_latency_ns = 0;
+    sim->queued_sleeps = 0;
+
+    canSimAttach(bus, &sim->node, rxFrame, txDone, sim);
+}
+
+/**
+ * @brief Attach a receive model in event mode to the bus
+ * 
+ * @param sim Receive model
+ * @param bus Bus the target listens on
+ * @param cfg Queue depth, ISR cost, filtering and the events to post, copied
+ * @param sched Scheduler of the target, the ISR and TX mailboxes post to it
+ * @param step Runs the next pending event
+ * @param ctx User data for step
+ */
+void initBLRxSimEvents(bl_rx_sim_t* sim, can_sim_bus_t* bus, const bl_rx_sim_cfg_t* cfg, ev_sched_t* sched,
+                       bl_rx_sim_event_fn step, void* ctx)
+{
+    initBLRxSim(sim, bus, cfg, 0, ctx);
+    sim->sched = sched;
+    sim->step = step;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file bl_rx_sim.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Timing model of the bootloader receive path: the three deep bxCAN FIFO0,
+ * CAN1_RX0_IRQHandler, rx_message_q and the bootloaderMain loop that drains it.
+ * @version 0.1
+ * @date 2021-05-08
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BL_RX_SIM_H
+#define BL_RX_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <rb_queue.h>
+#include <ev_sched.h>
+#include <can_sim.h>
+
+#define BL_RX_SIM_HW_FIFO    (3U)     // bxCAN receive FIFO depth
+#define BL_RX_SIM_MAX_QUEUE  (64U)
+
+typedef struct bl_rx_sim bl_rx_sim_t;
+
+/**
+ * @brief Main loop work for one dequeued frame
+ * 
+ * @param sim Receive model
+ * @param msg Frame taken from the queue
+ * @param blocking_ns Set to the trailing part of the work that also holds off interrupts,
+ * such as a flash program operation stalling instruction fetch
+ * @return uint32_t Total main loop time for the frame in ns
+ */
+typedef uint32_t (*bl_rx_sim_handler_fn)(bl_rx_sim_t* sim, CanMsgTypeDef* msg, uint32_t* blocking_ns);
+
+/**
+ * @brief Event mode: run the next pending event of the scheduler. Handlers take frames from the
+ * queue themselves and call blRxSimResume() for each.
+ * 
+ * @param sim Receive model
+ * @param blocking_ns Same as for bl_rx_sim_handler_fn
+ * @return uint32_t Main loop time of the event in ns
+ */
+typedef uint32_t (*bl_rx_sim_event_fn)(bl_rx_sim_t* sim, uint32_t* blocking_ns);
+
+typedef struct {
+    uint32_t queue_depth;       ///< rx_message_q entries, up to BL_RX_SIM_MAX_QUEUE
+    uint32_t isr_ns;            ///< Cost of one RX interrupt
+    bool id_filter;             ///< ISR drops frames not sent to accept_id instead of queueing them
+    uint32_t accept_id;
+    bool ecu_filter;            ///< ISR also drops accept_id frames whose BL_RxECUID is not ecu_id
+    uint8_t ecu_id;
+    bool wfi_each_frame;        ///< Super loop before the event scheduler: one frame per wakeup, then wfi even with frames queued
+    uint8_t rx_event;           ///< Event mode: posted by the ISR for every queued frame
+    uint8_t tx_event;           ///< Event mode: posted when a TX mailbox frees up
+    uint8_t timer_event;        ///< Event mode: posted when the timer of blRxSimTimer() expires
+} bl_rx_sim_cfg_t;
+
+struct bl_rx_sim {
+    can_sim_node_t node;
+    bl_rx_sim_cfg_t cfg;
+    bl_rx_sim_handler_fn handler;
+    ev_sched_t* sched;          ///< Event mode when set, step runs the events
+    bl_rx_sim_event_fn step;
+    void* ctx;
+
+    CanMsgTypeDef fifo[BL_RX_SIM_HW_FIFO];
+    uint64_t fifo_ns[BL_RX_SIM_HW_FIFO];    ///< Arrival time of each FIFO0 entry
+    uint32_t fifo_count;
+    rb_queue_t q;
+    CanMsgTypeDef q_array[BL_RX_SIM_MAX_QUEUE];
+    bool isr_masked;            ///< Queue was full, FIFO0 interrupt off until the main loop dequeues
+    uint64_t cpu_free_ns;       ///< Main loop finishes its current frame
+    uint64_t block_start_ns;    ///< Interrupts held off in [block_start_ns, block_end_ns)
+    uint64_t block_end_ns;
+    bool wake;                  ///< wfi_each_frame: an interrupt came in while the loop slept
+    uint64_t wake_ns;
+    bool awake;                 ///< Event mode with wfi_each_frame: a pass of the loop is running
+    uint32_t wake_processed;    ///< Frames handled when the pass started
+    bool timer_armed;           ///< Event mode: one shot timer, SysTick on the target
+    uint64_t timer_ns;
+
+    uint32_t received;          ///< Frames seen on the bus
+    uint32_t filtered;          ///< Dropped by the ISR ID filter
+    uint32_t overruns;          ///< Lost because FIFO0 was full
+    uint32_t accept_overruns;   ///< Lost frames that were addressed to accept_id (and ecu_id)
+    uint32_t processed;         ///< Frames handled by the main loop
+    uint32_t high_water;        ///< Most rx_message_q entries in use at once
+    uint32_t stalls;            ///< Times the queue filled and the ISR had to back off
+    uint64_t stall_ns;          ///< Total time spent backed off
+    uint64_t max_latency_ns;    ///< Longest time from a frame landing in FIFO0 until the ISR was done with it
+    uint32_t queued_sleeps;     ///< wfi_each_frame: times the loop went to sleep with frames still queued
+    uint64_t stall_start_ns;
+};
+
+void initBLRxSim(bl_rx_sim_t* sim, can_sim_bus_t* bus, const bl_rx_sim_cfg_t* cfg, bl_rx_sim_handler_fn handler, void* ctx);
+void initBLRxSimEvents(bl_rx_sim_t* sim, can_sim_bus_t* bus, const bl_rx_sim_cfg_t* cfg, ev_sched_t* sched,
+                       bl_rx_sim_event_fn step, void* ctx);
+void blRxSimRun(bl_rx_sim_t* sim, uint64_t until_ns);
+void blRxSimResume(bl_rx_sim_t* sim);
+void blRxSimTimer(bl_rx_sim_t* sim, uint64_t at_ns);
+void blRxSimTimerStop(bl_rx_sim_t* sim);
+
+#endif
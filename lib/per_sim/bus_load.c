@@ -0,0 +1,289 @@
+/**
+ * @file bus_load.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Background traffic for the virtual CAN bus. Either generates synthetic load with a
+ * target bus utilisation, ID range and burst length, or replays a recorded candump/ASC log.
+ * 
+ * The generator is a single node that keeps its mailboxes loaded with frames scheduled for the
+ * future, so it competes in arbitration like a busy vehicle bus would. Bursts of frames are ready
+ * at the same time and followed by a random idle gap sized to hit the requested load on average.
+ * @version 0.1
+ * @date 2021-05-08
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <bus_load.h>
+#include <stdlib.h>
+
+static uint32_t nextRandom(bus_load_t* gen)
+{
+    // xorshift32, reproducible for a given seed
+    uint32_t x = gen->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return gen->rng = x;
+}
+
+/**
+ * @brief Build the next synthetic frame and schedule it
+ * 
+ * @param gen Generator
+ * @param msg Frame to fill
+ * @return true Frame is due before the stop time
+ * @return false Generator is done
+ */
+static bool nextSynthetic(bus_load_t* gen, CanMsgTypeDef* msg)
+{
+    if (gen->cfg.load_pct == 0)
+        return false;
+
+    if (gen->burst_left == 0)
+    {
+        // Idle gap after the previous burst, uniform in [0, 2x) of the mean for the target load
+        uint64_t mean_gap = gen->burst_ns * (100 - gen->cfg.load_pct) / gen->cfg.load_pct;
+        gen->next_ns += gen->burst_ns + mean_gap * (nextRandom(gen) % 2000) / 1000;
+        gen->burst_ns = 0;
+        gen->burst_left = 1 + nextRandom(gen) % (gen->cfg.burst_max ? gen->cfg.burst_max : 1);
+    }
+
+    uint32_t id = gen->cfg.id_min + nextRandom(gen) % (gen->cfg.id_max - gen->cfg.id_min + 1);
+    msg->IDE = (nextRandom(gen) % 100) < gen->cfg.ext_pct ? CAN_ID_EXT : CAN_ID_STD;
+    msg->ExtId = id & 0x1FFFFFFF;
+    msg->StdId = id & 0x7FF;
+    msg->DLC = gen->cfg.dlc_min >= 8 ? 8 : gen->cfg.dlc_min + nextRandom(gen) % (9 - gen->cfg.dlc_min);
+    msg->FDF = 0;
+    for (int i = 0; i < 8; i++)
+        msg->Data[i] = nextRandom(gen) & 0xFF;
+
+    gen->burst_ns += canSimFrameTime(gen->bus, msg);
+    gen->burst_left--;
+
+    return gen->next_ns < gen->stop_ns;
+}
+
+/**
+ * @brief Parse log lines until the next data frame and schedule it at its recorded time
+ * 
+ * @param gen Replay generator
+ * @param msg Frame to fill
+ * @return true Frame is due before the stop time
+ * @return false End of log
+ */
+static bool nextReplay(bus_load_t* gen, CanMsgTypeDef* msg)
+{
+    uint64_t t;
+
+    while (gen->log && *gen->log)
+    {
+        const char* line = gen->log;
+        while (*gen->log && *gen->log != '\n')
+            gen->log++;
+        if (*gen->log)
+            gen->log++;
+
+        if (!busLoadParseLine(line, msg, &t))
+            continue;
+
+        if (!gen->log_synced)
+        {
+            gen->log_offset_ns = (int64_t) gen->next_ns - (int64_t) t;
+            gen->log_synced = true;
+        }
+        gen->next_ns = t + gen->log_offset_ns;
+        return gen->next_ns < gen->stop_ns;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Keep the generator mailboxes loaded, called at start and on every TX complete
+ */
+static void refill(bus_load_t* gen)
+{
+    CanMsgTypeDef msg;
+
+    while (!isRBQueueFull(&gen->node.tx_q))
+    {
+        if (!(gen->log ? nextReplay(gen, &msg) : nextSynthetic(gen, &msg)))
+            break;
+        canSimTransmit(&gen->node, &msg, gen->next_ns);
+        gen->generated++;
+    }
+}
+
+static void loadTxDone(can_sim_node_t* node, uint64_t now_ns)
+{
+    refill((bus_load_t*) node->ctx);
+}
+
+/**
+ * @brief Attach a synthetic traffic generator to a bus. It stays idle until @ref busLoadStart
+ * 
+ * @param gen Generator
+ * @param bus Bus to load
+ * @param cfg Load, ID distribution and burst settings, copied
+ */
+void initBusLoad(bus_load_t* gen, can_sim_bus_t* bus, const bus_load_cfg_t* cfg)
+{
+    gen->bus = bus;
+    gen->cfg = *cfg;
+    gen->log = 0;
+    gen->rng = cfg->seed ? cfg->seed : 1;
+    gen->generated = 0;
+    canSimAttach(bus, &gen->node, 0, loadTxDone, gen);
+}
+
+/**
+ * @brief Attach a generator that replays a recorded log. Timestamps keep their spacing,
+ * the first frame is sent at the start time.
+ * 
+ * @param gen Generator
+ * @param bus Bus to load
+ * @param log candump -l or Vector ASC text, must outlive the generator
+ */
+void initBusReplay(bus_load_t* gen, can_sim_bus_t* bus, const char* log)
+{
+    gen->bus = bus;
+    gen->log = log;
+    gen->log_synced = false;
+    gen->generated = 0;
+    canSimAttach(bus, &gen->node, 0, loadTxDone, gen);
+}
+
+/**
+ * @brief Begin sending background frames
+ * 
+ * @param gen Generator
+ * @param start_ns Bus time of the first frame
+ * @param stop_ns No frames are scheduled at or after this time
+ */
+void busLoadStart(bus_load_t* gen, uint64_t start_ns, uint64_t stop_ns)
+{
+    gen->next_ns = start_ns;
+    gen->stop_ns = stop_ns;
+    gen->burst_ns = 0;
+    gen->burst_left = 0;
+    refill(gen);
+}
+
+/**
+ * @brief Parse a decimal timestamp in seconds without going through a double
+ */
+static const char* parseSeconds(const char* p, uint64_t* t_ns)
+{
+    char* end;
+    uint64_t ns = strtoull(p, &end, 10) * 1000000000ULL;
+
+    if (end == p)
+        return 0;
+
+    if (*end == '.')
+    {
+        uint64_t scale = 100000000ULL;
+        for (end++; *end >= '0' && *end <= '9'; end++, scale /= 10)
+            ns += (*end - '0') * scale;
+    }
+
+    *t_ns = ns;
+    return end;
+}
+
+static const char* skipSpaces(const char* p)
+{
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+/**
+ * @brief Parse one line of a candump -l log or a Vector ASC log. Remote frames, CAN FD frames,
+ * error frames and header lines are skipped.
+ * 
+ *     (1436509052.249713) can0 18FF0010#0102030405060708
+ *        1.234567 1  18FF0010x       Rx   d 8 01 02 03 04 05 06 07 08
+ * 
+ * @param line Text, parsing stops at the end of the line
+ * @param msg Parsed frame
+ * @param t_ns Timestamp from the log
+ * @return true Line held a classic data frame
+ * @return false Anything else
+ */
+bool busLoadParseLine(const char* line, CanMsgTypeDef* msg, uint64_t* t_ns)
+{
+    const char* p = skipSpaces(line);
+    char* end;
+    uint32_t id;
+    bool extended;
+
+    if (*p == '(')
+    {
+        // candump -l: (time) interface id#data
+        if (!(p = parseSeconds(p + 1, t_ns)) || *p != ')')
+            return false;
+        p = skipSpaces(p + 1);
+        while (*p && *p != ' ' && *p != '\t' && *p != '\n')
+            p++;
+        p = skipSpaces(p);
+
+        const char* id_start = p;
+        id = strtoul(p, &end, 16);
+        if (end == id_start || *end != '#' || end[1] == '#' || end[1] == 'R')
+            return false;
+        extended = (end - id_start) > 3;
+        p = end + 1;
+
+        msg->DLC = 0;
+        while (msg->DLC < 8 && p[0] && p[1] && p[0] != '\n' && p[0] != '\r' && p[0] != ' ')
+        {
+            char byte[3] = {p[0], p[1], 0};
+            msg->Data[msg->DLC++] = strtoul(byte, 0, 16);
+            p += 2;
+        }
+    }
+    else
+    {
+        // ASC: time channel id[x] Rx|Tx d dlc data...
+        if (!(p = parseSeconds(p, t_ns)) || (*p != ' ' && *p != '\t'))
+            return false;
+        p = skipSpaces(p);
+        strtoul(p, &end, 10);
+        if (end == p)
+            return false;
+        p = skipSpaces(end);
+
+        id = strtoul(p, &end, 16);
+        if (end == p)
+            return false;
+        extended = (*end == 'x');
+        p = skipSpaces(end + extended);
+
+        if (!(p[0] == 'R' || p[0] == 'T') || p[1] != 'x')
+            return false;
+        p = skipSpaces(p + 2);
+        if (*p != 'd')
+            return false;
+
+        msg->DLC = strtoul(p + 1, &end, 10);
+        if (msg->DLC > 8)
+            return false;
+        p = end;
+        for (uint32_t i = 0; i < msg->DLC; i++)
+        {
+            p = skipSpaces(p);
+            msg->Data[i] = strtoul(p, &end, 16);
+            if (end == p)
+                return false;
+            p = end;
+        }
+    }
+
+    msg->IDE = extended ? CAN_ID_EXT : CAN_ID_STD;
+    msg->ExtId = extended ? id : 0;
+    msg->StdId = extended ? 0 : id;
+    msg->FDF = 0;
+    return true;
+}
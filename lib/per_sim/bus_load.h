@@ -0,0 +1,52 @@
+/**
+ * @file bus_load.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Background traffic for the virtual CAN bus. Either generates synthetic load with a
+ * target bus utilisation, ID range and burst length, or replays a recorded candump/ASC log.
+ * @version 0.1
+ * @date 2021-05-08
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef BUS_LOAD_H
+#define BUS_LOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <can_sim.h>
+
+typedef struct {
+    uint8_t load_pct;           ///< Target share of bus time used by background frames
+    uint32_t id_min;            ///< IDs are drawn uniformly from [id_min, id_max]
+    uint32_t id_max;
+    uint8_t ext_pct;            ///< Share of frames sent with a 29 bit ID
+    uint8_t dlc_min;            ///< Data length drawn uniformly from [dlc_min, 8]
+    uint8_t burst_max;          ///< Bursts of 1 to burst_max back to back frames, 1 spreads traffic evenly
+    uint32_t seed;
+} bus_load_cfg_t;
+
+typedef struct {
+    can_sim_node_t node;
+    can_sim_bus_t* bus;
+    bus_load_cfg_t cfg;
+
+    const char* log;            ///< Replay cursor, NULL when generating
+    int64_t log_offset_ns;      ///< Added to log timestamps to get bus time
+    bool log_synced;
+
+    uint64_t next_ns;           ///< Ready time of the next frame
+    uint64_t stop_ns;           ///< No frames are scheduled at or after this time
+    uint64_t burst_ns;          ///< Bus time of the current burst
+    uint32_t burst_left;
+    uint32_t rng;
+    uint32_t generated;
+} bus_load_t;
+
+void initBusLoad(bus_load_t* gen, can_sim_bus_t* bus, const bus_load_cfg_t* cfg);
+void initBusReplay(bus_load_t* gen, can_sim_bus_t* bus, const char* log);
+void busLoadStart(bus_load_t* gen, uint64_t start_ns, uint64_t stop_ns);
+bool busLoadParseLine(const char* line, CanMsgTypeDef* msg, uint64_t* t_ns);
+
+#endif
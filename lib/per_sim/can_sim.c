@@ -0,0 +1,244 @@
+/**
+ * @file can_sim.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Virtual CAN bus for native tests. Models arbitration, per-frame bit time and
+ * a limited number of TX mailboxes per node so bootloader traffic can be timed off-target.
+ * CAN FD frames run their data phase at the data bit rate when they switch bit rate.
+ * @version 0.1
+ * @date 2021-04-10
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <can_sim.h>
+
+/**
+ * @brief Initalize an idle bus with no nodes attached
+ * 
+ * @param bus Bus handle
+ * @param bitrate Nominal bit rate in bits per second
+ */
+void initCANSimBus(can_sim_bus_t* bus, uint32_t bitrate)
+{
+    initCANSimFDBus(bus, bitrate, bitrate);
+}
+
+/**
+ * @brief Initalize an idle CAN FD bus with no nodes attached
+ * 
+ * @param bus Bus handle
+ * @param bitrate Nominal bit rate in bits per second, arbitration and classic frames
+ * @param data_bitrate Data phase bit rate of FD frames with BRS
+ */
+void initCANSimFDBus(can_sim_bus_t* bus, uint32_t bitrate, uint32_t data_bitrate)
+{
+    bus->bitrate = bitrate;
+    bus->data_bitrate = data_bitrate;
+    bus->now_ns = 0;
+    bus->busy_ns = 0;
+    bus->frames = 0;
+    bus->node_count = 0;
+}
+
+/**
+ * @brief Connect a node to the bus
+ * 
+ * @param bus Bus handle
+ * @param node Node to attach, its mailboxes start empty
+ * @param rx Called for every frame another node puts on the bus, may be NULL
+ * @param tx_done Called when one of this node's frames has been sent, may be NULL
+ * @param ctx User data for the callbacks
+ */
+void canSimAttach(can_sim_bus_t* bus, can_sim_node_t* node, can_sim_rx_fn rx, can_sim_tx_fn tx_done, void* ctx)
+{
+    initRBQueue(&node->tx_q, (uint8_t*) node->tx_array, CAN_SIM_MAILBOXES, sizeof(can_sim_frame_t));
+    node->rx = rx;
+    node->tx_done = tx_done;
+    node->ctx = ctx;
+    node->tx_count = 0;
+    node->rx_count = 0;
+
+    if (bus->node_count < CAN_SIM_MAX_NODES)
+        bus->nodes[bus->node_count++] = node;
+}
+
+/**
+ * @brief Load a frame into a free mailbox of a node
+ * 
+ * @param node Transmitting node
+ * @param msg Frame to send
+ * @param ready_ns Time the frame was loaded, it can not win arbitration before this
+ * @return true Frame loaded
+ * @return false All mailboxes of the node are busy
+ */
+bool canSimTransmit(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t ready_ns)
+{
+    can_sim_frame_t frame;
+    frame.msg = *msg;
+    frame.ready_ns = ready_ns;
+    return rbEnqueue(&node->tx_q, &frame);
+}
+
+/**
+ * @brief Check if any node on the bus has a frame loaded
+ * 
+ * @param bus Bus handle
+ * @return true At least one frame is waiting
+ * @return false Bus will stay idle
+ */
+bool canSimPending(can_sim_bus_t* bus)
+{
+    for (int i = 0; i < bus->node_count; i++)
+        if (!isRBQueueEmpty(&bus->nodes[i]->tx_q))
+            return true;
+    return false;
+}
+
+/**
+ * @brief Time at which the next frame would start on the bus
+ * 
+ * @param bus Bus handle
+ * @return uint64_t Start time in ns, UINT64_MAX if nothing is pending
+ */
+uint64_t canSimNextStart(can_sim_bus_t* bus)
+{
+    uint64_t start = UINT64_MAX;
+    can_sim_frame_t head;
+
+    for (int i = 0; i < bus->node_count; i++)
+        if (rbPeek(&bus->nodes[i]->tx_q, &head) && head.ready_ns < start)
+            start = head.ready_ns;
+
+    if (start != UINT64_MAX && start < bus->now_ns)
+        start = bus->now_ns;
+    return start;
+}
+
+/**
+ * @brief Worst case bits of an FD frame, split at the bit rate switch. The arbitration phase runs
+ * from SOF to BRS with dynamic stuff bits, the data phase from ESI to the CRC delimiter with
+ * the stuff count and fixed stuff bits in a 17 or 21 bit CRC. ACK, EOF and interframe space
+ * are back at the nominal rate.
+ * 
+ * @param msg FD frame
+ * @param data_bits Bits of the data phase
+ * @return uint32_t Bits at the nominal rate
+ */
+static uint32_t fdFrameBits(CanMsgTypeDef* msg, uint32_t* data_bits)
+{
+    uint32_t length = canDlcLength(msg->DLC, true);
+    uint32_t arbitration = msg->IDE == CAN_ID_EXT ? 36 : 17;
+    uint32_t stuffed = 5 + 8 * length;      // ESI, DLC and data
+    uint32_t crc = length > 16 ? 21 : 17;
+
+    *data_bits = stuffed + (stuffed - 1) / 4 + 4 + crc + (4 + crc + 3) / 4 + 1;
+    return arbitration + (arbitration - 1) / 4 + 12;
+}
+
+/**
+ * @brief Worst case length of a data frame including stuff bits and interframe space
+ * 
+ * @param msg Frame
+ * @return uint32_t Number of bit times the frame occupies the bus, both phases of an FD frame
+ */
+uint32_t canSimFrameBits(CanMsgTypeDef* msg)
+{
+    uint32_t data_bits = 8 * msg->DLC;
+
+    if (msg->FDF)
+    {
+        uint32_t nominal = fdFrameBits(msg, &data_bits);
+        return nominal + data_bits;
+    }
+
+    if (msg->IDE == CAN_ID_EXT)
+        return 67 + data_bits + (54 + data_bits - 1) / 4;
+    return 47 + data_bits + (34 + data_bits - 1) / 4;
+}
+
+/**
+ * @brief Time a frame occupies the bus
+ * 
+ * @param bus Bus handle
+ * @param msg Frame
+ * @return uint64_t Frame duration in ns
+ */
+uint64_t canSimFrameTime(can_sim_bus_t* bus, CanMsgTypeDef* msg)
+{
+    uint32_t data_bits;
+
+    if (msg->FDF && msg->BRS)
+    {
+        uint32_t nominal = fdFrameBits(msg, &data_bits);
+        return (uint64_t) nominal * 1000000000ULL / bus->bitrate +
+               (uint64_t) data_bits * 1000000000ULL / bus->data_bitrate;
+    }
+    return (uint64_t) canSimFrameBits(msg) * 1000000000ULL / bus->bitrate;
+}
+
+/**
+ * @brief Order in which frames win arbitration, lower wins. The 11 bit base ID is compared
+ * first, a standard frame beats an extended frame with the same base (SRR/IDE recessive)
+ * 
+ * @param msg Frame
+ * @return uint32_t Arbitration key
+ */
+static uint32_t arbitrationKey(const CanMsgTypeDef* msg)
+{
+    if (msg->IDE == CAN_ID_EXT)
+        return ((msg->ExtId >> 18) << 19) | (1U << 18) | (msg->ExtId & 0x3FFFF);
+    return (uint32_t) msg->StdId << 19;
+}
+
+/**
+ * @brief Put a single frame on the bus. The highest priority frame among those ready at the
+ * start of the slot wins arbitration, is delivered to every other node and then frees
+ * the sender's mailbox.
+ * 
+ * @param bus Bus handle
+ * @return true A frame was transmitted
+ * @return false Bus is idle
+ */
+bool canSimStep(can_sim_bus_t* bus)
+{
+    uint64_t start = canSimNextStart(bus);
+    can_sim_node_t* winner = 0;
+    can_sim_frame_t head;
+    can_sim_frame_t frame;
+
+    if (start == UINT64_MAX)
+        return false;
+
+    for (int i = 0; i < bus->node_count; i++)
+    {
+        if (rbPeek(&bus->nodes[i]->tx_q, &head) && head.ready_ns <= start &&
+            (!winner || arbitrationKey(&head.msg) < arbitrationKey(&frame.msg)))
+        {
+            winner = bus->nodes[i];
+            frame = head;
+        }
+    }
+
+    rbDequeue(&winner->tx_q, &frame);
+    uint64_t duration = canSimFrameTime(bus, &frame.msg);
+    bus->now_ns = start + duration;
+    bus->busy_ns += duration;
+    bus->frames++;
+    winner->tx_count++;
+
+    for (int i = 0; i < bus->node_count; i++)
+    {
+        can_sim_node_t* node = bus->nodes[i];
+        if (node != winner && node->rx)
+        {
+            node->rx_count++;
+            node->rx(node, &frame.msg, bus->now_ns);
+        }
+    }
+
+    if (winner->tx_done)
+        winner->tx_done(winner, bus->now_ns);
+
+    return true;
+}
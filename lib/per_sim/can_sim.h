@@ -0,0 +1,67 @@
+/**
+ * @file can_sim.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Virtual CAN bus for native tests. Models arbitration, per-frame bit time and
+ * a limited number of TX mailboxes per node so bootloader traffic can be timed off-target.
+ * CAN FD frames run their data phase at the data bit rate when they switch bit rate.
+ * @version 0.1
+ * @date 2021-04-10
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef CAN_SIM_H
+#define CAN_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <rb_queue.h>
+#include <can_msg.h>
+
+#define CAN_SIM_MAX_NODES  (8U)
+#define CAN_SIM_MAILBOXES  (3U)     // Same as bxCAN
+
+typedef struct can_sim_node can_sim_node_t;
+
+typedef void (*can_sim_rx_fn)(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t now_ns);
+typedef void (*can_sim_tx_fn)(can_sim_node_t* node, uint64_t now_ns);
+
+typedef struct {
+    CanMsgTypeDef msg;
+    uint64_t ready_ns;          ///< Earliest time the frame may start arbitration
+} can_sim_frame_t;
+
+struct can_sim_node {
+    rb_queue_t tx_q;                                ///< Loaded TX mailboxes
+    can_sim_frame_t tx_array[CAN_SIM_MAILBOXES];
+    can_sim_rx_fn rx;                               ///< Frame received (RX IRQ)
+    can_sim_tx_fn tx_done;                          ///< Mailbox freed (TX empty IRQ)
+    void* ctx;                                      ///< User data for callbacks
+
+    uint32_t tx_count;
+    uint32_t rx_count;
+};
+
+typedef struct {
+    uint32_t bitrate;           ///< Bits per second
+    uint32_t data_bitrate;      ///< Data phase of FD frames with BRS, bits per second
+    uint64_t now_ns;            ///< Bus time, end of the last frame
+    uint64_t busy_ns;           ///< Time spent transmitting frames
+    uint32_t frames;            ///< Frames put on the bus
+
+    can_sim_node_t* nodes[CAN_SIM_MAX_NODES];
+    uint8_t node_count;
+} can_sim_bus_t;
+
+void initCANSimBus(can_sim_bus_t* bus, uint32_t bitrate);
+void initCANSimFDBus(can_sim_bus_t* bus, uint32_t bitrate, uint32_t data_bitrate);
+void canSimAttach(can_sim_bus_t* bus, can_sim_node_t* node, can_sim_rx_fn rx, can_sim_tx_fn tx_done, void* ctx);
+bool canSimTransmit(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t ready_ns);
+bool canSimPending(can_sim_bus_t* bus);
+uint64_t canSimNextStart(can_sim_bus_t* bus);
+bool canSimStep(can_sim_bus_t* bus);
+uint32_t canSimFrameBits(CanMsgTypeDef* msg);
+uint64_t canSimFrameTime(can_sim_bus_t* bus, CanMsgTypeDef* msg);
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * @file flash_sim.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief NOR flash model for native tests. Programming can only clear bits, erases work on
+ * whole sectors and power can be cut in the middle of any operation.
+ * 
+ * A cut during a program clears a random subset of the requested bits. A cut during an erase
+ * leaves every word of the sector either erased, untouched or random. After a cut all
+ * operations are ignored until @ref flashSimPowerOn.
+ * @version 0.1
+ * @date 2021-05-15
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <flash_sim.h>
+
+static uint32_t nextRandom(flash_sim_t* f)
+{
+    uint32_t x = f->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return f->rng = x;
+}
+
+/**
+ * @brief Count down to the power cut
+ * 
+ * @return true This operation is interrupted
+ */
+static bool cutNow(flash_sim_t* f)
+{
+    if (f->ops_to_cut < 0)
+        return false;
+    if (f->ops_to_cut-- > 0)
+        return false;
+    f->powered = false;
+    return true;
+}
+
+/**
+ * @brief Start with every word erased
+ * 
+ * @param f Flash model
+ * @param mem Backing storage of `bytes` bytes
+ * @param bytes Flash size
+ * @param sector_bytes Uniform sector size
+ * @param seed Seed for torn operations
+ */
+void initFlashSim(flash_sim_t* f, uint32_t* mem, uint32_t bytes, uint32_t sector_bytes, uint32_t seed)
+{
+    f->mem = mem;
+    f->words = bytes / 4;
+    f->sector_words = sector_bytes / 4;
+    f->programs = 0;
+    f->overwrites = 0;
+    f->powered = true;
+    f->ops_to_cut = -1;
+    f->rng = seed ? seed : 1;
+
+    for (uint32_t i = 0; i < FLASH_SIM_MAX_SECTORS; i++)
+        f->erases[i] = 0;
+    for (uint32_t i = 0; i < f->words; i++)
+        mem[i] = 0xFFFFFFFF;
+}
+
+/**
+ * @brief Program one word. Bits can only go from 1 to 0.
+ * 
+ * @param f Flash model
+ * @param address Word inside the model
+ * @param value Value to program
+ */
+void flashSimProgram(flash_sim_t* f, volatile uint32_t* address, uint32_t value)
+{
+    if (!f->powered)
+        return;
+
+    if (cutNow(f))
+    {
+        *address &= value | nextRandom(f);
+        return;
+    }
+
+    if (value & ~*address)
+        f->overwrites++;
+    *address &= value;
+    f->programs++;
+}
+
+/**
+ * @brief Erase the sector starting at `sector`
+ * 
+ * @param f Flash model
+ * @param sector First word of the sector
+ */
+void flashSimErase(flash_sim_t* f, volatile uint32_t* sector)
+{
+    uint32_t index = (uint32_t) ((uint32_t*) sector - f->mem) / f->sector_words;
+    volatile uint32_t* words = f->mem + index * f->sector_words;
+
+    if (!f->powered)
+        return;
+
+    if (cutNow(f))
+    {
+        for (uint32_t i = 0; i < f->sector_words; i++)
+        {
+            uint32_t r = nextRandom(f) % 3;
+            if (r == 0)
+                words[i] = 0xFFFFFFFF;
+            else if (r == 1)
+                words[i] = nextRandom(f);
+        }
+        return;
+    }
+
+    for (uint32_t i = 0; i < f->sector_words; i++)
+        words[i] = 0xFFFFFFFF;
+    if (index < FLASH_SIM_MAX_SECTORS)
+        f->erases[index]++;
+}
+
+/**
+ * @brief Cut power during a later operation
+ * 
+ * @param f Flash model
+ * @param ops Number of operations that complete before the cut, negative to disable
+ */
+void flashSimCutAfter(flash_sim_t* f, int32_t ops)
+{
+    f->ops_to_cut = ops;
+}
+
+/**
+ * @brief Restore power, contents are kept
+ */
+void flashSimPowerOn(flash_sim_t* f)
+{
+    f->powered = true;
+    f->ops_to_cut = -1;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file flash_sim.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief NOR flash model for native tests. Programming can only clear bits, erases work on
+ * whole sectors and power can be cut in the middle of any operation.
+ * @version 0.1
+ * @date 2021-05-15
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef FLASH_SIM_H
+#define FLASH_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FLASH_SIM_MAX_SECTORS (16U)
+
+typedef struct {
+    uint32_t* mem;              ///< Backing storage, reads go straight to it
+    uint32_t words;
+    uint32_t sector_words;
+
+    uint32_t programs;          ///< Completed word programs
+    uint32_t erases[FLASH_SIM_MAX_SECTORS];
+    uint32_t overwrites;        ///< Programs that tried to set a cleared bit
+
+    bool powered;
+    int32_t ops_to_cut;         ///< Operations until the power cut, negative for never
+    uint32_t rng;
+} flash_sim_t;
+
+void initFlashSim(flash_sim_t* f, uint32_t* mem, uint32_t bytes, uint32_t sector_bytes, uint32_t seed);
+void flashSimProgram(flash_sim_t* f, volatile uint32_t* address, uint32_t value);
+void flashSimErase(flash_sim_t* f, volatile uint32_t* sector);
+void flashSimCutAfter(flash_sim_t* f, int32_t ops);
+void flashSimPowerOn(flash_sim_t* f);
+
+#endif
@@ -0,0 +1,243 @@
+/**
+ * @file sim_tester.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Tester side of the native tests: reference CRC, a CPU fed CRC unit, bootloader frames,
+ * a tester streaming at a fixed rate and an orchestrator host on the simulated bus.
+ *
+ * The reference CRC is crcSoftware(), the model of the STM32 CRC unit the bootloader nodes and
+ * the orchestrator use as well. test_crc pins it to known values. The hooks of bl_crc_hw_t and
+ * the transmit function of the orchestrator carry no context, they work on `unit` and `pumping`.
+ * @version 0.1
+ * @date 2021-07-24
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <sim_tester.h>
+#include <bl_node_sim.h>
+#include <string.h>
+
+static sim_crc_unit_t* unit;
+static sim_host_t* pumping;
+
+/**
+ * @brief Continue a CRC over bytes, four at a time like the CRC unit. The last word is padded with zeros.
+ *
+ * @param crc CRC so far, 0xFFFFFFFF to start
+ * @param data Bytes, little endian words
+ * @param length Bytes
+ * @return uint32_t CRC through the end of data
+ */
+uint32_t simCRC(uint32_t crc, const uint8_t* data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i += 4)
+    {
+        uint32_t word = 0;
+        for (uint32_t b = 0; b < 4 && i + b < length; b++)
+            word |= (uint32_t) data[i + b] << (8 * b);
+        crc = crcSoftware(crc, word);
+    }
+    return crc;
+}
+
+/**
+ * @brief CRC of a whole image, the BL_CRCValue a tester sends
+ */
+uint32_t simImageCRC(const uint8_t* data, uint32_t length)
+{
+    return simCRC(0xFFFFFFFF, data, length);
+}
+
+/**
+ * @brief Unit the hooks of simCRCUnitHw work on until the next select
+ */
+void simCRCUnitSelect(sim_crc_unit_t* selected)
+{
+    unit = selected;
+}
+
+void simCRCUnitReset(void)
+{
+    unit->dr = 0xFFFFFFFF;
+    unit->resets++;
+}
+
+uint32_t simCRCUnitFeed(uint32_t word)
+{
+    unit->dr = crcSoftware(unit->dr, word);
+    unit->words++;
+    return unit->dr;
+}
+
+uint32_t simCRCUnitValue(void)
+{
+    return unit->dr;
+}
+
+const bl_crc_hw_t simCRCUnitHw = {simCRCUnitReset, simCRCUnitFeed, 0, 0, 0, simCRCUnitValue};
+
+/**
+ * @brief Classic 8 byte frame with an extended ID, a type byte and one little endian word
+ *
+ * @param id Extended identifier
+ * @param byte0 First data byte, message type and ECU ID of the bootloader protocol
+ * @param value Word in bytes 1 to 4
+ */
+void simFrame(CanMsgTypeDef* msg, uint32_t id, uint8_t byte0, uint32_t value)
+{
+    msg->IDE = CAN_ID_EXT;
+    msg->ExtId = id;
+    msg->StdId = 0;
+    msg->DLC = 8;
+    msg->FDF = 0;
+    msg->Data[0] = byte0;
+    for (int i = 0; i < 4; i++)
+        msg->Data[1 + i] = (value >> (8 * i)) & 0xFF;
+    msg->Data[5] = msg->Data[6] = msg->Data[7] = 0;
+}
+
+/**
+ * @brief Word in bytes 1 to 4 of a frame
+ */
+uint32_t simFrameValue(const CanMsgTypeDef* msg)
+{
+    return msg->Data[1] | (msg->Data[2] << 8) | (msg->Data[3] << 16) | ((uint32_t) msg->Data[4] << 24);
+}
+
+/**
+ * @brief Load the mailboxes with the next frames, each one ready `period_ns` after the one before
+ */
+static void testerFill(can_sim_node_t* node, uint64_t now_ns)
+{
+    sim_tester_t* tester = node->ctx;
+    CanMsgTypeDef msg;
+
+    while (tester->sent < tester->frames)
+    {
+        if (tester->sent == 0)
+            simFrame(&msg, tester->rx_id, 0x1, 0x1);                        // M_FLAG_SET, flash new app
+        else if (tester->sent == 1)
+            simFrame(&msg, tester->rx_id, 0x2, tester->image_words * 4);    // M_METADATA, length only
+        else
+            simFrame(&msg, tester->rx_id, 0x3, tester->sent - 2);           // M_APP_DATA, word n holds n
+
+        if (!canSimTransmit(&tester->node, &msg, tester->start_ns + (uint64_t) tester->sent * tester->period_ns))
+            break;
+        tester->sent++;
+    }
+}
+
+/**
+ * @brief Attach a tester to the bus, it sends nothing until simTesterStart()
+ *
+ * @param rx_id BL_RxMessage of the target
+ * @param image_words Image length in the metadata, in words
+ * @param frames Frames to send in total, image_words + 2 for the whole image
+ * @param period_ns Frame rate, the bootloader ID wins arbitration against almost every vehicle ID
+ */
+void initSimTester(sim_tester_t* tester, can_sim_bus_t* bus, uint32_t rx_id, uint32_t image_words, uint32_t frames, uint64_t period_ns)
+{
+    memset(tester, 0, sizeof(*tester));
+    tester->rx_id = rx_id;
+    tester->image_words = image_words;
+    tester->frames = frames;
+    tester->period_ns = period_ns;
+    canSimAttach(bus, &tester->node, 0, testerFill, tester);
+}
+
+void simTesterStart(sim_tester_t* tester, uint64_t start_ns)
+{
+    tester->start_ns = start_ns;
+    testerFill(&tester->node, start_ns);
+}
+
+/**
+ * @brief Every frame is on the bus
+ */
+bool simTesterDone(sim_tester_t* tester)
+{
+    return tester->sent == tester->frames && isRBQueueEmpty(&tester->node.tx_q);
+}
+
+static bool hostTx(CanMsgTypeDef* msg)
+{
+    return canSimTransmit(&pumping->node, msg, pumping->now_ns);
+}
+
+static void hostRx(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t now_ns)
+{
+    sim_host_t* host = node->ctx;
+
+    orchestratorRx(&host->orch, msg, now_ns / 1000);
+    simHostPump(host, now_ns);
+}
+
+static void hostTxDone(can_sim_node_t* node, uint64_t now_ns)
+{
+    simHostPump(node->ctx, now_ns);
+}
+
+/**
+ * @brief Attach a host to the bus. The orchestrator is set up by the caller with initOrchestrator().
+ */
+void initSimHost(sim_host_t* host, can_sim_bus_t* bus)
+{
+    memset(host, 0, sizeof(*host));
+    canSimAttach(bus, &host->node, hostRx, hostTxDone, host);
+}
+
+/**
+ * @brief Let the orchestrator send what it can at `now_ns`
+ */
+void simHostPump(sim_host_t* host, uint64_t now_ns)
+{
+    pumping = host;
+    host->now_ns = now_ns;
+    orchestratorPump(&host->orch, hostTx, now_ns / 1000);
+}
+
+/**
+ * @brief Run the buses and the bootloader nodes until every job of the orchestrator finished,
+ * or nothing is left to happen. Starts from the first simHostPump(). The bus with the earliest
+ * frame goes first, and once no bus has anything to send, time skips to the next orchestrator timeout.
+ *
+ * @param buses Bus of the host first, then buses behind gateways
+ * @param nodes Bootloader nodes on any of the buses
+ */
+void simHostRun(sim_host_t* host, can_sim_bus_t** buses, uint8_t bus_count, bl_node_sim_t* nodes, uint8_t node_count)
+{
+    while (!orchestratorDone(&host->orch))
+    {
+        can_sim_bus_t* step = 0;
+        for (uint8_t i = 0; i < bus_count; i++)
+        {
+            if (canSimPending(buses[i]) && (!step || canSimNextStart(buses[i]) < canSimNextStart(step)))
+                step = buses[i];
+        }
+
+        uint64_t next = step ? canSimNextStart(step) : UINT64_MAX;
+        for (uint8_t i = 0; i < node_count; i++)
+            blRxSimRun(&nodes[i].rx, next);
+
+        if (step)
+        {
+            canSimStep(step);
+            continue;
+        }
+
+        // The nodes ran out of work, they may have loaded a mailbox on the way
+        bool pending = false;
+        for (uint8_t i = 0; i < bus_count; i++)
+            pending |= canSimPending(buses[i]);
+        if (pending)
+            continue;
+
+        uint64_t deadline = orchestratorDeadline(&host->orch);
+        if (deadline == UINT64_MAX)
+            break;
+        for (uint8_t i = 0; i < bus_count; i++)
+            buses[i]->now_ns = deadline * 1000;
+        simHostPump(host, deadline * 1000);
+    }
+}
@@ -0,0 +1,78 @@
+/**
+ * @file sim_tester.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Tester side of the native tests: reference CRC, a CPU fed CRC unit, bootloader frames,
+ * a tester streaming at a fixed rate and an orchestrator host on the simulated bus.
+ * @version 0.1
+ * @date 2021-07-24
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SIM_TESTER_H
+#define SIM_TESTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <can_msg.h>
+#include <can_sim.h>
+#include <bl_crc.h>
+#include <bl_orchestrator.h>
+
+typedef struct bl_node_sim bl_node_sim_t;   // bl_node_sim.h, which runs its nodes on sim_crc_unit_t
+
+/**
+ * @brief CRC unit model, fed by the CPU only. The hooks of simCRCUnitHw work on the selected unit.
+ */
+typedef struct {
+    uint32_t dr;                ///< Data register
+    uint32_t words;             ///< Words written by the CPU
+    uint32_t resets;
+} sim_crc_unit_t;
+
+/**
+ * @brief Tester sending M_FLAG_SET, M_METADATA and then data words at a fixed rate. Data word n holds n.
+ */
+typedef struct {
+    can_sim_node_t node;
+    uint32_t rx_id;             ///< BL_RxMessage of the target
+    uint32_t image_words;       ///< Length sent in the metadata, in words
+    uint32_t frames;            ///< Frames to send in total
+    uint64_t period_ns;         ///< Start of one frame to the start of the next
+    uint64_t start_ns;
+    uint32_t sent;
+} sim_tester_t;
+
+/**
+ * @brief Host running the orchestrator on one CAN interface, pumped from RX and TX done like
+ * a SocketCAN loop
+ */
+typedef struct {
+    can_sim_node_t node;
+    bl_orchestrator_t orch;
+    uint64_t now_ns;
+} sim_host_t;
+
+extern const bl_crc_hw_t simCRCUnitHw;
+
+uint32_t simCRC(uint32_t crc, const uint8_t* data, uint32_t length);
+uint32_t simImageCRC(const uint8_t* data, uint32_t length);
+
+void simCRCUnitSelect(sim_crc_unit_t* unit);
+void simCRCUnitReset(void);
+uint32_t simCRCUnitFeed(uint32_t word);
+uint32_t simCRCUnitValue(void);
+
+void simFrame(CanMsgTypeDef* msg, uint32_t id, uint8_t byte0, uint32_t value);
+uint32_t simFrameValue(const CanMsgTypeDef* msg);
+
+void initSimTester(sim_tester_t* tester, can_sim_bus_t* bus, uint32_t rx_id, uint32_t image_words, uint32_t frames, uint64_t period_ns);
+void simTesterStart(sim_tester_t* tester, uint64_t start_ns);
+bool simTesterDone(sim_tester_t* tester);
+
+void initSimHost(sim_host_t* host, can_sim_bus_t* bus);
+void simHostPump(sim_host_t* host, uint64_t now_ns);
+void simHostRun(sim_host_t* host, can_sim_bus_t** buses, uint8_t bus_count, bl_node_sim_t* nodes, uint8_t node_count);
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * @file ev_sched.c
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Run-to-completion event scheduler. Interrupts post events, the main loop runs the
+ * handler of the highest priority pending event, one at a time.
+ * 
+ * Each event has its own pending byte. A post is a single byte store, so interrupts never need a
+ * critical section, and the main loop clears the byte before it calls the handler, so a post
+ * that comes in while the handler runs is not lost. Priorities are checked again after every
+ * handler, so a handler that works through a long job in chunks lets every higher priority
+ * event run in between.
+ * @version 0.1
+ * @date 2021-07-03
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <ev_sched.h>
+
+/**
+ * @brief Initalize a scheduler without events
+ * 
+ * @param sched Scheduler
+ * @param ctx User data passed to every handler
+ */
+void initScheduler(ev_sched_t* sched, void* ctx)
+{
+    for (uint8_t i = 0; i < SCHED_MAX_EVENTS; i++)
+    {
+        sched->pending[i] = 0;
+        sched->handlers[i] = 0;
+        sched->runs[i] = 0;
+    }
+    sched->ctx = ctx;
+    sched->count = 0;
+}
+
+/**
+ * @brief Set the handler of an event
+ * 
+ * @param sched Scheduler
+ * @param event Event number, also its priority. 0 is the highest.
+ * @param handler Called from schedRunOne() while the event is pending
+ */
+void schedRegister(ev_sched_t* sched, uint8_t event, sched_handler_fn handler)
+{
+    if (event >= SCHED_MAX_EVENTS)
+        return;
+
+    sched->handlers[event] = handler;
+    if (event >= sched->count)
+        sched->count = event + 1;
+}
+
+/**
+ * @brief Mark an event pending, safe to call from interrupts.
+ * Posting a pending event again does nothing, the handler runs once.
+ * 
+ * @param sched Scheduler
+ * @param event Event number
+ */
+RAM_FUNC void schedPost(ev_sched_t* sched, uint8_t event)
+{
+    if (event < SCHED_MAX_EVENTS)
+        sched->pending[event] = 1;
+}
+
+/**
+ * @brief Check for pending events, sleep only when this is false
+ * 
+ * @param sched Scheduler
+ * @return true At least one event is pending
+ * @return false Nothing to do until the next post
+ */
+bool schedPending(ev_sched_t* sched)
+{
+    for (uint8_t i = 0; i < sched->count; i++)
+    {
+        if (sched->pending[i])
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Run the handler of the highest priority pending event
+ * 
+ * @param sched Scheduler
+ * @return true A handler ran
+ * @return false No event was pending
+ */
+bool schedRunOne(ev_sched_t* sched)
+{
+    for (uint8_t i = 0; i < sched->count; i++)
+    {
+        if (!sched->pending[i])
+            continue;
+
+        sched->pending[i] = 0;
+        sched->runs[i]++;
+        if (sched->handlers[i] && sched->handlers[i](sched->ctx))
+            sched->pending[i] = 1;
+        return true;
+    }
+    return false;
+}
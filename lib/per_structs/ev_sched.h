@@ -0,0 +1,46 @@
+/**
+ * @file ev_sched.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Run-to-completion event scheduler. Interrupts post events, the main loop runs the
+ * handler of the highest priority pending event, one at a time.
+ * @version 0.1
+ * @date 2021-07-03
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef EV_SCHED_H
+#define EV_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <ram_func.h>
+
+#define SCHED_MAX_EVENTS (8U)
+
+/**
+ * @brief Event handler, runs to completion. Long work does one chunk per call.
+ * 
+ * @param ctx User data given to initScheduler()
+ * @return true More work is left, the event stays pending
+ * @return false Done until the event is posted again
+ */
+typedef bool (*sched_handler_fn)(void* ctx);
+
+typedef struct {
+    volatile uint8_t pending[SCHED_MAX_EVENTS]; ///< One byte per event so an ISR posts without a critical section
+    sched_handler_fn handlers[SCHED_MAX_EVENTS];///< Index is the priority, 0 runs first
+    void* ctx;
+    uint8_t count;                              ///< Events in use
+
+    uint32_t runs[SCHED_MAX_EVENTS];            ///< Handler calls per event
+} ev_sched_t;
+
+void initScheduler(ev_sched_t* sched, void* ctx);
+void schedRegister(ev_sched_t* sched, uint8_t event, sched_handler_fn handler);
+RAM_FUNC void schedPost(ev_sched_t* sched, uint8_t event);
+bool schedPending(ev_sched_t* sched);
+bool schedRunOne(ev_sched_t* sched);
+
+#endif
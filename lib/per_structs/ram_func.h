@@ -0,0 +1,28 @@
+/**
+ * @file ram_func.h
+ * @author Adam Busch (busch8@purdue.edu)
+ * @brief Place a function in RAM so it keeps running while flash is programmed or erased
+ * @version 0.1
+ * @date 2021-05-22
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#ifndef RAM_FUNC_H
+#define RAM_FUNC_H
+
+/*
+*   The F4 stalls instruction fetch from a flash bank while it is being programmed or erased.
+*   Functions in .ramfunc are copied to RAM with .data by the startup code. RAM is out of range
+*   of a BL instruction from flash, long_call makes callers load the full address instead.
+*   Everything a RAM function calls must be in RAM as well, at -O0 that includes static
+*   inline helpers since they are emitted out of line.
+*/
+#ifdef STM32F4
+#define RAM_FUNC __attribute__((section(".ramfunc"), long_call, noinline))
+#else
+#define RAM_FUNC
+#endif
+
+#endif
@@ -19,7 +19,7 @@
  * @param src Memoy copy source
  * @param n Number of btes to copy
  */
-void queue_memcpy(void *dest, void *src, size_t n)
+RAM_FUNC void queue_memcpy(void *dest, void *src, size_t n)
 {
     for(int i = 0; i < n; i++)
         ((uint8_t*)dest)[i] = ((uint8_t*)src)[i];
@@ -50,7 +50,7 @@ void initRBQueue(rb_queue_t* q, uint8_t* elements, uint32_t capacity, uint32_t e
  * @return true queue has no elements in it
  * @return false queue has at least one element in it
  */
-bool isRBQueueEmpty(rb_queue_t* q)
+RAM_FUNC bool isRBQueueEmpty(rb_queue_t* q)
 {
     return q->_size == 0;
 }
@@ -62,7 +62,7 @@ bool isRBQueueEmpty(rb_queue_t* q)
  * @return true queue is at capacity
  * @return false queue has space for another item
  */
-bool isRBQueueFull(rb_queue_t* q)
+RAM_FUNC bool isRBQueueFull(rb_queue_t* q)
 {
     return q->_size == q->capacity;
 }
@@ -75,7 +75,7 @@ bool isRBQueueFull(rb_queue_t* q)
  * @return true Element sucessfully added
  * @return false Queue does not exist or is full
  */
-bool rbEnqueue(rb_queue_t* q, void* element)
+RAM_FUNC bool rbEnqueue(rb_queue_t* q, void* element)
 {
     if(!q || isRBQueueFull(q))
         return false;
@@ -95,7 +95,7 @@ bool rbEnqueue(rb_queue_t* q, void* element)
  * @return true Element copied sucessfully
  * @return false queue was already empty
  */
-bool rbDequeue(rb_queue_t* q, void* dest)
+RAM_FUNC bool rbDequeue(rb_queue_t* q, void* dest)
 {
     if (!q || isRBQueueEmpty(q))
         return false;
@@ -115,7 +115,7 @@ bool rbDequeue(rb_queue_t* q, void* dest)
  * @return true Element copied sucessfully
  * @return false queue is empty
  */
-bool rbPeek(rb_queue_t* q, void* dest)
+RAM_FUNC bool rbPeek(rb_queue_t* q, void* dest)
 {
     if (!q || isRBQueueEmpty(q))
         return false;
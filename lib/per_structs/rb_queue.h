@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <ram_func.h>
 
 /**
  * @brief  Define the underlying data storage element. 32 bit is chosen to match MCU archetecture
@@ -36,13 +37,14 @@ typedef struct {
     uint32_t _tail;             ///< Index of last item in queue
 } rb_queue_t;
 
-void queue_memcpy(void *dest, void *src, size_t n);
+// Used by the CAN RX interrupt, kept in RAM so frames are queued while flash is busy
+RAM_FUNC void queue_memcpy(void *dest, void *src, size_t n);
 
 void initRBQueue(rb_queue_t* q, uint8_t* elements, uint32_t capacity, uint32_t element_size);
-bool isRBQueueEmpty(rb_queue_t* q);
-bool isRBQueueFull(rb_queue_t* q);
-bool rbEnqueue(rb_queue_t* q, void* element);
-bool rbDequeue(rb_queue_t* q, void* dest);
-bool rbPeek(rb_queue_t* q, void* dest);
+RAM_FUNC bool isRBQueueEmpty(rb_queue_t* q);
+RAM_FUNC bool isRBQueueFull(rb_queue_t* q);
+RAM_FUNC bool rbEnqueue(rb_queue_t* q, void* element);
+RAM_FUNC bool rbDequeue(rb_queue_t* q, void* dest);
+RAM_FUNC bool rbPeek(rb_queue_t* q, void* dest);
 
 #endif
\ No newline at end of file
@@ -1,272 +1,164 @@
 /**
  * @file bootloader.c
  * @author Adam Busch (busch8@purdue.edu)
- * @brief Bootloader FSM implementation
+ * @brief Bootloader on the STM32F4: hooks and flash layout of the node in lib/bl_core
  * @version 0.1
  * @date 2021-02-22
- * 
+ *
  * @copyright Copyright (c) 2021
- * 
+ *
  */
 #include <bootloader.h>
 
-
-// Persistant Values
-#define SHARED_FLASH __attribute__((section(".shared_flash")));
-volatile uint32_t MAGIC_WORD        SHARED_FLASH;
-volatile uint32_t SAVED_CRC         SHARED_FLASH;
-volatile uint32_t SAVED_APP_LENGTH  SHARED_FLASH;
-volatile uint32_t BOOT_FLAG         SHARED_FLASH;
-volatile uint32_t APP_FLASH_START   SHARED_FLASH;
-
-static BLState_e setBootFlags(BLMessageData_t* msg);
-static BLState_e checkBootFlags(BLMessageData_t* msg);
-static BLState_e processMetadata(BLMessageData_t* msg);
-static BLState_e checkFlashedCRC(BLMessageData_t* msg);
-static BLState_e flashApp(BLMessageData_t* msg);
-static BLState_e validateFlash(BLMessageData_t* msg);
-static BLState_e launchApp(BLMessageData_t* msg);
-
-static bool decodeCANMsg(CanMsgTypeDef* canMessage, BLMessageData_t* fsmMessage);
-
-static FSMTableEntry_t transition_table[] = 
-{
-    {S_WAIT_FOR_FLAG,  M_FLAG_SET,  setBootFlags},      // Waiting for flag, got external message
-    {S_WAIT_FOR_FLAG,  M_NONE,      checkBootFlags},    // Waiting for flag, but timed out
-
-    {S_RECOVERY,       M_FLAG_SET,  setBootFlags},      // In recovery mode, recieved new flags
-
-    {S_CRC_CHECK,      M_NONE,      checkFlashedCRC},   // Going to check CRC
-    
-    {S_WAIT_FOR_META,  M_METADATA,  processMetadata},   // Waiting for meta, got metadata message
-
-    {S_FLASH_APP,      M_APP_DATA,  flashApp},          // Rx a piece of program data and write to flash
-
-    {S_VALIDATE_FLASH, M_NONE,      validateFlash},     // Validate Flash CRC and store to flash
-
-    {S_LAUNCH_APP,     M_NONE,      launchApp}          // Clean up peripherals and launch application
+#ifdef BL_SIGNED_IMAGES
+#include <bl_public_key.h>
+#endif
+
+#ifdef BL_ENCRYPTED_IMAGES
+#include <bl_image_key.h>
+#endif
+
+// Application flash region from the linker script
+extern uint32_t _app_origin;
+extern uint32_t _app_length;
+#define APP_FLASH_ORIGIN ((uint32_t) &_app_origin)
+#define APP_FLASH_LENGTH ((uint32_t) &_app_length)
+
+// Persistant values, journaled across the two shared flash sectors
+extern uint32_t _shared_origin;
+extern uint32_t _shared_length;
+#define SHARED_FLASH_ORIGIN ((uint32_t) &_shared_origin)
+#define SHARED_SECTOR_BYTES ((uint32_t) &_shared_length / 2)
+
+// 1 MB bank: 4 x 16 kB, 64 kB, 7 x 128 kB
+static const uint32_t flashSectors[] = {
+    0x4000U, 0x4000U, 0x4000U, 0x4000U, 0x10000U,
+    0x20000U, 0x20000U, 0x20000U, 0x20000U, 0x20000U, 0x20000U, 0x20000U
 };
 
-/**
- * @brief Based on the current operating state, call the state function corresponding to the type of the incoming message
- * See the @ref transition_table for the mapping of state functions. Next state is determined by the return value of state functions.
- * 
- * @param message Bootloader message recieved
- */
-static BLState_e bootloaderFSM(BLState_e currentState, BLMessageData_t *message)
-{
-    for(int i = 0; i < sizeof(transition_table)/sizeof(FSMTableEntry_t); i++)
-    {
-        FSMTableEntry_t *entry = &(transition_table[i]);
-        if (currentState == entry->state && message->generic.message_type == entry->type)
-        {
-            return entry->fn(message);
-        }
-    }
-    
-    // Maybe handle some sort of invalid message error?
-    return currentState;
-}
-
-/**
- * @brief Begin main bootloader super loop. Wait for a message in the FIFO queue and send it to the FSM.
- * 
- */
-void bootloaderMain()
-{
-    BLState_e currentState = S_WAIT_FOR_FLAG;
-    BLMessageData_t fsmMessage;
-    CanMsgTypeDef canMessage;
-    while (1)
-    {
-        if (!isRBQueueEmpty(&rx_message_q))
-        {
-            rbDequeue(&rx_message_q, &canMessage);
-            
-            if (decodeCANMsg(&canMessage, &fsmMessage)) // Ensure that message is valid type
-            {
-                currentState = bootloaderFSM(currentState, &fsmMessage);
-            }
-            
-        }
-        asm("wfi");
-    }
-}
-
-/**
- * @brief Initalize all bootloader data structures before FSM starts
- * 
- */
-void bootloaderInit()
-{
-    initRBQueue(&rx_message_q, (uint8_t*)rx_array, sizeof(rx_array)/sizeof(CanMsgTypeDef), sizeof(CanMsgTypeDef));
-    initRBQueue(&tx_message_q, (uint8_t*)tx_array, sizeof(tx_array)/sizeof(CanMsgTypeDef), sizeof(CanMsgTypeDef));
-
-    tempApplicationCRC = 0;
-    tempApplicationLength = 0;
-    flashedApplicationIndex = 0;
-
-    if(MAGIC_WORD != 0xDEADBEEF)
-    {
-        flashWriteU32((uint32_t) &BOOT_FLAG,  0xFA);
-    }
-        
-}
+static const bl_crc_hw_t crcUnit = {initCRC, accum32CRC, streamCRC, streamCRCBusy, stopStreamCRC, readCRC};
 
-/**
- * @brief Translate CANRx message into bootloader message data structure.
- * 
- * @param canMessage 
- * @param fsmMessage 
- * @return true CAN message translated into a valid Bootloader message
- * @return false otherwise
- */
-static bool decodeCANMsg(CanMsgTypeDef* canMessage, BLMessageData_t* fsmMessage)
-{
-    for(int i = 0; i < 8; i++)
-        ((uint8_t*)&(fsmMessage->all_data))[i] = ((uint8_t*)canMessage->Data)[i];
+static bl_node_t node;
 
-    return fsmMessage->generic.message_type <= M_APP_DATA;
-}
+// Milliseconds left on the node's one shot timer
+static volatile uint32_t timerTicks;
 
 /**
- * @brief Set the Boot Flags object stored in Flash
- * 
- * @param msg 
- * @return BLState_e 
+ * @brief DWT cycle counter, enabled by bootloaderInit()
+ *
+ * @return uint32_t Core clock cycles
  */
-static BLState_e setBootFlags(BLMessageData_t* msg)
+static uint32_t cycleCount()
 {
-    // BOOT_FLAG = msg->flag_set.operation_mode_flag;
-    flashWriteU32((uint32_t) &BOOT_FLAG,  msg->flag_set.operation_mode_flag);
-    return checkBootFlags(msg);
+    return DWT->CYCCNT;
 }
 
 /**
- * @brief Decide to flash a new application or launch current one based on
- * saved boot flag.
- * 
- * @param msg 
- * @return BLState_e 
+ * @brief One shot timer of the node on SysTick, 1 ms ticks. Posts EV_TIMER once and stops.
+ *
+ * @param us Time until EV_TIMER, rounded up to whole ticks. 0 stops the timer.
  */
-static BLState_e checkBootFlags(BLMessageData_t* msg)
+static void startTimer(uint32_t us)
 {
-    if (BOOT_FLAG == FLAG_BOOT_TO_APP)
-        return S_VALIDATE_FLASH;
-    
-    if (BOOT_FLAG == FLAG_FLASH_NEW_APP)
-        return S_WAIT_FOR_META;
-    
-    return S_RECOVERY;
+    SysTick->CTRL = 0;
+    timerTicks = (us + 999U) / 1000U;
+    if (timerTicks == 0)
+        return;
+
+    SysTick->LOAD = SystemCoreClock / 1000U - 1U;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
 }
 
-/**
- * @brief Store user supplied CRC and application lengths
- * 
- * @param msg 
- * @return BLState_e 
- */
-static BLState_e processMetadata(BLMessageData_t* msg)
+RAM_FUNC void SysTick_Handler()
 {
-    tempApplicationLength   = msg->metadata.application_length;
-    tempApplicationCRC      = msg->metadata.crc_value;
-    flashedApplicationIndex = APP_FLASH_START;
-    flashedApplicationEnd   = APP_FLASH_START + tempApplicationLength;
-
-    // Metadata for application recieved, begin waiting for application data.
-    return S_FLASH_APP;
-}
-
-/**
- * @brief Check the temparary CRC and lenght after flashing a new application
- * 
- * @param msg 
- * @return BLState_e 
- */
-static BLState_e checkFlashedCRC(BLMessageData_t* msg)
-{
-    BLState_e nextState = S_RECOVERY;
-    
-    if (calculateCRC(APP_FLASH_START, tempApplicationLength) == tempApplicationCRC)
+    if (timerTicks && --timerTicks == 0)
     {
-        // Recieved length and CRC passed the check, store new values and reboot
-        // SAVED_CRC = tempApplicationCRC;
-        // SAVED_APP_LENGTH = tempApplicationLength;
-        // BOOT_FLAG = FLAG_BOOT_TO_APP;
-
-        flashWriteU32((uint32_t) &SAVED_CRC, tempApplicationCRC);
-        flashWriteU32((uint32_t) &SAVED_APP_LENGTH, tempApplicationLength);
-        flashWriteU32((uint32_t) &BOOT_FLAG, FLAG_BOOT_TO_APP);
-
-        nextState = S_LAUNCH_APP;
-    } else {
-        // TODO: Send CRC Error
-        // BOOT_FLAG = FLAG_FLASH_NEW_APP;
-        flashWriteU32((uint32_t) &BOOT_FLAG, FLAG_FLASH_NEW_APP);
-
-        nextState = S_WAIT_FOR_META;
+        SysTick->CTRL = 0;
+        schedPost(&bl_sched, EV_TIMER);
     }
-
-    deinitCRC();
-    return nextState;
 }
 
 /**
- * @brief Recieve a word from outside world and program it according to a running counter.
- * Once all words have been recieved, proceed to check that all recieved data matches temp CRC.
- * 
- * @param msg 
- * @return BLState_e 
+ * @brief Begin main bootloader loop. Run the highest priority pending event, sleep once none is left.
+ *
  */
-static BLState_e flashApp(BLMessageData_t* msg)
+void bootloaderMain()
 {
-    // *((uint32_t*)flashedApplicationIndex++) = msg->app_data.app_data;
-    flashWriteU32((uint32_t) *((uint32_t*)flashedApplicationIndex++), msg->app_data.app_data);
-
-    if (flashedApplicationIndex == flashedApplicationEnd)
+    while (1)
     {
-        return S_CRC_CHECK;
+        if (schedRunOne(&bl_sched))
+            continue;
+
+        // With interrupts masked an interrupt still ends wfi, it is only taken after cpsie.
+        // A post that lands between the check and wfi can not be slept through.
+        __disable_irq();
+        if (!schedPending(&bl_sched))
+            asm("wfi");
+        __enable_irq();
     }
-    
-    return S_FLASH_APP;
 }
 
 /**
- * @brief Validate currently stored Flash application with saved CRC and lenght values.
- * If validation is sucessful, we will enter the Launch App state.
- * Otherwise, bootloader will wait for a new application to be flashed.
- * 
- * @param msg Not Used
- * @return BLState_e Next State
+ * @brief Initalize all bootloader data structures before FSM starts
+ *
+ * @param port CAN controller the bootloader talks through
  */
-static BLState_e validateFlash(BLMessageData_t* msg)
+void bootloaderInit(const can_port_t* port)
 {
-    BLState_e nextState = S_RECOVERY;
-    
-    if (calculateCRC(APP_FLASH_START, SAVED_APP_LENGTH) == SAVED_CRC)
-    {
-        // We have verified the integrety of the current flash. Go ahead and launch the application
-        nextState = S_LAUNCH_APP;
-    } else {
-        // TODO: Send CRC Error
-        // BOOT_FLAG = FLAG_FLASH_NEW_APP;
-        flashWriteU32((uint32_t) &BOOT_FLAG, FLAG_FLASH_NEW_APP);
+    static bl_node_hw_t hw;
+    bl_node_cfg_t cfg = {0};
 
-        nextState = S_WAIT_FOR_META;
-    }
+    initRBQueue(&rx_message_q, (uint8_t*)rx_array, sizeof(rx_array)/sizeof(CanMsgTypeDef), sizeof(CanMsgTypeDef));
+    initRBQueue(&tx_message_q, (uint8_t*)tx_array, sizeof(tx_array)/sizeof(CanMsgTypeDef), sizeof(CanMsgTypeDef));
 
-    deinitCRC();
-    return nextState;
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    hw.port    = port;
+    hw.program = flashWriteU32;
+    hw.erase   = flashEraseSector;
+    hw.crc     = &crcUnit;
+    hw.crcOff  = deinitCRC;
+    hw.cycles  = cycleCount;
+    hw.timer   = startTimer;
+
+    cfg.ecu_id              = BL_ECU_ID;
+    cfg.tx_id               = BL_TX_MSG_ID;
+    cfg.status_id           = BL_STATUS_MSG_ID;
+    cfg.flash               = (const uint8_t*) FLASH_BASE;
+    cfg.flash_address       = FLASH_BASE;
+    cfg.sector_bytes        = flashSectors;
+    cfg.sectors             = sizeof(flashSectors) / sizeof(flashSectors[0]);
+    cfg.shared_address      = SHARED_FLASH_ORIGIN;
+    cfg.shared_sector_bytes = SHARED_SECTOR_BYTES;
+    cfg.app_address         = APP_FLASH_ORIGIN;
+    cfg.app_length          = APP_FLASH_LENGTH;
+    cfg.handoff             = BL_HANDOFF;
+    cfg.can_clock           = CAN_CLOCK;
+#ifdef BL_UDS
+    cfg.uds_block_length    = BL_UDS_BLOCK_LENGTH;
+    cfg.uds_bs              = BL_UDS_BS;
+    cfg.uds_stmin           = BL_UDS_STMIN;
+#endif
+#ifdef BL_SIGNED_IMAGES
+    cfg.public_key          = bl_public_key;
+#endif
+#ifdef BL_ENCRYPTED_IMAGES
+    cfg.image_key           = bl_image_key;
+#endif
+
+    initNode(&node, &cfg, &hw, &bl_sched, &rx_message_q);
 }
 
 /**
- * @brief Prepare bootloader to launch user application
- * 
- * @param msg Not Used
- * @return BLState_e 
+ * @brief CAN1 bit timing, the one asked for by a warm re-entry or the default
+ *
+ * @return uint32_t BTR value
  */
-static BLState_e launchApp(BLMessageData_t* msg)
+uint32_t bootloaderBitTiming()
 {
-    return S_RECOVERY;
+    uint32_t btr = nodeBitTiming(&node);
+    return btr ? btr : CAN_BTR_DEFAULT;
 }
-
@@ -9,24 +9,95 @@
 #include <rb_queue.h>
 #include <bootloader.h>
 
+// Core exceptions plus every STM32F429 interrupt, DMA2D is the last one
+#define VECTOR_TABLE_WORDS (16U + DMA2D_IRQn + 1U)
+
+// Vector table copy in RAM, fetching a vector from flash stalls while flash is programmed or erased
+static uint32_t ramVectors[VECTOR_TABLE_WORDS] __attribute__((section(".ram_vector")));
+
+volatile uint32_t rxDuringFlashOp;      // Frames received while flash was busy, read with a debugger
+
+#ifdef BL_GATEWAY
+#include <can_gateway.h>
+
+// Bootloader traffic for BL_GATEWAY_ECUS is bridged from CAN1 to CAN2
+static can_gateway_t gateway;
+static CanMsgTypeDef gw_down_array [16];
+static CanMsgTypeDef gw_up_array [16];
+
+RAM_FUNC static bool gwTxPrimary(CanMsgTypeDef* msg)
+{
+    return txCANMessageAsync(CAN1, msg);
+}
+
+RAM_FUNC static bool gwTxSecondary(CanMsgTypeDef* msg)
+{
+    return txCANMessageAsync(CAN2, msg);
+}
+
+/**
+ * @brief Bootloader responses from the main loop. CAN1_TX and CAN2_RX0 load relayed frames into
+ * the CAN1 mailboxes, so they are masked while the main loop picks and fills a mailbox.
+ */
+static bool gwCan1Tx(CanMsgTypeDef* msg)
+{
+    NVIC_DisableIRQ(CAN1_TX_IRQn);
+    NVIC_DisableIRQ(CAN2_RX0_IRQn);
+    bool loaded = txCANMessageAsync(CAN1, msg);
+    NVIC_EnableIRQ(CAN2_RX0_IRQn);
+    NVIC_EnableIRQ(CAN1_TX_IRQn);
+    return loaded;
+}
+
+static void gwCan1RxResume(void)
+{
+    can1Port.rxResume();
+}
+
+static const can_port_t gwCan1Port = {
+    .tx = gwCan1Tx,
+    .rxResume = gwCan1RxResume,
+    .max_dlen = CAN_CLASSIC_DLEN,
+    .brs = false,
+};
+#endif
+
 int main (void)
 {
 
-    // Ensure that Vector table offset is carried over from linker script
-    // VTOR is set in the SystemInit() function to 0x08000000, as long as we do not
-    // Have an interrupt from SystemInit() to main(), we should be fine.
-    extern uint32_t* g_pfnVectors;
-    SCB->VTOR = (uint32_t) (&g_pfnVectors);
+    // Run the vector table from RAM. VTOR is set in the SystemInit() function to 0x08000000,
+    // as long as we do not have an interrupt from SystemInit() to main(), we should be fine.
+    // The handlers in .ramfunc were copied to RAM with .data by the startup code.
+    extern uint32_t g_pfnVectors[];
+    for (uint32_t i = 0; i < VECTOR_TABLE_WORDS; i++)
+        ramVectors[i] = g_pfnVectors[i];
+    SCB->VTOR = (uint32_t) ramVectors;
+    __DSB();
+
+    // Free running cycle counter for flashOpCycles
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
     /*************
      * Queue & Data Structure Setup
      *************/
-    bootloaderInit();
+#ifdef BL_GATEWAY
+    bootloaderInit(&gwCan1Port);
+    initGateway(&gateway, BL_RX_MSG_ID, BL_TX_MSG_ID, BL_STATUS_MSG_BASE, BL_GATEWAY_ECUS,
+                gw_down_array, sizeof(gw_down_array)/sizeof(CanMsgTypeDef),
+                gw_up_array, sizeof(gw_up_array)/sizeof(CanMsgTypeDef));
+#else
+    bootloaderInit(&can1Port);
+#endif
 
     /*************
      * Peripheral Setup
      *************/
-    initCAN1();
+    initCAN1(bootloaderBitTiming());
+    CAN1->IER |= CAN_IER_TMEIE;     // Wake up to refill CAN1 mailboxes while streaming
+#ifdef BL_GATEWAY
+    initCAN2();
+#endif
 
     /*************
      * Enable IRQ lines
@@ -34,6 +105,16 @@ int main (void)
 
     // CAN1 Interrupts
     NVIC_EnableIRQ(CAN1_RX0_IRQn);
+    NVIC_EnableIRQ(CAN1_TX_IRQn);
+
+    // Image check DMA, one event per chunk
+    NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+#ifdef BL_GATEWAY
+    // All CAN interrupts share the default priority so the gateway queues are never
+    // accessed by two handlers at once
+    NVIC_EnableIRQ(CAN2_RX0_IRQn);
+    NVIC_EnableIRQ(CAN2_TX_IRQn);
+#endif
 
     /*************
      * Main program loop
@@ -45,22 +126,92 @@ int main (void)
      *************/
     deinitCAN1();
     NVIC_DisableIRQ(CAN1_RX0_IRQn);
+    NVIC_DisableIRQ(CAN1_TX_IRQn);
+    NVIC_DisableIRQ(DMA2_Stream0_IRQn);
+#ifdef BL_GATEWAY
+    deinitCAN2();
+    NVIC_DisableIRQ(CAN2_RX0_IRQn);
+    NVIC_DisableIRQ(CAN2_TX_IRQn);
+#endif
 
 }
 
 static CanMsgTypeDef can_rx_msg;
 extern rb_queue_t rx_message_q;
-void CAN1_RX0_IRQHandler() 
+extern ev_sched_t bl_sched;
+RAM_FUNC void CAN1_RX0_IRQHandler() 
 {
     // Copy CAN frame into message buffer
-    *(&can_rx_msg.Data[0]) = (CAN1->sFIFOMailBox[0].RDLR);
-    *(&can_rx_msg.Data[4]) = (CAN1->sFIFOMailBox[0].RDHR);
+    rxCANMessage(CAN1, &can_rx_msg);
+
+    if (FLASH->SR & FLASH_SR_BSY)
+        rxDuringFlashOp++;
+
+#ifdef BL_GATEWAY
+    if (gatewayRoute(&gateway, GW_BUS_PRIMARY, &can_rx_msg))
+    {
+        CAN1->RF0R |= (CAN_RF0R_RFOM0); // Frame belongs to the secondary bus
+        gatewayPump(&gateway, GW_BUS_SECONDARY, gwTxSecondary);
+        return;
+    }
+#endif
+
+    // Filter bank 0 accepts everything, drop vehicle traffic and frames for other ECUs before they take a queue entry
+    bool accept = canMsgId(&can_rx_msg) == BL_RX_MSG_ID && (can_rx_msg.Data[0] >> 4) == BL_ECU_ID;
+#ifdef BL_UDS
+    accept = accept || canMsgId(&can_rx_msg) == BL_UDS_RX_ID;
+#endif
+    if (!accept)
+    {
+        CAN1->RF0R |= (CAN_RF0R_RFOM0);
+        return;
+    }
 
     if (rbEnqueue(&rx_message_q, &can_rx_msg))
     {
         CAN1->RF0R |= (CAN_RF0R_RFOM0); // Release this mailbox
-        NVIC_ClearPendingIRQ(CAN1_RX0_IRQn);
+        schedPost(&bl_sched, EV_RX_READY);
+        // NVIC_ClearPendingIRQ() is not inlined at -O0 and lives in flash
+        NVIC->ICPR[CAN1_RX0_IRQn >> 5] = 1U << (CAN1_RX0_IRQn & 0x1F);
     } else {
-        // We filled up our message queue! Do something about it
+        // Queue is full, leave the frame in FIFO0 and stop interrupting until
+        // bootloaderMain() frees an entry. Returning with the interrupt still
+        // enabled would re-enter this handler forever.
+        CAN1->IER &= ~(CAN_IER_FMPIE0);
     }    
-}
\ No newline at end of file
+}
+
+RAM_FUNC void CAN1_TX_IRQHandler()
+{
+    CAN1->TSR = CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2; // Clear request complete flags
+    schedPost(&bl_sched, EV_TX_FREE);
+#ifdef BL_GATEWAY
+    gatewayPump(&gateway, GW_BUS_PRIMARY, gwTxPrimary);
+#endif
+}
+
+// Also set when the stream is stopped, the event handler finds the check cancelled
+RAM_FUNC void DMA2_Stream0_IRQHandler()
+{
+    DMA2->LIFCR = DMA_LIFCR_CTCIF0;
+    schedPost(&bl_sched, EV_CRC_CHUNK);
+}
+
+#ifdef BL_GATEWAY
+static CanMsgTypeDef can2_rx_msg;
+RAM_FUNC void CAN2_RX0_IRQHandler()
+{
+    rxCANMessage(CAN2, &can2_rx_msg);
+    CAN2->RF0R |= (CAN_RF0R_RFOM0); // Release this mailbox
+
+    // Only bootloader responses and status reports are relayed, everything else on the secondary bus is ignored
+    if (gatewayRoute(&gateway, GW_BUS_SECONDARY, &can2_rx_msg))
+        gatewayPump(&gateway, GW_BUS_PRIMARY, gwTxPrimary);
+}
+
+RAM_FUNC void CAN2_TX_IRQHandler()
+{
+    CAN2->TSR = CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2; // Clear request complete flags
+    gatewayPump(&gateway, GW_BUS_SECONDARY, gwTxSecondary);
+}
+#endif
\ No newline at end of file
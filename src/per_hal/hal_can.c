@@ -16,10 +16,11 @@
 /**
  * @brief Initilize CAN1 peripheral using PA11 and PA12
  * 
+ * @param btr Bit timing, CAN_BTR_DEFAULT unless a warm re-entry asked for another bit rate
  * @return true Peripheral sucessfully initalized
  * @return false Peripheral stalled during initilization
  */
-bool initCAN1()
+bool initCAN1(uint32_t btr)
 {
     // Enable PA11 => CAN1_RX and PA12 => CAN_TX
     RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN;
@@ -43,8 +44,8 @@ bool initCAN1()
     while(!(CAN1->MSR & CAN_MSR_INAK))
         ; 
 
-    // Bit timing recovered from http://www.bittiming.can-wiki.info/
-    CAN1->BTR = 0x001c0063;
+    // Default bit timing recovered from http://www.bittiming.can-wiki.info/
+    CAN1->BTR = btr;
     
     // Keep the bus active
     CAN1->MCR |= CAN_MCR_ABOM;
@@ -83,50 +84,181 @@ bool deinitCAN1()
 }
 
 /**
- * @brief Find an empty TX mailbox and transmit a CAN message if one is found.
- * Function will block until sucessful transmission of message until a specified timeout.
+ * @brief Initilize CAN2 peripheral using PB12 and PB13
+ * CAN2 is a slave of CAN1 on the F4, so CAN1 clock must stay on and filter
+ * banks are shared. CAN2 owns every bank from @ref CAN2_FILTER_START up.
  * 
- * @param can CAN peripheral to transmit with
- * @param msgId Message ID
- * @return true Sucessful TX of message.
- * @return false Unable to find empty message or transmit took too long.
+ * @return true Peripheral sucessfully initalized
+ * @return false Peripheral stalled during initilization
  */
-bool txCANMessage(CAN_TypeDef* can, CanMsgTypeDef* msg)
+bool initCAN2()
 {
+    // Enable PB12 => CAN2_RX and PB13 => CAN2_TX
+    RCC->AHB1ENR |= RCC_AHB1ENR_GPIOBEN;
+
+    // Set to alternate function mode #9 for both PB12 and PB13
+    GPIOB->MODER &= ~(GPIO_MODER_MODE12_Msk | GPIO_MODER_MODE13_Msk);
+    GPIOB->MODER |= GPIO_MODER_MODER12_1 | GPIO_MODER_MODER13_1;
+    GPIOB->AFR[1] |= (9 << GPIO_AFRH_AFSEL12_Pos) | (9 << GPIO_AFRH_AFSEL13_Pos);
+
+    // CAN2 needs the CAN1 (master) clock for filter access
+    RCC->APB1ENR |= RCC_APB1ENR_CAN1EN | RCC_APB1ENR_CAN2EN;
+
+    // Leave SLEEP state
+    CAN2->MCR &= ~CAN_MCR_SLEEP; 
+    while(CAN2->MSR & CAN_MSR_SLAK)
+        ; 
+
+    // Enter INIT state
+    CAN2->MCR |= CAN_MCR_INRQ;
+    while(!(CAN2->MSR & CAN_MSR_INAK))
+        ; 
+
+    // Default bit timing, a warm re-entry only changes CAN1
+    CAN2->BTR = CAN_BTR_DEFAULT;
+
+    // Keep the bus active
+    CAN2->MCR |= CAN_MCR_ABOM;
 
+    // Setup filters for all IDs, filter banks only exist on CAN1
+    CAN1->FMR  |= CAN_FMR_FINIT;                                 // Enter init mode for filter banks
+    CAN1->FMR  &= ~(CAN_FMR_CAN2SB_Msk);
+    CAN1->FMR  |= (CAN2_FILTER_START << CAN_FMR_CAN2SB_Pos);     // Split banks between CAN1 and CAN2
+    CAN1->FM1R &= ~(1 << CAN2_FILTER_START);                     // Set bank to mask mode
+    CAN1->FS1R &= ~(1 << CAN2_FILTER_START);                     // Set bank to 16bit mode
+    CAN1->FA1R |= (1 << CAN2_FILTER_START);                      // Activate bank
+    CAN1->sFilterRegister[CAN2_FILTER_START].FR1 = 0;            // Set mask to 0
+    CAN1->sFilterRegister[CAN2_FILTER_START].FR2 = 0;
+    CAN1->FMR  &= ~CAN_FMR_FINIT;                                // Enable Filters
+
+    // Enable FIFO0 RX message pending and TX mailbox empty interrupts
+    CAN2->IER |= CAN_IER_FMPIE0 | CAN_IER_TMEIE;
+
+    // Enter NORMAL mode
+    CAN2->MCR &= ~CAN_MCR_INRQ;
+    while(CAN2->MSR & CAN_MSR_INAK)
+        ;
+
+    return true;
+}
+
+bool deinitCAN2()
+{
+    RCC->APB1RSTR |= RCC_APB1RSTR_CAN2RST;
+    RCC->AHB1RSTR |= RCC_AHB1RSTR_GPIOBRST;
+
+    RCC->AHB1ENR &= ~RCC_AHB1ENR_GPIOBEN;
+    RCC->APB1ENR &= ~RCC_APB1ENR_CAN2EN;
+    return true;
+}
+
+/**
+ * @brief Find an empty TX mailbox and load a CAN message into it.
+ * 
+ * @param can CAN peripheral to transmit with
+ * @param msg Message to load
+ * @return int8_t Mailbox number the message was loaded into, -1 if all mailboxes are busy
+ */
+RAM_FUNC static int8_t loadTxMailbox(CAN_TypeDef* can, CanMsgTypeDef* msg)
+{
     uint8_t txMbox = 0;
-    uint32_t timeout = 0;
-    uint32_t txOkay = 0;
 
     if (can->TSR & CAN_TSR_TME0)
-    {
         txMbox = 0;
-        txOkay = CAN_TSR_TXOK0;
-    }
     else if (can->TSR & CAN_TSR_TME1)
-    {
         txMbox = 1;
-        txOkay = CAN_TSR_TXOK1;
-    }
     else if (can->TSR & CAN_TSR_TME2)
-    {
         txMbox = 2;
-        txOkay = CAN_TSR_TXOK2;
-    }
     else   
-        return false;   // Unable to find Mailbox
+        return -1;   // Unable to find Mailbox
 
-    can->sTxMailBox[txMbox].TIR  = (msg->StdId << CAN_TI0R_STID_Pos);  // ID
+    if (msg->IDE == CAN_ID_EXT)
+        can->sTxMailBox[txMbox].TIR  = (msg->ExtId << CAN_TI0R_EXID_Pos) | CAN_TI0R_IDE;   // Extended ID
+    else
+        can->sTxMailBox[txMbox].TIR  = (msg->StdId << CAN_TI0R_STID_Pos);                  // ID
     can->sTxMailBox[txMbox].TDTR = (msg->DLC << CAN_TDT0R_DLC_Pos);    // Data Length
-    can->sTxMailBox[txMbox].TDLR = (uint32_t) *(&msg->Data[0]);        // Data
-    can->sTxMailBox[txMbox].TDHR = (uint32_t) *(&msg->Data[4]);        // Data
+    can->sTxMailBox[txMbox].TDLR = *((uint32_t*) &msg->Data[0]);       // Data
+    can->sTxMailBox[txMbox].TDHR = *((uint32_t*) &msg->Data[4]);       // Data
     
     can->sTxMailBox[txMbox].TIR |= (0b1 << CAN_TI0R_TXRQ_Pos);   // Request TX
 
-    while(!(can->TSR & txOkay) && timeout != TX_TIMEOUT)         // Wait for message to be sent within specified timeout
+    return txMbox;
+}
+
+/**
+ * @brief Find an empty TX mailbox and transmit a CAN message if one is found.
+ * Function will block until sucessful transmission of message until a specified timeout.
+ * 
+ * @param can CAN peripheral to transmit with
+ * @param msgId Message ID
+ * @return true Sucessful TX of message.
+ * @return false Unable to find empty message or transmit took too long.
+ */
+bool txCANMessage(CAN_TypeDef* can, CanMsgTypeDef* msg)
+{
+    static const uint32_t txOkay[] = {CAN_TSR_TXOK0, CAN_TSR_TXOK1, CAN_TSR_TXOK2};
+    uint32_t timeout = 0;
+    int8_t txMbox = loadTxMailbox(can, msg);
+
+    if (txMbox < 0)
+        return false;
+
+    while(!(can->TSR & txOkay[txMbox]) && timeout != TX_TIMEOUT)         // Wait for message to be sent within specified timeout
         timeout++;
 
     return timeout != TX_TIMEOUT;
 }
 
+/**
+ * @brief Queue a CAN message into an empty TX mailbox without waiting for it to go out on the bus.
+ * Used when frames are pipelined from interrupt context and completion is signaled by the TX mailbox empty IRQ.
+ * 
+ * @param can CAN peripheral to transmit with
+ * @param msg Message to send
+ * @return true Message loaded into a mailbox
+ * @return false All mailboxes busy
+ */
+RAM_FUNC bool txCANMessageAsync(CAN_TypeDef* can, CanMsgTypeDef* msg)
+{
+    return loadTxMailbox(can, msg) >= 0;
+}
+
+/**
+ * @brief Copy the frame at the head of RX FIFO0 into a message buffer.
+ * Does not release the FIFO mailbox, the caller decides when the frame is consumed.
+ * 
+ * @param can CAN peripheral to read from
+ * @param msg Where to copy the frame to
+ */
+RAM_FUNC void rxCANMessage(CAN_TypeDef* can, CanMsgTypeDef* msg)
+{
+    uint32_t rir = can->sFIFOMailBox[0].RIR;
+
+    msg->IDE   = (rir & CAN_RI0R_IDE) ? CAN_ID_EXT : CAN_ID_STD;
+    msg->StdId = (rir & CAN_RI0R_STID_Msk) >> CAN_RI0R_STID_Pos;
+    msg->ExtId = (rir & CAN_RI0R_EXID_Msk) >> CAN_RI0R_EXID_Pos;
+    msg->DLC   = (can->sFIFOMailBox[0].RDTR & CAN_RDT0R_DLC_Msk) >> CAN_RDT0R_DLC_Pos;
+    msg->FDF   = 0;     // bxCAN only does classic CAN
+    msg->BRS   = 0;
+    *((uint32_t*) &msg->Data[0]) = can->sFIFOMailBox[0].RDLR;
+    *((uint32_t*) &msg->Data[4]) = can->sFIFOMailBox[0].RDHR;
+}
+
+static bool can1Tx(CanMsgTypeDef* msg)
+{
+    return txCANMessageAsync(CAN1, msg);
+}
+
+static void can1RxResume(void)
+{
+    CAN1->IER |= CAN_IER_FMPIE0;
+}
+
+const can_port_t can1Port = {
+    .tx = can1Tx,
+    .rxResume = can1RxResume,
+    .max_dlen = CAN_CLASSIC_DLEN,
+    .brs = false,
+};
+
 #endif
\ No newline at end of file
@@ -46,17 +46,79 @@ uint32_t accum32CRC(uint32_t data)
 
 /**
  * @brief Calculate CRC of an arbitrary memory region. Will reset any previous CRC calculations.
+ * The last partial word is zero padded, like bl_crc does it.
  * 
  * @param start Flash memory start location
- * @param length Number of words to accumulate
+ * @param length Number of bytes to accumulate
  * @return uint32_t 
  */
 uint32_t calculateCRC(uint32_t start, uint32_t length)
 {
     initCRC();
-    for(uint32_t flash_index = start; flash_index < length + start; flash_index++)
-        accum32CRC(*((uint32_t*)(flash_index)));
+    for(uint32_t flash_index = start; flash_index < length + start; flash_index += 4)
+    {
+        uint32_t word = 0;
+        for (uint32_t b = 0; b < 4 && flash_index + b < length + start; b++)
+            word |= (uint32_t) *((uint8_t*)(flash_index + b)) << (8 * b);
+        accum32CRC(word);
+    }
     uint32_t final_crc = CRC->DR;
     deinitCRC();
     return final_crc;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Read the CRC unit without writing to it
+ * 
+ * @return uint32_t Accumulated CRC value
+ */
+uint32_t readCRC()
+{
+    return CRC->DR;
+}
+
+/**
+ * @brief Feed word aligned memory into CRC->DR with DMA2 stream 0. The F4 CRC unit has no DMA
+ * request, so the stream runs memory to memory: the peripheral port reads the source with
+ * increment, the memory port writes the fixed data register. Returns right away, the transfer
+ * complete interrupt fires once the chunk is in.
+ * 
+ * @param words Word aligned source
+ * @param count Words, at most 65535
+ */
+void streamCRC(const uint32_t* words, uint32_t count)
+{
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+
+    DMA2_Stream0->CR &= ~DMA_SxCR_EN;
+    while (DMA2_Stream0->CR & DMA_SxCR_EN);
+    DMA2->LIFCR = DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 | DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0;
+
+    DMA2_Stream0->PAR  = (uint32_t) words;
+    DMA2_Stream0->M0AR = (uint32_t) &CRC->DR;
+    DMA2_Stream0->NDTR = count;
+    DMA2_Stream0->FCR  = DMA_SxFCR_DMDIS | DMA_SxFCR_FTH;   // Direct mode is not allowed memory to memory
+    // Low priority so CAN and the CPU win the bus matrix
+    DMA2_Stream0->CR   = DMA_SxCR_DIR_1 | DMA_SxCR_PINC | DMA_SxCR_PSIZE_1 | DMA_SxCR_MSIZE_1 | DMA_SxCR_TCIE;
+    DMA2_Stream0->CR  |= DMA_SxCR_EN;
+}
+
+/**
+ * @brief Stream transfer still running
+ * 
+ * @return true DMA2 stream 0 is enabled
+ */
+bool streamCRCBusy()
+{
+    return DMA2_Stream0->CR & DMA_SxCR_EN;
+}
+
+/**
+ * @brief Abort a stream transfer, waits until the stream has stopped
+ * 
+ */
+void stopStreamCRC()
+{
+    DMA2_Stream0->CR &= ~DMA_SxCR_EN;
+    while (DMA2_Stream0->CR & DMA_SxCR_EN);
+}
@@ -11,7 +11,9 @@
 
 #include "per_hal/hal_flash.h"
 
-static void flashUnlock()
+volatile uint32_t flashOpCycles;    // DWT cycles of the last program or erase, read with a debugger
+
+RAM_FUNC static void flashUnlock()
 {
     while ((FLASH->SR & FLASH_SR_BSY))
         asm("nop");
@@ -22,13 +24,27 @@ static void flashUnlock()
     
 }
 
-static void flashLock()
+/**
+ * @brief Wait for the current operation in RAM, returning to code in flash would stall the core
+ * with interrupts held off until the operation is done
+ * 
+ * @param start DWT cycle count when the operation was started
+ */
+RAM_FUNC static void flashWait(uint32_t start)
+{
+    while ((FLASH->SR & FLASH_SR_BSY))
+        asm("nop");
+
+    flashOpCycles = DWT->CYCCNT - start;
+}
+
+RAM_FUNC static void flashLock()
 {
     __DSB();
     FLASH->CR |= FLASH_CR_LOCK;
 }
 
-void flashWriteU32(uint32_t address, uint32_t value)
+RAM_FUNC void flashWriteU32(uint32_t address, uint32_t value)
 {
     flashUnlock();
     // Set program size to 32bit
@@ -36,8 +52,23 @@ void flashWriteU32(uint32_t address, uint32_t value)
     FLASH->CR |= FLASH_CR_PSIZE_1;
 
     FLASH->CR |= FLASH_CR_PG;
+    uint32_t start = DWT->CYCCNT;
     *(__IO uint32_t*)address = value;
-    asm("nop");
-    asm("nop");
+    flashWait(start);
     flashLock();
 }
+
+RAM_FUNC void flashEraseSector(uint8_t sector)
+{
+    flashUnlock();
+    FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_PSIZE_Msk | FLASH_CR_SNB_Msk);   // PG is left set by flashWriteU32
+    FLASH->CR |= FLASH_CR_PSIZE_1;                          // x32 parallelism, 2.7 - 3.6 V
+    FLASH->CR |= FLASH_CR_SER | (sector << FLASH_CR_SNB_Pos);
+
+    uint32_t start = DWT->CYCCNT;
+    FLASH->CR |= FLASH_CR_STRT;
+    flashWait(start);
+
+    FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB_Msk);
+    flashLock();
+}
\ No newline at end of file
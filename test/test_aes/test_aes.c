@@ -0,0 +1,127 @@
+#include <unity.h>
+#include <aes128.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static void fromHex(uint8_t* out, const char* hex)
+{
+    for (size_t i = 0; hex[2 * i]; i++)
+    {
+        unsigned int byte;
+        sscanf(&hex[2 * i], "%2x", &byte);
+        out[i] = byte;
+    }
+}
+
+/**
+ * @brief FIPS-197 appendix C.1 and the appendix B cipher example
+ */
+void testAES_knownAnswers(void)
+{
+    uint8_t key[16], pt[16], ct[16], expected[16];
+    aes128_ctx_t ctx;
+
+    fromHex(key, "000102030405060708090a0b0c0d0e0f");
+    fromHex(pt,  "00112233445566778899aabbccddeeff");
+    fromHex(expected, "69c4e0d86a7b0430d8cdb78070b4c55a");
+    aes128Init(&ctx, key);
+    aes128EncryptBlock(&ctx, pt, ct);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, ct, 16, "FIPS-197 C.1");
+
+    fromHex(key, "2b7e151628aed2a6abf7158809cf4f3c");
+    fromHex(pt,  "3243f6a8885a308d313198a2e0370734");
+    fromHex(expected, "3925841d02dc09fbdc118597196a0b32");
+    aes128Init(&ctx, key);
+    aes128EncryptBlock(&ctx, pt, pt);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, pt, 16, "FIPS-197 B, in place");
+}
+
+/**
+ * @brief NIST SP 800-38A F.5.2 CTR-AES128.Decrypt
+ */
+void testAES_ctrSP80038A(void)
+{
+    uint8_t key[16], iv[16], data[64], expected[64];
+    aes128_ctr_t ctr;
+
+    fromHex(key, "2b7e151628aed2a6abf7158809cf4f3c");
+    fromHex(iv,  "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+    fromHex(data, "874d6191b620e3261bef6864990db6ce"
+                  "9806f66b7970fdff8617187bb9fffdff"
+                  "5ae4df3edbd5d35e5b4f09020db03eab"
+                  "1e031dda2fbe03d1792170a0f3009cee");
+    fromHex(expected, "6bc1bee22e409f96e93d7e117393172a"
+                      "ae2d8a571e03ac9c9eb76fac45af8e51"
+                      "30c81c46a35ce411e5fbc1191a0a52ef"
+                      "f69f2445df4f9b17ad2b417be66c3710");
+
+    aesCtrInit(&ctr, key, iv);
+    aesCtrCrypt(&ctr, data, sizeof(data));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, data, 64);
+}
+
+/**
+ * @brief Decrypting one block per call, as flashApp() does, matches one call over the image,
+ * including a short final block and a counter that carries across bytes
+ */
+void testAES_ctrBlockStream(void)
+{
+    uint8_t key[16], iv[16];
+    uint8_t image[1000], one_shot[1000];
+    aes128_ctr_t ctr;
+
+    fromHex(key, "000102030405060708090a0b0c0d0e0f");
+    fromHex(iv,  "00000000000000000000fffffffffffe");
+    for (uint32_t i = 0; i < sizeof(image); i++)
+        image[i] = one_shot[i] = (i * 31 + 7) & 0xFF;
+
+    aesCtrInit(&ctr, key, iv);
+    aesCtrCrypt(&ctr, one_shot, sizeof(one_shot));
+
+    aesCtrInit(&ctr, key, iv);
+    for (uint32_t i = 0; i < sizeof(image); i += AES_BLOCK_SIZE)
+        aesCtrCrypt(&ctr, &image[i], sizeof(image) - i < AES_BLOCK_SIZE ? sizeof(image) - i : AES_BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(one_shot, image, sizeof(image));
+
+    // Round trip
+    aesCtrInit(&ctr, key, iv);
+    aesCtrCrypt(&ctr, image, sizeof(image));
+    for (uint32_t i = 0; i < sizeof(image); i++)
+        TEST_ASSERT_EQUAL_HEX8((i * 31 + 7) & 0xFF, image[i]);
+}
+
+/**
+ * @brief Decryption must keep up with the bus. At 1 Mbit/s with 4 image bytes per frame the
+ * payload rate is roughly 25 kB/s, require an order of magnitude of headroom on native.
+ */
+void testAES_throughput(void)
+{
+    static uint8_t buffer[256 * 1024];
+    uint8_t key[16] = {0}, iv[16] = {0};
+    aes128_ctr_t ctr;
+    char info[128];
+
+    aesCtrInit(&ctr, key, iv);
+    clock_t start = clock();
+    for (uint32_t i = 0; i < sizeof(buffer); i += AES_BLOCK_SIZE)
+        aesCtrCrypt(&ctr, &buffer[i], AES_BLOCK_SIZE);
+    double s = (double) (clock() - start) / CLOCKS_PER_SEC;
+    double kbps = sizeof(buffer) / 1024.0 / (s > 0 ? s : 1e-6);
+
+    TEST_ASSERT_GREATER_THAN_MESSAGE(250, (int) kbps, "AES-CTR slower than 10x the CAN payload rate");
+
+    snprintf(info, sizeof(info), "AES-128-CTR on native: %.0f kB/s", kbps);
+    TEST_MESSAGE(info);
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testAES_knownAnswers);
+    RUN_TEST(testAES_ctrSP80038A);
+    RUN_TEST(testAES_ctrBlockStream);
+    RUN_TEST(testAES_throughput);
+
+    return UNITY_END();
+}
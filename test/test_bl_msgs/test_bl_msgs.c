@@ -0,0 +1,236 @@
+#include <unity.h>
+#include <bl_msgs.h>
+#include <string.h>
+
+#define RANDOM_FRAMES (10000U)
+
+/*
+*   BLMessageData_t as it was maintained by hand, GCC little endian bitfield layout
+*/
+typedef union {
+    uint64_t all_data;
+    struct { uint64_t message_type : 4, ecu_id : 4, not_used : 56; } generic;
+    struct { uint64_t message_type : 4, ecu_id : 4, app_data : 32, not_used : 24; } app_data;
+    struct { uint64_t message_type : 4, ecu_id : 4, operation_mode_flag : 2, not_used : 54; } flag_set;
+    struct { uint64_t message_type : 4, ecu_id : 4, application_length : 24, crc_value : 32; } metadata;
+    struct { uint64_t message_type : 4, ecu_id : 4, start_offset : 24, length : 24, window : 8; } read_req;
+    struct { uint64_t message_type : 4, ecu_id : 4, sequence : 8, not_used : 48; } read_ack;
+    struct { uint64_t message_type : 4, ecu_id : 4, word_index : 8, signature_word : 32, not_used : 16; } signature;
+    struct { uint64_t message_type : 4, ecu_id : 4, word_index : 8, iv_word : 32, not_used : 16; } cipher_iv;
+} legacy_rx_t;
+
+/*
+*   Bits of BL_RxMessage carried by each multiplexer value, byte 0 always
+*/
+static const uint64_t rx_coverage[10] = {
+    0x00000000000000FFULL,  // M_NONE
+    0x00000000000003FFULL,  // M_FLAG_SET
+    0xFFFFFFFFFFFFFFFFULL,  // M_METADATA
+    0x000000FFFFFFFFFFULL,  // M_APP_DATA
+    0xFFFFFFFFFFFFFFFFULL,  // M_READ_REQ
+    0x000000000000FFFFULL,  // M_READ_ACK
+    0x0000FFFFFFFFFFFFULL,  // M_SIGNATURE
+    0x0000FFFFFFFFFFFFULL,  // M_CIPHER_IV
+    0xFFFFFFFFFFFFFFFFULL,  // M_SEGMENT
+    0x0000FFFFFFFFFFFFULL,  // M_SEGMENT_CRC
+};
+
+static uint32_t seed = 0x12345678;
+
+static uint32_t nextRandom(void)
+{
+    seed = seed * 1664525 + 1013904223;
+    return seed;
+}
+
+static void randomFrame(uint8_t* data)
+{
+    for (int i = 0; i < 8; i++)
+        data[i] = nextRandom() >> 24;
+}
+
+static uint64_t frameBits(const uint8_t* data)
+{
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++)
+        bits |= (uint64_t) data[i] << (8 * i);
+    return bits;
+}
+
+void testBLMsgs_rxGolden(void)
+{
+    BLRxMessage_t msg = {0};
+    uint8_t data[8];
+    const uint8_t metadata[8] = {0x32, 0x45, 0x23, 0x01, 0xEF, 0xBE, 0xAD, 0xDE};
+    const uint8_t read_req[8] = {0x04, 0x00, 0x10, 0x00, 0x00, 0x00, 0x10, 0x20};
+
+    msg.message_type = 2;
+    msg.rx_ecuid = 3;
+    msg.application_length = 0x012345;
+    msg.crc_value = 0xDEADBEEF;
+    blPackRxMessage(&msg, data);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(metadata, data, 8);
+
+    memset(&msg, 0, sizeof(msg));
+    blUnpackRxMessage(read_req, &msg);
+    TEST_ASSERT_EQUAL_UINT8(4, msg.message_type);
+    TEST_ASSERT_EQUAL_UINT8(0, msg.rx_ecuid);
+    TEST_ASSERT_EQUAL_UINT32(0x1000, msg.read_start_offset);
+    TEST_ASSERT_EQUAL_UINT32(0x100000, msg.read_length);
+    TEST_ASSERT_EQUAL_UINT8(32, msg.read_window);
+
+    const uint8_t segment[8] = {0x38, 0x01, 0x00, 0x00, 0x07, 0x00, 0x40, 0x00};
+    memset(&msg, 0, sizeof(msg));
+    msg.message_type = 8;
+    msg.rx_ecuid = 3;
+    msg.segment_index = 1;
+    msg.segment_offset = 0x070000;
+    msg.segment_length = 0x004000;
+    blPackRxMessage(&msg, data);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(segment, data, 8);
+}
+
+/**
+ * @brief Unpack reads the same values the bitfield union did, so the FSM sees no change
+ */
+void testBLMsgs_rxMatchesLegacy(void)
+{
+    BLRxMessage_t msg;
+    legacy_rx_t legacy;
+
+    for (uint32_t n = 0; n < RANDOM_FRAMES; n++)
+    {
+        uint8_t data[8];
+        randomFrame(data);
+        memcpy(&legacy.all_data, data, 8);
+        blUnpackRxMessage(data, &msg);
+
+        TEST_ASSERT_EQUAL_UINT32(legacy.generic.message_type, msg.message_type);
+        TEST_ASSERT_EQUAL_UINT32(legacy.generic.ecu_id, msg.rx_ecuid);
+        TEST_ASSERT_EQUAL_UINT32(legacy.flag_set.operation_mode_flag, msg.op_mode_flag);
+        TEST_ASSERT_EQUAL_UINT32(legacy.metadata.application_length, msg.application_length);
+        TEST_ASSERT_EQUAL_UINT32(legacy.metadata.crc_value, msg.crc_value);
+        TEST_ASSERT_EQUAL_UINT32(legacy.app_data.app_data, msg.application_data);
+        TEST_ASSERT_EQUAL_UINT32(legacy.read_req.start_offset, msg.read_start_offset);
+        TEST_ASSERT_EQUAL_UINT32(legacy.read_req.length, msg.read_length);
+        TEST_ASSERT_EQUAL_UINT32(legacy.read_req.window, msg.read_window);
+        TEST_ASSERT_EQUAL_UINT32(legacy.read_ack.sequence, msg.read_ack_sequence);
+        TEST_ASSERT_EQUAL_UINT32(legacy.signature.word_index, msg.signature_index);
+        TEST_ASSERT_EQUAL_UINT32(legacy.signature.signature_word, msg.signature_data);
+        TEST_ASSERT_EQUAL_UINT32(legacy.cipher_iv.word_index, msg.cipher_iv_index);
+        TEST_ASSERT_EQUAL_UINT32(legacy.cipher_iv.iv_word, msg.cipher_iv_data);
+    }
+}
+
+/**
+ * @brief Frame -> unpack -> pack gives back every bit the multiplexer value carries, and
+ * nothing else is set
+ */
+void testBLMsgs_rxRoundTrip(void)
+{
+    BLRxMessage_t msg;
+    uint8_t data[8];
+    uint8_t packed[8];
+
+    for (uint32_t n = 0; n < RANDOM_FRAMES; n++)
+    {
+        randomFrame(data);
+        data[0] = (data[0] & 0xF0) | ((data[0] & 0xF) % 10);    // Multiplexer values 0-9 are defined
+        blUnpackRxMessage(data, &msg);
+        blPackRxMessage(&msg, packed);
+
+        uint64_t coverage = rx_coverage[msg.message_type];
+        TEST_ASSERT_EQUAL_HEX64(frameBits(data) & coverage, frameBits(packed));
+    }
+}
+
+/**
+ * @brief Signals of other multiplexer values and bits above a signal never reach the frame
+ */
+void testBLMsgs_rxPackMasks(void)
+{
+    BLRxMessage_t msg;
+    uint8_t data[8];
+
+    memset(&msg, 0xFF, sizeof(msg));
+    for (uint8_t type = 0; type < 10; type++)
+    {
+        msg.message_type = type;
+        msg.rx_ecuid = 0x5;
+        blPackRxMessage(&msg, data);
+        TEST_ASSERT_EQUAL_HEX64(rx_coverage[type] & ~0xFFULL, frameBits(data) & ~0xFFULL);
+        TEST_ASSERT_EQUAL_HEX8(0x50 | type, data[0]);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.message_type = 1;
+    msg.rx_ecuid = 0x1F;
+    msg.op_mode_flag = 0xFE;
+    blPackRxMessage(&msg, data);
+    TEST_ASSERT_EQUAL_HEX64(0x02F1, frameBits(data));
+}
+
+void testBLMsgs_status(void)
+{
+    BLStatusMessage_t msg = {0};
+    BLStatusMessage_t unpacked;
+    uint8_t data[8] = {0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA};
+    const uint8_t golden[8] = {0x75, 0x56, 0x34, 0x12, 0x01, 0x00, 0x10, 0x00};
+
+    msg.status_state = 5;
+    msg.status_ecuid = 7;
+    msg.status_words = 0x123456;
+    msg.status_crc_failed = 1;
+    msg.status_checked = 0x1000;
+    blPackStatusMessage(&msg, data);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(golden, data, 8);
+
+    data[4] = 0xFF;
+    blUnpackStatusMessage(data, &unpacked);
+    TEST_ASSERT_EQUAL_UINT8(5, unpacked.status_state);
+    TEST_ASSERT_EQUAL_UINT8(7, unpacked.status_ecuid);
+    TEST_ASSERT_EQUAL_UINT32(0x123456, unpacked.status_words);
+    TEST_ASSERT_EQUAL_UINT8(1, unpacked.status_crc_failed);
+    TEST_ASSERT_EQUAL_UINT32(0x1000, unpacked.status_checked);
+}
+
+void testBLMsgs_tx(void)
+{
+    BLTxMessage_t msg;
+    uint8_t data[8];
+    uint8_t packed[8];
+
+    for (uint32_t n = 0; n < RANDOM_FRAMES; n++)
+    {
+        randomFrame(data);
+        blUnpackTxMessage(data, &msg);
+        TEST_ASSERT_EQUAL_UINT8(data[0], msg.tx_sequence);
+        TEST_ASSERT_EQUAL_HEX64(frameBits(data) >> 8, msg.tx_data);
+
+        blPackTxMessage(&msg, packed);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(data, packed, 8);
+    }
+}
+
+void testBLMsgs_ids(void)
+{
+    TEST_ASSERT_EQUAL_HEX32(0x0C00FF10, BL_RX_MESSAGE_ID);
+    TEST_ASSERT_EQUAL_HEX32(0x0C01FEFE, BL_TX_MESSAGE_ID);
+    TEST_ASSERT_EQUAL_HEX32(0x0C00FE00, BL_STATUS_MESSAGE_ID);
+    TEST_ASSERT_EQUAL_UINT32(8, BL_RX_MESSAGE_DLC);
+    TEST_ASSERT_EQUAL_UINT32(8, BL_STATUS_MESSAGE_DLC);
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testBLMsgs_rxGolden);
+    RUN_TEST(testBLMsgs_rxMatchesLegacy);
+    RUN_TEST(testBLMsgs_rxRoundTrip);
+    RUN_TEST(testBLMsgs_rxPackMasks);
+    RUN_TEST(testBLMsgs_status);
+    RUN_TEST(testBLMsgs_tx);
+    RUN_TEST(testBLMsgs_ids);
+
+    return UNITY_END();
+}
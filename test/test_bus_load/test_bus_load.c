@@ -0,0 +1,299 @@
+#include <unity.h>
+#include <bus_load.h>
+#include <bl_rx_sim.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BL_RX_ID     (0x0C00FF10U)
+#define BITRATE      (1000000U)
+#define IMAGE_WORDS  (4096U)            // 16 kB application
+#define TESTER_PERIOD_NS (500000U)      // One frame every 0.5 ms, about a third of the bus
+
+/*
+*   Target costs, HSI 16 MHz and -O0 as in env:disco_f429zi. Flash program time is the
+*   RM0090 worst case for a 32 bit write, instruction fetch stalls for the whole operation.
+*/
+#define ISR_NS       (40000U)           // rxCANMessage + rbEnqueue
+#define DECODE_NS    (30000U)           // Dequeue, decodeCANMsg and FSM lookup
+#define FLASH_NS     (100000U)          // flashWriteU32
+
+/*
+*   Tester streaming an image at a fixed frame rate. The bootloader ID wins arbitration against
+*   almost every vehicle ID, so a tester sending back to back would starve the background traffic.
+*/
+static sim_tester_t tester;
+
+/*
+*   Bootloader session as seen by the FSM
+*/
+static struct {
+    bool metadata;
+    uint32_t words;                     // Data words programmed
+    uint32_t out_of_order;
+    uint64_t done_ns;
+} session;
+
+static can_sim_bus_t bus;
+static bl_rx_sim_t target;
+static bus_load_t load;
+
+static uint32_t sessionHandler(bl_rx_sim_t* sim, CanMsgTypeDef* msg, uint32_t* blocking_ns)
+{
+    if (canMsgId(msg) != BL_RX_ID)
+        return DECODE_NS;               // Foreign frame, decoded and dropped
+
+    if ((msg->Data[0] & 0xF) == 0x2)
+        session.metadata = true;
+
+    if ((msg->Data[0] & 0xF) == 0x3 && session.metadata)
+    {
+        if (simFrameValue(msg) != session.words)
+            session.out_of_order++;
+        session.words++;
+        if (session.words == IMAGE_WORDS)
+            session.done_ns = sim->cpu_free_ns + DECODE_NS + FLASH_NS;
+
+        *blocking_ns = FLASH_NS;
+        return DECODE_NS + FLASH_NS;
+    }
+
+    return DECODE_NS;
+}
+
+typedef struct {
+    bool complete;                      // Every word programmed in order
+    uint32_t bl_lost;
+    uint32_t overruns;
+    uint32_t high_water;
+    uint32_t stalls;
+    double stall_ms;
+    double flash_s;
+    double load_pct;                    // Measured background load
+} soak_result_t;
+
+/**
+ * @brief Stream one image while the generator keeps the bus loaded
+ */
+static soak_result_t runSoak(const bus_load_cfg_t* load_cfg, uint32_t depth, bool id_filter)
+{
+    bl_rx_sim_cfg_t rx_cfg = {
+        .queue_depth = depth,
+        .isr_ns = ISR_NS,
+        .id_filter = id_filter,
+        .accept_id = BL_RX_ID,
+    };
+    soak_result_t r;
+    uint64_t background_ns = 0;
+
+    uint64_t start_ns = 10000000;
+
+    memset(&session, 0, sizeof(session));
+
+    initCANSimBus(&bus, BITRATE);
+    initBLRxSim(&target, &bus, &rx_cfg, sessionHandler, 0);
+    initSimTester(&tester, &bus, BL_RX_ID, IMAGE_WORDS, IMAGE_WORDS + 2, TESTER_PERIOD_NS);
+    initBusLoad(&load, &bus, load_cfg);
+
+    // Let the background traffic settle before the session starts
+    busLoadStart(&load, 0, UINT64_MAX);
+    while (canSimNextStart(&bus) < start_ns)
+        canSimStep(&bus);
+    simTesterStart(&tester, start_ns);
+
+    // Run until the tester is done, the background generator never runs dry
+    uint64_t session_busy = bus.busy_ns;
+    uint32_t bl_frames = tester.node.tx_count;
+    while (!simTesterDone(&tester))
+        canSimStep(&bus);
+    blRxSimRun(&target, UINT64_MAX);
+
+    CanMsgTypeDef bl_frame;
+    simFrame(&bl_frame, BL_RX_ID, 0x3, 0);
+    background_ns = bus.busy_ns - session_busy - (tester.node.tx_count - bl_frames) * canSimFrameTime(&bus, &bl_frame);
+
+    r.complete = session.words == IMAGE_WORDS && session.out_of_order == 0;
+    r.bl_lost = target.accept_overruns;
+    r.overruns = target.overruns;
+    r.high_water = target.high_water;
+    r.stalls = target.stalls;
+    r.stall_ms = target.stall_ns / 1e6;
+    r.flash_s = r.complete ? (session.done_ns - tester.start_ns) / 1e9 : 0;
+    r.load_pct = 100.0 * background_ns / (bus.now_ns - tester.start_ns);
+    return r;
+}
+
+static bus_load_cfg_t vehicleLoad(uint8_t load_pct)
+{
+    bus_load_cfg_t cfg = {
+        .load_pct = load_pct,
+        .id_min = 0x000,
+        .id_max = 0x7FF,
+        .ext_pct = 20,
+        .dlc_min = 0,
+        .burst_max = 8,
+        .seed = 0xC0FFEE,
+    };
+    return cfg;
+}
+
+/**
+ * @brief candump -l and Vector ASC lines, skipping everything that is not a classic data frame
+ */
+void testBusLoad_parseLogs(void)
+{
+    CanMsgTypeDef msg;
+    uint64_t t;
+
+    TEST_ASSERT_TRUE(busLoadParseLine("(1436509052.249713) can0 123#DEADBEEF\n", &msg, &t));
+    TEST_ASSERT_EQUAL_UINT64(1436509052249713000ULL, t);
+    TEST_ASSERT_EQUAL_UINT32(CAN_ID_STD, msg.IDE);
+    TEST_ASSERT_EQUAL_HEX32(0x123, msg.StdId);
+    TEST_ASSERT_EQUAL_UINT32(4, msg.DLC);
+    TEST_ASSERT_EQUAL_HEX8(0xEF, msg.Data[3]);
+
+    TEST_ASSERT_TRUE(busLoadParseLine("(0.5) vcan0 0C00FF10#", &msg, &t));
+    TEST_ASSERT_EQUAL_UINT64(500000000ULL, t);
+    TEST_ASSERT_EQUAL_UINT32(CAN_ID_EXT, msg.IDE);
+    TEST_ASSERT_EQUAL_HEX32(0x0C00FF10, msg.ExtId);
+    TEST_ASSERT_EQUAL_UINT32(0, msg.DLC);
+
+    TEST_ASSERT_TRUE(busLoadParseLine("   1.234567 1  18FF0010x       Rx   d 8 01 02 03 04 05 06 07 08", &msg, &t));
+    TEST_ASSERT_EQUAL_UINT64(1234567000ULL, t);
+    TEST_ASSERT_EQUAL_UINT32(CAN_ID_EXT, msg.IDE);
+    TEST_ASSERT_EQUAL_HEX32(0x18FF0010, msg.ExtId);
+    TEST_ASSERT_EQUAL_UINT32(8, msg.DLC);
+    TEST_ASSERT_EQUAL_HEX8(0x08, msg.Data[7]);
+
+    TEST_ASSERT_TRUE(busLoadParseLine("2.000100 2 7E8 Tx d 3 02 41 0C", &msg, &t));
+    TEST_ASSERT_EQUAL_HEX32(0x7E8, msg.StdId);
+    TEST_ASSERT_EQUAL_UINT32(3, msg.DLC);
+
+    TEST_ASSERT_FALSE(busLoadParseLine("(0.1) can0 123#R", &msg, &t));
+    TEST_ASSERT_FALSE(busLoadParseLine("(0.1) can0 123##1DEADBEEF", &msg, &t));
+    TEST_ASSERT_FALSE(busLoadParseLine("date Mon May 3 10:00:00 am 2021", &msg, &t));
+    TEST_ASSERT_FALSE(busLoadParseLine("base hex  timestamps absolute", &msg, &t));
+    TEST_ASSERT_FALSE(busLoadParseLine("   0.000000 Start of measurement", &msg, &t));
+    TEST_ASSERT_FALSE(busLoadParseLine("   0.010000 1  ErrorFrame", &msg, &t));
+    TEST_ASSERT_FALSE(busLoadParseLine("", &msg, &t));
+}
+
+/**
+ * @brief Generated traffic hits the requested bus load
+ */
+void testBusLoad_generatorLoad(void)
+{
+    uint8_t targets[] = {10, 30, 60, 90};
+
+    for (int i = 0; i < sizeof(targets); i++)
+    {
+        bus_load_cfg_t cfg = vehicleLoad(targets[i]);
+        initCANSimBus(&bus, BITRATE);
+        initBusLoad(&load, &bus, &cfg);
+        busLoadStart(&load, 0, 2000000000ULL);
+        while (canSimStep(&bus))
+            ;
+
+        double measured = 100.0 * bus.busy_ns / 2e9;
+        TEST_ASSERT_FLOAT_WITHIN(3.0, targets[i], measured);
+    }
+}
+
+/**
+ * @brief Replayed frames keep their recorded spacing and order
+ */
+void testBusLoad_replay(void)
+{
+    static const char log[] =
+        "(1620000000.000000) can0 100#0011223344556677\n"
+        "(1620000000.001000) can0 0CFE6CEE#0102030405060708\n"
+        "garbage line\n"
+        "(1620000000.001000) can0 050#AA\n"
+        "(1620000000.005500) can0 7FF#\n";
+    uint64_t start = 3000000;
+
+    initCANSimBus(&bus, BITRATE);
+    initBusReplay(&load, &bus, log);
+    busLoadStart(&load, start, UINT64_MAX);
+
+    TEST_ASSERT_TRUE(canSimStep(&bus));
+    TEST_ASSERT_EQUAL_UINT64(start + canSimFrameTime(&bus, &(CanMsgTypeDef){.IDE = CAN_ID_STD, .DLC = 8}), bus.now_ns);
+
+    // Both frames logged at 1 ms are ready together, the generator keeps log order
+    TEST_ASSERT_TRUE(canSimStep(&bus));
+    TEST_ASSERT_EQUAL_UINT64(start + 1000000 + canSimFrameTime(&bus, &(CanMsgTypeDef){.IDE = CAN_ID_EXT, .DLC = 8}), bus.now_ns);
+    TEST_ASSERT_TRUE(canSimStep(&bus));
+
+    TEST_ASSERT_TRUE(canSimStep(&bus));
+    TEST_ASSERT_EQUAL_UINT64(start + 5500000 + canSimFrameTime(&bus, &(CanMsgTypeDef){.IDE = CAN_ID_STD, .DLC = 0}), bus.now_ns);
+
+    TEST_ASSERT_FALSE(canSimStep(&bus));
+    TEST_ASSERT_EQUAL_UINT32(4, load.generated);
+}
+
+/**
+ * @brief Receive path under load: the ISR backs off when the queue is full and the main loop
+ * catches up, a fourth frame while FIFO0 is full is lost
+ */
+void testBusLoad_fifoOverrun(void)
+{
+    bus_load_cfg_t cfg = vehicleLoad(95);
+    cfg.dlc_min = 0;
+    cfg.burst_max = 32;
+
+    soak_result_t r = runSoak(&cfg, 3, false);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, r.stalls);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, r.overruns);
+    TEST_ASSERT_EQUAL_UINT32(3, r.high_water);
+    TEST_ASSERT_FALSE_MESSAGE(r.complete, "Lost data words must be detected");
+}
+
+/**
+ * @brief Sweep background load and queue depth, with and without dropping foreign IDs in the
+ * ISR. Prints the capacity table and checks the shipped configuration (10 entries, ISR filter).
+ */
+void testBusLoad_capacityTable(void)
+{
+    uint8_t loads[] = {0, 20, 40, 60, 80, 90};
+    uint32_t depths[] = {3, 10, 32};
+    char line[160];
+
+    TEST_MESSAGE("Capacity at 1 Mbit/s, 16 kB image sent every 0.5 ms, 20% extended IDs, DLC 0-8, bursts up to 8");
+    TEST_MESSAGE("filter depth load%  ok  bl_lost overruns high_water stalls stall_ms flash_s");
+
+    for (int f = 0; f < 2; f++)
+    {
+        for (int d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+        {
+            for (int l = 0; l < sizeof(loads); l++)
+            {
+                bus_load_cfg_t cfg = vehicleLoad(loads[l]);
+                soak_result_t r = runSoak(&cfg, depths[d], f);
+
+                snprintf(line, sizeof(line), "%-6s %5u %5.1f %3s %8u %8u %10u %6u %8.1f %7.2f",
+                         f ? "isr" : "none", depths[d], r.load_pct, r.complete ? "yes" : "NO",
+                         r.bl_lost, r.overruns, r.high_water, r.stalls, r.stall_ms, r.flash_s);
+                TEST_MESSAGE(line);
+
+                if (f && depths[d] == 10)
+                {
+                    TEST_ASSERT_TRUE_MESSAGE(r.complete, line);
+                    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, r.bl_lost, line);
+                }
+            }
+        }
+    }
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testBusLoad_parseLogs);
+    RUN_TEST(testBusLoad_generatorLoad);
+    RUN_TEST(testBusLoad_replay);
+    RUN_TEST(testBusLoad_fifoOverrun);
+    RUN_TEST(testBusLoad_capacityTable);
+
+    return UNITY_END();
+}
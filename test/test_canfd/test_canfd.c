@@ -0,0 +1,292 @@
+#include <unity.h>
+#include <bl_transport.h>
+#include <bl_orchestrator.h>
+#include <bl_node_sim.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef BL_CAN_FD
+#error "test_canfd needs 64 byte frame buffers, run it in env:native_canfd"
+#endif
+
+#define BL_RX_ID     (0x0C00FF10U)
+#define BL_STATUS_ID (0x0C00FE00U)     // BL_STATUS_MSG_BASE
+#define BITRATE      (500000U)          // Arbitration phase
+#define DATA_BITRATE (2000000U)         // Common CAN FD data phase
+#define QUEUE_DEPTH  (10U)              // rx_message_q
+#define TIMEOUT_US   (1000000U)
+#define IMAGE_BYTES  (16U * 1024U)
+#define FLASH_BYTES  (128U * 1024U)     // Sectors 0 to 4
+
+/*
+*   Target costs, HSI 16 MHz and -O0 as in env:disco_f429zi
+*/
+#define ISR_NS       (40000U)           // rxCANMessage + rbEnqueue
+#define DECODE_NS    (30000U)           // Dequeue, decodeCANMsg and FSM lookup
+#define PROGRAM_NS   (100000U)          // flashWriteU32
+#define CRC_WORD_NS  (1250U)            // Image check per word
+
+void testCanFD_dlc(void)
+{
+    static const uint8_t lengths[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+    for (uint32_t dlc = 0; dlc < 16; dlc++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(lengths[dlc], canDlcLength(dlc, true));
+        TEST_ASSERT_EQUAL_UINT8(dlc < 8 ? dlc : 8, canDlcLength(dlc, false));
+        TEST_ASSERT_EQUAL_UINT32(dlc, canLengthDlc(lengths[dlc]));
+    }
+    TEST_ASSERT_EQUAL_UINT32(9, canLengthDlc(9));
+    TEST_ASSERT_EQUAL_UINT32(13, canLengthDlc(25));
+    TEST_ASSERT_EQUAL_UINT32(15, canLengthDlc(62));
+
+    // Never more than the controller takes, never below a classic frame
+    TEST_ASSERT_EQUAL_UINT32(15, transportNegotiate(15, CAN_FD_DLEN));
+    TEST_ASSERT_EQUAL_UINT32(11, transportNegotiate(11, CAN_FD_DLEN));
+    TEST_ASSERT_EQUAL_UINT32(8, transportNegotiate(15, CAN_CLASSIC_DLEN));
+    TEST_ASSERT_EQUAL_UINT32(8, transportNegotiate(3, CAN_FD_DLEN));
+    TEST_ASSERT_EQUAL_UINT32(8, transportNegotiate(0, CAN_FD_DLEN));
+
+    TEST_ASSERT_EQUAL_UINT8(1, transportFrameWords(8));
+    TEST_ASSERT_EQUAL_UINT8(2, transportFrameWords(9));
+    TEST_ASSERT_EQUAL_UINT8(7, transportFrameWords(13));
+    TEST_ASSERT_EQUAL_UINT8(TRANSPORT_WORDS_MAX, transportFrameWords(15));
+}
+
+/**
+ * @brief FD data frames pad to the next FD length, the first word sits where BL_ApplicationData does
+ */
+void testCanFD_packing(void)
+{
+    uint32_t words[TRANSPORT_WORDS_MAX];
+    uint32_t out[TRANSPORT_WORDS_MAX];
+    CanMsgTypeDef msg;
+    BLRxMessage_t rx;
+
+    for (uint8_t i = 0; i < TRANSPORT_WORDS_MAX; i++)
+        words[i] = 0x01020304U * (i + 1);
+
+    for (uint8_t count = 1; count <= TRANSPORT_WORDS_MAX; count++)
+    {
+        memset(&msg, 0xA5, sizeof(msg));
+        transportPackData(&msg, 0x3 | (7 << 4), words, count, true);
+
+        TEST_ASSERT_EQUAL_UINT8(1, msg.FDF);
+        TEST_ASSERT_EQUAL_UINT8(1, msg.BRS);
+        TEST_ASSERT_EQUAL_UINT32(canLengthDlc(2 + 4 * count), msg.DLC);
+        TEST_ASSERT_EQUAL_UINT8(count, transportUnpackData(&msg, out));
+        TEST_ASSERT_EQUAL_MEMORY(words, out, 4 * count);
+
+        blUnpackRxMessage(msg.Data, &rx);
+        TEST_ASSERT_EQUAL_UINT8(0x3, rx.message_type);
+        TEST_ASSERT_EQUAL_UINT8(7, rx.rx_ecuid);
+        TEST_ASSERT_EQUAL_HEX32(words[0], rx.application_data);
+    }
+
+    // Word count past the end of the frame
+    transportPackData(&msg, 0x3, words, 2, false);
+    msg.Data[canDlcLength(msg.DLC, true) - 1] = 3;
+    TEST_ASSERT_EQUAL_UINT8(0, transportUnpackData(&msg, out));
+    msg.Data[canDlcLength(msg.DLC, true) - 1] = 0;
+    TEST_ASSERT_EQUAL_UINT8(0, transportUnpackData(&msg, out));
+
+    // Classic frames carry one word, no count
+    BLRxMessage_t frame = {.message_type = 0x3, .application_data = 0xDEADBEEF};
+    msg.DLC = BL_RX_MESSAGE_DLC;
+    msg.FDF = 0;
+    blPackRxMessage(&frame, msg.Data);
+    TEST_ASSERT_EQUAL_UINT8(1, transportUnpackData(&msg, out));
+    TEST_ASSERT_EQUAL_HEX32(0xDEADBEEF, out[0]);
+}
+
+/**
+ * @brief FD frames only pass once the session agreed on FD, and only up to the agreed length
+ */
+void testCanFD_accept(void)
+{
+    uint32_t words[TRANSPORT_WORDS_MAX] = {0};
+    CanMsgTypeDef msg = {.DLC = 8};
+
+    // Classic frames pass in any session
+    TEST_ASSERT_TRUE(transportAccepts(&msg, TRANSPORT_CLASSIC_DLC));
+    TEST_ASSERT_TRUE(transportAccepts(&msg, 15));
+
+    // Never negotiated
+    transportPackData(&msg, 0x3, words, 1, false);
+    TEST_ASSERT_FALSE(transportAccepts(&msg, TRANSPORT_CLASSIC_DLC));
+
+    // 7 words is DLC 13 (32 bytes)
+    transportPackData(&msg, 0x3, words, 7, true);
+    TEST_ASSERT_TRUE(transportAccepts(&msg, 15));
+    TEST_ASSERT_TRUE(transportAccepts(&msg, 13));
+    TEST_ASSERT_FALSE(transportAccepts(&msg, 12));
+}
+
+/**
+ * @brief Only the data phase of a frame with BRS runs at the data bit rate
+ */
+void testCanFD_frameTime(void)
+{
+    can_sim_bus_t bus;
+    CanMsgTypeDef classic = {.IDE = CAN_ID_EXT, .DLC = 8};
+    CanMsgTypeDef fd = {.IDE = CAN_ID_EXT, .DLC = 15, .FDF = 1};
+    CanMsgTypeDef fd_brs = {.IDE = CAN_ID_EXT, .DLC = 15, .FDF = 1, .BRS = 1};
+    CanMsgTypeDef fd_short = {.IDE = CAN_ID_STD, .DLC = 8, .FDF = 1};
+
+    initCANSimFDBus(&bus, BITRATE, DATA_BITRATE);
+
+    // Classic frames keep their length
+    TEST_ASSERT_EQUAL_UINT32(67 + 64 + (54 + 64 - 1) / 4, canSimFrameBits(&classic));
+    TEST_ASSERT_EQUAL_UINT64(canSimFrameBits(&classic) * 2000ULL, canSimFrameTime(&bus, &classic));
+
+    // 64 bytes, extended ID: 56 arbitration, ACK and EOF bits, 679 data phase bits with CRC21
+    TEST_ASSERT_EQUAL_UINT32(56 + 679, canSimFrameBits(&fd));
+    TEST_ASSERT_EQUAL_UINT64(735 * 2000ULL, canSimFrameTime(&bus, &fd));
+    TEST_ASSERT_EQUAL_UINT64(56 * 2000ULL + 679 * 500ULL, canSimFrameTime(&bus, &fd_brs));
+
+    // 8 bytes, standard ID: CRC17
+    TEST_ASSERT_EQUAL_UINT32(17 + 4 + 12 + 69 + 17 + 4 + 17 + 6 + 1, canSimFrameBits(&fd_short));
+
+    // Without a data bit rate the whole frame runs at the nominal rate
+    initCANSimBus(&bus, BITRATE);
+    TEST_ASSERT_EQUAL_UINT64(canSimFrameTime(&bus, &fd), canSimFrameTime(&bus, &fd_brs));
+}
+
+/*
+*   Bootloader node on an FD bus, the CAN controller of the node decides what it can take
+*/
+static bl_node_sim_t ecu;
+static uint8_t ecu_flash[FLASH_BYTES];
+
+static sim_host_t host;
+static can_sim_bus_t bus;
+static uint8_t image[IMAGE_BYTES];
+
+typedef struct {
+    bool done;
+    uint8_t data_dlc;
+    bool brs;
+    double ms;
+    uint32_t data_frames;
+    double busy_pct;
+    uint32_t overruns;
+} session_result_t;
+
+/**
+ * @brief Flash IMAGE_BYTES to one ECU
+ * 
+ * @param max_dlen Largest payload of the ECU's CAN controller
+ * @param dlc Data length code the tester asks for, 8 for a classic session
+ * @param brs Tester asks for bit rate switching
+ */
+static session_result_t runSession(uint8_t max_dlen, uint8_t dlc, bool brs)
+{
+    bl_node_sim_cfg_t node_cfg = {
+        .rx = {
+            .queue_depth = QUEUE_DEPTH,
+            .isr_ns = ISR_NS,
+            .id_filter = true,
+            .accept_id = BL_RX_ID,
+        },
+        .max_dlen = max_dlen,
+        .brs = max_dlen > CAN_CLASSIC_DLEN,
+        .frame_ns = DECODE_NS,
+        .program_ns = PROGRAM_NS,
+        .crc_word_ns = CRC_WORD_NS,
+    };
+    bl_manifest_entry_t entry = {0};
+    can_sim_bus_t* buses[] = {&bus};
+    session_result_t r;
+
+    for (uint32_t i = 0; i < IMAGE_BYTES; i++)
+        image[i] = (i * 31 + (i >> 9)) & 0xFF;
+    entry.image = image;
+    entry.length = IMAGE_BYTES;
+    entry.crc = simImageCRC(image, IMAGE_BYTES);
+
+    initCANSimFDBus(&bus, BITRATE, DATA_BITRATE);
+    initBLNodeSim(&ecu, &bus, &node_cfg, ecu_flash, sizeof(ecu_flash));
+    initSimHost(&host, &bus);
+
+    initOrchestrator(&host.orch, &entry, 1, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0);
+    if (dlc > TRANSPORT_CLASSIC_DLC)
+        orchestratorTransport(&host.orch, dlc, brs);
+    simHostPump(&host, 0);
+    simHostRun(&host, buses, 1, &ecu, 1);
+
+    r.done = host.orch.jobs[0].state == JOB_DONE && memcmp(blNodeSimApp(&ecu), image, IMAGE_BYTES) == 0;
+    r.data_dlc = host.orch.jobs[0].data_dlc;
+    r.brs = host.orch.jobs[0].brs;
+    r.ms = (host.orch.jobs[0].end_us - host.orch.jobs[0].start_us) / 1e3;
+    r.data_frames = ecu.rx.processed;
+    r.busy_pct = 100.0 * bus.busy_ns / bus.now_ns;
+    r.overruns = ecu.rx.overruns;
+    return r;
+}
+
+/**
+ * @brief 16 kB at 500 kbit/s. Classic frames keep the bus busy the whole session, 64 byte frames
+ * with BRS move the limit to flash programming.
+ */
+void testCanFD_session(void)
+{
+    static const struct {
+        const char* name;
+        uint8_t max_dlen;
+        uint8_t dlc;
+        bool brs;
+    } runs[] = {
+        {"classic",          CAN_CLASSIC_DLEN, 8,  false},
+        {"fd 64 B",          CAN_FD_DLEN,      15, false},
+        {"fd 64 B, brs",     CAN_FD_DLEN,      15, true},
+        {"fd 16 B, brs",     CAN_FD_DLEN,      10, true},
+        {"bxcan ecu",        CAN_CLASSIC_DLEN, 15, true},
+    };
+    session_result_t r[sizeof(runs) / sizeof(runs[0])];
+    char line[128];
+
+    TEST_MESSAGE("16 kB, 500 kbit/s arbitration, 2 Mbit/s data");
+    TEST_MESSAGE("session        dlc  brs  frames   time_ms  kB/s  bus_busy");
+    for (int i = 0; i < sizeof(runs) / sizeof(runs[0]); i++)
+    {
+        r[i] = runSession(runs[i].max_dlen, runs[i].dlc, runs[i].brs);
+        snprintf(line, sizeof(line), "%-13s %4u %4u %7u %9.1f %5.1f %8.0f%%", runs[i].name, r[i].data_dlc, r[i].brs,
+                 r[i].data_frames, r[i].ms, IMAGE_BYTES / 1024.0 / (r[i].ms / 1e3), r[i].busy_pct);
+        TEST_MESSAGE(line);
+        TEST_ASSERT_TRUE(r[i].done);
+        TEST_ASSERT_EQUAL_UINT32(0, r[i].overruns);
+    }
+
+    // Classic session unchanged, one word per frame
+    TEST_ASSERT_EQUAL_UINT8(8, r[0].data_dlc);
+    TEST_ASSERT_TRUE(r[0].data_frames >= IMAGE_BYTES / 4);
+
+    // 15 words per frame
+    TEST_ASSERT_EQUAL_UINT8(15, r[1].data_dlc);
+    TEST_ASSERT_TRUE(r[1].data_frames < IMAGE_BYTES / 4 / 10);
+    TEST_ASSERT_FALSE(r[1].brs);
+    TEST_ASSERT_TRUE(r[1].ms < r[0].ms);
+    TEST_ASSERT_TRUE(r[2].brs);
+    TEST_ASSERT_TRUE(r[2].ms < r[1].ms);
+    TEST_ASSERT_TRUE(r[2].ms * 2 < r[0].ms);
+    TEST_ASSERT_EQUAL_UINT8(10, r[3].data_dlc);
+
+    // A classic controller answers with DLC 8 and the session falls back to classic frames
+    TEST_ASSERT_EQUAL_UINT8(8, r[4].data_dlc);
+    TEST_ASSERT_FALSE(r[4].brs);
+    TEST_ASSERT_TRUE(r[4].data_frames >= IMAGE_BYTES / 4);
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testCanFD_dlc);
+    RUN_TEST(testCanFD_packing);
+    RUN_TEST(testCanFD_accept);
+    RUN_TEST(testCanFD_frameTime);
+    RUN_TEST(testCanFD_session);
+
+    return UNITY_END();
+}
@@ -0,0 +1,250 @@
+#include <unity.h>
+#include <bl_crc.h>
+#include <sim_tester.h>
+#include <stdio.h>
+#include <string.h>
+
+#define REGION_WORDS (40000U)
+#define DMA_POLLS    (3U)               // Polls a transfer stays busy
+
+static uint32_t region_words[REGION_WORDS];
+static uint8_t* region = (uint8_t*) region_words;
+
+/*
+*   CRC unit and DMA stream model. A transfer is busy for DMA_POLLS polls, then feeds all its words.
+*/
+static struct {
+    sim_crc_unit_t cpu;                 // Data register and writes by the CPU
+    const uint32_t* src;
+    uint32_t count;
+    uint32_t busy_polls;
+    bool active;
+
+    uint32_t dma_words;
+    uint32_t transfers;
+    uint32_t max_transfer;
+    uint32_t stops;
+    bool misaligned;
+} unit;
+
+static void unitStream(const uint32_t* words, uint32_t count)
+{
+    if ((uintptr_t) words & 0x3)
+        unit.misaligned = true;
+    unit.src = words;
+    unit.count = count;
+    unit.busy_polls = DMA_POLLS;
+    unit.active = true;
+    unit.transfers++;
+    if (count > unit.max_transfer)
+        unit.max_transfer = count;
+}
+
+static bool unitBusy(void)
+{
+    if (!unit.active)
+        return false;
+    if (unit.busy_polls)
+    {
+        unit.busy_polls--;
+        return true;
+    }
+
+    for (uint32_t i = 0; i < unit.count; i++)
+        unit.cpu.dr = crcSoftware(unit.cpu.dr, unit.src[i]);
+    unit.dma_words += unit.count;
+    unit.active = false;
+    return false;
+}
+
+static void unitStop(void)
+{
+    unit.active = false;
+    unit.stops++;
+}
+
+static const bl_crc_hw_t dma_hw = {simCRCUnitReset, simCRCUnitFeed, unitStream, unitBusy, unitStop, simCRCUnitValue};
+
+/**
+ * @brief calculateCRC() before the fix: a 32 bit read at every byte address
+ */
+static uint32_t crcByteStride(const uint8_t* data, uint32_t length, uint32_t* writes)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        uint32_t word = 0;
+        memcpy(&word, &data[i], 4);
+        crc = crcSoftware(crc, word);
+        (*writes)++;
+    }
+    return crc;
+}
+
+static void setUpRegion(void)
+{
+    uint32_t seed = 0xC0FFEE;
+    for (uint32_t i = 0; i < REGION_WORDS * 4; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        region[i] = seed >> 24;
+    }
+    memset(&unit, 0, sizeof(unit));
+    simCRCUnitSelect(&unit.cpu);
+}
+
+/**
+ * @brief crcSoftware() is the reference of every test, pin it to values that do not come from it
+ */
+void testCRC_unitModel(void)
+{
+    // STM32 CRC unit after reset, one write of 0x12345678
+    TEST_ASSERT_EQUAL_HEX32(0xDF8A8A2B, crcSoftware(0xFFFFFFFF, 0x12345678));
+    TEST_ASSERT_EQUAL_HEX32(0xDF8A8A2B, simImageCRC((const uint8_t*) "\x78\x56\x34\x12", 4));
+
+    // CRC-32/MPEG-2 of "12345678", one byte at a time, with the words as the unit sees them
+    TEST_ASSERT_EQUAL_HEX32(0x49E3C2FB, crcSoftware(crcSoftware(0xFFFFFFFF, 0x31323334), 0x35363738));
+}
+
+/**
+ * @brief Every start alignment, tail length and chunk size against the reference, with the
+ * DMA stream and with CPU feeding only
+ */
+void testCRC_matchesReference(void)
+{
+    bl_crc_t crc;
+    const uint32_t lengths[] = {0, 1, 2, 3, 4, 5, 7, 8, 1023, 4 * 4096, 4 * 4096 + 3, 4 * REGION_WORDS - 8};
+    const uint32_t chunks[] = {1, 7, 4096, CRC_MAX_CHUNK_WORDS};
+    uint32_t runs = 0;
+
+    setUpRegion();
+    for (int c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++)
+    {
+        for (uint32_t offset = 0; offset < 8; offset++)
+        {
+            for (int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+            {
+                uint32_t expected = simImageCRC(region + offset, lengths[l]);
+
+                initCRCEngine(&crc, &dma_hw, chunks[c]);
+                TEST_ASSERT_EQUAL_HEX32(expected, crcRun(&crc, region + offset, lengths[l]));
+                TEST_ASSERT_EQUAL_UINT32(lengths[l], crcProgress(&crc));
+
+                initCRCEngine(&crc, &simCRCUnitHw, chunks[c]);
+                TEST_ASSERT_EQUAL_HEX32(expected, crcRun(&crc, region + offset, lengths[l]));
+                runs += 2;
+            }
+        }
+    }
+
+    TEST_ASSERT_FALSE(unit.misaligned);
+    TEST_ASSERT_TRUE(unit.max_transfer <= CRC_MAX_CHUNK_WORDS);
+    TEST_ASSERT_TRUE(runs > 0);
+}
+
+/**
+ * @brief The old loop advanced one byte per 32 bit read: four times the data register writes
+ * and a CRC no tester computes
+ */
+void testCRC_byteStride(void)
+{
+    bl_crc_t crc;
+    uint32_t length = 16 * 1024;
+    uint32_t writes = 0;
+    char line[96];
+
+    setUpRegion();
+    uint32_t legacy = crcByteStride(region, length, &writes);
+
+    initCRCEngine(&crc, &simCRCUnitHw, 4096);
+    uint32_t fixed = crcRun(&crc, region, length);
+
+    snprintf(line, sizeof(line), "16 kB: %u writes byte stride, %u word stride", writes, unit.cpu.words);
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_EQUAL_HEX32(simImageCRC(region, length), fixed);
+    TEST_ASSERT_TRUE(legacy != fixed);
+    TEST_ASSERT_EQUAL_UINT32(length, writes);
+    TEST_ASSERT_EQUAL_UINT32(length / 4, unit.cpu.words);
+}
+
+/**
+ * @brief Aligned data only goes through the stream, polls return at once while a chunk is busy
+ * and progress moves one chunk at a time
+ */
+void testCRC_progress(void)
+{
+    bl_crc_t crc;
+    uint32_t length = 4 * 10000 + 2;
+    uint32_t polls = 0;
+    uint32_t reports = 0;
+    uint32_t last = 0;
+
+    setUpRegion();
+    initCRCEngine(&crc, &dma_hw, 1024);
+    crcStart(&crc, region, length);
+
+    while (crc.state == CRC_RUNNING)
+    {
+        polls++;
+        if (crcPoll(&crc))
+        {
+            uint32_t progress = crcProgress(&crc);
+            TEST_ASSERT_TRUE(progress > last);
+            TEST_ASSERT_TRUE(progress == length || progress % (4 * 1024) == 0);
+            last = progress;
+            reports++;
+        }
+    }
+
+    TEST_ASSERT_EQUAL(CRC_DONE, crc.state);
+    TEST_ASSERT_EQUAL_HEX32(simImageCRC(region, length), crc.result);
+    TEST_ASSERT_EQUAL_UINT32(10, unit.transfers);
+    TEST_ASSERT_EQUAL_UINT32(10000, unit.dma_words);
+    TEST_ASSERT_EQUAL_UINT32(1, unit.cpu.words);                // Zero padded tail
+    TEST_ASSERT_EQUAL_UINT32(10, reports);                      // The tail goes with the last chunk
+    TEST_ASSERT_EQUAL_UINT32(10 * (DMA_POLLS + 1) + 1, polls);
+}
+
+/**
+ * @brief Cancel stops the running transfer, a new start gives the right CRC again
+ */
+void testCRC_cancel(void)
+{
+    bl_crc_t crc;
+    uint32_t length = 4 * REGION_WORDS;
+
+    setUpRegion();
+    initCRCEngine(&crc, &dma_hw, 4096);
+    crcStart(&crc, region, length);
+    for (int i = 0; i < 3 * (DMA_POLLS + 1); i++)
+        crcPoll(&crc);
+    TEST_ASSERT_TRUE(unit.active);
+
+    crcCancel(&crc);
+    TEST_ASSERT_EQUAL(CRC_CANCELLED, crc.state);
+    TEST_ASSERT_FALSE(unit.active);
+    TEST_ASSERT_EQUAL_UINT32(1, unit.stops);
+    TEST_ASSERT_EQUAL_UINT32(2 * 4 * 4096, crcProgress(&crc));
+    TEST_ASSERT_FALSE(crcPoll(&crc));
+
+    // Start while running cancels as well
+    crcStart(&crc, region, length);
+    crcPoll(&crc);
+    TEST_ASSERT_EQUAL_HEX32(simImageCRC(region + 4, 1000), crcRun(&crc, region + 4, 1000));
+    TEST_ASSERT_EQUAL_UINT32(2, unit.stops);
+
+    TEST_ASSERT_EQUAL_HEX32(simImageCRC(region, length), crcRun(&crc, region, length));
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testCRC_unitModel);
+    RUN_TEST(testCRC_matchesReference);
+    RUN_TEST(testCRC_byteStride);
+    RUN_TEST(testCRC_progress);
+    RUN_TEST(testCRC_cancel);
+
+    return UNITY_END();
+}
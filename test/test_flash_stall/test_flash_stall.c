@@ -0,0 +1,218 @@
+#include <unity.h>
+#include <bus_load.h>
+#include <bl_rx_sim.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BL_RX_ID     (0x0C00FF10U)
+#define BITRATE      (1000000U)
+#define QUEUE_DEPTH  (10U)              // rx_message_q
+#define IMAGE_WORDS  (4096U)            // 16 kB application
+#define TESTER_PERIOD_NS (500000U)      // One frame every 0.5 ms
+
+/*
+*   Target costs, HSI 16 MHz and -O0 as in env:disco_f429zi. Program and erase times are the
+*   datasheet maximums for x32 parallelism, a 16 kB sector is what the boot metadata journal erases.
+*/
+#define ISR_NS       (40000U)           // rxCANMessage + rbEnqueue
+#define DECODE_NS    (30000U)           // Dequeue, decodeCANMsg and FSM lookup
+#define PROGRAM_NS   (100000U)          // flashWriteU32
+#define ERASE_NS     (500000000U)       // flashEraseSector, 16 kB sector
+
+/*
+*   Tester sending M_FLAG_SET, M_METADATA and then data words at a fixed rate.
+*/
+static sim_tester_t tester;
+
+/*
+*   Bootloader session as seen by the FSM
+*/
+static struct {
+    bool ram_resident;                  // Flash driver and RX path run from RAM
+    bool erase_on_flag;                 // M_FLAG_SET triggers a journal compaction
+    uint32_t bl_frames;                 // Bootloader frames handled by the main loop
+    uint32_t words;
+    uint32_t out_of_order;
+} session;
+
+static can_sim_bus_t bus;
+static bl_rx_sim_t target;
+static bus_load_t load;
+
+/**
+ * @brief Flash operations stall instruction fetch from the same bank. With the driver in flash
+ * the ISR can not run until the operation is done, with the driver in RAM only the main loop waits.
+ */
+static uint32_t flashOp(uint32_t op_ns, uint32_t* blocking_ns)
+{
+    *blocking_ns = session.ram_resident ? 0 : op_ns;
+    return op_ns;
+}
+
+static uint32_t sessionHandler(bl_rx_sim_t* sim, CanMsgTypeDef* msg, uint32_t* blocking_ns)
+{
+    uint8_t type = msg->Data[0] & 0xF;
+
+    if (canMsgId(msg) != BL_RX_ID)
+        return DECODE_NS;
+
+    session.bl_frames++;
+
+    if (type == 0x1 && session.erase_on_flag)
+        return DECODE_NS + flashOp(ERASE_NS, blocking_ns);
+
+    if (type == 0x3)
+    {
+        if (simFrameValue(msg) != session.words)
+            session.out_of_order++;
+        session.words++;
+        return DECODE_NS + flashOp(PROGRAM_NS, blocking_ns);
+    }
+
+    return DECODE_NS;
+}
+
+typedef struct {
+    uint32_t bl_lost;
+    uint32_t overruns;
+    uint32_t high_water;
+    double max_latency_us;
+    bool accounted;                     // Every bootloader frame was either handled or lost
+} stall_result_t;
+
+/**
+ * @brief Send `frames` bootloader frames while the generator keeps the bus loaded
+ */
+static stall_result_t runSession(uint32_t frames, uint8_t load_pct, bool ram_resident, bool erase_on_flag)
+{
+    bl_rx_sim_cfg_t rx_cfg = {
+        .queue_depth = QUEUE_DEPTH,
+        .isr_ns = ISR_NS,
+        .id_filter = true,
+        .accept_id = BL_RX_ID,
+    };
+    bus_load_cfg_t load_cfg = {
+        .load_pct = load_pct,
+        .id_min = 0x000,
+        .id_max = 0x7FF,
+        .ext_pct = 20,
+        .dlc_min = 0,
+        .burst_max = 8,
+        .seed = 0xC0FFEE,
+    };
+    stall_result_t r;
+
+    uint64_t start_ns = 10000000;
+
+    memset(&session, 0, sizeof(session));
+    session.ram_resident = ram_resident;
+    session.erase_on_flag = erase_on_flag;
+
+    initCANSimBus(&bus, BITRATE);
+    initBLRxSim(&target, &bus, &rx_cfg, sessionHandler, 0);
+    initSimTester(&tester, &bus, BL_RX_ID, IMAGE_WORDS, frames, TESTER_PERIOD_NS);
+    initBusLoad(&load, &bus, &load_cfg);
+
+    busLoadStart(&load, 0, UINT64_MAX);
+    while (canSimNextStart(&bus) < start_ns)
+        canSimStep(&bus);
+    simTesterStart(&tester, start_ns);
+
+    while (!simTesterDone(&tester))
+        canSimStep(&bus);
+
+    // Keep the background traffic running until the target has caught up
+    while (!isRBQueueEmpty(&target.q) || target.fifo_count)
+    {
+        canSimStep(&bus);
+        blRxSimRun(&target, bus.now_ns);
+    }
+    blRxSimRun(&target, UINT64_MAX);
+
+    r.bl_lost = target.accept_overruns;
+    r.overruns = target.overruns;
+    r.high_water = target.high_water;
+    r.max_latency_us = target.max_latency_ns / 1e3;
+    r.accounted = session.bl_frames + r.bl_lost == frames;
+    return r;
+}
+
+/**
+ * @brief While a word is programmed the RAM resident ISR keeps draining FIFO0, so no frame waits
+ * for the flash operation. From flash the ISR is held off for the whole program time.
+ */
+void testFlashStall_programLatency(void)
+{
+    char line[128];
+
+    stall_result_t flash = runSession(IMAGE_WORDS + 2, 60, false, false);
+    stall_result_t ram = runSession(IMAGE_WORDS + 2, 60, true, false);
+
+    snprintf(line, sizeof(line), "16 kB image at 60%% load: max RX latency %.0f us from flash, %.0f us from RAM",
+             flash.max_latency_us, ram.max_latency_us);
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_TRUE(flash.accounted && ram.accounted);
+    TEST_ASSERT_EQUAL_UINT32(0, ram.bl_lost);
+    TEST_ASSERT_EQUAL_UINT32(0, session.out_of_order);
+    TEST_ASSERT_EQUAL_UINT32(IMAGE_WORDS, session.words);
+    TEST_ASSERT_TRUE(flash.max_latency_us * 1e3 >= PROGRAM_NS);
+    TEST_ASSERT_TRUE(ram.max_latency_us * 1e3 <= BL_RX_SIM_HW_FIFO * ISR_NS + ISR_NS);
+}
+
+/**
+ * @brief M_FLAG_SET compacts the journal and erases a sector while the tester keeps sending.
+ * From flash the ISR is held off, FIFO0 fills with vehicle frames and the whole burst is lost.
+ * From RAM the ISR keeps filtering, and bootloader frames are lost only once rx_message_q is full.
+ */
+void testFlashStall_eraseBurst(void)
+{
+    uint32_t bursts[] = {3, 6, QUEUE_DEPTH, 16, 64};
+    char line[128];
+
+    TEST_MESSAGE("Frames sent during a 16 kB sector erase, 60% background load, 10 entry queue");
+    TEST_MESSAGE("burst driver bl_lost overruns high_water max_latency_ms");
+
+    for (int b = 0; b < sizeof(bursts) / sizeof(bursts[0]); b++)
+    {
+        for (int ram_resident = 0; ram_resident < 2; ram_resident++)
+        {
+            // Flag frame plus the burst, all sent before the erase is done
+            stall_result_t r = runSession(1 + bursts[b], 60, ram_resident, true);
+
+            snprintf(line, sizeof(line), "%5u %-6s %7u %8u %10u %14.1f", bursts[b], ram_resident ? "ram" : "flash",
+                     r.bl_lost, r.overruns, r.high_water, r.max_latency_us / 1e3);
+            TEST_MESSAGE(line);
+
+            TEST_ASSERT_TRUE_MESSAGE(r.accounted, line);
+
+            if (ram_resident && bursts[b] <= QUEUE_DEPTH)
+            {
+                TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, r.bl_lost, line);
+                TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, r.overruns, line);
+            }
+            else if (ram_resident)
+            {
+                // Queue full, the ISR backs off and FIFO0 fills with whatever comes next
+                TEST_ASSERT_TRUE_MESSAGE(r.bl_lost <= bursts[b] - QUEUE_DEPTH, line);
+            }
+            else
+            {
+                // Vehicle traffic fills FIFO0 long before the first bootloader frame arrives
+                TEST_ASSERT_EQUAL_UINT32_MESSAGE(bursts[b], r.bl_lost, line);
+                TEST_ASSERT_TRUE_MESSAGE(r.max_latency_us * 1e3 >= ERASE_NS, line);
+            }
+        }
+    }
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testFlashStall_programLatency);
+    RUN_TEST(testFlashStall_eraseBurst);
+
+    return UNITY_END();
+}
@@ -0,0 +1,314 @@
+#include <unity.h>
+#include <can_gateway.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+#include <stdio.h>
+
+#define BL_RX_ID    (0x0C00FF10U)
+#define BL_TX_ID    (0x0C01FEFEU)
+#define BL_STATUS_BASE (0x0C00FE00U)   // BL_STATUS_MSG_BASE
+#define ECU_REMOTE  (3U)
+#define ECU_LOCAL   (1U)
+
+#define FRAME_COUNT (2000U)
+#define WINDOW      (32U)
+#define ACK_EVERY   (8U)
+
+/*
+*   Simulated tester: streams FRAME_COUNT app data frames to ECU_REMOTE keeping
+*   at most WINDOW frames un-acknowledged.
+*/
+static struct {
+    can_sim_node_t node;
+    uint32_t sent;
+    uint32_t acked;
+} tester;
+
+/*
+*   Simulated target ECU: checks ordering and acknowledges every ACK_EVERY frames.
+*/
+static struct {
+    can_sim_node_t node;
+    uint32_t received;
+    uint32_t out_of_order;
+    bool ack_pending;
+    uint64_t last_rx_ns;
+} ecu;
+
+/*
+*   Bridge node with one controller on each bus
+*/
+static struct {
+    can_sim_node_t primary;
+    can_sim_node_t secondary;
+    can_gateway_t gw;
+    CanMsgTypeDef down_array[16];
+    CanMsgTypeDef up_array[16];
+    uint32_t local;
+} bridge;
+
+static can_sim_bus_t bus_a;
+static can_sim_bus_t bus_b;
+static uint64_t now_ns;
+
+static void testerFill(uint64_t t)
+{
+    CanMsgTypeDef msg;
+    while (tester.sent < FRAME_COUNT && tester.sent - tester.acked < WINDOW)
+    {
+        simFrame(&msg, BL_RX_ID, (ECU_REMOTE << 4) | 0x3, tester.sent);
+        if (!canSimTransmit(&tester.node, &msg, t))
+            break;
+        tester.sent++;
+    }
+}
+
+static void testerRx(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t t)
+{
+    if (canMsgId(msg) == BL_TX_ID)
+        tester.acked = simFrameValue(msg);
+    testerFill(t);
+}
+
+static void testerTxDone(can_sim_node_t* node, uint64_t t)
+{
+    testerFill(t);
+}
+
+static void ecuSendAck(uint64_t t)
+{
+    CanMsgTypeDef msg;
+    simFrame(&msg, BL_TX_ID, 0, ecu.received);
+    ecu.ack_pending = !canSimTransmit(&ecu.node, &msg, t);
+}
+
+static void ecuRx(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t t)
+{
+    if (canMsgId(msg) != BL_RX_ID || (msg->Data[0] >> 4) != ECU_REMOTE)
+        return;
+
+    if (simFrameValue(msg) != ecu.received)
+        ecu.out_of_order++;
+    ecu.received++;
+    ecu.last_rx_ns = t;
+
+    if (ecu.received % ACK_EVERY == 0 || ecu.received == FRAME_COUNT)
+        ecuSendAck(t);
+}
+
+static void ecuTxDone(can_sim_node_t* node, uint64_t t)
+{
+    if (ecu.ack_pending)
+        ecuSendAck(t);
+}
+
+static bool bridgeTxPrimary(CanMsgTypeDef* msg)
+{
+    return canSimTransmit(&bridge.primary, msg, now_ns);
+}
+
+static bool bridgeTxSecondary(CanMsgTypeDef* msg)
+{
+    return canSimTransmit(&bridge.secondary, msg, now_ns);
+}
+
+// Mirrors CAN1_RX0_IRQHandler in gateway mode
+static void bridgePrimaryRx(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t t)
+{
+    now_ns = t;
+    if (gatewayRoute(&bridge.gw, GW_BUS_PRIMARY, msg))
+        gatewayPump(&bridge.gw, GW_BUS_SECONDARY, bridgeTxSecondary);
+    else
+        bridge.local++;
+}
+
+// Mirrors CAN2_RX0_IRQHandler
+static void bridgeSecondaryRx(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t t)
+{
+    now_ns = t;
+    if (gatewayRoute(&bridge.gw, GW_BUS_SECONDARY, msg))
+        gatewayPump(&bridge.gw, GW_BUS_PRIMARY, bridgeTxPrimary);
+}
+
+// Mirrors CAN1_TX_IRQHandler
+static void bridgePrimaryTxDone(can_sim_node_t* node, uint64_t t)
+{
+    now_ns = t;
+    gatewayPump(&bridge.gw, GW_BUS_PRIMARY, bridgeTxPrimary);
+}
+
+// Mirrors CAN2_TX_IRQHandler
+static void bridgeSecondaryTxDone(can_sim_node_t* node, uint64_t t)
+{
+    now_ns = t;
+    gatewayPump(&bridge.gw, GW_BUS_SECONDARY, bridgeTxSecondary);
+}
+
+static void resetNodes(void)
+{
+    tester.sent = tester.acked = 0;
+    ecu.received = ecu.out_of_order = 0;
+    ecu.ack_pending = false;
+    ecu.last_rx_ns = 0;
+    bridge.local = 0;
+    initGateway(&bridge.gw, BL_RX_ID, BL_TX_ID, BL_STATUS_BASE, (1U << ECU_REMOTE),
+                bridge.down_array, 16, bridge.up_array, 16);
+}
+
+/**
+ * @brief Run both buses in time order until neither has traffic left
+ */
+static void runBuses(void)
+{
+    while (canSimPending(&bus_a) || canSimPending(&bus_b))
+    {
+        if (canSimNextStart(&bus_a) <= canSimNextStart(&bus_b))
+            canSimStep(&bus_a);
+        else
+            canSimStep(&bus_b);
+    }
+}
+
+/**
+ * @brief Session with tester and ECU on the same bus, used as the reference time
+ */
+static uint64_t runDirect(void)
+{
+    resetNodes();
+    initCANSimBus(&bus_a, 500000);
+    initCANSimBus(&bus_b, 500000);
+    canSimAttach(&bus_a, &tester.node, testerRx, testerTxDone, 0);
+    canSimAttach(&bus_a, &ecu.node, ecuRx, ecuTxDone, 0);
+
+    testerFill(0);
+    runBuses();
+    return ecu.last_rx_ns;
+}
+
+/**
+ * @brief Same session with the ECU behind the bridge on the secondary bus
+ */
+static uint64_t runBridged(uint32_t secondary_bitrate)
+{
+    resetNodes();
+    initCANSimBus(&bus_a, 500000);
+    initCANSimBus(&bus_b, secondary_bitrate);
+    canSimAttach(&bus_a, &tester.node, testerRx, testerTxDone, 0);
+    canSimAttach(&bus_a, &bridge.primary, bridgePrimaryRx, bridgePrimaryTxDone, 0);
+    canSimAttach(&bus_b, &bridge.secondary, bridgeSecondaryRx, bridgeSecondaryTxDone, 0);
+    canSimAttach(&bus_b, &ecu.node, ecuRx, ecuTxDone, 0);
+
+    testerFill(0);
+    runBuses();
+    return ecu.last_rx_ns;
+}
+
+/**
+ * @brief Only commands for mapped ECUs and responses from the secondary bus are forwarded
+ */
+void testGateway_routing(void)
+{
+    CanMsgTypeDef msg;
+    resetNodes();
+
+    simFrame(&msg, BL_RX_ID, (ECU_REMOTE << 4) | 0x3, 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_PRIMARY, &msg) == true,  "Mapped ECU forwarded down");
+
+    simFrame(&msg, BL_RX_ID, (ECU_LOCAL << 4) | 0x3, 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_PRIMARY, &msg) == false, "Local ECU kept");
+
+    simFrame(&msg, 0x123, (ECU_REMOTE << 4), 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_PRIMARY, &msg) == false, "Unrelated traffic kept");
+
+    simFrame(&msg, BL_TX_ID, 0, 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_PRIMARY, &msg) == false, "Responses not sent back down");
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_SECONDARY, &msg) == true, "Responses forwarded up");
+
+    simFrame(&msg, BL_RX_ID, (ECU_REMOTE << 4) | 0x3, 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_SECONDARY, &msg) == false, "Commands not sent back up");
+
+    // Status reports of every ECU ID, and nothing past the last one
+    simFrame(&msg, BL_STATUS_BASE | ECU_REMOTE, 0, 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_PRIMARY, &msg) == false, "Status not sent back down");
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_SECONDARY, &msg) == true, "Status forwarded up");
+    simFrame(&msg, BL_STATUS_BASE, 0, 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_SECONDARY, &msg) == true, "Status of ECU 0 forwarded up");
+    simFrame(&msg, BL_STATUS_BASE + GW_STATUS_IDS - 1, 0, 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_SECONDARY, &msg) == true, "Status of ECU 15 forwarded up");
+    simFrame(&msg, BL_STATUS_BASE + GW_STATUS_IDS, 0, 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_SECONDARY, &msg) == false, "Past the status range kept");
+    simFrame(&msg, BL_STATUS_BASE - 1, 0, 0);
+    TEST_ASSERT_MESSAGE(gatewayRoute(&bridge.gw, GW_BUS_SECONDARY, &msg) == false, "Below the status range kept");
+
+    TEST_ASSERT_EQUAL_UINT32(1, bridge.gw.down_q._size);
+    TEST_ASSERT_EQUAL_UINT32(4, bridge.gw.up_q._size);
+}
+
+/**
+ * @brief Queues report dropped frames once full instead of overwriting
+ */
+void testGateway_overflow(void)
+{
+    CanMsgTypeDef msg;
+    resetNodes();
+
+    simFrame(&msg, BL_RX_ID, (ECU_REMOTE << 4) | 0x3, 0);
+    for (int i = 0; i < 20; i++)
+        TEST_ASSERT(gatewayRoute(&bridge.gw, GW_BUS_PRIMARY, &msg) == true);
+
+    TEST_ASSERT_EQUAL_UINT32(16, bridge.gw.high_water[GW_BUS_SECONDARY]);
+    TEST_ASSERT_EQUAL_UINT32(4, bridge.gw.dropped[GW_BUS_SECONDARY]);
+}
+
+/**
+ * @brief Full windowed session through the bridge. Every frame arrives in order, every ACK
+ * makes it back and the session takes no longer than the direct one plus store-and-forward latency.
+ */
+void testGateway_throughput(void)
+{
+    char info[128];
+    uint64_t direct = runDirect();
+    TEST_ASSERT_EQUAL_UINT32(FRAME_COUNT, ecu.received);
+
+    uint64_t bridged = runBridged(500000);
+    TEST_ASSERT_EQUAL_UINT32(FRAME_COUNT, ecu.received);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, ecu.out_of_order, "Frames forwarded in order");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(FRAME_COUNT, tester.acked, "Final ACK made it back");
+    TEST_ASSERT_EQUAL_UINT32(0, bridge.gw.dropped[GW_BUS_SECONDARY]);
+    TEST_ASSERT_EQUAL_UINT32(0, bridge.gw.dropped[GW_BUS_PRIMARY]);
+    TEST_ASSERT_EQUAL_UINT32(0, bridge.local);
+
+    // A constant few frame times of store-and-forward delay (last data frame plus relayed ACKs)
+    // on top of the direct session. A bottleneck would grow with FRAME_COUNT instead.
+    CanMsgTypeDef probe;
+    simFrame(&probe, BL_RX_ID, 0, 0);
+    uint64_t latency = 4 * canSimFrameTime(&bus_a, &probe);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(direct + latency, bridged, "Bridge is not the bottleneck");
+
+    snprintf(info, sizeof(info), "direct %llu us, bridged %llu us, down queue high water %u",
+             (unsigned long long) direct / 1000, (unsigned long long) bridged / 1000,
+             (unsigned) bridge.gw.high_water[GW_BUS_SECONDARY]);
+    TEST_MESSAGE(info);
+}
+
+/**
+ * @brief A faster secondary bus must never fill the down queue, the bridge keeps up with the tester
+ */
+void testGateway_fasterSecondary(void)
+{
+    runBridged(1000000);
+    TEST_ASSERT_EQUAL_UINT32(FRAME_COUNT, ecu.received);
+    TEST_ASSERT_EQUAL_UINT32(0, bridge.gw.dropped[GW_BUS_SECONDARY]);
+    TEST_ASSERT_LESS_OR_EQUAL(2, bridge.gw.high_water[GW_BUS_SECONDARY]);
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testGateway_routing);
+    RUN_TEST(testGateway_overflow);
+    RUN_TEST(testGateway_throughput);
+    RUN_TEST(testGateway_fasterSecondary);
+
+    return UNITY_END();
+}
@@ -0,0 +1,125 @@
+#include <unity.h>
+#include <bl_handoff.h>
+#include <string.h>
+
+#define ECU_ID      (3U)
+#define APP_LENGTH  (976U * 1024U)
+#define CLOCK       (16000000U)
+#define RANDOM_RAM  (200000U)
+
+static bl_handoff_t ram;           // Stands in for the no-init RAM at BL_HANDOFF_ADDR
+
+static uint32_t seed = 0x600DF00D;
+
+static uint32_t nextRandom(void)
+{
+    seed = seed * 1664525 + 1013904223;
+    return seed;
+}
+
+static bool take(bl_handoff_session_t* session)
+{
+    return handoffTake(&ram, ECU_ID, APP_LENGTH, CLOCK, session);
+}
+
+void testHandoff_roundTrip(void)
+{
+    bl_handoff_session_t session;
+
+    memset(&ram, 0, sizeof(ram));
+    handoffWrite(&ram, ECU_ID, 500000, 128 * 1024);
+
+    TEST_ASSERT_TRUE(take(&session));
+    TEST_ASSERT_EQUAL_UINT32(ECU_ID, session.ecu_id);
+    TEST_ASSERT_EQUAL_HEX32(0x001C0001, session.btr);
+    TEST_ASSERT_EQUAL_UINT32(128 * 1024, session.image_length);
+
+    // One shot, the reset after flashing boots normally
+    TEST_ASSERT_EQUAL_HEX32(0, ram.token);
+    TEST_ASSERT_FALSE(take(&session));
+
+    handoffWrite(&ram, ECU_ID, 0, 0);
+    TEST_ASSERT_TRUE(take(&session));
+    TEST_ASSERT_EQUAL_HEX32(0, session.btr);
+    TEST_ASSERT_EQUAL_UINT32(0, session.image_length);
+}
+
+/**
+ * @brief SRAM holds garbage after a power cycle, none of it may start a session
+ */
+void testHandoff_randomRam(void)
+{
+    bl_handoff_session_t session;
+    uint32_t accepted = 0;
+
+    for (uint32_t n = 0; n < RANDOM_RAM; n++)
+    {
+        uint32_t* words = (uint32_t*) &ram;
+        for (uint32_t i = 0; i < sizeof(ram) / 4; i++)
+            words[i] = nextRandom();
+        // Half of the blocks even carry the token
+        if (n & 1)
+            ram.token = BL_HANDOFF_TOKEN;
+
+        accepted += take(&session);
+        TEST_ASSERT_EQUAL_HEX32(0, ram.token);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(0, accepted);
+}
+
+/**
+ * @brief Requests this node can not serve are dropped and cleared, a single flipped bit
+ * fails the check
+ */
+void testHandoff_rejects(void)
+{
+    bl_handoff_session_t session;
+
+    handoffWrite(&ram, ECU_ID + 1, 500000, 0);
+    TEST_ASSERT_FALSE(take(&session));
+    TEST_ASSERT_EQUAL_HEX32(0, ram.token);
+
+    handoffWrite(&ram, ECU_ID, 500000, APP_LENGTH + 4);
+    TEST_ASSERT_FALSE(take(&session));
+
+    handoffWrite(&ram, ECU_ID, 333333, 0);
+    TEST_ASSERT_FALSE(take(&session));
+
+    for (uint32_t bit = 0; bit < 32 * 5; bit++)
+    {
+        handoffWrite(&ram, ECU_ID, 500000, 64 * 1024);
+        ((uint32_t*) &ram)[bit / 32] ^= 1U << (bit % 32);
+        TEST_ASSERT_FALSE(take(&session));
+    }
+
+    handoffWrite(&ram, ECU_ID, 500000, APP_LENGTH);
+    TEST_ASSERT_TRUE(take(&session));
+}
+
+void testHandoff_bitTiming(void)
+{
+    TEST_ASSERT_EQUAL_HEX32(0x001c0063, handoffBitTiming(CLOCK, 10000));     // CAN_BTR_DEFAULT
+    TEST_ASSERT_EQUAL_HEX32(0x001C0000, handoffBitTiming(CLOCK, 1000000));
+    TEST_ASSERT_EQUAL_HEX32(0x001C0001, handoffBitTiming(CLOCK, 500000));
+    TEST_ASSERT_EQUAL_HEX32(0x001C0003, handoffBitTiming(CLOCK, 250000));
+    TEST_ASSERT_EQUAL_HEX32(0x001C0007, handoffBitTiming(CLOCK, 125000));
+    TEST_ASSERT_EQUAL_HEX32(0x001C0004, handoffBitTiming(45000000, 562500));
+
+    TEST_ASSERT_EQUAL_HEX32(0, handoffBitTiming(CLOCK, 0));
+    TEST_ASSERT_EQUAL_HEX32(0, handoffBitTiming(CLOCK, 2000000));           // Below one quantum
+    TEST_ASSERT_EQUAL_HEX32(0, handoffBitTiming(CLOCK, 333333));            // Not exact
+    TEST_ASSERT_EQUAL_HEX32(0, handoffBitTiming(CLOCK, 500));               // Prescaler above 1024
+    TEST_ASSERT_EQUAL_HEX32(0, handoffBitTiming(CLOCK, 0xFFFFFFFF));
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testHandoff_roundTrip);
+    RUN_TEST(testHandoff_randomRam);
+    RUN_TEST(testHandoff_rejects);
+    RUN_TEST(testHandoff_bitTiming);
+
+    return UNITY_END();
+}
@@ -0,0 +1,211 @@
+#include <unity.h>
+#include <bl_journal.h>
+#include <flash_sim.h>
+#include <stdio.h>
+
+#define SECTOR_BYTES (16U * 1024U)      // STM32F4 sectors 1 and 2
+#define SLOTS        (SECTOR_BYTES / 4 / JOURNAL_RECORD_WORDS - 1)
+
+static uint32_t mem[2 * SECTOR_BYTES / 4];
+static flash_sim_t flash;
+static bl_journal_t journal;
+
+static void simProgram(volatile uint32_t* address, uint32_t value)
+{
+    flashSimProgram(&flash, address, value);
+}
+
+static void simErase(volatile uint32_t* sector)
+{
+    flashSimErase(&flash, sector);
+}
+
+static bool mount(void)
+{
+    initJournal(&journal, mem, mem + SECTOR_BYTES / 4, SECTOR_BYTES, simProgram, simErase);
+    return journalMount(&journal);
+}
+
+static bl_boot_meta_t metaFor(uint32_t n)
+{
+    bl_boot_meta_t meta = {
+        .boot_flag = n % 3,
+        .app_crc = n * 2654435761U,
+        .app_length = n,
+        .app_start = 0x0800C000,
+    };
+    return meta;
+}
+
+static bool metaIs(uint32_t n)
+{
+    bl_boot_meta_t expected = metaFor(n);
+    return journal.has_record && journal.meta.boot_flag == expected.boot_flag &&
+           journal.meta.app_crc == expected.app_crc && journal.meta.app_length == expected.app_length &&
+           journal.meta.app_start == expected.app_start;
+}
+
+static uint32_t totalErases(void)
+{
+    return flash.erases[0] + flash.erases[1];
+}
+
+/**
+ * @brief Blank flash is formatted without an erase and reports no record
+ */
+void testJournal_format(void)
+{
+    initFlashSim(&flash, mem, sizeof(mem), SECTOR_BYTES, 1);
+
+    TEST_ASSERT_FALSE(mount());
+    TEST_ASSERT_EQUAL_UINT32(0, totalErases());
+    TEST_ASSERT_EQUAL_HEX32(JOURNAL_SECTOR_ACTIVE, mem[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, journal.next_slot);
+
+    // Random contents are erased and formatted too
+    for (uint32_t i = 0; i < sizeof(mem) / 4; i++)
+        mem[i] = (i + 1) * 2654435761U;
+    TEST_ASSERT_FALSE(mount());
+    TEST_ASSERT_EQUAL_UINT32(2, totalErases());
+    TEST_ASSERT_EQUAL_HEX32(JOURNAL_SECTOR_ACTIVE, mem[0]);
+}
+
+/**
+ * @brief Appends are found again after a remount, unchanged metadata costs no flash writes
+ */
+void testJournal_appendAndMount(void)
+{
+    initFlashSim(&flash, mem, sizeof(mem), SECTOR_BYTES, 2);
+    mount();
+
+    for (uint32_t n = 1; n <= 100; n++)
+    {
+        bl_boot_meta_t meta = metaFor(n);
+        TEST_ASSERT_TRUE(journalAppend(&journal, &meta));
+    }
+    TEST_ASSERT_TRUE(mount());
+    TEST_ASSERT_TRUE(metaIs(100));
+    TEST_ASSERT_EQUAL_UINT32(100, journal.sequence);
+    TEST_ASSERT_EQUAL_UINT32(101, journal.next_slot);
+
+    uint32_t programs = flash.programs;
+    bl_boot_meta_t same = metaFor(100);
+    TEST_ASSERT_TRUE(journalAppend(&journal, &same));
+    TEST_ASSERT_EQUAL_UINT32(programs, flash.programs);
+
+    // Bit patterns that needed several rewrites of one word before
+    bl_boot_meta_t meta = metaFor(100);
+    for (uint32_t flag = 0; flag < 3; flag++)
+    {
+        meta.boot_flag = flag;
+        journalAppend(&journal, &meta);
+        TEST_ASSERT_TRUE(mount());
+        TEST_ASSERT_EQUAL_UINT32(flag, journal.meta.boot_flag);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, flash.overwrites);
+}
+
+/**
+ * @brief Sectors are only erased when one fills up, and wear is spread over both
+ */
+void testJournal_wear(void)
+{
+    char info[128];
+    const uint32_t updates = 20000;
+
+    initFlashSim(&flash, mem, sizeof(mem), SECTOR_BYTES, 3);
+    mount();
+
+    for (uint32_t n = 1; n <= updates; n++)
+    {
+        bl_boot_meta_t meta = metaFor(n);
+        TEST_ASSERT_TRUE(journalAppend(&journal, &meta));
+    }
+
+    TEST_ASSERT_TRUE(mount());
+    TEST_ASSERT_TRUE(metaIs(updates));
+    TEST_ASSERT_EQUAL_UINT32(0, flash.overwrites);
+
+    // One erase per compaction, the first fills a whole sector and later ones start at slot 2
+    uint32_t compactions = 1 + (updates - SLOTS - 1) / (SLOTS - 1);
+    TEST_ASSERT_EQUAL_UINT32(compactions, totalErases());
+    TEST_ASSERT_EQUAL_UINT32(compactions, journal.generation);
+    TEST_ASSERT_LESS_OR_EQUAL(1, (int32_t) flash.erases[0] - (int32_t) flash.erases[1]);
+
+    snprintf(info, sizeof(info), "%u updates: %u erases per sector, %u records per erase",
+             updates, flash.erases[0], updates / totalErases());
+    TEST_MESSAGE(info);
+}
+
+/**
+ * @brief Cut power at every possible point of an append, including across compactions and
+ * during the recovery that follows. After mounting again the newest record is either the last completed append or the interrupted one,
+ * and the journal keeps working.
+ */
+void testJournal_powerCuts(void)
+{
+    uint32_t trials = 0, torn = 0;
+
+    for (uint32_t seed = 1; seed <= 3000; seed++)
+    {
+        initFlashSim(&flash, mem, sizeof(mem), SECTOR_BYTES, seed);
+        mount();
+
+        // Start anywhere in the fill cycle, often right before a compaction
+        uint32_t done = (seed * 7919) % (3 * SLOTS);
+        if (seed % 3 == 0)
+            done = SLOTS - 2 + seed % 5;
+        for (uint32_t n = 1; n <= done; n++)
+        {
+            bl_boot_meta_t meta = metaFor(n);
+            journalAppend(&journal, &meta);
+        }
+
+        // A compaction is about 12 operations, an append 8
+        flashSimCutAfter(&flash, seed % 24);
+        bl_boot_meta_t next = metaFor(done + 1);
+        bool completed = journalAppend(&journal, &next) && flash.powered;
+
+        flashSimPowerOn(&flash);
+
+        // Sometimes lose power again while mounting finishes the recovery
+        if (seed % 4 == 0)
+        {
+            flashSimCutAfter(&flash, seed % 3);
+            mount();
+            flashSimPowerOn(&flash);
+        }
+
+        bool found = mount();
+        trials++;
+
+        if (completed)
+        {
+            TEST_ASSERT_TRUE(metaIs(done + 1));
+        }
+        else
+        {
+            torn++;
+            TEST_ASSERT_TRUE(done == 0 ? (!found || metaIs(1)) : (metaIs(done) || metaIs(done + 1)));
+        }
+
+        // Journal is usable again
+        bl_boot_meta_t after = metaFor(done + 2);
+        TEST_ASSERT_TRUE(journalAppend(&journal, &after));
+        TEST_ASSERT_TRUE(mount());
+        TEST_ASSERT_TRUE(metaIs(done + 2));
+    }
+
+    TEST_ASSERT_GREATER_THAN_UINT32(trials / 3, torn);
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testJournal_format);
+    RUN_TEST(testJournal_appendAndMount);
+    RUN_TEST(testJournal_wear);
+    RUN_TEST(testJournal_powerCuts);
+
+    return UNITY_END();
+}
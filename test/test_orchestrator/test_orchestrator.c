@@ -0,0 +1,474 @@
+#include <unity.h>
+#include <bl_orchestrator.h>
+#include <bl_node_sim.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+#include <can_gateway.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BL_RX_ID     (0x0C00FF10U)
+#define BL_STATUS_ID (0x0C00FE00U)     // BL_STATUS_MSG_BASE
+#define BL_TX_ID     (0x0C01FEFEU)
+#define BITRATE      (1000000U)
+#define QUEUE_DEPTH  (10U)              // rx_message_q
+#define TIMEOUT_US   (1000000U)
+
+#define MAX_ECUS     (6U)
+#define IMAGE_MAX    (32U * 1024U)
+#define FLASH_BYTES  (384U * 1024U)     // Sectors 0 to 6 of each ECU, 336 kB of application flash
+
+/*
+*   Target costs, HSI 16 MHz and -O0 as in env:disco_f429zi. M_FLAG_SET appends to the boot
+*   metadata journal, every ECU starts with a full journal so that append compacts and erases
+*   a 16 kB sector.
+*/
+#define ISR_NS       (40000U)           // rxCANMessage + rbEnqueue
+#define DECODE_NS    (30000U)           // Dequeue, decodeCANMsg and FSM lookup
+#define PROGRAM_NS   (100000U)          // flashWriteU32
+#define FLAG_NS      (250000000U)       // Journal compaction, 16 kB sector erase
+#define CRC_WORD_NS  (1250U)            // Image check per word
+
+/*
+*   Bootloader nodes of the vehicle
+*/
+static bl_node_sim_t ecus[MAX_ECUS];
+static uint8_t ecu_flash[MAX_ECUS][FLASH_BYTES];
+static uint8_t ecu_count;
+
+/*
+*   Host: one CAN interface, orchestrator pumped from RX and TX-done like a SocketCAN loop
+*/
+static sim_host_t host;
+
+static struct {
+    uint32_t calls;
+    bool monotonic;
+    uint32_t last_acked[16];
+} progress;
+
+static can_sim_bus_t bus;
+static uint8_t images[MAX_ECUS][IMAGE_MAX];
+
+/*
+*   Gateway node bridging bus to bus_b, the tester only sees bus
+*/
+static struct {
+    bool present;
+    can_sim_node_t primary;
+    can_sim_node_t secondary;
+    can_gateway_t gw;
+    CanMsgTypeDef down_array[16];
+    CanMsgTypeDef up_array[16];
+    uint64_t now_ns;
+} bridge;
+
+static can_sim_bus_t bus_b;
+
+static void addECU(can_sim_bus_t* on, uint8_t ecu_id)
+{
+    bl_node_sim_cfg_t node_cfg = {
+        .rx = {
+            .queue_depth = QUEUE_DEPTH,
+            .isr_ns = ISR_NS,
+            .id_filter = true,
+            .accept_id = BL_RX_ID,
+            .ecu_filter = true,
+            .ecu_id = ecu_id,
+        },
+        .ecu_id = ecu_id,
+        .frame_ns = DECODE_NS,
+        .program_ns = PROGRAM_NS,
+        .crc_word_ns = CRC_WORD_NS,
+        .journal_full = true,
+    };
+
+    initBLNodeSim(&ecus[ecu_count], on, &node_cfg, ecu_flash[ecu_count], FLASH_BYTES);
+    ecu_count++;
+}
+
+static void hostProgress(const bl_flash_job_t* job)
+{
+    progress.calls++;
+    if (job->acked < progress.last_acked[job->entry->ecu_id])
+        progress.monotonic = false;
+    progress.last_acked[job->entry->ecu_id] = job->acked;
+}
+
+static void setupBus(const uint8_t* ecu_ids, uint8_t count)
+{
+    memset(&progress, 0, sizeof(progress));
+    progress.monotonic = true;
+    ecu_count = 0;
+    bridge.present = false;
+
+    initCANSimBus(&bus, BITRATE);
+    for (uint8_t i = 0; i < count; i++)
+        addECU(&bus, ecu_ids[i]);
+    initSimHost(&host, &bus);
+}
+
+static bool bridgeTxPrimary(CanMsgTypeDef* msg)
+{
+    return canSimTransmit(&bridge.primary, msg, bridge.now_ns);
+}
+
+static bool bridgeTxSecondary(CanMsgTypeDef* msg)
+{
+    return canSimTransmit(&bridge.secondary, msg, bridge.now_ns);
+}
+
+// CAN1_RX0_IRQHandler in gateway mode, frames for its own ECU are not modeled
+static void bridgePrimaryRx(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t now_ns)
+{
+    bridge.now_ns = now_ns;
+    if (gatewayRoute(&bridge.gw, GW_BUS_PRIMARY, msg))
+        gatewayPump(&bridge.gw, GW_BUS_SECONDARY, bridgeTxSecondary);
+}
+
+// CAN2_RX0_IRQHandler
+static void bridgeSecondaryRx(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t now_ns)
+{
+    bridge.now_ns = now_ns;
+    if (gatewayRoute(&bridge.gw, GW_BUS_SECONDARY, msg))
+        gatewayPump(&bridge.gw, GW_BUS_PRIMARY, bridgeTxPrimary);
+}
+
+static void bridgePrimaryTxDone(can_sim_node_t* node, uint64_t now_ns)
+{
+    bridge.now_ns = now_ns;
+    gatewayPump(&bridge.gw, GW_BUS_PRIMARY, bridgeTxPrimary);
+}
+
+static void bridgeSecondaryTxDone(can_sim_node_t* node, uint64_t now_ns)
+{
+    bridge.now_ns = now_ns;
+    gatewayPump(&bridge.gw, GW_BUS_SECONDARY, bridgeTxSecondary);
+}
+
+/**
+ * @brief Tester and local ECUs on bus, remote ECUs on bus_b behind a gateway
+ */
+static void setupGateway(const uint8_t* local_ids, uint8_t local_count, const uint8_t* remote_ids, uint8_t remote_count)
+{
+    uint16_t remote = 0;
+
+    setupBus(local_ids, local_count);
+    initCANSimBus(&bus_b, BITRATE);
+    for (uint8_t i = 0; i < remote_count; i++)
+    {
+        addECU(&bus_b, remote_ids[i]);
+        remote |= 1U << remote_ids[i];
+    }
+
+    bridge.present = true;
+    bridge.now_ns = 0;
+    initGateway(&bridge.gw, BL_RX_ID, BL_TX_ID, BL_STATUS_ID, remote,
+                bridge.down_array, 16, bridge.up_array, 16);
+    canSimAttach(&bus, &bridge.primary, bridgePrimaryRx, bridgePrimaryTxDone, 0);
+    canSimAttach(&bus_b, &bridge.secondary, bridgeSecondaryRx, bridgeSecondaryTxDone, 0);
+}
+
+static void makeManifest(bl_manifest_entry_t* manifest, uint8_t index, uint8_t ecu_id, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+        images[index][i] = (i * 31 + ecu_id * 17 + (i >> 9)) & 0xFF;
+
+    manifest[index].ecu_id = ecu_id;
+    manifest[index].image = images[index];
+    manifest[index].length = length;
+    manifest[index].crc = simImageCRC(images[index], length);
+    manifest[index].signature = 0;
+    manifest[index].window = 0;
+    manifest[index].segments = 0;
+    manifest[index].segment_count = 0;
+}
+
+/**
+ * @brief Run the orchestrator until every job finished
+ * 
+ * @return uint64_t Wall clock time in ns
+ */
+static uint64_t runManifest(const bl_manifest_entry_t* manifest, uint8_t count)
+{
+    TEST_ASSERT_TRUE(initOrchestrator(&host.orch, manifest, count, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, hostProgress));
+
+    uint64_t start_ns = bus.now_ns;
+    can_sim_bus_t* buses[] = {&bus, &bus_b};
+    simHostPump(&host, start_ns);
+    simHostRun(&host, buses, bridge.present ? 2 : 1, ecus, ecu_count);
+
+    uint64_t end_ns = start_ns;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (host.orch.jobs[i].end_us * 1000 > end_ns)
+            end_ns = host.orch.jobs[i].end_us * 1000;
+    }
+    return end_ns - start_ns;
+}
+
+static const uint8_t vehicle_ids[] = {1, 2, 3, 5, 8, 12};
+static const uint32_t vehicle_sizes[] = {16 * 1024, 32 * 1024, 8 * 1024, 24 * 1024, 12 * 1024 + 3, 20 * 1024};
+
+/**
+ * @brief Whole vehicle at once against one ECU after the other. One session alone already
+ * keeps the bus close to busy while streaming, concurrent sessions win by overlapping the
+ * journal erases and CRC checks and end up near the time the data frames take on the bus.
+ */
+void testOrchestrator_vehicle(void)
+{
+    static bl_manifest_entry_t manifest[MAX_ECUS];
+    char line[128];
+    uint64_t serial_ns = 0;
+    uint32_t data_frames = 0;
+
+    for (uint8_t i = 0; i < MAX_ECUS; i++)
+    {
+        makeManifest(manifest, i, vehicle_ids[i], vehicle_sizes[i]);
+        data_frames += (vehicle_sizes[i] + 3) / 4;
+    }
+
+    TEST_MESSAGE("ECU  bytes  alone_ms");
+    for (uint8_t i = 0; i < MAX_ECUS; i++)
+    {
+        setupBus(vehicle_ids, MAX_ECUS);
+        uint64_t alone_ns = runManifest(&manifest[i], 1);
+        serial_ns += alone_ns;
+
+        snprintf(line, sizeof(line), "%3u %6u %9.1f", vehicle_ids[i], vehicle_sizes[i], alone_ns / 1e6);
+        TEST_MESSAGE(line);
+        TEST_ASSERT_EQUAL(JOB_DONE, host.orch.jobs[0].state);
+    }
+
+    setupBus(vehicle_ids, MAX_ECUS);
+    uint64_t concurrent_ns = runManifest(manifest, MAX_ECUS);
+
+    CanMsgTypeDef data = {.IDE = CAN_ID_EXT, .ExtId = BL_RX_ID, .DLC = 8};
+    uint64_t bound_ns = data_frames * canSimFrameTime(&bus, &data);
+
+    snprintf(line, sizeof(line), "%u ECUs, %u data frames: serial %.1f ms, concurrent %.1f ms, bus bound %.1f ms",
+             MAX_ECUS, data_frames, serial_ns / 1e6, concurrent_ns / 1e6, bound_ns / 1e6);
+    TEST_MESSAGE(line);
+    snprintf(line, sizeof(line), "bus busy %.0f%%, %u status frames",
+             100.0 * bus.busy_ns / concurrent_ns, host.orch.status_frames);
+    TEST_MESSAGE(line);
+
+    for (uint8_t i = 0; i < MAX_ECUS; i++)
+    {
+        TEST_ASSERT_EQUAL(JOB_DONE, host.orch.jobs[i].state);
+        TEST_ASSERT_EQUAL(S_LAUNCH_APP, ecus[i].node.state);
+        TEST_ASSERT_EQUAL_MEMORY(images[i], blNodeSimApp(&ecus[i]), vehicle_sizes[i]);
+        TEST_ASSERT_EQUAL_UINT32(0, ecus[i].rx.overruns);
+        TEST_ASSERT_TRUE(ecus[i].rx.high_water <= ORCH_DEFAULT_WINDOW);
+    }
+    TEST_ASSERT_TRUE(progress.monotonic);
+
+    // One journal erase and the largest CRC check on top of the bus time, status frames take the rest
+    TEST_ASSERT_TRUE(concurrent_ns < bound_ns * 1.25 + FLAG_NS + CRC_WORD_NS * IMAGE_MAX / 4);
+    TEST_ASSERT_TRUE(serial_ns > concurrent_ns + (MAX_ECUS - 2) * (uint64_t) FLAG_NS);
+}
+
+/**
+ * @brief A bad image, a missing ECU and an ECU in the wrong state fail on their own,
+ * the rest of the vehicle is still flashed
+ */
+void testOrchestrator_failures(void)
+{
+    static bl_manifest_entry_t manifest[4];
+    const uint8_t present[] = {1, 2, 3};
+
+    setupBus(present, 3);
+    makeManifest(manifest, 0, 1, 8 * 1024);
+    makeManifest(manifest, 1, 2, 8 * 1024);
+    makeManifest(manifest, 2, 3, 8 * 1024);
+    makeManifest(manifest, 3, 9, 8 * 1024);
+    manifest[1].crc ^= 1;
+    ecus[2].node.state = S_FLASH_APP;    // Left over from an aborted session
+
+    runManifest(manifest, 4);
+
+    TEST_ASSERT_EQUAL(JOB_DONE, host.orch.jobs[0].state);
+    TEST_ASSERT_EQUAL(JOB_FAILED, host.orch.jobs[1].state);
+    TEST_ASSERT_EQUAL(JOB_ERR_CRC, host.orch.jobs[1].error);
+    TEST_ASSERT_EQUAL(JOB_FAILED, host.orch.jobs[2].state);
+    TEST_ASSERT_EQUAL(JOB_ERR_STATE, host.orch.jobs[2].error);
+    TEST_ASSERT_EQUAL(JOB_FAILED, host.orch.jobs[3].state);
+    TEST_ASSERT_EQUAL(JOB_ERR_TIMEOUT, host.orch.jobs[3].error);
+    TEST_ASSERT_EQUAL_UINT32(host.orch.jobs[1].words, host.orch.jobs[1].acked);
+    TEST_ASSERT_TRUE(host.orch.jobs[3].end_us - host.orch.jobs[3].start_us >= TIMEOUT_US);
+}
+
+/**
+ * @brief A smaller window costs throughput but never more queue entries than the window
+ */
+void testOrchestrator_window(void)
+{
+    static bl_manifest_entry_t manifest[1];
+    uint8_t windows[] = {BL_STATUS_EVERY + 1, 8, ORCH_DEFAULT_WINDOW};
+    char line[128];
+
+    TEST_MESSAGE("window  16 kB alone_ms  high_water");
+    for (int w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+    {
+        setupBus(vehicle_ids, 1);
+        makeManifest(manifest, 0, vehicle_ids[0], 16 * 1024);
+        manifest[0].window = windows[w];
+
+        uint64_t ns = runManifest(manifest, 1);
+        snprintf(line, sizeof(line), "%6u %15.1f %11u", windows[w], ns / 1e6, ecus[0].rx.high_water);
+        TEST_MESSAGE(line);
+
+        TEST_ASSERT_EQUAL(JOB_DONE, host.orch.jobs[0].state);
+        TEST_ASSERT_TRUE(ecus[0].rx.high_water <= windows[w]);
+    }
+}
+
+/**
+ * @brief Code at the start of flash and a calibration table near the end. Sending only the two
+ * segments skips the erased gap that a padded image sends as 0xFF words.
+ */
+void testOrchestrator_sparse(void)
+{
+    static bl_manifest_entry_t manifest[1];
+    static uint8_t padded[256U * 1024U];
+    static bl_image_segment_t segments[2];
+    const uint32_t code = 16 * 1024;
+    const uint32_t cal_offset = 224 * 1024;
+    const uint32_t cal = 8 * 1024 + 2;
+    char line[128];
+
+    memset(padded, 0xFF, sizeof(padded));
+    for (uint32_t i = 0; i < code; i++)
+        padded[i] = (i * 13 + (i >> 7)) & 0xFF;
+    for (uint32_t i = 0; i < cal; i++)
+        padded[cal_offset + i] = (i * 7 + 0x5A) & 0xFF;
+
+    setupBus(vehicle_ids, 1);
+    manifest[0] = (bl_manifest_entry_t) {.ecu_id = vehicle_ids[0], .image = padded, .length = cal_offset + cal};
+    manifest[0].crc = simImageCRC(padded, manifest[0].length);
+    uint64_t padded_ns = runManifest(manifest, 1);
+    uint32_t padded_words = host.orch.jobs[0].words;
+    TEST_ASSERT_EQUAL(JOB_DONE, host.orch.jobs[0].state);
+
+    segments[0] = (bl_image_segment_t) {.offset = 0, .data = padded, .length = code};
+    segments[1] = (bl_image_segment_t) {.offset = cal_offset, .data = &padded[cal_offset], .length = cal};
+    setupBus(vehicle_ids, 1);
+    manifest[0] = (bl_manifest_entry_t) {.ecu_id = vehicle_ids[0], .segments = segments, .segment_count = 2};
+    manifest[0].crc = orchestratorSegmentCRCs(segments, 2);
+    uint64_t sparse_ns = runManifest(manifest, 1);
+
+    snprintf(line, sizeof(line), "%u kB span: padded %u words %.1f ms, sparse %u words %.1f ms",
+             (cal_offset + cal) / 1024, padded_words, padded_ns / 1e6, host.orch.jobs[0].words, sparse_ns / 1e6);
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_EQUAL(JOB_DONE, host.orch.jobs[0].state);
+    TEST_ASSERT_EQUAL(S_LAUNCH_APP, ecus[0].node.state);
+    TEST_ASSERT_EQUAL_UINT32((code + cal + 3) / 4, host.orch.jobs[0].words);
+    TEST_ASSERT_EQUAL_MEMORY(padded, blNodeSimApp(&ecus[0]), cal_offset + cal);
+    TEST_ASSERT_EQUAL_HEX32(simImageCRC(padded, cal_offset + cal), ecus[0].node.image_segments.span_crc);
+    TEST_ASSERT_TRUE(sparse_ns * 5 < padded_ns);
+
+    // An earlier image left in the gaps is erased by the metadata, the span CRC still matches
+    setupBus(vehicle_ids, 1);
+    memset(blNodeSimApp(&ecus[0]), 0xA5, cal_offset + cal);
+    runManifest(manifest, 1);
+    TEST_ASSERT_EQUAL(JOB_DONE, host.orch.jobs[0].state);
+    TEST_ASSERT_EQUAL(S_LAUNCH_APP, ecus[0].node.state);
+    TEST_ASSERT_EQUAL_MEMORY(padded, blNodeSimApp(&ecus[0]), cal_offset + cal);
+    TEST_ASSERT_EQUAL_HEX32(simImageCRC(padded, cal_offset + cal), ecus[0].node.journal.meta.app_crc);
+
+    // A bad CRC in the first segment fails the check
+    setupBus(vehicle_ids, 1);
+    segments[0].crc ^= 1;
+    runManifest(manifest, 1);
+    TEST_ASSERT_EQUAL(JOB_FAILED, host.orch.jobs[0].state);
+    TEST_ASSERT_EQUAL(JOB_ERR_CRC, host.orch.jobs[0].error);
+    TEST_ASSERT_EQUAL_UINT32(0, ecus[0].node.image_segments.current);
+}
+
+/**
+ * @brief Two ECUs on the tester's bus and two behind a gateway. The gateway relays the status
+ * reports of the remote ECUs, so the tester paces them like the local ones.
+ */
+void testOrchestrator_gateway(void)
+{
+    static bl_manifest_entry_t manifest[4];
+    const uint8_t local[] = {1, 2};
+    const uint8_t remote[] = {5, 8};
+    char line[128];
+
+    setupGateway(local, 2, remote, 2);
+    makeManifest(manifest, 0, 1, 8 * 1024);
+    makeManifest(manifest, 1, 2, 8 * 1024);
+    makeManifest(manifest, 2, 5, 8 * 1024);
+    makeManifest(manifest, 3, 8, 8 * 1024 + 1);
+
+    uint64_t ns = runManifest(manifest, 4);
+    snprintf(line, sizeof(line), "2 local and 2 remote ECUs, 32 kB: %.1f ms, up queue high water %u",
+             ns / 1e6, bridge.gw.high_water[GW_BUS_PRIMARY]);
+    TEST_MESSAGE(line);
+
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_EQUAL(JOB_DONE, host.orch.jobs[i].state);
+        TEST_ASSERT_EQUAL(S_LAUNCH_APP, ecus[i].node.state);
+        TEST_ASSERT_EQUAL_MEMORY(images[i], blNodeSimApp(&ecus[i]), manifest[i].length);
+        TEST_ASSERT_EQUAL_UINT32(0, ecus[i].rx.overruns);
+        TEST_ASSERT_TRUE(ecus[i].rx.high_water <= ORCH_DEFAULT_WINDOW);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, bridge.gw.dropped[GW_BUS_PRIMARY]);
+    TEST_ASSERT_EQUAL_UINT32(0, bridge.gw.dropped[GW_BUS_SECONDARY]);
+    TEST_ASSERT_TRUE(bridge.gw.forwarded[GW_BUS_PRIMARY] > 0);
+}
+
+void testOrchestrator_manifest(void)
+{
+    static bl_manifest_entry_t manifest[ORCH_MAX_ECUS + 1];
+
+    makeManifest(manifest, 0, 1, 16);
+    makeManifest(manifest, 1, 1, 16);
+    TEST_ASSERT_FALSE(initOrchestrator(&host.orch, manifest, 2, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0));
+
+    manifest[1].ecu_id = 16;
+    TEST_ASSERT_FALSE(initOrchestrator(&host.orch, manifest, 2, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0));
+
+    manifest[1].ecu_id = 2;
+    manifest[1].length = 0;
+    TEST_ASSERT_FALSE(initOrchestrator(&host.orch, manifest, 2, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0));
+
+    manifest[1].length = 16;
+    TEST_ASSERT_TRUE(initOrchestrator(&host.orch, manifest, 2, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0));
+    TEST_ASSERT_FALSE(initOrchestrator(&host.orch, manifest, ORCH_MAX_ECUS + 1, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0));
+
+    // Segments the bootloader would refuse: overlapping, unaligned, or a CRC that is not the image CRC
+    static bl_image_segment_t segments[2];
+    segments[0] = (bl_image_segment_t) {.offset = 0, .data = images[0], .length = 64};
+    segments[1] = (bl_image_segment_t) {.offset = 32, .data = images[0], .length = 16};
+    manifest[1].segments = segments;
+    manifest[1].segment_count = 2;
+    manifest[1].crc = orchestratorSegmentCRCs(segments, 2);
+    TEST_ASSERT_FALSE(initOrchestrator(&host.orch, manifest, 2, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0));
+
+    segments[1].offset = 66;
+    TEST_ASSERT_FALSE(initOrchestrator(&host.orch, manifest, 2, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0));
+
+    segments[1].offset = 128;
+    TEST_ASSERT_TRUE(initOrchestrator(&host.orch, manifest, 2, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0));
+    TEST_ASSERT_EQUAL_UINT32(80, host.orch.jobs[1].length);
+
+    manifest[1].crc ^= 1;
+    TEST_ASSERT_FALSE(initOrchestrator(&host.orch, manifest, 2, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0));
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testOrchestrator_vehicle);
+    RUN_TEST(testOrchestrator_failures);
+    RUN_TEST(testOrchestrator_window);
+    RUN_TEST(testOrchestrator_sparse);
+    RUN_TEST(testOrchestrator_gateway);
+    RUN_TEST(testOrchestrator_manifest);
+
+    return UNITY_END();
+}
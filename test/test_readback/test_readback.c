@@ -0,0 +1,318 @@
+#include <unity.h>
+#include <bl_readback.h>
+#include <bl_node_sim.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BL_TX_ID     (0x0C01FEFEU)
+#define BL_RX_ID     (0x0C00FF10U)
+
+#define REGION_SIZE  (1024U * 1024U)
+#define APP_SIZE     (REGION_SIZE - (BL_NODE_SIM_APP_ADDRESS - BL_NODE_SIM_FLASH_ADDRESS))
+#define WINDOW       (64U)
+#define QUEUE_DEPTH  (10U)              // rx_message_q
+
+/*
+*   Target costs, HSI 16 MHz and -O0 as in env:disco_f429zi
+*/
+#define ISR_NS       (40000U)           // rxCANMessage + rbEnqueue
+#define DECODE_NS    (30000U)           // Dequeue, decodeCANMsg and FSM lookup
+#define CRC_WORD_NS  (1250U)            // Trailer CRC per word
+
+static uint8_t flash[REGION_SIZE];
+static uint8_t dump[REGION_SIZE];
+
+/*
+*   Read-back service on its own over `flash`
+*/
+static bl_readback_t rb;
+
+/*
+*   Bootloader node with a 1 MB bank, the read-back region is its application flash
+*/
+static bl_node_sim_t target;
+static uint8_t bank[REGION_SIZE];
+
+/*
+*   Tester reassembling the stream into `dump`
+*/
+static struct {
+    can_sim_node_t node;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t received;          // Frames received in order
+    uint32_t gaps;
+    uint32_t crc;
+    bool done;
+} host;
+
+static uint32_t flashCRC(uint32_t offset, uint32_t length)
+{
+    return simImageCRC(&flash[offset], length);
+}
+
+static void hostSend(const BLRxMessage_t* frame, uint64_t t)
+{
+    CanMsgTypeDef msg = {.IDE = CAN_ID_EXT, .ExtId = BL_RX_ID, .DLC = 8};
+    blPackRxMessage(frame, msg.Data);
+    canSimTransmit(&host.node, &msg, t);
+}
+
+static void hostAck(uint8_t sequence, uint64_t t)
+{
+    BLRxMessage_t ack = {.message_type = M_READ_ACK, .read_ack_sequence = sequence};
+    hostSend(&ack, t);
+}
+
+static void hostRx(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t t)
+{
+    uint32_t data_frames = (host.length + READBACK_BYTES_PER_FRAME - 1) / READBACK_BYTES_PER_FRAME;
+
+    if (canMsgId(msg) != BL_TX_ID)
+        return;
+
+    if (msg->Data[0] != (uint8_t) host.received)
+    {
+        host.gaps++;
+        return;
+    }
+
+    if (host.received == data_frames)
+    {
+        host.crc = simFrameValue(msg);
+        host.done = true;
+        hostAck(msg->Data[0], t);
+        return;
+    }
+
+    uint32_t pos = host.received * READBACK_BYTES_PER_FRAME;
+    for (uint32_t i = 0; i + 1 < msg->DLC; i++)
+        dump[host.offset + pos + i] = msg->Data[1 + i];
+    host.received++;
+
+    if (host.received % (WINDOW / 2) == 0)
+        hostAck(msg->Data[0], t);
+}
+
+static can_sim_bus_t bus;
+
+static bool sinkTx(CanMsgTypeDef* msg)
+{
+    return true;
+}
+
+static void fillFlash(uint8_t* region, uint32_t length)
+{
+    uint32_t x = 0x12345678;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        x = x * 1103515245 + 12345;
+        region[i] = x >> 24;
+    }
+}
+
+/**
+ * @brief Node with a programmed application, and a tester asking for [offset, offset + length)
+ */
+static void setupDump(uint32_t offset, uint32_t length)
+{
+    bl_node_sim_cfg_t node_cfg = {
+        .rx = {
+            .queue_depth = QUEUE_DEPTH,
+            .isr_ns = ISR_NS,
+            .id_filter = true,
+            .accept_id = BL_RX_ID,
+        },
+        .frame_ns = DECODE_NS,
+        .crc_word_ns = CRC_WORD_NS,
+    };
+
+    initCANSimBus(&bus, 1000000);
+    initBLNodeSim(&target, &bus, &node_cfg, bank, sizeof(bank));
+    fillFlash(blNodeSimApp(&target), APP_SIZE);
+    canSimAttach(&bus, &host.node, hostRx, 0, 0);
+
+    host.offset = offset;
+    host.length = length;
+    host.received = 0;
+    host.gaps = 0;
+    host.done = false;
+}
+
+/**
+ * @brief Step the bus until nothing is left to send
+ */
+static void runBus(void)
+{
+    while (1)
+    {
+        blRxSimRun(&target.rx, canSimNextStart(&bus));
+        if (!canSimPending(&bus))
+            break;
+        canSimStep(&bus);
+    }
+}
+
+/**
+ * @brief Dump a range from recovery, the tester sends an empty message to leave the flag wait
+ *
+ * @return uint64_t Bus time at the end
+ */
+static uint64_t runDump(uint32_t offset, uint32_t length)
+{
+    BLRxMessage_t none = {.message_type = M_NONE};
+    BLRxMessage_t req = {.message_type = M_READ_REQ, .read_start_offset = offset, .read_length = length, .read_window = WINDOW};
+
+    setupDump(offset, length);
+    hostSend(&none, 0);
+    hostSend(&req, 0);
+    runBus();
+
+    return bus.now_ns;
+}
+
+/**
+ * @brief Ranges that leave the region are rejected
+ */
+void testReadback_bounds(void)
+{
+    initReadback(&rb, flash, REGION_SIZE, BL_TX_ID, flashCRC);
+
+    TEST_ASSERT(readbackStart(&rb, 0, REGION_SIZE, WINDOW) == true);
+    TEST_ASSERT(readbackStart(&rb, REGION_SIZE - 4, 4, WINDOW) == true);
+    TEST_ASSERT(readbackStart(&rb, REGION_SIZE - 4, 5, WINDOW) == false);
+    TEST_ASSERT(readbackStart(&rb, REGION_SIZE, 1, WINDOW) == false);
+    TEST_ASSERT(readbackStart(&rb, 16, 0, WINDOW) == false);
+    TEST_ASSERT(readbackStart(&rb, 16, 0xFFFFFFF0, WINDOW) == false);
+    TEST_ASSERT_FALSE(rb.active);
+}
+
+/**
+ * @brief Without ACKs only one window of frames goes out, stale ACKs are ignored
+ */
+void testReadback_window(void)
+{
+    initReadback(&rb, flash, REGION_SIZE, BL_TX_ID, flashCRC);
+    readbackStart(&rb, 0, 7 * 1000, 16);
+
+    TEST_ASSERT_EQUAL_UINT32(16, readbackPump(&rb, sinkTx));
+    TEST_ASSERT_EQUAL_UINT32(0,  readbackPump(&rb, sinkTx));
+
+    readbackAck(&rb, 7);                    // Frames 0..7 received
+    TEST_ASSERT_EQUAL_UINT32(8, rb.acked);
+    readbackAck(&rb, 3);                    // Stale
+    TEST_ASSERT_EQUAL_UINT32(8, rb.acked);
+    TEST_ASSERT_EQUAL_UINT32(8, readbackPump(&rb, sinkTx));
+
+    // Walk far enough for the 8 bit sequence to wrap
+    while (rb.sent < 600)
+    {
+        readbackAck(&rb, (uint8_t) (rb.sent - 1));
+        readbackPump(&rb, sinkTx);
+    }
+    TEST_ASSERT_EQUAL_UINT32(rb.sent - 16, rb.acked);
+}
+
+/**
+ * @brief Partial range with an odd length, checks the short last frame and trailer CRC
+ */
+void testReadback_partial(void)
+{
+    const uint8_t* app;
+
+    runDump(1001, 333);
+    app = blNodeSimApp(&target);
+
+    TEST_ASSERT_TRUE(host.done);
+    TEST_ASSERT_FALSE(target.node.readback.active);
+    TEST_ASSERT_EQUAL_UINT32(0, host.gaps);
+    TEST_ASSERT_EQUAL_MEMORY(&app[1001], &dump[1001], 333);
+    TEST_ASSERT_EQUAL_HEX32(simImageCRC(&app[1001], 333), host.crc);
+}
+
+/**
+ * @brief Metadata in the middle of a dump ends it. ACKs that follow do not restart it and the
+ * trailer CRC is never computed.
+ */
+void testReadback_metadata(void)
+{
+    BLRxMessage_t flag = {.message_type = M_FLAG_SET, .op_mode_flag = FLAG_FLASH_NEW_APP};
+    BLRxMessage_t req = {.message_type = M_READ_REQ, .read_start_offset = 0, .read_length = 7 * 1000, .read_window = WINDOW};
+    BLRxMessage_t meta = {.message_type = M_METADATA, .application_length = 1024, .crc_value = 0};
+    bl_readback_t* dumping = &target.node.readback;
+    uint32_t sent_at_stop = 0;
+    bool stopped = false;
+
+    setupDump(0, 7 * 1000);
+    hostSend(&flag, 0);
+    hostSend(&req, 0);
+
+    while (host.received < 100)
+    {
+        blRxSimRun(&target.rx, canSimNextStart(&bus));
+        if (!canSimStep(&bus))
+            break;
+    }
+    hostSend(&meta, bus.now_ns);
+
+    while (1)
+    {
+        blRxSimRun(&target.rx, canSimNextStart(&bus));
+        if (!stopped && !dumping->active)
+        {
+            stopped = true;
+            sent_at_stop = dumping->sent;
+        }
+        if (!canSimPending(&bus))
+            break;
+        canSimStep(&bus);
+    }
+
+    TEST_ASSERT_EQUAL(S_FLASH_APP, target.node.state);
+    TEST_ASSERT_TRUE(stopped);
+    TEST_ASSERT_FALSE(host.done);
+    TEST_ASSERT_EQUAL_UINT32(sent_at_stop, dumping->sent);
+    TEST_ASSERT_EQUAL_UINT32(0, target.crc.resets);
+    TEST_ASSERT_LESS_OR_EQUAL(dumping->total - 1, dumping->sent);
+
+    // A late ACK from the tester is ignored
+    readbackAck(dumping, (uint8_t) (dumping->sent - 1));
+    TEST_ASSERT_EQUAL_UINT32(0, readbackPump(dumping, sinkTx));
+}
+
+/**
+ * @brief Dump the whole application region of a 1 MB bank at 1 Mbit/s end-to-end on the simulated bus
+ */
+void testReadback_fullRegion(void)
+{
+    char info[128];
+    uint64_t elapsed = runDump(0, APP_SIZE);
+
+    TEST_ASSERT_TRUE(host.done);
+    TEST_ASSERT_EQUAL_UINT32(0, host.gaps);
+    TEST_ASSERT_EQUAL_MEMORY(blNodeSimApp(&target), dump, APP_SIZE);
+    TEST_ASSERT_EQUAL_HEX32(simImageCRC(blNodeSimApp(&target), APP_SIZE), host.crc);
+
+    // Payload is 7 of 8 bytes per frame, the rest of the bus time is ACKs and idle gaps
+    uint64_t ideal = (uint64_t) target.node.readback.total * canSimFrameBits(&(CanMsgTypeDef){.IDE = CAN_ID_EXT, .DLC = 8}) * 1000;
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(ideal + ideal / 20, elapsed, "Stream keeps the bus busy");
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(30000000000ULL, elapsed, "976 kB in under 30 s");
+
+    snprintf(info, sizeof(info), "976 kB read-back at 1 Mbit/s: %.2f s, %.1f kB/s",
+             elapsed / 1e9, APP_SIZE / 1024.0 / (elapsed / 1e9));
+    TEST_MESSAGE(info);
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testReadback_bounds);
+    RUN_TEST(testReadback_window);
+    RUN_TEST(testReadback_partial);
+    RUN_TEST(testReadback_metadata);
+    RUN_TEST(testReadback_fullRegion);
+
+    return UNITY_END();
+}
@@ -0,0 +1,225 @@
+#include <unity.h>
+#include <ev_sched.h>
+#include <bl_node_sim.h>
+#include <bl_orchestrator.h>
+#include <bus_load.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BL_RX_ID     (0x0C00FF10U)
+#define BL_STATUS_ID (0x0C00FE00U)     // BL_STATUS_MSG_BASE
+#define BITRATE      (1000000U)
+#define QUEUE_DEPTH  (10U)              // rx_message_q
+#define WINDOW       (10U)              // Orchestrator default, unreported words in flight
+#define IMAGE_WORDS  (4096U)            // 16 kB application
+#define FLASH_BYTES  (128U * 1024U)     // Sectors 0 to 4
+#define TIMEOUT_US   (1000000U)
+
+/*
+*   Target costs, HSI 16 MHz and -O0 as in env:disco_f429zi
+*/
+#define ISR_NS       (40000U)           // rxCANMessage + rbEnqueue
+#define DECODE_NS    (30000U)           // Dequeue, decodeCANMsg and FSM lookup
+#define PROGRAM_NS   (100000U)          // flashWriteU32
+#define CRC_WORD_NS  (1250U)            // Image check per word
+
+/*
+*   Scheduler semantics
+*/
+static ev_sched_t sched;
+static char order[32];
+static uint8_t order_len;
+static uint32_t chunks_left;
+
+static bool eventA(void* ctx)
+{
+    order[order_len++] = 'A';
+    return false;
+}
+
+static bool eventB(void* ctx)
+{
+    order[order_len++] = 'B';
+    // Posted while running, must not be lost
+    if (order_len < 3)
+        schedPost(&sched, 1);
+    return false;
+}
+
+static bool eventChunk(void* ctx)
+{
+    order[order_len++] = 'c';
+    chunks_left--;
+    // Every other chunk something more urgent comes in
+    if (chunks_left & 1)
+        schedPost(&sched, 0);
+    return chunks_left > 0;
+}
+
+void testSched_priority(void)
+{
+    initScheduler(&sched, 0);
+    schedRegister(&sched, 0, eventA);
+    schedRegister(&sched, 1, eventB);
+    schedRegister(&sched, SCHED_MAX_EVENTS, eventA);
+    order_len = 0;
+
+    TEST_ASSERT_FALSE(schedPending(&sched));
+    TEST_ASSERT_FALSE(schedRunOne(&sched));
+
+    schedPost(&sched, 1);
+    schedPost(&sched, 0);
+    schedPost(&sched, 0);                   // Still one run
+    schedPost(&sched, SCHED_MAX_EVENTS);    // Ignored
+    TEST_ASSERT_TRUE(schedPending(&sched));
+
+    while (schedRunOne(&sched))
+        ;
+
+    order[order_len] = 0;
+    TEST_ASSERT_EQUAL_STRING("ABB", order);
+    TEST_ASSERT_EQUAL_UINT32(1, sched.runs[0]);
+    TEST_ASSERT_EQUAL_UINT32(2, sched.runs[1]);
+    TEST_ASSERT_FALSE(schedPending(&sched));
+}
+
+/**
+ * @brief A long job runs one chunk per call, a higher priority event gets in between chunks
+ */
+void testSched_chunks(void)
+{
+    initScheduler(&sched, 0);
+    schedRegister(&sched, 0, eventA);
+    schedRegister(&sched, 2, eventChunk);
+    order_len = 0;
+    chunks_left = 4;
+
+    schedPost(&sched, 2);
+    while (schedRunOne(&sched))
+        ;
+
+    order[order_len] = 0;
+    TEST_ASSERT_EQUAL_STRING("cAccAc", order);
+    TEST_ASSERT_EQUAL_UINT32(4, sched.runs[2]);
+}
+
+/*
+*   Flashing session: the orchestrator keeps WINDOW words unreported, the bootloader node reports every
+*   BL_STATUS_EVERY words
+*/
+static sim_host_t host;
+static can_sim_bus_t bus;
+static bl_node_sim_t target;
+static uint8_t target_flash[FLASH_BYTES];
+static uint8_t image[IMAGE_WORDS * 4];
+static bus_load_t load;
+
+typedef struct {
+    bool done;
+    uint32_t words;
+    double ms;
+    uint32_t queued_sleeps;
+} session_result_t;
+
+/**
+ * @brief Flash IMAGE_WORDS with background traffic until the orchestrator saw the image check
+ * pass, or nothing is left to do
+ */
+static session_result_t runSession(bool wfi_each_frame, uint8_t load_pct)
+{
+    bl_node_sim_cfg_t node_cfg = {
+        .rx = {
+            .queue_depth = QUEUE_DEPTH,
+            .isr_ns = ISR_NS,
+            .id_filter = true,
+            .accept_id = BL_RX_ID,
+            .wfi_each_frame = wfi_each_frame,
+        },
+        .frame_ns = DECODE_NS,
+        .program_ns = PROGRAM_NS,
+        .crc_word_ns = CRC_WORD_NS,
+    };
+    bus_load_cfg_t load_cfg = {
+        .load_pct = load_pct,
+        .id_min = 0x000,
+        .id_max = 0x7FF,
+        .ext_pct = 20,
+        .dlc_min = 0,
+        .burst_max = 1,
+        .seed = 0xC0FFEE,
+    };
+    bl_manifest_entry_t entry = {.image = image, .length = sizeof(image), .window = WINDOW};
+    can_sim_bus_t* buses[] = {&bus};
+    session_result_t r;
+    uint64_t start_ns = 1000000;
+
+    for (uint32_t i = 0; i < sizeof(image); i++)
+        image[i] = (i * 31 + (i >> 9)) & 0xFF;
+    entry.crc = simImageCRC(image, sizeof(image));
+
+    initCANSimBus(&bus, BITRATE);
+    initBLNodeSim(&target, &bus, &node_cfg, target_flash, sizeof(target_flash));
+    initSimHost(&host, &bus);
+    if (load_pct)
+    {
+        initBusLoad(&load, &bus, &load_cfg);
+        busLoadStart(&load, 0, 60000000000ULL);
+    }
+
+    while (canSimNextStart(&bus) < start_ns)
+        canSimStep(&bus);
+    initOrchestrator(&host.orch, &entry, 1, BL_RX_ID, BL_STATUS_ID, TIMEOUT_US, 0);
+    simHostPump(&host, start_ns);
+    simHostRun(&host, buses, 1, &target, 1);
+
+    r.done = host.orch.jobs[0].state == JOB_DONE && memcmp(blNodeSimApp(&target), image, sizeof(image)) == 0;
+    r.words = target.node.image_words;
+    r.ms = (host.orch.jobs[0].end_us * 1000 - start_ns) / 1e6;
+    r.queued_sleeps = target.rx.queued_sleeps;
+    return r;
+}
+
+/**
+ * @brief The old loop handled one frame per wakeup. Frames that came in while it was busy waited
+ * for the next interrupt, so it ran at the rate of bus traffic and stopped once the tester waited
+ * for a report. The scheduler handles frames until the queue is empty.
+ */
+void testSched_throughput(void)
+{
+    uint8_t loads[] = {0, 10, 30, 60};
+    char line[128];
+
+    TEST_MESSAGE("16 kB, window 10, report every 5 words");
+    TEST_MESSAGE("load  loop        words     time_ms  kB/s  queued_sleeps");
+
+    for (int l = 0; l < sizeof(loads) / sizeof(loads[0]); l++)
+    {
+        session_result_t before = runSession(true, loads[l]);
+        session_result_t after = runSession(false, loads[l]);
+
+        snprintf(line, sizeof(line), "%3u%%  super loop  %5u  %10.1f  %4.1f  %13u%s", loads[l], before.words,
+                 before.ms, before.words * 4 / before.ms, before.queued_sleeps, before.done ? "" : "  stalled");
+        TEST_MESSAGE(line);
+        snprintf(line, sizeof(line), "%3u%%  scheduler   %5u  %10.1f  %4.1f  %13u", loads[l], after.words,
+                 after.ms, after.words * 4 / after.ms, after.queued_sleeps);
+        TEST_MESSAGE(line);
+
+        TEST_ASSERT_TRUE(after.done);
+        TEST_ASSERT_EQUAL_UINT32(IMAGE_WORDS, after.words);
+        TEST_ASSERT_EQUAL_UINT32(0, after.queued_sleeps);
+        TEST_ASSERT_TRUE(before.queued_sleeps > 0);
+        TEST_ASSERT_TRUE(!before.done || after.ms < before.ms);
+    }
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testSched_priority);
+    RUN_TEST(testSched_chunks);
+    RUN_TEST(testSched_throughput);
+
+    return UNITY_END();
+}
@@ -0,0 +1,220 @@
+#include <unity.h>
+#include <bl_segments.h>
+#include <sim_tester.h>
+#include <string.h>
+
+#define FLASH_BYTES (64U * 1024U)
+
+static uint32_t flash_words[FLASH_BYTES / 4];
+static uint8_t* flash = (uint8_t*) flash_words;
+
+/*
+*   CRC unit model, CPU feeding only
+*/
+static sim_crc_unit_t unit;
+
+/*
+*   Three segments with gaps, the last one ends off a word boundary
+*/
+static const uint32_t offsets[3] = {0x0100, 0x2000, 0xC000};
+static const uint32_t lengths[3] = {0x0400, 0x0010, 0x1003};
+
+static uint32_t setUpTable(bl_segment_table_t* table)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t crcs[3];
+    uint32_t seed = 0xC0FFEE;
+
+    for (uint32_t i = 0; i < FLASH_BYTES; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        flash[i] = seed >> 24;
+    }
+
+    initSegments(table);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        crc = simCRC(crc, flash + offsets[i], lengths[i]);
+        crcs[i] = crc;
+        segmentSet(table, i, offsets[i], lengths[i]);
+    }
+    // Out of order on purpose, the table only has to be complete
+    for (int i = 2; i >= 0; i--)
+        segmentSetCRC(table, i, crcs[i]);
+    return crc;
+}
+
+static uint32_t totalLength(void)
+{
+    return lengths[0] + lengths[1] + lengths[2];
+}
+
+void testSegments_validate(void)
+{
+    bl_segment_table_t table;
+    bl_segment_table_t bad;
+    uint32_t crc = setUpTable(&table);
+
+    TEST_ASSERT_TRUE(segmentsValidate(&table, FLASH_BYTES, totalLength(), crc));
+    TEST_ASSERT_EQUAL_UINT32(0xC000 + 0x1003, segmentsSpan(&table));
+
+    TEST_ASSERT_FALSE(segmentsValidate(&table, FLASH_BYTES, totalLength() - 1, crc));
+    TEST_ASSERT_FALSE(segmentsValidate(&table, FLASH_BYTES, totalLength(), crc ^ 1));
+    TEST_ASSERT_FALSE(segmentsValidate(&table, 0xC000 + 0x1002, totalLength(), crc));
+
+    bad = table;
+    bad.crcs &= ~0x2;
+    TEST_ASSERT_FALSE(segmentsValidate(&bad, FLASH_BYTES, totalLength(), crc));
+
+    bad = table;
+    bad.entries &= ~0x1;
+    TEST_ASSERT_FALSE(segmentsValidate(&bad, FLASH_BYTES, totalLength(), crc));
+
+    bad = table;
+    bad.segments[1].offset = 0x2002;
+    TEST_ASSERT_FALSE(segmentsValidate(&bad, FLASH_BYTES, totalLength(), crc));
+
+    bad = table;
+    bad.segments[0].length = 0x0402;
+    TEST_ASSERT_FALSE(segmentsValidate(&bad, FLASH_BYTES, totalLength() + 2, crc));
+
+    bad = table;
+    bad.segments[1].offset = 0x04FC;    // Overlaps segment 0
+    TEST_ASSERT_FALSE(segmentsValidate(&bad, FLASH_BYTES, totalLength(), crc));
+
+    bad = table;
+    bad.segments[2].offset = 0xFFFFF000;
+    TEST_ASSERT_FALSE(segmentsValidate(&bad, FLASH_BYTES, totalLength(), crc));
+
+    bad = table;
+    bad.segments[1].length = 0;
+    TEST_ASSERT_FALSE(segmentsValidate(&bad, FLASH_BYTES, totalLength() - 0x10, crc));
+
+    TEST_ASSERT_FALSE(segmentSet(&table, SEGMENT_MAX, 0, 4));
+    TEST_ASSERT_FALSE(segmentSetCRC(&table, SEGMENT_MAX, 0));
+
+    initSegments(&bad);
+    TEST_ASSERT_FALSE(segmentsValidate(&bad, FLASH_BYTES, 0, 0));
+}
+
+/**
+ * @brief Data words land in the segments only, the last word ends the span
+ */
+void testSegments_advance(void)
+{
+    bl_segment_table_t table;
+    uint32_t crc = setUpTable(&table);
+    uint32_t offset;
+    uint32_t words = 0;
+    uint32_t in_segment[3] = {0};
+
+    TEST_ASSERT_TRUE(segmentsValidate(&table, FLASH_BYTES, totalLength(), crc));
+
+    offset = table.segments[0].offset;
+    while (offset < segmentsSpan(&table))
+    {
+        bool found = false;
+        for (int i = 0; i < 3; i++)
+        {
+            if (offset >= offsets[i] && offset < offsets[i] + lengths[i])
+            {
+                in_segment[i]++;
+                found = true;
+            }
+        }
+        TEST_ASSERT_TRUE(found);
+        TEST_ASSERT_EQUAL_UINT32(0, offset & 0x3);
+
+        offset = segmentAdvance(&table, offset + 4);
+        words++;
+    }
+
+    TEST_ASSERT_EQUAL_UINT32((totalLength() + 3) / 4, words);
+    TEST_ASSERT_EQUAL_UINT32(lengths[0] / 4, in_segment[0]);
+    TEST_ASSERT_EQUAL_UINT32(lengths[1] / 4, in_segment[1]);
+    TEST_ASSERT_EQUAL_UINT32((lengths[2] + 3) / 4, in_segment[2]);
+    TEST_ASSERT_EQUAL_UINT32(2, table.current);
+}
+
+/**
+ * @brief One pass checks every segment CRC, then the span CRC covers the gaps for boot validation
+ */
+void testSegments_check(void)
+{
+    bl_segment_table_t table;
+    bl_crc_t crc;
+    uint32_t polls = 0;
+    uint32_t last = 0;
+    uint32_t image_crc = setUpTable(&table);
+
+    TEST_ASSERT_TRUE(segmentsValidate(&table, FLASH_BYTES, totalLength(), image_crc));
+    simCRCUnitSelect(&unit);
+    initCRCEngine(&crc, &simCRCUnitHw, 256);
+    segmentCheckStart(&table, &crc, flash);
+
+    while (segmentCheckPoll(&table, &crc, flash))
+    {
+        uint32_t progress = segmentCheckProgress(&table, &crc);
+        TEST_ASSERT_TRUE(progress >= last);
+        last = progress;
+        polls++;
+    }
+
+    TEST_ASSERT_EQUAL(SEGMENT_CHECK_PASSED, table.check);
+    TEST_ASSERT_EQUAL_HEX32(simImageCRC(flash, segmentsSpan(&table)), table.span_crc);
+    TEST_ASSERT_EQUAL_UINT32(totalLength() + segmentsSpan(&table), segmentCheckProgress(&table, &crc));
+    TEST_ASSERT_TRUE(polls > 3);
+
+    // Gap contents are not part of the image
+    flash[0x1000] ^= 0xFF;
+    segmentCheckStart(&table, &crc, flash);
+    while (segmentCheckPoll(&table, &crc, flash))
+        ;
+    TEST_ASSERT_EQUAL(SEGMENT_CHECK_PASSED, table.check);
+
+    // A bad byte fails its own segment, later segments are not checked
+    flash[offsets[1] + 3] ^= 0x01;
+    segmentCheckStart(&table, &crc, flash);
+    while (segmentCheckPoll(&table, &crc, flash))
+        ;
+    TEST_ASSERT_EQUAL(SEGMENT_CHECK_FAILED, table.check);
+    TEST_ASSERT_EQUAL_UINT32(1, table.current);
+    TEST_ASSERT_EQUAL_UINT32(lengths[0] + lengths[1], segmentCheckProgress(&table, &crc));
+}
+
+/**
+ * @brief A contiguous image is one segment at offset 0, its CRC is the span CRC, no second pass
+ */
+void testSegments_single(void)
+{
+    bl_segment_table_t table;
+    bl_crc_t crc;
+    uint32_t length = 10 * 1024 + 1;
+    uint32_t image_crc = simImageCRC(flash, length);
+
+    segmentsSingle(&table, length, image_crc);
+    TEST_ASSERT_TRUE(segmentsValidate(&table, FLASH_BYTES, length, image_crc));
+    TEST_ASSERT_EQUAL_UINT32(length, segmentsSpan(&table));
+    TEST_ASSERT_EQUAL_UINT32(length, segmentAdvance(&table, length));
+
+    simCRCUnitSelect(&unit);
+    initCRCEngine(&crc, &simCRCUnitHw, 0);
+    segmentCheckStart(&table, &crc, flash);
+    while (segmentCheckPoll(&table, &crc, flash))
+        ;
+
+    TEST_ASSERT_EQUAL(SEGMENT_CHECK_PASSED, table.check);
+    TEST_ASSERT_EQUAL_HEX32(image_crc, table.span_crc);
+    TEST_ASSERT_EQUAL_UINT32(length, segmentCheckProgress(&table, &crc));
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testSegments_validate);
+    RUN_TEST(testSegments_advance);
+    RUN_TEST(testSegments_check);
+    RUN_TEST(testSegments_single);
+
+    return UNITY_END();
+}
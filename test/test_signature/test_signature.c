@@ -0,0 +1,181 @@
+#include <unity.h>
+#include <sha256.h>
+#include <sha512.h>
+#include <ed25519.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static void fromHex(uint8_t* out, const char* hex)
+{
+    for (size_t i = 0; hex[2 * i]; i++)
+    {
+        unsigned int byte;
+        sscanf(&hex[2 * i], "%2x", &byte);
+        out[i] = byte;
+    }
+}
+
+static void sha256Of(const uint8_t* data, uint32_t length, uint8_t* digest)
+{
+    sha256_ctx_t ctx;
+    sha256Init(&ctx);
+    sha256Update(&ctx, data, length);
+    sha256Final(&ctx, digest);
+}
+
+/**
+ * @brief FIPS 180-4 known answers, including the two block and padding boundary cases
+ */
+void testSHA256_knownAnswers(void)
+{
+    uint8_t digest[32], expected[32];
+    static uint8_t million_a[1000000];
+
+    sha256Of((const uint8_t*) "", 0, digest);
+    fromHex(expected, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, digest, 32, "Empty message");
+
+    sha256Of((const uint8_t*) "abc", 3, digest);
+    fromHex(expected, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, digest, 32, "abc");
+
+    sha256Of((const uint8_t*) "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56, digest);
+    fromHex(expected, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, digest, 32, "Two block message");
+
+    memset(million_a, 'a', sizeof(million_a));
+    sha256Of(million_a, sizeof(million_a), digest);
+    fromHex(expected, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, digest, 32, "One million a");
+}
+
+/**
+ * @brief Feeding one 32 bit word at a time, as flashApp() does, gives the one-shot digest
+ */
+void testSHA256_wordStream(void)
+{
+    uint8_t image[4099];
+    uint8_t one_shot[32], streamed[32];
+    sha256_ctx_t ctx;
+
+    for (uint32_t i = 0; i < sizeof(image); i++)
+        image[i] = (i * 31 + 7) & 0xFF;
+
+    sha256Of(image, sizeof(image), one_shot);
+
+    sha256Init(&ctx);
+    for (uint32_t i = 0; i < sizeof(image); i += 4)
+        sha256Update(&ctx, &image[i], sizeof(image) - i < 4 ? sizeof(image) - i : 4);
+    sha256Final(&ctx, streamed);
+
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(one_shot, streamed, 32);
+}
+
+void testSHA512_knownAnswer(void)
+{
+    uint8_t digest[64], expected[64];
+    sha512_ctx_t ctx;
+
+    sha512Init(&ctx);
+    sha512Update(&ctx, (const uint8_t*) "abc", 3);
+    sha512Final(&ctx, digest);
+    fromHex(expected, "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+                      "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, digest, 64);
+}
+
+/**
+ * @brief RFC 8032 section 7.1 tests 1 and 2
+ */
+void testEd25519_rfc8032(void)
+{
+    uint8_t pk[32], sig[64], msg[1];
+
+    fromHex(pk,  "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a");
+    fromHex(sig, "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e065224901555"
+                 "fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b");
+    TEST_ASSERT_TRUE_MESSAGE(ed25519Verify(sig, msg, 0, pk), "Test 1");
+
+    fromHex(pk,  "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c");
+    fromHex(sig, "92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da"
+                 "085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00");
+    msg[0] = 0x72;
+    TEST_ASSERT_TRUE_MESSAGE(ed25519Verify(sig, msg, 1, pk), "Test 2");
+
+    msg[0] = 0x73;
+    TEST_ASSERT_FALSE_MESSAGE(ed25519Verify(sig, msg, 1, pk), "Modified message");
+}
+
+/**
+ * @brief Image signed with tools/sign_image.py using the RFC 8032 test 1 key. Checks the
+ * full bootloader path (word-wise SHA-256, then Ed25519 over the digest) and tampering.
+ */
+void testEd25519_signedImage(void)
+{
+    static const uint8_t signature[64] = {
+        0x53, 0xed, 0xf9, 0x80, 0xb7, 0x7f, 0x95, 0xe6,
+        0x38, 0x6a, 0xc1, 0xf6, 0x87, 0x97, 0xe3, 0x24,
+        0x26, 0x9f, 0x03, 0x7d, 0xe1, 0x64, 0x24, 0x89,
+        0x3d, 0x5b, 0x34, 0xc2, 0xf5, 0x11, 0x93, 0x89,
+        0x7a, 0xc5, 0x6b, 0xb7, 0xfe, 0x51, 0x82, 0x21,
+        0x55, 0x93, 0x2b, 0xbe, 0xe7, 0x38, 0xca, 0x5e,
+        0x01, 0x59, 0x7c, 0x67, 0xda, 0x64, 0x1d, 0x2f,
+        0x72, 0x04, 0xc7, 0xc0, 0x34, 0x6a, 0x90, 0x0f,
+    };
+    uint8_t pk[32], digest[32], expected[32], bad[64];
+    uint8_t image[4099];
+    char info[128];
+
+    fromHex(pk, "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a");
+    for (uint32_t i = 0; i < sizeof(image); i++)
+        image[i] = (i * 31 + 7) & 0xFF;
+
+    sha256Of(image, sizeof(image), digest);
+    fromHex(expected, "c8f9533a174e0066d1c828b946fd122d0e3b13d61b011dcf3a29964e3162acc6");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, digest, 32);
+
+    clock_t start = clock();
+    bool ok = ed25519Verify(signature, digest, 32, pk);
+    double ms = 1000.0 * (clock() - start) / CLOCKS_PER_SEC;
+    TEST_ASSERT_TRUE_MESSAGE(ok, "Host signature accepted");
+
+    // Flipped image bit
+    image[100] ^= 0x01;
+    sha256Of(image, sizeof(image), digest);
+    TEST_ASSERT_FALSE_MESSAGE(ed25519Verify(signature, digest, 32, pk), "Tampered image rejected");
+    image[100] ^= 0x01;
+    sha256Of(image, sizeof(image), digest);
+
+    // Flipped signature bits in R and S
+    memcpy(bad, signature, 64);
+    bad[3] ^= 0x40;
+    TEST_ASSERT_FALSE_MESSAGE(ed25519Verify(bad, digest, 32, pk), "Tampered R rejected");
+    memcpy(bad, signature, 64);
+    bad[40] ^= 0x02;
+    TEST_ASSERT_FALSE_MESSAGE(ed25519Verify(bad, digest, 32, pk), "Tampered S rejected");
+
+    // S + L is the same point but must be rejected as non-canonical
+    memcpy(bad, signature, 64);
+    bad[63] |= 0xF0;
+    TEST_ASSERT_FALSE_MESSAGE(ed25519Verify(bad, digest, 32, pk), "Non-canonical S rejected");
+
+    // Different key
+    pk[0] ^= 0x01;
+    TEST_ASSERT_FALSE_MESSAGE(ed25519Verify(signature, digest, 32, pk), "Wrong key rejected");
+
+    snprintf(info, sizeof(info), "Ed25519 verify on native: %.2f ms (runs once after the last word)", ms);
+    TEST_MESSAGE(info);
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testSHA256_knownAnswers);
+    RUN_TEST(testSHA256_wordStream);
+    RUN_TEST(testSHA512_knownAnswer);
+    RUN_TEST(testEd25519_rfc8032);
+    RUN_TEST(testEd25519_signedImage);
+
+    return UNITY_END();
+}
@@ -0,0 +1,228 @@
+#include <unity.h>
+#include <bl_node_sim.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+#include <string.h>
+
+#ifndef BL_SIGNED_IMAGES
+#error "test_signed_boot runs the signed bootloader, run it in env:native_signed"
+#endif
+
+#define BL_RX_ID     (0x0C00FF10U)
+#define BITRATE      (1000000U)
+#define QUEUE_DEPTH  (10U)              // rx_message_q
+#define IMAGE_BYTES  (4099U)
+#define FLASH_BYTES  (128U * 1024U)     // Sectors 0 to 4
+
+/*
+*   Target costs, HSI 16 MHz and -O0 as in env:disco_f429zi
+*/
+#define ISR_NS       (40000U)           // rxCANMessage + rbEnqueue
+#define DECODE_NS    (30000U)           // Dequeue, decodeCANMsg and FSM lookup
+#define PROGRAM_NS   (16000U)           // flashWriteU32
+#define CRC_WORD_NS  (1250U)            // Image check per word
+
+/*
+*   Image of test_signature, signed with tools/sign_image.py using the RFC 8032 test 1 key
+*/
+static const uint8_t public_key[32] = {
+    0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7,
+    0xd5, 0x4b, 0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a,
+    0x0e, 0xe1, 0x72, 0xf3, 0xda, 0xa6, 0x23, 0x25,
+    0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51, 0x1a,
+};
+
+static const uint8_t signature[64] = {
+    0x53, 0xed, 0xf9, 0x80, 0xb7, 0x7f, 0x95, 0xe6,
+    0x38, 0x6a, 0xc1, 0xf6, 0x87, 0x97, 0xe3, 0x24,
+    0x26, 0x9f, 0x03, 0x7d, 0xe1, 0x64, 0x24, 0x89,
+    0x3d, 0x5b, 0x34, 0xc2, 0xf5, 0x11, 0x93, 0x89,
+    0x7a, 0xc5, 0x6b, 0xb7, 0xfe, 0x51, 0x82, 0x21,
+    0x55, 0x93, 0x2b, 0xbe, 0xe7, 0x38, 0xca, 0x5e,
+    0x01, 0x59, 0x7c, 0x67, 0xda, 0x64, 0x1d, 0x2f,
+    0x72, 0x04, 0xc7, 0xc0, 0x34, 0x6a, 0x90, 0x0f,
+};
+
+static uint8_t image[IMAGE_BYTES];
+
+static bl_node_sim_t target;
+static uint8_t bank[FLASH_BYTES];
+
+static can_sim_bus_t bus;
+static can_sim_node_t host;
+
+/**
+ * @brief Image word at byte i, bytes past the image are `pad`
+ */
+static uint32_t imageWord(uint32_t i, uint8_t pad)
+{
+    uint32_t word = 0;
+    for (uint32_t b = 0; b < 4; b++)
+        word |= (uint32_t) (i + b < IMAGE_BYTES ? image[i + b] : pad) << (8 * b);
+    return word;
+}
+
+/**
+ * @brief Send one frame and run the node until it has nothing left to do
+ */
+static void send(const BLRxMessage_t* frame)
+{
+    CanMsgTypeDef msg = {.IDE = CAN_ID_EXT, .ExtId = BL_RX_ID, .DLC = 8};
+
+    blPackRxMessage(frame, msg.Data);
+    canSimTransmit(&host, &msg, bus.now_ns);
+    while (1)
+    {
+        blRxSimRun(&target.rx, canSimNextStart(&bus));
+        if (!canSimStep(&bus))
+            break;
+    }
+}
+
+static void sendFlag(uint8_t flag)
+{
+    BLRxMessage_t frame = {.message_type = M_FLAG_SET, .op_mode_flag = flag};
+    send(&frame);
+}
+
+static void sendNone(void)
+{
+    BLRxMessage_t frame = {.message_type = M_NONE};
+    send(&frame);
+}
+
+/**
+ * @brief Flash the signed image, stopping after `words` data words
+ */
+static void download(uint32_t words)
+{
+    BLRxMessage_t meta = {.message_type = M_METADATA, .application_length = IMAGE_BYTES, .crc_value = simImageCRC(image, IMAGE_BYTES)};
+    BLRxMessage_t data = {.message_type = M_APP_DATA};
+    BLRxMessage_t sig = {.message_type = M_SIGNATURE};
+
+    sendFlag(FLAG_FLASH_NEW_APP);
+    TEST_ASSERT_EQUAL(S_WAIT_FOR_META, target.node.state);
+    send(&meta);
+    TEST_ASSERT_EQUAL(S_FLASH_APP, target.node.state);
+
+    for (uint32_t i = 0; i < words && 4 * i < IMAGE_BYTES; i++)
+    {
+        data.application_data = imageWord(4 * i, 0xFF);
+        send(&data);
+    }
+    if (4 * words < IMAGE_BYTES)
+        return;
+
+    for (uint8_t i = 0; i < sizeof(signature) / 4; i++)
+    {
+        sig.signature_index = i;
+        sig.signature_data = signature[4 * i] | (signature[4 * i + 1] << 8) |
+                             (signature[4 * i + 2] << 16) | ((uint32_t) signature[4 * i + 3] << 24);
+        send(&sig);
+    }
+    sendNone();
+}
+
+static void setupTarget(void)
+{
+    bl_node_sim_cfg_t node_cfg = {
+        .rx = {
+            .queue_depth = QUEUE_DEPTH,
+            .isr_ns = ISR_NS,
+            .id_filter = true,
+            .accept_id = BL_RX_ID,
+        },
+        .frame_ns = DECODE_NS,
+        .program_ns = PROGRAM_NS,
+        .crc_word_ns = CRC_WORD_NS,
+        .public_key = public_key,
+    };
+
+    for (uint32_t i = 0; i < IMAGE_BYTES; i++)
+        image[i] = (i * 31 + 7) & 0xFF;
+
+    initCANSimBus(&bus, BITRATE);
+    initBLNodeSim(&target, &bus, &node_cfg, bank, FLASH_BYTES);
+    canSimAttach(&bus, &host, 0, 0, 0);
+}
+
+/**
+ * @brief A download that passes the CRC and the signature is stored as bootable and boots
+ * after a reset
+ */
+void testSignedBoot_verified(void)
+{
+    setupTarget();
+    download(UINT32_MAX);
+
+    TEST_ASSERT_EQUAL(S_LAUNCH_APP, target.node.state);
+    TEST_ASSERT_EQUAL_UINT32(FLAG_BOOT_TO_APP, target.node.journal.meta.boot_flag);
+    TEST_ASSERT_EQUAL_UINT32(CHECK_SIGNATURE, target.node.journal.meta.app_check);
+    TEST_ASSERT_EQUAL_MEMORY(image, blNodeSimApp(&target), IMAGE_BYTES);
+
+    blNodeSimReboot(&target);
+    sendNone();
+    TEST_ASSERT_EQUAL(S_VALIDATE_FLASH, target.node.state);
+    sendNone();
+    TEST_ASSERT_EQUAL(S_LAUNCH_APP, target.node.state);
+}
+
+/**
+ * @brief A signed download cut off half way leaves nothing to boot. The tester can not ask
+ * for the application, and a reset does not boot it either, even though the words that made it
+ * into flash are the ones of the signed image.
+ */
+void testSignedBoot_interrupted(void)
+{
+    setupTarget();
+    download(UINT32_MAX);
+    TEST_ASSERT_EQUAL(S_LAUNCH_APP, target.node.state);
+
+    // Same image again, cut off after 100 words
+    blNodeSimReboot(&target);
+    download(100);
+    TEST_ASSERT_EQUAL(S_FLASH_APP, target.node.state);
+    TEST_ASSERT_EQUAL_UINT32(FLAG_FLASH_NEW_APP, target.node.journal.meta.boot_flag);
+    TEST_ASSERT_EQUAL_UINT32(CHECK_NONE, target.node.journal.meta.app_check);
+    TEST_ASSERT_EQUAL_UINT32(0, target.node.journal.meta.app_length);
+
+    // Reset, the tester asks for the application
+    blNodeSimReboot(&target);
+    sendFlag(FLAG_BOOT_TO_APP);
+    TEST_ASSERT_EQUAL(S_WAIT_FOR_META, target.node.state);
+    TEST_ASSERT_EQUAL_UINT32(FLAG_FLASH_NEW_APP, target.node.journal.meta.boot_flag);
+
+    // Reset, no tester
+    blNodeSimReboot(&target);
+    sendNone();
+    TEST_ASSERT_EQUAL(S_WAIT_FOR_META, target.node.state);
+
+    // A record that never went through the signature check is not booted, whatever its CRC says
+    bl_boot_meta_t forged = target.node.journal.meta;
+    forged.boot_flag = FLAG_BOOT_TO_APP;
+    forged.app_crc = simImageCRC(image, IMAGE_BYTES);
+    forged.app_length = IMAGE_BYTES;
+    forged.app_check = CHECK_CRC;
+    TEST_ASSERT_TRUE(journalAppend(&target.node.journal, &forged));
+
+    blNodeSimReboot(&target);
+    sendNone();
+    TEST_ASSERT_EQUAL(S_VALIDATE_FLASH, target.node.state);
+    sendNone();
+    TEST_ASSERT_EQUAL(S_WAIT_FOR_META, target.node.state);
+
+    // A complete download makes the node bootable again
+    blNodeSimReboot(&target);
+    download(UINT32_MAX);
+    TEST_ASSERT_EQUAL(S_LAUNCH_APP, target.node.state);
+    TEST_ASSERT_EQUAL_UINT32(CHECK_SIGNATURE, target.node.journal.meta.app_check);
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testSignedBoot_verified);
+    RUN_TEST(testSignedBoot_interrupted);
+
+    return UNITY_END();
+}
@@ -0,0 +1,807 @@
+#include <unity.h>
+#include <isotp.h>
+#include <bl_uds.h>
+#include <bl_node_sim.h>
+#include <can_sim.h>
+#include <sim_tester.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UDS_RX_ID    (0x7E0U)
+#define UDS_TX_ID    (0x7E8U)
+#define BITRATE      (1000000U)
+#define QUEUE_DEPTH  (10U)              // rx_message_q
+
+#define APP_START    (0x0800C000U)
+#define APP_SIZE     (64U * 1024U)
+
+/*
+*   Target costs, HSI 16 MHz and -O0 as in env:disco_f429zi. Word programming uses the datasheet
+*   typical time, PROGRAM_MAX_NS is the maximum.
+*/
+#define ISR_NS          (40000U)        // rxCANMessage + rbEnqueue
+#define FRAME_NS        (40000U)        // Dequeue, ISO-TP and UDS bookkeeping per frame
+#define PROGRAM_NS      (16000U)        // flashWriteU32, typical
+#define PROGRAM_MAX_NS  (100000U)       // flashWriteU32, maximum
+#define CRC_WORD_NS     (1250U)         // Check memory routine per word
+#define FLASH_BYTES     (128U * 1024U)  // Sectors 0 to 4, 80 kB of application flash
+
+/*
+*   Bootloader node on the simulated bus, and an in-memory application flash behind a bare UDS server
+*/
+static bl_node_sim_t target;
+static uint8_t target_flash[FLASH_BYTES];
+static uint8_t image[APP_SIZE];
+
+static uint8_t flash[APP_SIZE];
+static struct {
+    bl_uds_t uds;
+    uint32_t index;                     // Next byte to program
+    uint32_t end;
+    bool erased;
+    uint32_t pending_sent;
+    bool async;                         // Routines go on after the hook, finished with udsRoutineDone()
+} server;
+
+static uint8_t opsErase(uint32_t address, uint32_t length)
+{
+    if (address < APP_START || length == 0 || length > APP_START + APP_SIZE - address)
+        return UDS_NRC_OUT_OF_RANGE;
+    memset(&flash[address - APP_START], 0xFF, length);
+    server.erased = true;
+    return server.async ? UDS_NRC_RESPONSE_PENDING : UDS_NRC_OK;
+}
+
+static uint8_t opsDownload(uint32_t address, uint32_t length)
+{
+    if (!server.erased)
+        return UDS_NRC_DOWNLOAD_NOT_ACCEPTED;
+    if (address != APP_START || length == 0 || length > APP_SIZE)
+        return UDS_NRC_OUT_OF_RANGE;
+    server.index = 0;
+    server.end = length;
+    return UDS_NRC_OK;
+}
+
+static uint8_t opsTransfer(const uint8_t* data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (server.index >= server.end || flash[server.index] != 0xFF)
+            return UDS_NRC_PROGRAMMING_FAILURE;
+        flash[server.index++] = data[i];
+    }
+    return UDS_NRC_OK;
+}
+
+static uint8_t opsExit(void)
+{
+    return server.index == server.end ? UDS_NRC_OK : UDS_NRC_SEQUENCE_ERROR;
+}
+
+static uint8_t opsCheck(const uint8_t* record, uint32_t length, bool* passed)
+{
+    if (length != 4)
+        return UDS_NRC_INCORRECT_LENGTH;
+    uint32_t crc = ((uint32_t) record[0] << 24) | (record[1] << 16) | (record[2] << 8) | record[3];
+    *passed = simImageCRC(flash, server.end) == crc;
+    return server.async ? UDS_NRC_RESPONSE_PENDING : UDS_NRC_OK;
+}
+
+static void opsPending(uint8_t sid)
+{
+    server.pending_sent++;
+}
+
+static const bl_uds_ops_t ops = {
+    .erase    = opsErase,
+    .download = opsDownload,
+    .transfer = opsTransfer,
+    .exit     = opsExit,
+    .check    = opsCheck,
+    .pending  = opsPending,
+};
+
+/*
+*   Tester: ISO-TP peer running a programming sequence, one request at a time
+*/
+typedef enum {
+    STEP_SESSION,
+    STEP_ERASE,
+    STEP_DOWNLOAD,
+    STEP_TRANSFER,
+    STEP_EXIT,
+    STEP_CHECK,
+    STEP_DONE,
+    STEP_FAILED
+} TesterStep_e;
+
+static struct {
+    can_sim_node_t node;
+    isotp_t tp;
+    uint8_t rx_buf[64];
+    uint8_t req[4095];
+    uint64_t ready_ns;
+
+    TesterStep_e step;
+    uint32_t image_length;
+    uint32_t block_length;              // maxNumberOfBlockLength from the RequestDownload response
+    uint32_t sent;                      // Image bytes sent
+    uint8_t counter;
+    uint32_t blocks;
+    uint8_t last_nrc;
+    uint32_t pending;                   // Response pending frames
+    bool check_passed;
+
+    uint64_t transfer_start_ns;
+    uint64_t transfer_end_ns;
+} tester;
+
+static can_sim_bus_t bus;
+
+static bool testerTx(CanMsgTypeDef* msg)
+{
+    return canSimTransmit(&tester.node, msg, tester.ready_ns);
+}
+
+/**
+ * @brief Load as many frames as mailboxes and STmin allow. Frames held back by STmin are
+ * loaded with the time they may go out.
+ */
+static void testerPump(uint64_t now_ns)
+{
+    while (1)
+    {
+        uint64_t t = now_ns;
+        if (tester.tp.tx_next_us * 1000 > t)
+            t = tester.tp.tx_next_us * 1000;
+        tester.ready_ns = t;
+        if (isoTpPump(&tester.tp, testerTx, t / 1000) == 0)
+            break;
+    }
+}
+
+static uint32_t putAddressLength(uint8_t* p, uint32_t address, uint32_t length)
+{
+    p[0] = 0x44;
+    for (int i = 0; i < 4; i++)
+    {
+        p[1 + i] = address >> (24 - 8 * i);
+        p[5 + i] = length >> (24 - 8 * i);
+    }
+    return 9;
+}
+
+static void testerRequest(uint64_t now_ns)
+{
+    uint32_t length = 0;
+    uint8_t* r = tester.req;
+
+    switch (tester.step)
+    {
+        case STEP_SESSION:
+            r[0] = UDS_SID_SESSION_CONTROL;
+            r[1] = UDS_SESSION_PROGRAMMING;
+            length = 2;
+            break;
+        case STEP_ERASE:
+            r[0] = UDS_SID_ROUTINE_CONTROL;
+            r[1] = UDS_ROUTINE_START;
+            r[2] = UDS_ROUTINE_ERASE_MEMORY >> 8;
+            r[3] = UDS_ROUTINE_ERASE_MEMORY & 0xFF;
+            length = 4 + putAddressLength(&r[4], APP_START, APP_SIZE);
+            break;
+        case STEP_DOWNLOAD:
+            r[0] = UDS_SID_REQUEST_DOWNLOAD;
+            r[1] = 0x00;
+            length = 2 + putAddressLength(&r[2], APP_START, tester.image_length);
+            break;
+        case STEP_TRANSFER:
+        {
+            uint32_t chunk = tester.image_length - tester.sent;
+            if (chunk > tester.block_length - 2)
+                chunk = tester.block_length - 2;
+            r[0] = UDS_SID_TRANSFER_DATA;
+            r[1] = ++tester.counter;
+            memcpy(&r[2], &image[tester.sent], chunk);
+            tester.sent += chunk;
+            length = 2 + chunk;
+            if (tester.blocks++ == 0)
+                tester.transfer_start_ns = now_ns;
+            break;
+        }
+        case STEP_EXIT:
+            r[0] = UDS_SID_TRANSFER_EXIT;
+            length = 1;
+            break;
+        case STEP_CHECK:
+        {
+            uint32_t crc = simImageCRC(image, tester.image_length);
+            r[0] = UDS_SID_ROUTINE_CONTROL;
+            r[1] = UDS_ROUTINE_START;
+            r[2] = UDS_ROUTINE_CHECK_MEMORY >> 8;
+            r[3] = UDS_ROUTINE_CHECK_MEMORY & 0xFF;
+            for (int i = 0; i < 4; i++)
+                r[4 + i] = crc >> (24 - 8 * i);
+            length = 8;
+            break;
+        }
+        default:
+            return;
+    }
+
+    isoTpSend(&tester.tp, r, length);
+}
+
+static void testerResponse(const uint8_t* rsp, uint32_t length, uint64_t now_ns)
+{
+    if (rsp[0] == UDS_SID_NEGATIVE)
+    {
+        if (length == 3 && rsp[2] == UDS_NRC_RESPONSE_PENDING)
+        {
+            tester.pending++;
+            return;
+        }
+        tester.last_nrc = rsp[2];
+        tester.step = STEP_FAILED;
+        return;
+    }
+
+    switch (tester.step)
+    {
+        case STEP_DOWNLOAD:
+            tester.block_length = (rsp[2] << 8) | rsp[3];
+            tester.step = STEP_TRANSFER;
+            break;
+        case STEP_TRANSFER:
+            if (tester.sent == tester.image_length)
+            {
+                tester.transfer_end_ns = now_ns;
+                tester.step = STEP_EXIT;
+            }
+            break;
+        case STEP_CHECK:
+            tester.check_passed = rsp[4] == 0x00;
+            tester.step = STEP_DONE;
+            return;
+        default:
+            tester.step++;
+            break;
+    }
+
+    testerRequest(now_ns);
+}
+
+static void testerRx(can_sim_node_t* node, CanMsgTypeDef* msg, uint64_t now_ns)
+{
+    if (canMsgId(msg) != UDS_TX_ID)
+        return;
+
+    if (isoTpRxFrame(&tester.tp, msg, now_ns / 1000))
+        testerResponse(tester.rx_buf, tester.tp.rx_length, now_ns);
+    testerPump(now_ns);
+}
+
+static void testerTxDone(can_sim_node_t* node, uint64_t now_ns)
+{
+    testerPump(now_ns);
+}
+
+typedef struct {
+    bool passed;                        // Programming sequence completed and the check routine passed
+    uint32_t lost;                      // UDS frames lost in FIFO0
+    uint32_t high_water;
+    double transfer_ms;
+    double efficiency;                  // ISO-TP line rate over achieved rate during TransferData
+} uds_result_t;
+
+/**
+ * @brief Program an image of `image_length` bytes through the whole UDS sequence
+ */
+static uds_result_t runDownload(uint32_t image_length, uint16_t block_length, uint8_t bs, uint8_t st_min, uint32_t program_ns)
+{
+    bl_node_sim_cfg_t node_cfg = {
+        .rx = {
+            .queue_depth = QUEUE_DEPTH,
+            .isr_ns = ISR_NS,
+            .id_filter = true,
+            .accept_id = UDS_RX_ID,
+        },
+        .frame_ns = FRAME_NS,
+        .program_ns = program_ns,
+        .crc_word_ns = CRC_WORD_NS,
+        .uds_block_length = block_length,
+        .uds_bs = bs,
+        .uds_stmin = st_min,
+    };
+    uds_result_t r;
+
+    memset(&tester, 0, sizeof(tester));
+    for (uint32_t i = 0; i < image_length; i++)
+        image[i] = (i * 7 + (i >> 8)) & 0xFF;
+
+    initCANSimBus(&bus, BITRATE);
+    initBLNodeSim(&target, &bus, &node_cfg, target_flash, sizeof(target_flash));
+    memset(blNodeSimApp(&target), 0x00, APP_SIZE);   // Old application, the tester has to erase it
+
+    canSimAttach(&bus, &tester.node, testerRx, testerTxDone, 0);
+    initIsoTp(&tester.tp, UDS_TX_ID, UDS_RX_ID, 0, 0, tester.rx_buf, sizeof(tester.rx_buf));
+    tester.image_length = image_length;
+
+    testerRequest(0);
+    testerPump(0);
+
+    // Lost frames leave both sides waiting, the run ends once nothing is left to do
+    while (1)
+    {
+        blRxSimRun(&target.rx, canSimNextStart(&bus));
+        if (!canSimPending(&bus))
+            break;
+        canSimStep(&bus);
+    }
+
+    CanMsgTypeDef cf = {.IDE = CAN_ID_STD, .StdId = UDS_RX_ID, .DLC = 8};
+    double line_ns = (double) canSimFrameTime(&bus, &cf) * ((image_length + 6) / 7);
+
+    r.passed = tester.step == STEP_DONE && tester.check_passed && memcmp(blNodeSimApp(&target), image, image_length) == 0;
+    r.lost = target.rx.accept_overruns;
+    r.high_water = target.rx.high_water;
+    r.transfer_ms = 0;
+    r.efficiency = 0;
+    if (tester.transfer_end_ns)
+    {
+        r.transfer_ms = (tester.transfer_end_ns - tester.transfer_start_ns) / 1e6;
+        r.efficiency = line_ns / (tester.transfer_end_ns - tester.transfer_start_ns);
+    }
+    return r;
+}
+
+/*
+*   ISO-TP loopback, frames are passed by hand between two transports
+*/
+#define LOOP_MAX_FRAMES (700U)
+
+static CanMsgTypeDef loop_frames[LOOP_MAX_FRAMES];
+static uint32_t loop_count;
+
+static bool loopTx(CanMsgTypeDef* msg)
+{
+    if (loop_count == LOOP_MAX_FRAMES)
+        return false;
+    loop_frames[loop_count++] = *msg;
+    return true;
+}
+
+/**
+ * @brief Move frames from `from` to `to` until neither has anything to send
+ *
+ * @param drop_cf Consecutive frame number (1 based) to drop on the way, 0 for none
+ * @return uint32_t Messages completed at `to`
+ */
+static uint32_t loopExchange(isotp_t* from, isotp_t* to, uint32_t drop_cf, uint32_t* frames)
+{
+    uint32_t completed = 0, cf = 0;
+    *frames = 0;
+
+    while (1)
+    {
+        loop_count = 0;
+        isoTpPump(from, loopTx, 0);
+        isoTpPump(to, loopTx, 0);
+        if (loop_count == 0)
+            return completed;
+
+        for (uint32_t i = 0; i < loop_count; i++)
+        {
+            CanMsgTypeDef* msg = &loop_frames[i];
+            (*frames)++;
+            if (canMsgId(msg) == from->tx_id)
+            {
+                if ((msg->Data[0] >> 4) == ISOTP_PCI_CF && ++cf == drop_cf)
+                    continue;
+                completed += isoTpRxFrame(to, msg, 0);
+            }
+            else
+            {
+                isoTpRxFrame(from, msg, 0);
+            }
+        }
+    }
+}
+
+static isotp_t sender, receiver;
+static uint8_t sender_buf[16], receiver_buf[4095];
+
+void testIsoTp_singleFrame(void)
+{
+    uint8_t msg[] = {0x10, 0x02};
+    uint32_t frames;
+
+    initIsoTp(&sender, 0x7E8, 0x7E0, 0, 0, sender_buf, sizeof(sender_buf));
+    initIsoTp(&receiver, 0x7E0, 0x7E8, 0, 0, receiver_buf, sizeof(receiver_buf));
+
+    TEST_ASSERT_TRUE(isoTpSend(&sender, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_UINT32(1, loopExchange(&sender, &receiver, 0, &frames));
+    TEST_ASSERT_EQUAL_UINT32(1, frames);
+    TEST_ASSERT_EQUAL_UINT32(2, receiver.rx_length);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(msg, receiver_buf, sizeof(msg));
+    TEST_ASSERT_EQUAL(ISOTP_TX_IDLE, sender.tx_state);
+}
+
+/**
+ * @brief 1000 bytes with BS 4: one FF, 142 CFs and a flow control after the FF and every 4 CFs
+ */
+void testIsoTp_segmentation(void)
+{
+    static uint8_t msg[1000];
+    uint32_t frames;
+
+    for (uint32_t i = 0; i < sizeof(msg); i++)
+        msg[i] = i * 13;
+
+    initIsoTp(&sender, 0x7E8, 0x7E0, 0, 0, sender_buf, sizeof(sender_buf));
+    initIsoTp(&receiver, 0x7E0, 0x7E8, 4, 0, receiver_buf, sizeof(receiver_buf));
+
+    TEST_ASSERT_TRUE(isoTpSend(&sender, msg, sizeof(msg)));
+    TEST_ASSERT_FALSE(isoTpSend(&sender, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_UINT32(1, loopExchange(&sender, &receiver, 0, &frames));
+
+    // (1000 - 6) / 7 is 142 CFs, flow control after the FF and after CF 4, 8, ... 140
+    TEST_ASSERT_EQUAL_UINT32(1 + 142 + 1 + 35, frames);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(msg), receiver.rx_length);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(msg, receiver_buf, sizeof(msg));
+    TEST_ASSERT_EQUAL(ISOTP_TX_IDLE, sender.tx_state);
+    TEST_ASSERT_EQUAL_UINT32(1, sender.tx_messages);
+    TEST_ASSERT_EQUAL_UINT32(0, receiver.rx_errors);
+}
+
+/**
+ * @brief A lost CF aborts the reception, the next message is received normally
+ */
+void testIsoTp_sequenceError(void)
+{
+    static uint8_t msg[100];
+    uint32_t frames;
+
+    initIsoTp(&sender, 0x7E8, 0x7E0, 0, 0, sender_buf, sizeof(sender_buf));
+    initIsoTp(&receiver, 0x7E0, 0x7E8, 0, 0, receiver_buf, sizeof(receiver_buf));
+
+    TEST_ASSERT_TRUE(isoTpSend(&sender, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_UINT32(0, loopExchange(&sender, &receiver, 5, &frames));
+    TEST_ASSERT_EQUAL_UINT32(1, receiver.rx_errors);
+    TEST_ASSERT_FALSE(receiver.rx_active);
+
+    TEST_ASSERT_TRUE(isoTpSend(&sender, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_UINT32(1, loopExchange(&sender, &receiver, 0, &frames));
+}
+
+/**
+ * @brief A message longer than the receive buffer is refused with FS overflow, the sender gives up
+ */
+void testIsoTp_overflow(void)
+{
+    static uint8_t msg[100];
+    uint32_t frames;
+
+    initIsoTp(&sender, 0x7E8, 0x7E0, 0, 0, sender_buf, sizeof(sender_buf));
+    initIsoTp(&receiver, 0x7E0, 0x7E8, 0, 0, receiver_buf, 64);
+
+    TEST_ASSERT_TRUE(isoTpSend(&sender, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_UINT32(0, loopExchange(&sender, &receiver, 0, &frames));
+    TEST_ASSERT_EQUAL_UINT32(2, frames);
+    TEST_ASSERT_EQUAL_UINT32(1, receiver.overflows);
+    TEST_ASSERT_EQUAL_UINT32(1, sender.overflows);
+    TEST_ASSERT_EQUAL(ISOTP_TX_IDLE, sender.tx_state);
+}
+
+/**
+ * @brief An aborted send frees the transport, the next message goes out in full
+ */
+void testIsoTp_abort(void)
+{
+    static uint8_t msg[100];
+    uint32_t frames;
+
+    initIsoTp(&sender, 0x7E8, 0x7E0, 0, 0, sender_buf, sizeof(sender_buf));
+    initIsoTp(&receiver, 0x7E0, 0x7E8, 0, 0, receiver_buf, sizeof(receiver_buf));
+
+    TEST_ASSERT_TRUE(isoTpSend(&sender, msg, sizeof(msg)));
+    isoTpAbort(&sender);
+    loop_count = 0;
+    TEST_ASSERT_EQUAL_UINT32(0, isoTpPump(&sender, loopTx, 0));
+    TEST_ASSERT_EQUAL(ISOTP_TX_IDLE, sender.tx_state);
+
+    TEST_ASSERT_TRUE(isoTpSend(&sender, msg, 3));
+    TEST_ASSERT_EQUAL_UINT32(1, loopExchange(&sender, &receiver, 0, &frames));
+    TEST_ASSERT_EQUAL_UINT32(3, receiver.rx_length);
+}
+
+/*
+*   UDS server without a transport
+*/
+static uint32_t request(const uint8_t* req, uint32_t length)
+{
+    udsStream(&server.uds, req, length, length);
+    return udsProcess(&server.uds, req, length);
+}
+
+#define REQUEST(...) request((const uint8_t[]) {__VA_ARGS__}, sizeof((const uint8_t[]) {__VA_ARGS__}))
+
+static void assertNegative(uint32_t length, uint8_t sid, uint8_t nrc)
+{
+    TEST_ASSERT_EQUAL_UINT32(3, length);
+    TEST_ASSERT_EQUAL_HEX8(UDS_SID_NEGATIVE, server.uds.response[0]);
+    TEST_ASSERT_EQUAL_HEX8(sid, server.uds.response[1]);
+    TEST_ASSERT_EQUAL_HEX8(nrc, server.uds.response[2]);
+}
+
+static void startDownload(uint32_t length)
+{
+    memset(&server, 0, sizeof(server));
+    memset(flash, 0x00, sizeof(flash));
+    initUDS(&server.uds, &ops, 258);
+
+    REQUEST(0x10, 0x02);
+    REQUEST(0x31, 0x01, 0xFF, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x10, 0x00);
+    REQUEST(0x34, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, length >> 8, length & 0xFF);
+}
+
+void testUDS_sessions(void)
+{
+    uint32_t length;
+
+    memset(&server, 0, sizeof(server));
+    initUDS(&server.uds, &ops, 1026);
+
+    assertNegative(REQUEST(0x22, 0xF1, 0x90), 0x22, UDS_NRC_SERVICE_NOT_SUPPORTED);
+    assertNegative(REQUEST(0x34, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x01, 0x00), 0x34, UDS_NRC_NOT_IN_SESSION);
+    assertNegative(REQUEST(0x36, 0x01, 0xAA), 0x36, UDS_NRC_NOT_IN_SESSION);
+    assertNegative(REQUEST(0x31, 0x01, 0xFF, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x10, 0x00), 0x31, UDS_NRC_CONDITIONS_NOT_CORRECT);
+    assertNegative(REQUEST(0x10, 0x04), 0x10, UDS_NRC_SUBFUNCTION_NOT_SUPPORTED);
+    assertNegative(REQUEST(0x10), 0x10, UDS_NRC_INCORRECT_LENGTH);
+
+    length = REQUEST(0x10, 0x02);
+    TEST_ASSERT_EQUAL_UINT32(6, length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(((uint8_t[]) {0x50, 0x02, 0x00, 0x32, 0x01, 0xF4}), server.uds.response, 6);
+
+    TEST_ASSERT_EQUAL_UINT32(2, REQUEST(0x3E, 0x00));
+    TEST_ASSERT_EQUAL_HEX8(0x7E, server.uds.response[0]);
+    TEST_ASSERT_EQUAL_UINT32(0, REQUEST(0x3E, 0x80));
+    assertNegative(REQUEST(0x3E, 0x01), 0x3E, UDS_NRC_SUBFUNCTION_NOT_SUPPORTED);
+
+    assertNegative(REQUEST(0x34, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x01, 0x00), 0x34, UDS_NRC_DOWNLOAD_NOT_ACCEPTED);
+    assertNegative(REQUEST(0x31, 0x01, 0xFF, 0x00, 0x44, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00), 0x31, UDS_NRC_OUT_OF_RANGE);
+    assertNegative(REQUEST(0x31, 0x01, 0x12, 0x34), 0x31, UDS_NRC_OUT_OF_RANGE);
+    assertNegative(REQUEST(0x31, 0x03, 0xFF, 0x00), 0x31, UDS_NRC_SUBFUNCTION_NOT_SUPPORTED);
+
+    // Suppressed positive response, the erase still runs
+    TEST_ASSERT_EQUAL_UINT32(0, REQUEST(0x31, 0x81, 0xFF, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x10, 0x00));
+    TEST_ASSERT_TRUE(server.erased);
+    TEST_ASSERT_EQUAL_UINT32(2, server.pending_sent);
+
+    length = REQUEST(0x34, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x01, 0x00);
+    TEST_ASSERT_EQUAL_UINT32(4, length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(((uint8_t[]) {0x74, 0x20, 0x04, 0x02}), server.uds.response, 4);
+    assertNegative(REQUEST(0x34, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x01, 0x00), 0x34, UDS_NRC_CONDITIONS_NOT_CORRECT);
+    assertNegative(REQUEST(0x37), 0x37, UDS_NRC_SEQUENCE_ERROR);
+
+    // Leaving the programming session ends the download
+    REQUEST(0x10, 0x01);
+    REQUEST(0x10, 0x02);
+    assertNegative(REQUEST(0x36, 0x01, 0xAA), 0x36, UDS_NRC_SEQUENCE_ERROR);
+}
+
+/**
+ * @brief Counter starts at 1 and wraps from FF to 00. A repeat of the last block is acknowledged
+ * without programming it again, any other counter is refused.
+ */
+void testUDS_blockCounter(void)
+{
+    uint8_t block[2 + 4];
+    uint32_t blocks = 300;
+
+    startDownload(blocks * 4);
+
+    assertNegative(REQUEST(0x36, 0x02, 1, 2, 3, 4), 0x36, UDS_NRC_WRONG_BLOCK_COUNTER);
+
+    for (uint32_t i = 0; i < blocks; i++)
+    {
+        block[0] = UDS_SID_TRANSFER_DATA;
+        block[1] = (i + 1) & 0xFF;
+        for (int b = 0; b < 4; b++)
+            block[2 + b] = i + b;
+
+        TEST_ASSERT_EQUAL_UINT32(2, request(block, sizeof(block)));
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(((uint8_t[]) {0x76, block[1]}), server.uds.response, 2);
+
+        if (i == 100)
+        {
+            // Response lost, tester sends the same block again
+            TEST_ASSERT_EQUAL_UINT32(2, request(block, sizeof(block)));
+            TEST_ASSERT_EQUAL_HEX8(0x76, server.uds.response[0]);
+            TEST_ASSERT_EQUAL_UINT32(404, server.index);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(blocks * 4, server.index);
+    TEST_ASSERT_EQUAL_HEX8(44, server.uds.block_counter);
+    for (uint32_t i = 0; i < blocks; i++)
+        TEST_ASSERT_EQUAL_HEX8(i, flash[4 * i]);
+
+    assertNegative(REQUEST(0x36, 0x2D, 0xAA), 0x36, UDS_NRC_OUT_OF_RANGE);
+    TEST_ASSERT_EQUAL_UINT32(1, REQUEST(0x37));
+    TEST_ASSERT_EQUAL_HEX8(0x77, server.uds.response[0]);
+
+    // Wrong CRC still gets a positive response, the routine status says the image is bad
+    TEST_ASSERT_EQUAL_UINT32(5, REQUEST(0x31, 0x01, 0x02, 0x02, 0x12, 0x34, 0x56, 0x78));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(((uint8_t[]) {0x71, 0x01, 0x02, 0x02, 0x01}), server.uds.response, 5);
+}
+
+void testUDS_blockLength(void)
+{
+    static uint8_t block[300];
+
+    startDownload(1024);
+    block[0] = UDS_SID_TRANSFER_DATA;
+    block[1] = 0x01;
+
+    assertNegative(request(block, 259), 0x36, UDS_NRC_INCORRECT_LENGTH);
+    assertNegative(request(block, 2), 0x36, UDS_NRC_INCORRECT_LENGTH);
+    TEST_ASSERT_EQUAL_UINT32(2, request(block, 258));
+    assertNegative(REQUEST(0x37), 0x37, UDS_NRC_SEQUENCE_ERROR);
+
+    // Address and length format must be 1 to 4 bytes each and match the request length
+    startDownload(1024);
+    assertNegative(REQUEST(0x34, 0x00, 0x45, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x04, 0x00), 0x34, UDS_NRC_OUT_OF_RANGE);
+    assertNegative(REQUEST(0x34, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x04, 0x00), 0x34, UDS_NRC_INCORRECT_LENGTH);
+    assertNegative(REQUEST(0x34, 0x11, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x04, 0x00), 0x34, UDS_NRC_OUT_OF_RANGE);
+}
+
+/**
+ * @brief TransferData is programmed as its frames arrive. A block cut off half way ends the
+ * download, the bytes already programmed can not be written again.
+ */
+void testUDS_streamAbort(void)
+{
+    static uint8_t block[258];
+
+    startDownload(1024);
+    block[0] = UDS_SID_TRANSFER_DATA;
+    block[1] = 0x01;
+    for (uint32_t i = 2; i < sizeof(block); i++)
+        block[i] = i;
+
+    udsStream(&server.uds, block, 6, sizeof(block));
+    udsStream(&server.uds, block, 13, sizeof(block));
+    TEST_ASSERT_EQUAL_UINT32(11, server.index);
+
+    // Same block again from its first frame
+    udsStream(&server.uds, block, 6, sizeof(block));
+    TEST_ASSERT_FALSE(server.uds.downloading);
+    assertNegative(udsProcess(&server.uds, block, sizeof(block)), 0x36, UDS_NRC_SEQUENCE_ERROR);
+    TEST_ASSERT_EQUAL_UINT32(11, server.index);
+}
+
+/**
+ * @brief A routine the bootloader finishes later is answered with 0x78. Requests in the meantime
+ * are refused with busyRepeatRequest, the final response comes from udsRoutineDone().
+ */
+void testUDS_routinePending(void)
+{
+    uint32_t length;
+
+    memset(&server, 0, sizeof(server));
+    initUDS(&server.uds, &ops, 1026);
+    server.async = true;
+    REQUEST(0x10, 0x02);
+
+    // Suppressed positive response, the final one is still sent after 0x78
+    assertNegative(REQUEST(0x31, 0x81, 0xFF, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x10, 0x00), 0x31, UDS_NRC_RESPONSE_PENDING);
+    TEST_ASSERT_TRUE(server.uds.routine_running);
+    assertNegative(REQUEST(0x3E, 0x00), 0x3E, UDS_NRC_BUSY_REPEAT_REQUEST);
+    assertNegative(REQUEST(0x34, 0x00, 0x44, 0x08, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x01, 0x00), 0x34, UDS_NRC_BUSY_REPEAT_REQUEST);
+
+    length = udsRoutineDone(&server.uds, UDS_NRC_OK, true);
+    TEST_ASSERT_EQUAL_UINT32(4, length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(((uint8_t[]) {0x71, 0x01, 0xFF, 0x00}), server.uds.response, 4);
+    TEST_ASSERT_EQUAL_UINT32(0, udsRoutineDone(&server.uds, UDS_NRC_OK, true));
+
+    // A failed routine ends with its negative response
+    assertNegative(REQUEST(0x31, 0x01, 0x02, 0x02, 0x12, 0x34, 0x56, 0x78), 0x31, UDS_NRC_RESPONSE_PENDING);
+    assertNegative(udsRoutineDone(&server.uds, UDS_NRC_PROGRAMMING_FAILURE, false), 0x31, UDS_NRC_PROGRAMMING_FAILURE);
+
+    assertNegative(REQUEST(0x31, 0x01, 0x02, 0x02, 0x12, 0x34, 0x56, 0x78), 0x31, UDS_NRC_RESPONSE_PENDING);
+    length = udsRoutineDone(&server.uds, UDS_NRC_OK, false);
+    TEST_ASSERT_EQUAL_UINT32(5, length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(((uint8_t[]) {0x71, 0x01, 0x02, 0x02, 0x01}), server.uds.response, 5);
+
+    TEST_ASSERT_EQUAL_UINT32(2, REQUEST(0x3E, 0x00));
+}
+
+/**
+ * @brief Whole sequence over the simulated bus with the shipped configuration
+ */
+void testUDS_download(void)
+{
+    char line[128];
+    uds_result_t r = runDownload(APP_SIZE - 3, 1026, 8, 0, PROGRAM_NS);
+
+    snprintf(line, sizeof(line), "64 kB image, 1026 byte blocks, BS 8: %.1f ms transfer, %.0f%% of ISO-TP line rate",
+             r.transfer_ms, 100 * r.efficiency);
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_EQUAL_UINT8(0, tester.last_nrc);
+    TEST_ASSERT_TRUE(r.passed);
+    TEST_ASSERT_EQUAL_UINT32(0, r.lost);
+    TEST_ASSERT_TRUE(r.high_water <= 8);
+    TEST_ASSERT_TRUE(r.efficiency > 0.8);
+    TEST_ASSERT_EQUAL_UINT32(2, tester.pending);
+}
+
+/**
+ * @brief Throughput over block length and block size. Without flow control the bootloader only
+ * keeps up while programming a frame takes less than its bus time.
+ */
+void testUDS_throughput(void)
+{
+    uint16_t block_lengths[] = {130, 258, 1026, 4095};
+    uint8_t block_sizes[] = {0, 2, 8, 16};
+    char line[128];
+
+    TEST_MESSAGE("64 kB image, typical program time");
+    TEST_MESSAGE("block_length  BS  transfer_ms  line_rate  lost  high_water");
+    for (int l = 0; l < sizeof(block_lengths) / sizeof(block_lengths[0]); l++)
+    {
+        for (int b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++)
+        {
+            uds_result_t r = runDownload(APP_SIZE, block_lengths[l], block_sizes[b], 0, PROGRAM_NS);
+            snprintf(line, sizeof(line), "%12u %3u %12.1f %9.0f%% %5u %11u", block_lengths[l], block_sizes[b],
+                     r.transfer_ms, 100 * r.efficiency, r.lost, r.high_water);
+            TEST_MESSAGE(line);
+
+            TEST_ASSERT_TRUE_MESSAGE(r.passed, line);
+            TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, r.lost, line);
+        }
+    }
+
+    TEST_MESSAGE("64 kB image, maximum program time");
+    for (int b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++)
+    {
+        uds_result_t r = runDownload(APP_SIZE, 1026, block_sizes[b], 0, PROGRAM_MAX_NS);
+        snprintf(line, sizeof(line), "%12u %3u %12.1f %9.0f%% %5u %11u", 1026, block_sizes[b],
+                 r.transfer_ms, 100 * r.efficiency, r.lost, r.high_water);
+        TEST_MESSAGE(line);
+
+        if (block_sizes[b] == 0)
+        {
+            // CFs arrive faster than they are programmed until rx_message_q and FIFO0 are full
+            TEST_ASSERT_FALSE_MESSAGE(r.passed, line);
+            TEST_ASSERT_TRUE_MESSAGE(r.lost > 0, line);
+        }
+        else if (block_sizes[b] <= QUEUE_DEPTH)
+        {
+            // A whole block always fits rx_message_q
+            TEST_ASSERT_TRUE_MESSAGE(r.passed, line);
+            TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, r.lost, line);
+        }
+    }
+}
+
+int main( int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(testIsoTp_singleFrame);
+    RUN_TEST(testIsoTp_segmentation);
+    RUN_TEST(testIsoTp_sequenceError);
+    RUN_TEST(testIsoTp_overflow);
+    RUN_TEST(testIsoTp_abort);
+    RUN_TEST(testUDS_sessions);
+    RUN_TEST(testUDS_blockCounter);
+    RUN_TEST(testUDS_blockLength);
+    RUN_TEST(testUDS_streamAbort);
+    RUN_TEST(testUDS_routinePending);
+    RUN_TEST(testUDS_download);
+    RUN_TEST(testUDS_throughput);
+
+    return UNITY_END();
+}
@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+"""
+Generates C pack/unpack functions for the bootloader CAN messages from the DBC.
+
+Every message gets an ID and DLC define, a struct with one field per signal
+(raw values, factor and offset are not applied) and two functions:
+
+    void blUnpack<Message>(const uint8_t* data, BL<Message>_t* msg);
+    void blPack<Message>(const BL<Message>_t* msg, uint8_t* data);
+
+Both are straight line code with constant shifts and masks on single bytes, so
+the layout no longer depends on how the compiler lays out bitfields and no
+64 bit shifts are needed on Cortex-M. Unpack decodes every signal. Pack only
+writes multiplexed signals of the selected multiplexer value, selected with a
+mask instead of a branch. Only little endian (@1) unsigned signals are used by
+the bootloader, anything else is rejected.
+
+    dbc_codegen.py [docs/BootloaderGeneric.dbc] [-o lib/bl_msgs/bl_msgs.h]
+
+PlatformIO runs this as a pre build script (extra_scripts in platformio.ini).
+The header is only rewritten when its contents change, so an unchanged DBC
+does not trigger a rebuild.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+DEFAULT_DBC = os.path.join("docs", "BootloaderGeneric.dbc")
+DEFAULT_OUT = os.path.join("lib", "bl_msgs", "bl_msgs.h")
+
+BO_RE = re.compile(r"^BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)\s+(\w+)")
+SG_RE = re.compile(r"^\s+SG_\s+(\w+)\s*(M|m\d+)?\s*:\s*(\d+)\|(\d+)@([01])([+-])")
+CM_SG_RE = re.compile(r'^CM_\s+SG_\s+(\d+)\s+(\w+)\s+"([^"]*)"\s*;')
+
+
+class Signal:
+    def __init__(self, name, mux, start, length):
+        self.name = name
+        self.mux = mux          # None, "M" for the multiplexer, or the multiplexer value
+        self.start = start
+        self.length = length
+        self.comment = ""
+
+    @property
+    def field(self):
+        return snake_case(strip_prefix(self.name))
+
+    @property
+    def ctype(self):
+        if self.length <= 8:
+            return "uint8_t"
+        if self.length <= 16:
+            return "uint16_t"
+        if self.length <= 32:
+            return "uint32_t"
+        return "uint64_t"
+
+
+class Message:
+    def __init__(self, frame_id, name, dlc):
+        self.extended = bool(frame_id & 0x80000000)
+        self.frame_id = frame_id & 0x1FFFFFFF
+        self.name = name
+        self.dlc = dlc
+        self.signals = []
+
+    @property
+    def base(self):
+        return strip_prefix(self.name)
+
+    @property
+    def multiplexer(self):
+        for signal in self.signals:
+            if signal.mux == "M":
+                return signal
+        return None
+
+
+def strip_prefix(name):
+    return name[3:] if name.startswith("BL_") else name
+
+
+def snake_case(name):
+    name = re.sub(r"([A-Z]+)([A-Z][a-z])", r"\1_\2", name)
+    name = re.sub(r"([a-z0-9])([A-Z])", r"\1_\2", name)
+    return name.lower()
+
+
+def macro_case(name):
+    return snake_case(name).upper()
+
+
+def parse_dbc(path):
+    messages = []
+    by_id = {}
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            match = BO_RE.match(line)
+            if match:
+                message = Message(int(match.group(1)), match.group(2), int(match.group(3)))
+                messages.append(message)
+                by_id[int(match.group(1))] = message
+                continue
+
+            match = SG_RE.match(line)
+            if match:
+                name, mux, start, length, order, sign = match.groups()
+                if order != "1" or sign != "+":
+                    sys.exit("%s:%d: %s is not little endian unsigned" % (path, number, name))
+                if mux and mux != "M":
+                    mux = int(mux[1:])
+                signal = Signal(name, mux, int(start), int(length))
+                if signal.start + signal.length > 8 * messages[-1].dlc:
+                    sys.exit("%s:%d: %s does not fit the DLC" % (path, number, name))
+                messages[-1].signals.append(signal)
+                continue
+
+            match = CM_SG_RE.match(line)
+            if match and int(match.group(1)) in by_id:
+                for signal in by_id[int(match.group(1))].signals:
+                    if signal.name == match.group(2):
+                        signal.comment = match.group(3)
+    return messages
+
+
+def byte_span(signal):
+    return range(signal.start // 8, (signal.start + signal.length - 1) // 8 + 1)
+
+
+def unpack_expr(signal):
+    terms = []
+    for byte in byte_span(signal):
+        shift = 8 * byte - signal.start
+        if shift > 0:
+            terms.append("((%s) data[%d] << %d)" % (signal.ctype, byte, shift))
+        elif shift < 0:
+            terms.append("(data[%d] >> %d)" % (byte, -shift))
+        else:
+            terms.append("data[%d]" % byte)
+
+    expr = " | ".join(terms)
+    # Bits above the signal in its last byte
+    if (signal.start + signal.length) % 8:
+        suffix = "ULL" if signal.length > 32 else "U"
+        if len(terms) > 1:
+            expr = "(%s)" % expr
+        expr = "%s & 0x%X%s" % (expr, (1 << signal.length) - 1, suffix)
+    return expr
+
+
+def pack_terms(message, signal):
+    """(byte, expression) pairs that place the signal in the frame."""
+    terms = []
+    for byte in byte_span(signal):
+        shift = 8 * byte - signal.start
+        low = max(signal.start, 8 * byte) - 8 * byte
+        high = min(signal.start + signal.length, 8 * byte + 8) - 8 * byte
+        mask = ((1 << high) - 1) & ~((1 << low) - 1)
+
+        value = "msg->%s" % signal.field
+        if shift > 0:
+            value = "(%s >> %d)" % (value, shift)
+        elif shift < 0:
+            value = "(%s << %d)" % (value, -shift)
+        if isinstance(signal.mux, int):
+            value = "(%s & mux_%d)" % (value, signal.mux)
+        terms.append((byte, "(%s & 0x%02XU)" % (value, mask)))
+    return terms
+
+
+def generate(messages, dbc_name):
+    out = []
+    out.append("""/**
+ * @file bl_msgs.h
+ * @brief Bootloader CAN messages, generated from %s by tools/dbc_codegen.py
+ *
+ * Do not edit, change the DBC instead. Fields hold raw signal values.
+ * Functions are always inlined so RAM resident callers stay in RAM at -O0.
+ */
+
+#ifndef BL_MSGS_H
+#define BL_MSGS_H
+
+#include <stdint.h>
+""" % dbc_name)
+
+    for message in messages:
+        prefix = "BL_" + macro_case(message.base)
+        out.append("// %s, %s ID" % (message.name, "29 bit" if message.extended else "11 bit"))
+        out.append("#define %s_ID (0x%08XU)" % (prefix, message.frame_id))
+        out.append("#define %s_DLC (%dU)" % (prefix, message.dlc))
+        out.append("")
+
+    for message in messages:
+        mux = message.multiplexer
+        signals = ([mux] if mux else []) + [s for s in message.signals if s is not mux]
+        width = max(len("%s %s;" % (s.ctype, s.field)) for s in signals)
+
+        out.append("")
+        out.append("/*")
+        out.append("*   %s" % message.name)
+        out.append("*/")
+        out.append("typedef struct {")
+        for signal in signals:
+            decl = "%s %s;" % (signal.ctype, signal.field)
+            notes = []
+            if signal.mux == "M":
+                notes.append("Multiplexer")
+            elif isinstance(signal.mux, int):
+                notes.append("%s %d" % (mux.field, signal.mux))
+            notes.append("%d|%d" % (signal.start, signal.length))
+            if signal.comment:
+                notes.append(signal.comment)
+            out.append("    %-*s ///< %s" % (width, decl, ", ".join(notes)))
+        out.append("} BL%s_t;" % message.base)
+        out.append("")
+
+        out.append("static inline __attribute__((always_inline)) void blUnpack%s(const uint8_t* data, BL%s_t* msg)"
+                   % (message.base, message.base))
+        out.append("{")
+        for signal in signals:
+            out.append("    msg->%s = %s;" % (signal.field, unpack_expr(signal)))
+        out.append("}")
+        out.append("")
+
+        out.append("static inline __attribute__((always_inline)) void blPack%s(const BL%s_t* msg, uint8_t* data)"
+                   % (message.base, message.base))
+        out.append("{")
+        values = sorted({s.mux for s in signals if isinstance(s.mux, int)})
+        for value in values:
+            out.append("    uint32_t mux_%d = -(uint32_t) (msg->%s == %d);" % (value, mux.field, value))
+        by_byte = {byte: [] for byte in range(message.dlc)}
+        for signal in signals:
+            for byte, term in pack_terms(message, signal):
+                by_byte[byte].append(term)
+        for byte in range(message.dlc):
+            terms = by_byte[byte]
+            if not terms:
+                out.append("    data[%d] = 0;" % byte)
+            else:
+                out.append("    data[%d] = %s;" % (byte, (" |\n              ").join(terms)))
+        out.append("}")
+        out.append("")
+
+    out.append("#endif")
+    out.append("")
+    return "\n".join(out)
+
+
+def write_if_changed(path, text):
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == text:
+                return False
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, "w") as f:
+        f.write(text)
+    return True
+
+
+def run(dbc, out):
+    text = generate(parse_dbc(dbc), os.path.basename(dbc))
+    if write_if_changed(out, text):
+        print("dbc_codegen: wrote %s" % out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dbc", nargs="?", default=DEFAULT_DBC)
+    parser.add_argument("-o", "--output", default=DEFAULT_OUT)
+    args = parser.parse_args()
+    run(args.dbc, args.output)
+
+
+if __name__ == "__main__":
+    main()
+else:
+    # PlatformIO extra_scripts
+    Import("env")  # noqa: F821
+    project = env.subst("$PROJECT_DIR")  # noqa: F821
+    run(os.path.join(project, DEFAULT_DBC), os.path.join(project, DEFAULT_OUT))
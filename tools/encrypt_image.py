@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""
+Host side encryption step for encrypted bootloader transfers.
+
+Images are encrypted with AES-128-CTR. The 16 byte initial counter block is
+sent to the bootloader in four M_CIPHER_IV words after the metadata. The
+bootloader decrypts each 16 byte block just before programming it, with the
+key compiled into bootloader flash (include/bl_image_key.h).
+
+    encrypt_image.py keygen  <image.key> [--header include/bl_image_key.h]
+    encrypt_image.py encrypt <image.key> <app.bin> [-o app.enc] [--iv hex]
+
+The metadata CRC is still computed over the plaintext because the bootloader
+checks what ends up in flash. Sign (tools/sign_image.py) the plaintext too.
+Pure Python so no extra packages are needed. Keep key files out of the repository.
+"""
+
+import argparse
+import os
+import sys
+
+SBOX = [0] * 256
+
+
+def _init_sbox():
+    # Multiplicative inverse in GF(2^8) followed by the affine transform, FIPS-197 section 5.1.1
+    p = q = 1
+    while True:
+        p = p ^ ((p << 1) & 0xFF) ^ (0x1B if p & 0x80 else 0)
+        q ^= q << 1
+        q ^= q << 2
+        q ^= q << 4
+        q &= 0xFF
+        if q & 0x80:
+            q ^= 0x09
+        x = q ^ ((q << 1) | (q >> 7)) & 0xFF
+        x ^= ((q << 2) | (q >> 6)) & 0xFF
+        x ^= ((q << 3) | (q >> 5)) & 0xFF
+        x ^= ((q << 4) | (q >> 4)) & 0xFF
+        SBOX[p] = (x ^ 0x63) & 0xFF
+        if p == 1:
+            break
+    SBOX[0] = 0x63
+
+
+_init_sbox()
+
+
+def _xtime(b):
+    return ((b << 1) ^ 0x1B) & 0xFF if b & 0x80 else b << 1
+
+
+def expand_key(key):
+    rcon = 1
+    w = list(key)
+    for i in range(16, 176, 4):
+        t = w[i - 4:i]
+        if i % 16 == 0:
+            t = [SBOX[t[1]] ^ rcon, SBOX[t[2]], SBOX[t[3]], SBOX[t[0]]]
+            rcon = _xtime(rcon)
+        w += [w[i - 16 + j] ^ t[j] for j in range(4)]
+    return w
+
+
+def encrypt_block(round_keys, block):
+    s = [b ^ k for b, k in zip(block, round_keys[:16])]
+    for rnd in range(1, 11):
+        s = [SBOX[b] for b in s]
+        s = [s[(i + 4 * (i % 4)) % 16] for i in range(16)]  # ShiftRows on column-major state
+        if rnd != 10:
+            mixed = []
+            for c in range(4):
+                a = s[4 * c:4 * c + 4]
+                t = a[0] ^ a[1] ^ a[2] ^ a[3]
+                mixed += [a[j] ^ t ^ _xtime(a[j] ^ a[(j + 1) % 4]) for j in range(4)]
+            s = mixed
+        s = [b ^ k for b, k in zip(s, round_keys[16 * rnd:16 * rnd + 16])]
+    return bytes(s)
+
+
+def ctr_crypt(key, iv, data):
+    round_keys = expand_key(key)
+    counter = int.from_bytes(iv, "big")
+    out = bytearray()
+    for i in range(0, len(data), 16):
+        stream = encrypt_block(round_keys, counter.to_bytes(16, "big"))
+        out += bytes(a ^ b for a, b in zip(data[i:i + 16], stream))
+        counter = (counter + 1) % (1 << 128)
+    return bytes(out)
+
+
+def write_header(path, key):
+    body = ",\n".join("    " + ", ".join("0x%02x" % b for b in key[i:i + 8]) for i in range(0, 16, 8))
+    with open(path, "w") as f:
+        f.write("""/**
+ * @file bl_image_key.h
+ * @brief AES-128 key used to decrypt encrypted application transfers.
+ * Generated by tools/encrypt_image.py keygen, do not edit by hand.
+ */
+
+#ifndef BL_IMAGE_KEY_H
+#define BL_IMAGE_KEY_H
+
+#include <stdint.h>
+
+// Kept in bootloader flash, outside the range served by flash read-back
+static const uint8_t bl_image_key[16] __attribute__((section(".bl_keys"), used)) = {
+%s
+};
+
+#endif
+""" % body)
+
+
+def load_key(path):
+    with open(path, "rb") as f:
+        key = f.read()
+    if len(key) == 32:
+        key = bytes.fromhex(key.decode())
+    if len(key) != 16:
+        sys.exit("%s: expected a 16 byte key" % path)
+    return key
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    k = sub.add_parser("keygen", help="create a new image key")
+    k.add_argument("key")
+    k.add_argument("--header", help="write the matching key header")
+
+    e = sub.add_parser("encrypt", help="encrypt an application binary")
+    e.add_argument("key")
+    e.add_argument("image")
+    e.add_argument("-o", "--output", help="encrypted image, defaults to <image>.enc")
+    e.add_argument("--iv", help="initial counter block in hex, random by default. Never reuse one with the same key")
+
+    args = parser.parse_args()
+
+    if args.cmd == "keygen":
+        key = os.urandom(16)
+        with open(args.key, "wb") as f:
+            f.write(key)
+        if args.header:
+            write_header(args.header, key)
+
+    elif args.cmd == "encrypt":
+        key = load_key(args.key)
+        iv = bytes.fromhex(args.iv) if args.iv else os.urandom(16)
+        if len(iv) != 16:
+            sys.exit("IV must be 16 bytes")
+        with open(args.image, "rb") as f:
+            data = f.read()
+        out = args.output or args.image + ".enc"
+        with open(out, "wb") as f:
+            f.write(ctr_crypt(key, iv, data))
+        print("iv:", iv.hex())
+        for i in range(4):
+            print("M_CIPHER_IV word %d: 0x%08x" % (i, int.from_bytes(iv[4 * i:4 * i + 4], "little")))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""
+Host side signing tool for authenticated bootloader images.
+
+The bootloader hashes every word it programs with SHA-256 and, once the
+transfer is complete, checks an Ed25519 signature over that 32 byte digest
+against the public key compiled into bootloader flash (include/bl_public_key.h).
+
+    sign_image.py keygen  <key.seed> [--header include/bl_public_key.h]
+    sign_image.py sign    <key.seed> <app.bin> [-o app.sig]
+    sign_image.py verify  <public key hex | key.seed> <app.bin> <app.sig>
+
+Pure Python (RFC 8032 reference arithmetic) so no extra packages are needed.
+Keep the seed file out of the repository.
+"""
+
+import argparse
+import hashlib
+import os
+import sys
+
+# Curve25519 / Ed25519 parameters, RFC 8032 section 5.1
+p = 2**255 - 19
+L = 2**252 + 27742317777372353535851937790883648493
+d = -121665 * pow(121666, p - 2, p) % p
+SQRT_M1 = pow(2, (p - 1) // 4, p)
+
+
+def _recover_x(y, sign):
+    if y >= p:
+        return None
+    x2 = (y * y - 1) * pow(d * y * y + 1, p - 2, p)
+    if x2 == 0:
+        return None if sign else 0
+    x = pow(x2, (p + 3) // 8, p)
+    if (x * x - x2) % p != 0:
+        x = x * SQRT_M1 % p
+    if (x * x - x2) % p != 0:
+        return None
+    if (x & 1) != sign:
+        x = p - x
+    return x
+
+
+G_Y = 4 * pow(5, p - 2, p) % p
+G_X = _recover_x(G_Y, 0)
+G = (G_X, G_Y, 1, G_X * G_Y % p)
+IDENTITY = (0, 1, 1, 0)
+
+
+def _add(P, Q):
+    A = (P[1] - P[0]) * (Q[1] - Q[0]) % p
+    B = (P[1] + P[0]) * (Q[1] + Q[0]) % p
+    C = 2 * P[3] * Q[3] * d % p
+    D = 2 * P[2] * Q[2] % p
+    E, F, G_, H = B - A, D - C, D + C, B + A
+    return (E * F % p, G_ * H % p, F * G_ % p, E * H % p)
+
+
+def _mul(s, P):
+    Q = IDENTITY
+    while s > 0:
+        if s & 1:
+            Q = _add(Q, P)
+        P = _add(P, P)
+        s >>= 1
+    return Q
+
+
+def _equal(P, Q):
+    return (P[0] * Q[2] - Q[0] * P[2]) % p == 0 and (P[1] * Q[2] - Q[1] * P[2]) % p == 0
+
+
+def _compress(P):
+    zinv = pow(P[2], p - 2, p)
+    x = P[0] * zinv % p
+    y = P[1] * zinv % p
+    return int.to_bytes(y | ((x & 1) << 255), 32, "little")
+
+
+def _decompress(s):
+    y = int.from_bytes(s, "little")
+    sign = y >> 255
+    y &= (1 << 255) - 1
+    x = _recover_x(y, sign)
+    if x is None:
+        return None
+    return (x, y, 1, x * y % p)
+
+
+def _sha512_int(*parts):
+    return int.from_bytes(hashlib.sha512(b"".join(parts)).digest(), "little")
+
+
+def _expand(seed):
+    h = hashlib.sha512(seed).digest()
+    a = int.from_bytes(h[:32], "little")
+    a &= (1 << 254) - 8
+    a |= 1 << 254
+    return a, h[32:]
+
+
+def public_key(seed):
+    a, _ = _expand(seed)
+    return _compress(_mul(a, G))
+
+
+def sign(seed, msg):
+    a, prefix = _expand(seed)
+    A = _compress(_mul(a, G))
+    r = _sha512_int(prefix, msg) % L
+    R = _compress(_mul(r, G))
+    h = _sha512_int(R, A, msg) % L
+    s = (r + h * a) % L
+    return R + int.to_bytes(s, 32, "little")
+
+
+def verify(public, msg, signature):
+    if len(public) != 32 or len(signature) != 64:
+        return False
+    A = _decompress(public)
+    R = _decompress(signature[:32])
+    if A is None or R is None:
+        return False
+    s = int.from_bytes(signature[32:], "little")
+    if s >= L:
+        return False
+    h = _sha512_int(signature[:32], public, msg) % L
+    return _equal(_mul(s, G), _add(R, _mul(h, A)))
+
+
+def image_digest(path):
+    with open(path, "rb") as f:
+        return hashlib.sha256(f.read()).digest()
+
+
+def c_array(data, indent="    "):
+    lines = []
+    for i in range(0, len(data), 8):
+        lines.append(indent + ", ".join("0x%02x" % b for b in data[i:i + 8]) + ",")
+    return "\n".join(lines)
+
+
+def write_header(path, public):
+    with open(path, "w") as f:
+        f.write("""/**
+ * @file bl_public_key.h
+ * @brief Ed25519 public key used to authenticate application images.
+ * Generated by tools/sign_image.py keygen, do not edit by hand.
+ */
+
+#ifndef BL_PUBLIC_KEY_H
+#define BL_PUBLIC_KEY_H
+
+#include <stdint.h>
+
+static const uint8_t bl_public_key[32] = {
+%s
+};
+
+#endif
+""" % c_array(public))
+
+
+def load_seed(path):
+    with open(path, "rb") as f:
+        seed = f.read()
+    if len(seed) == 64:
+        seed = bytes.fromhex(seed.decode())
+    if len(seed) != 32:
+        sys.exit("%s: expected a 32 byte seed" % path)
+    return seed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    k = sub.add_parser("keygen", help="create a new signing key")
+    k.add_argument("seed")
+    k.add_argument("--header", help="write the matching public key header")
+
+    s = sub.add_parser("sign", help="sign an application binary")
+    s.add_argument("seed")
+    s.add_argument("image")
+    s.add_argument("-o", "--output", help="signature file, defaults to <image>.sig")
+
+    v = sub.add_parser("verify", help="check a signature like the bootloader does")
+    v.add_argument("key", help="public key in hex or a seed file")
+    v.add_argument("image")
+    v.add_argument("signature")
+
+    args = parser.parse_args()
+
+    if args.cmd == "keygen":
+        seed = os.urandom(32)
+        with open(args.seed, "wb") as f:
+            f.write(seed)
+        public = public_key(seed)
+        print("public key:", public.hex())
+        if args.header:
+            write_header(args.header, public)
+
+    elif args.cmd == "sign":
+        seed = load_seed(args.seed)
+        digest = image_digest(args.image)
+        signature = sign(seed, digest)
+        out = args.output or args.image + ".sig"
+        with open(out, "wb") as f:
+            f.write(signature)
+        print("sha256:   ", digest.hex())
+        print("signature:", signature.hex())
+
+    elif args.cmd == "verify":
+        if os.path.exists(args.key):
+            public = public_key(load_seed(args.key))
+        else:
+            public = bytes.fromhex(args.key)
+        with open(args.signature, "rb") as f:
+            signature = f.read()
+        ok = verify(public, image_digest(args.image), signature)
+        print("signature OK" if ok else "signature INVALID")
+        sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()